@@ -0,0 +1,296 @@
+/***********************************************************************
+AllocatorBenchmark - Benchmark comparing the collaboration
+infrastructure's memory block allocator against the system's malloc.
+Copyright (c) 2019-2020 Oliver Kreylos
+***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <Threads/Spinlock.h>
+#include <Threads/MutexCond.h>
+#include <Threads/Thread.h>
+#include <Realtime/Time.h>
+
+#include <Collaboration2/Allocator.h>
+
+/**************
+Helper classes:
+**************/
+
+struct SystemAllocator // Adapter to allocate memory blocks using malloc/free
+	{
+	/* Methods: */
+	static void* allocate(size_t size)
+		{
+		return malloc(size);
+		}
+	static void release(void* block)
+		{
+		free(block);
+		}
+	};
+
+struct PooledAllocator // Adapter to allocate memory blocks using the collaboration infrastructure's allocator
+	{
+	/* Methods: */
+	static void* allocate(size_t size)
+		{
+		return Allocator::allocate(size);
+		}
+	static void release(void* block)
+		{
+		Allocator::release(block);
+		}
+	};
+
+class RandomSizes // Class to generate a stream of message sizes resembling a collaboration session's traffic
+	{
+	/* Elements: */
+	private:
+	unsigned int state; // Xorshift random number generator state
+	
+	/* Constructors and destructors: */
+	public:
+	RandomSizes(unsigned int seed)
+		:state(seed*2654435761U+1U)
+		{
+		}
+	
+	/* Methods: */
+	size_t next(void) // Returns the next message size
+		{
+		state^=state<<13;
+		state^=state>>17;
+		state^=state<<5;
+		
+		/* Most messages are small tracking or control messages; some are larger object or audio messages: */
+		if((state&0x7U)!=0)
+			return 16+((state>>3)&0xffU);
+		else
+			return 256+((state>>3)&0xfffU);
+		}
+	};
+
+template <class AllocatorParam>
+class ChurnBenchmark // Class measuring the allocation and release of short-lived blocks in concurrent threads
+	{
+	/* Elements: */
+	private:
+	unsigned int numThreads; // Number of concurrently allocating threads
+	size_t numOperations; // Number of allocate/release pairs per thread
+	size_t windowSize; // Number of live blocks per thread
+	
+	/* Private methods: */
+	void* threadMethod(void)
+		{
+		/* Hold a window of live blocks and replace random blocks: */
+		static Threads::Spinlock seedMutex;
+		static unsigned int nextSeed=1;
+		seedMutex.lock();
+		RandomSizes sizes(nextSeed++);
+		seedMutex.unlock();
+		std::vector<void*> window(windowSize);
+		for(size_t i=0;i<windowSize;++i)
+			window[i]=AllocatorParam::allocate(sizes.next());
+		for(size_t op=0;op<numOperations;++op)
+			{
+			size_t size=sizes.next();
+			void*& slot=window[(op*7919)%windowSize];
+			AllocatorParam::release(slot);
+			slot=AllocatorParam::allocate(size);
+			
+			/* Touch the new block like a message writer would: */
+			*static_cast<char*>(slot)=char(op);
+			}
+		for(size_t i=0;i<windowSize;++i)
+			AllocatorParam::release(window[i]);
+		
+		return 0;
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	ChurnBenchmark(unsigned int sNumThreads,size_t sNumOperations,size_t sWindowSize)
+		:numThreads(sNumThreads),numOperations(sNumOperations),windowSize(sWindowSize)
+		{
+		}
+	
+	/* Methods: */
+	double run(void) // Runs the benchmark and returns the average time per allocate/release pair in nanoseconds
+		{
+		Realtime::TimePointMonotonic timer;
+		Threads::Thread* threads=new Threads::Thread[numThreads];
+		for(unsigned int i=0;i<numThreads;++i)
+			threads[i].start(this,&ChurnBenchmark::threadMethod);
+		for(unsigned int i=0;i<numThreads;++i)
+			threads[i].join();
+		double time=double(timer.setAndDiff());
+		delete[] threads;
+		
+		return time*1.0e9/double(numOperations*numThreads);
+		}
+	};
+
+template <class AllocatorParam>
+class HandoffBenchmark // Class measuring blocks allocated in one thread and released in another, like messages passed between a front end and a back end
+	{
+	/* Elements: */
+	private:
+	size_t numOperations; // Number of blocks passed from the producer to the consumer
+	size_t batchSize; // Number of blocks the producer passes at once
+	Threads::MutexCond queueCond; // Condition variable protecting the hand-off queue and signaling changes to it
+	std::vector<void*> queue; // Queue of blocks passed from the producer to the consumer
+	bool done; // Flag whether the producer finished
+	
+	/* Private methods: */
+	void* producerThreadMethod(void)
+		{
+		RandomSizes sizes(12345);
+		std::vector<void*> batch;
+		batch.reserve(batchSize);
+		for(size_t op=0;op<numOperations;++op)
+			{
+			batch.push_back(AllocatorParam::allocate(sizes.next()));
+			if(batch.size()==batchSize||op+1==numOperations)
+				{
+				/* Hand the batch to the consumer, waiting if it is falling behind: */
+				{
+				Threads::MutexCond::Lock queueLock(queueCond);
+				while(queue.size()>=batchSize*64)
+					queueCond.wait(queueLock);
+				queue.insert(queue.end(),batch.begin(),batch.end());
+				queueCond.broadcast();
+				}
+				batch.clear();
+				}
+			}
+		
+		/* Tell the consumer that there are no more blocks: */
+		{
+		Threads::MutexCond::Lock queueLock(queueCond);
+		done=true;
+		queueCond.broadcast();
+		}
+		
+		return 0;
+		}
+	void* consumerThreadMethod(void)
+		{
+		std::vector<void*> batch;
+		while(true)
+			{
+			/* Wait for and grab all blocks the producer passed so far: */
+			{
+			Threads::MutexCond::Lock queueLock(queueCond);
+			while(queue.empty()&&!done)
+				queueCond.wait(queueLock);
+			if(queue.empty())
+				break;
+			batch.swap(queue);
+			queueCond.broadcast();
+			}
+			
+			/* Release the grabbed blocks: */
+			for(std::vector<void*>::iterator bIt=batch.begin();bIt!=batch.end();++bIt)
+				AllocatorParam::release(*bIt);
+			batch.clear();
+			}
+		
+		return 0;
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	HandoffBenchmark(size_t sNumOperations,size_t sBatchSize)
+		:numOperations(sNumOperations),batchSize(sBatchSize),done(false)
+		{
+		}
+	
+	/* Methods: */
+	double run(void) // Runs the benchmark and returns the average time per passed block in nanoseconds
+		{
+		Realtime::TimePointMonotonic timer;
+		Threads::Thread producer,consumer;
+		consumer.start(this,&HandoffBenchmark::consumerThreadMethod);
+		producer.start(this,&HandoffBenchmark::producerThreadMethod);
+		producer.join();
+		consumer.join();
+		double time=double(timer.setAndDiff());
+		
+		return time*1.0e9/double(numOperations);
+		}
+	};
+
+/****************
+Helper functions:
+****************/
+
+void printResult(const char* name,double systemTime,double pooledTime)
+	{
+	std::cout<<std::setw(28)<<std::left<<name<<std::right<<std::fixed<<std::setprecision(1);
+	std::cout<<std::setw(10)<<systemTime<<" ns"<<std::setw(10)<<pooledTime<<" ns"<<std::setw(9)<<std::setprecision(2)<<systemTime/pooledTime<<'x'<<std::endl;
+	}
+
+/*************
+Main function:
+*************/
+
+int main(int argc,char* argv[])
+	{
+	/* Parse the command line: */
+	size_t numOperations=10000000;
+	unsigned int numThreads=4;
+	for(int argi=1;argi<argc;++argi)
+		{
+		if(strcasecmp(argv[argi],"-ops")==0&&argi+1<argc)
+			numOperations=size_t(atol(argv[++argi]));
+		else if(strcasecmp(argv[argi],"-threads")==0&&argi+1<argc)
+			numThreads=(unsigned int)(atoi(argv[++argi]));
+		else
+			{
+			std::cerr<<"Usage: "<<argv[0]<<" [-ops <number of operations>] [-threads <number of threads>]"<<std::endl;
+			return 1;
+			}
+		}
+	
+	std::cout<<std::setw(28)<<std::left<<"Benchmark"<<std::right<<std::setw(13)<<"malloc"<<std::setw(13)<<"Allocator"<<std::setw(10)<<"Speedup"<<std::endl;
+	
+	/* Warm up both allocators: */
+	ChurnBenchmark<SystemAllocator>(1,numOperations/10,256).run();
+	ChurnBenchmark<PooledAllocator>(1,numOperations/10,256).run();
+	
+	/* Measure short-lived blocks in a single thread: */
+	{
+	double systemTime=ChurnBenchmark<SystemAllocator>(1,numOperations,256).run();
+	double pooledTime=ChurnBenchmark<PooledAllocator>(1,numOperations,256).run();
+	printResult("Churn, 1 thread",systemTime,pooledTime);
+	}
+	
+	/* Measure short-lived blocks in concurrent threads: */
+	if(numThreads>1)
+		{
+		double systemTime=ChurnBenchmark<SystemAllocator>(numThreads,numOperations/numThreads,256).run();
+		double pooledTime=ChurnBenchmark<PooledAllocator>(numThreads,numOperations/numThreads,256).run();
+		std::ostringstream name;
+		name<<"Churn, "<<numThreads<<" threads";
+		printResult(name.str().c_str(),systemTime,pooledTime);
+		}
+	
+	/* Measure blocks passed between threads in small and large batches: */
+	{
+	double systemTime=HandoffBenchmark<SystemAllocator>(numOperations,1).run();
+	double pooledTime=HandoffBenchmark<PooledAllocator>(numOperations,1).run();
+	printResult("Cross-thread, batch 1",systemTime,pooledTime);
+	}
+	{
+	double systemTime=HandoffBenchmark<SystemAllocator>(numOperations,64).run();
+	double pooledTime=HandoffBenchmark<PooledAllocator>(numOperations,64).run();
+	printResult("Cross-thread, batch 64",systemTime,pooledTime);
+	}
+	
+	return 0;
+	}
@@ -0,0 +1,144 @@
+/***********************************************************************
+BroadcastBenchmark - Benchmark measuring the cost of broadcasting
+messages to many clients, comparing atomic against biased message
+buffer reference counting and heap against slab pool allocation.
+Copyright (c) 2019-2020 Oliver Kreylos
+***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <Realtime/Time.h>
+
+#include <Collaboration2/Protocol.h>
+#include <Collaboration2/MessageBuffer.h>
+
+/**************
+Helper classes:
+**************/
+
+struct BroadcastMsg // Fixed-size message structure resembling a tracking state update
+	{
+	/* Elements: */
+	public:
+	static const size_t size=64;
+	};
+
+class BroadcastBenchmark // Class simulating a server broadcasting messages to all connected clients
+	{
+	/* Elements: */
+	private:
+	unsigned int numClients; // Number of simulated clients
+	bool useAtomic; // Flag whether to force atomic reference counting as if messages were shared between threads
+	bool usePool; // Flag whether to allocate messages from a slab pool instead of the heap
+	std::vector<std::vector<MessageBuffer*> > sendQueues; // Simulated send queues of all clients
+	
+	/* Private methods: */
+	MessageBuffer* createMessage(void) // Creates a message to be broadcast
+		{
+		MessageBuffer* result=usePool?MessageBuffer::create<BroadcastMsg>(0):MessageBuffer::create(0,BroadcastMsg::size);
+		memset(result->getBuffer(),0,result->getBufferSize());
+		
+		/* Switch the message to atomic reference counting if requested: */
+		if(useAtomic)
+			{
+			result->refShared();
+			result->unref();
+			}
+		
+		return result;
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	BroadcastBenchmark(unsigned int sNumClients,bool sUseAtomic,bool sUsePool)
+		:numClients(sNumClients),useAtomic(sUseAtomic),usePool(sUsePool),
+		 sendQueues(numClients)
+		{
+		}
+	
+	/* Methods: */
+	double run(size_t numBroadcasts,size_t batchSize) // Runs the benchmark and returns the average time per broadcast message in nanoseconds
+		{
+		Realtime::TimePointMonotonic timer;
+		unsigned int checksum=0;
+		for(size_t broadcast=0;broadcast<numBroadcasts;broadcast+=batchSize)
+			{
+			/* Queue a batch of messages to all clients, like PluginServer::broadcastMessage does: */
+			for(size_t i=0;i<batchSize;++i)
+				{
+				MessageBuffer* msg=createMessage();
+				for(unsigned int client=0;client<numClients;++client)
+					sendQueues[client].push_back(msg->ref());
+				msg->unref();
+				}
+			
+			/* Complete all clients' pending sends, like NonBlockSocket::writeToSocket does: */
+			for(unsigned int client=0;client<numClients;++client)
+				{
+				std::vector<MessageBuffer*>& queue=sendQueues[client];
+				for(std::vector<MessageBuffer*>::iterator qIt=queue.begin();qIt!=queue.end();++qIt)
+					{
+					checksum+=(unsigned char)((*qIt)->getBuffer()[0]);
+					(*qIt)->unref();
+					}
+				queue.clear();
+				}
+			}
+		double time=double(timer.setAndDiff());
+		
+		/* Keep the compiler from optimizing away the simulated sends: */
+		if(checksum!=0)
+			std::cerr<<"Unexpected message contents"<<std::endl;
+		
+		return time*1.0e9/double(numBroadcasts);
+		}
+	};
+
+/*************
+Main function:
+*************/
+
+int main(int argc,char* argv[])
+	{
+	/* Parse the command line: */
+	size_t numBroadcasts=200000;
+	unsigned int numClients=200;
+	size_t batchSize=16;
+	for(int argi=1;argi<argc;++argi)
+		{
+		if(strcasecmp(argv[argi],"-broadcasts")==0&&argi+1<argc)
+			numBroadcasts=size_t(atol(argv[++argi]));
+		else if(strcasecmp(argv[argi],"-clients")==0&&argi+1<argc)
+			numClients=(unsigned int)(atoi(argv[++argi]));
+		else if(strcasecmp(argv[argi],"-batch")==0&&argi+1<argc)
+			batchSize=size_t(atol(argv[++argi]));
+		else
+			{
+			std::cerr<<"Usage: "<<argv[0]<<" [-broadcasts <number of broadcast messages>] [-clients <number of clients>] [-batch <messages per send pass>]"<<std::endl;
+			return 1;
+			}
+		}
+	
+	std::cout<<"Broadcasting "<<numBroadcasts<<" messages of "<<BroadcastMsg::size<<" bytes to "<<numClients<<" clients"<<std::endl;
+	std::cout<<std::setw(36)<<std::left<<"Benchmark"<<std::right<<std::setw(16)<<"per broadcast"<<std::setw(16)<<"per recipient"<<std::endl;
+	
+	/* Warm up the allocator and slab pool: */
+	BroadcastBenchmark(numClients,false,false).run(numBroadcasts/10,batchSize);
+	BroadcastBenchmark(numClients,false,true).run(numBroadcasts/10,batchSize);
+	
+	/* Run all combinations of reference counting and allocation methods: */
+	static const char* names[4]={"Heap buffer, atomic refcount","Heap buffer, biased refcount","Pool buffer, atomic refcount","Pool buffer, biased refcount"};
+	double times[4];
+	for(int i=0;i<4;++i)
+		{
+		times[i]=BroadcastBenchmark(numClients,(i&0x1)==0,(i&0x2)!=0).run(numBroadcasts,batchSize);
+		std::cout<<std::setw(36)<<std::left<<names[i]<<std::right<<std::fixed<<std::setprecision(1);
+		std::cout<<std::setw(13)<<times[i]<<" ns"<<std::setw(13)<<std::setprecision(2)<<times[i]/double(numClients)<<" ns"<<std::endl;
+		}
+	std::cout<<"Speedup of biased over atomic reference counting: "<<std::setprecision(2)<<times[0]/times[1]<<"x (heap), "<<times[2]/times[3]<<"x (pool)"<<std::endl;
+	
+	return 0;
+	}
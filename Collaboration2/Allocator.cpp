@@ -1,7 +1,7 @@
 /***********************************************************************
 Allocator - Special-purpose allocator for medium-sized memory blocks
 that are allocated and then released after a short time.
-Copyright (c) 2019 Oliver Kreylos
+Copyright (c) 2019-2020 Oliver Kreylos
 ***********************************************************************/
 
 #include <Collaboration2/Allocator.h>
@@ -13,6 +13,7 @@ Static elements of class Allocator:
 **********************************/
 
 Allocator Allocator::theAllocator;
+__thread Allocator::ThreadCache* Allocator::threadCache=0;
 
 /**************************
 Methods of class Allocator:
@@ -21,13 +22,13 @@ Methods of class Allocator:
 void Allocator::growPool(size_t newNumPools)
 	{
 	/* Create a larger pool list: */
-	BlockHeader** newPools=new BlockHeader*[newNumPools];
+	Pool* newPools=new Pool[newNumPools];
 	
 	/* Copy over the old pool list: */
-	memcpy(newPools,pools,numPools*sizeof(BlockHeader*));
+	memcpy(newPools,pools,numPools*sizeof(Pool));
 	
 	/* Initialize the new pools to empty: */
-	memset(newPools+numPools*sizeof(BlockHeader*),0,(newNumPools-numPools)*sizeof(BlockHeader*));
+	memset(newPools+numPools,0,(newNumPools-numPools)*sizeof(Pool));
 	
 	/* Replace the old pool list: */
 	numPools=newNumPools;
@@ -35,30 +36,323 @@ void Allocator::growPool(size_t newNumPools)
 	pools=newPools;
 	}
 
+Allocator::ThreadCache* Allocator::createThreadCache(void)
+	{
+	/* Create an empty thread cache: */
+	ThreadCache* result=new ThreadCache;
+	for(size_t i=0;i<ALLOCATOR_NUM_CACHED_POOLS;++i)
+		{
+		result->pools[i]=0;
+		result->setPoolSize(i,0);
+		}
+	
+	/* Add the cache to the allocator's list: */
+	theAllocator.lockPools();
+	result->pred=0;
+	result->succ=theAllocator.threadCaches;
+	if(theAllocator.threadCaches!=0)
+		theAllocator.threadCaches->pred=result;
+	theAllocator.threadCaches=result;
+	theAllocator.unlockPools();
+	
+	/* Associate the cache with the calling thread so that it gets flushed when the thread terminates: */
+	threadCache=result;
+	pthread_setspecific(theAllocator.threadCacheKey,result);
+	
+	return result;
+	}
+
+void Allocator::flushThreadCache(Allocator::ThreadCache* cache)
+	{
+	/* Return each non-empty stack to the shared pool as a whole: */
+	for(size_t poolIndex=0;poolIndex<ALLOCATOR_NUM_CACHED_POOLS;++poolIndex)
+		if(cache->pools[poolIndex]!=0)
+			{
+			/* Find the last block in the stack: */
+			BlockHeader* last=cache->pools[poolIndex];
+			while(last->succ!=0)
+				last=last->succ;
+			
+			/* Splice the stack into the shared pool: */
+			theAllocator.releaseShared(cache->pools[poolIndex],last,cache->poolSizes[poolIndex],poolIndex);
+			cache->pools[poolIndex]=0;
+			cache->setPoolSize(poolIndex,0);
+			}
+	}
+
+void Allocator::destroyThreadCache(void* cache)
+	{
+	/* Return all cached blocks to the shared pool: */
+	ThreadCache* tc=static_cast<ThreadCache*>(cache);
+	flushThreadCache(tc);
+	
+	/* Remove the cache from the allocator's list: */
+	theAllocator.lockPools();
+	if(tc->pred!=0)
+		tc->pred->succ=tc->succ;
+	else
+		theAllocator.threadCaches=tc->succ;
+	if(tc->succ!=0)
+		tc->succ->pred=tc->pred;
+	theAllocator.unlockPools();
+	
+	/* Destroy the cache: */
+	delete tc;
+	threadCache=0;
+	}
+
+Allocator::BlockHeader* Allocator::allocateShared(size_t poolIndex,Allocator::ThreadCache* cache)
+	{
+	BlockHeader* block;
+	
+	lockPools();
+	
+	/* Grow the pool if necessary: */
+	if(poolIndex>=numPools)
+		growPool(poolIndex+1);
+	Pool& pool=pools[poolIndex];
+	
+	/* Check if there is a block of the requested size already available: */
+	block=pool.head;
+	if(block!=0)
+		{
+		/* Remove the unused block from the pool: */
+		pool.head=block->succ;
+		size_t numMoved=1;
+		
+		if(cache!=0&&pool.head!=0)
+			{
+			/* Move up to a batch of additional blocks into the thread cache to amortize locking: */
+			BlockHeader* first=pool.head;
+			BlockHeader* last=first;
+			unsigned int numCached=1;
+			while(numCached<ALLOCATOR_BATCH_SIZE&&last->succ!=0)
+				{
+				last=last->succ;
+				++numCached;
+				}
+			pool.head=last->succ;
+			
+			/* The thread cache for this size class is empty when this method is called: */
+			last->succ=0;
+			cache->pools[poolIndex]=first;
+			cache->setPoolSize(poolIndex,numCached);
+			numMoved+=numCached;
+			}
+		
+		/* Update the pool's occupancy: */
+		pool.numFree-=numMoved;
+		if(pool.minFree>pool.numFree)
+			pool.minFree=pool.numFree;
+		freeMemory-=numMoved*(poolIndex+1)*granularity;
+		}
+	else
+		{
+		/* Account for the new block that is about to be allocated: */
+		++pool.numBlocks;
+		if(pool.maxBlocks<pool.numBlocks)
+			pool.maxBlocks=pool.numBlocks;
+		}
+	
+	unlockPools();
+	
+	if(block==0)
+		{
+		/* Allocate a new block outside the critical section: */
+		block=static_cast<BlockHeader*>(malloc((poolIndex+1)*granularity));
+		}
+	
+	return block;
+	}
+
+void Allocator::releaseShared(Allocator::BlockHeader* first,Allocator::BlockHeader* last,size_t numBlocks,size_t poolIndex)
+	{
+	size_t listSize=numBlocks*(poolIndex+1)*granularity;
+	
+	lockPools();
+	
+	/* Grow the pool if necessary (only happens if a block is released into an allocator that has never seen its size class): */
+	if(poolIndex>=numPools)
+		growPool(poolIndex+1);
+	Pool& pool=pools[poolIndex];
+	
+	/* Check if the shared pools have room for the list of blocks: */
+	bool keep=freeMemory+listSize<=maxFreeMemory;
+	if(keep)
+		{
+		/* Splice the list of blocks onto the pool's stack: */
+		last->succ=pool.head;
+		pool.head=first;
+		pool.numFree+=numBlocks;
+		freeMemory+=listSize;
+		}
+	else
+		{
+		/* Account for the blocks that are about to be released: */
+		pool.numBlocks-=numBlocks;
+		}
+	
+	unlockPools();
+	
+	if(!keep)
+		{
+		/* Return the blocks to the operating system outside the critical section: */
+		last->succ=0;
+		freeList(first);
+		}
+	}
+
+void Allocator::freeList(Allocator::BlockHeader* head)
+	{
+	while(head!=0)
+		{
+		BlockHeader* succ=head->succ;
+		free(head);
+		head=succ;
+		}
+	}
+
+void Allocator::spill(Allocator::ThreadCache* cache,size_t poolIndex)
+	{
+	/* Detach a batch of blocks from the top of the thread cache's stack: */
+	BlockHeader* first=cache->pools[poolIndex];
+	BlockHeader* last=first;
+	for(unsigned int i=1;i<ALLOCATOR_BATCH_SIZE;++i)
+		last=last->succ;
+	cache->pools[poolIndex]=last->succ;
+	cache->setPoolSize(poolIndex,cache->poolSizes[poolIndex]-ALLOCATOR_BATCH_SIZE);
+	
+	/* Hand the batch to the shared pool: */
+	releaseShared(first,last,ALLOCATOR_BATCH_SIZE,poolIndex);
+	}
+
 Allocator::Allocator(size_t sGranularity)
 	:granularity(sGranularity),
 	 #if !ALLOCATOR_USE_SPINLOCK
 	 poolLock(0),
 	 #endif
-	 numPools(0),pools(0)
+	 threadCaches(0),
+	 numPools(0),pools(0),
+	 maxFreeMemory(~size_t(0)),freeMemory(0)
 	{
+	/* Create the key to flush thread caches of terminating threads: */
+	pthread_key_create(&threadCacheKey,destroyThreadCache);
 	}
 
 Allocator::~Allocator(void)
 	{
+	/* Flush the calling thread's cache, as thread-specific destructors do not run for the main thread: */
+	if(threadCache!=0)
+		{
+		pthread_setspecific(threadCacheKey,0);
+		destroyThreadCache(threadCache);
+		}
+	pthread_key_delete(threadCacheKey);
+	
 	/* Release all unused memory blocks: */
-	BlockHeader** pEnd=pools+numPools;
-	for(BlockHeader** pPtr=pools;pPtr!=pEnd;++pPtr)
+	Pool* pEnd=pools+numPools;
+	for(Pool* pPtr=pools;pPtr!=pEnd;++pPtr)
+		freeList(pPtr->head);
+	
+	/* Destroy the pool list: */
+	delete[] pools;
+	}
+
+void Allocator::setMaxFreeMemory(size_t newMaxFreeMemory)
+	{
+	BlockHeader* released=0;
+	
+	theAllocator.lockPools();
+	
+	/* Set the new limit: */
+	theAllocator.maxFreeMemory=newMaxFreeMemory;
+	
+	/* Detach unused blocks from the shared pools, starting with the largest size class, until the limit is met: */
+	for(size_t poolIndex=theAllocator.numPools;poolIndex>0&&theAllocator.freeMemory>theAllocator.maxFreeMemory;--poolIndex)
 		{
-		BlockHeader* head=*pPtr;
-		while(head!=0)
+		Pool& pool=theAllocator.pools[poolIndex-1];
+		size_t blockSize=poolIndex*theAllocator.granularity;
+		while(pool.head!=0&&theAllocator.freeMemory>theAllocator.maxFreeMemory)
 			{
-			BlockHeader* succ=head->succ;
-			free(head);
-			head=succ;
+			BlockHeader* block=pool.head;
+			pool.head=block->succ;
+			block->succ=released;
+			released=block;
+			--pool.numFree;
+			--pool.numBlocks;
+			theAllocator.freeMemory-=blockSize;
 			}
+		if(pool.minFree>pool.numFree)
+			pool.minFree=pool.numFree;
 		}
 	
-	/* Destroy the pool list: */
-	delete[] pools;
+	theAllocator.unlockPools();
+	
+	/* Return the detached blocks to the operating system: */
+	freeList(released);
+	}
+
+size_t Allocator::trim(void)
+	{
+	BlockHeader* released=0;
+	size_t releasedMemory=0;
+	
+	theAllocator.lockPools();
+	
+	for(size_t poolIndex=0;poolIndex<theAllocator.numPools;++poolIndex)
+		{
+		/* Blocks below the pool's low-water mark have not been touched since the last trim: */
+		Pool& pool=theAllocator.pools[poolIndex];
+		size_t blockSize=(poolIndex+1)*theAllocator.granularity;
+		for(size_t i=0;i<pool.minFree;++i)
+			{
+			BlockHeader* block=pool.head;
+			pool.head=block->succ;
+			block->succ=released;
+			released=block;
+			}
+		pool.numFree-=pool.minFree;
+		pool.numBlocks-=pool.minFree;
+		theAllocator.freeMemory-=pool.minFree*blockSize;
+		releasedMemory+=pool.minFree*blockSize;
+		
+		/* Start a new observation period: */
+		pool.minFree=pool.numFree;
+		}
+	
+	theAllocator.unlockPools();
+	
+	/* Return the idle blocks to the operating system: */
+	freeList(released);
+	
+	return releasedMemory;
+	}
+
+void Allocator::getStats(std::vector<Allocator::PoolStats>& stats)
+	{
+	stats.clear();
+	
+	theAllocator.lockPools();
+	
+	stats.reserve(theAllocator.numPools);
+	for(size_t poolIndex=0;poolIndex<theAllocator.numPools;++poolIndex)
+		{
+		const Pool& pool=theAllocator.pools[poolIndex];
+		PoolStats ps;
+		ps.blockSize=(poolIndex+1)*theAllocator.granularity;
+		ps.numBlocks=pool.numBlocks;
+		ps.maxBlocks=pool.maxBlocks;
+		ps.numFree=pool.numFree;
+		
+		/* Add up the thread caches' stacks, whose sizes are read atomically while their owners keep updating them and might be slightly off: */
+		ps.numCached=0;
+		if(poolIndex<ALLOCATOR_NUM_CACHED_POOLS)
+			for(const ThreadCache* tc=theAllocator.threadCaches;tc!=0;tc=tc->succ)
+				ps.numCached+=tc->getPoolSize(poolIndex);
+		
+		ps.numLive=ps.numBlocks>=ps.numFree+ps.numCached?ps.numBlocks-ps.numFree-ps.numCached:0;
+		stats.push_back(ps);
+		}
+	
+	theAllocator.unlockPools();
 	}
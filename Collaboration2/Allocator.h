@@ -1,7 +1,7 @@
 /***********************************************************************
 Allocator - Special-purpose allocator for medium-sized memory blocks
 that are allocated and then released after a short time.
-Copyright (c) 2019 Oliver Kreylos
+Copyright (c) 2019-2020 Oliver Kreylos
 ***********************************************************************/
 
 #ifndef ALLOCATOR_INCLUDED
@@ -9,8 +9,16 @@ Copyright (c) 2019 Oliver Kreylos
 
 #define ALLOCATOR_USE_SPINLOCK 1
 
+/* Number of size classes that are cached per thread; larger blocks go directly to the shared pool: */
+#define ALLOCATOR_NUM_CACHED_POOLS 64
+
+/* Number of unused blocks moved between a thread cache and the shared pool at once: */
+#define ALLOCATOR_BATCH_SIZE 32
+
 #include <stddef.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <vector>
 #if ALLOCATOR_USE_SPINLOCK
 #include <Threads/Spinlock.h>
 #else
@@ -20,6 +28,19 @@ Copyright (c) 2019 Oliver Kreylos
 class Allocator
 	{
 	/* Embedded classes: */
+	public:
+	struct PoolStats // Structure reporting the occupancy of one size class
+		{
+		/* Elements: */
+		public:
+		size_t blockSize; // Size of memory blocks in this size class including the block header
+		size_t numBlocks; // Number of memory blocks currently held from the operating system
+		size_t maxBlocks; // High-water mark of the number of held memory blocks
+		size_t numFree; // Number of unused memory blocks in the shared pool
+		size_t numCached; // Approximate number of unused memory blocks in thread caches
+		size_t numLive; // Approximate number of memory blocks currently in use
+		};
+	
 	private:
 	struct BlockHeader // Structure at the beginning of used or unused memory blocks
 		{
@@ -31,20 +52,80 @@ class Allocator
 			};
 		};
 	
+	struct ThreadCache // Structure holding a thread's private stacks of unused memory blocks
+		{
+		/* Elements: */
+		public:
+		BlockHeader* pools[ALLOCATOR_NUM_CACHED_POOLS]; // Stacks of unused memory blocks for each cached size class
+		unsigned int poolSizes[ALLOCATOR_NUM_CACHED_POOLS]; // Number of unused memory blocks in each stack; only written by the owning thread, but read by others via relaxed atomic loads
+		ThreadCache* pred; // Previous thread cache in the allocator's list of thread caches
+		ThreadCache* succ; // Next thread cache in the allocator's list of thread caches
+		
+		/* Methods: */
+		unsigned int getPoolSize(size_t poolIndex) const // Returns the number of unused memory blocks in the given stack; can be called from any thread
+			{
+			return __atomic_load_n(&poolSizes[poolIndex],__ATOMIC_RELAXED);
+			}
+		void setPoolSize(size_t poolIndex,unsigned int newPoolSize) // Sets the number of unused memory blocks in the given stack; must only be called from the cache's owning thread
+			{
+			__atomic_store_n(&poolSizes[poolIndex],newPoolSize,__ATOMIC_RELAXED);
+			}
+		};
+	
+	struct Pool // Structure representing the shared state of one size class
+		{
+		/* Elements: */
+		public:
+		BlockHeader* head; // Stack of unused memory blocks
+		size_t numFree; // Number of unused memory blocks on the stack
+		size_t minFree; // Low-water mark of the number of unused memory blocks since the last trim
+		size_t numBlocks; // Number of memory blocks currently held from the operating system
+		size_t maxBlocks; // High-water mark of the number of held memory blocks
+		};
+	
 	/* Elements: */
 	private:
 	static Allocator theAllocator; // Static instance of the allocator class
+	static __thread ThreadCache* threadCache; // The calling thread's cache of unused memory blocks, or null if not yet created
 	size_t granularity; // Granularity of memory block sizes
+	pthread_key_t threadCacheKey; // Key to release a thread's cache when the thread terminates
 	#if ALLOCATOR_USE_SPINLOCK
-	Threads::Spinlock poolMutex; // Mutex serializing access to the block pool
+	Threads::Spinlock poolMutex; // Mutex serializing access to the shared block pool
 	#else
 	Threads::Atomic<bool> poolLock; // Atomic counter for DIY spin locking
 	#endif
+	ThreadCache* threadCaches; // List of all current thread caches, to collect statistics
 	size_t numPools; // Number of block pools currently allocated
-	BlockHeader** pools; // List of block pools, each containing a stack of unused memory blocks
+	Pool* pools; // List of shared block pools, each containing a stack of unused memory blocks
+	size_t maxFreeMemory; // Maximum amount of memory held in unused blocks in the shared pools before blocks are returned to the operating system
+	size_t freeMemory; // Amount of memory currently held in unused blocks in the shared pools
 	
 	/* Private methods: */
-	void growPool(size_t newNumPools); // Grows the pool to the given new size
+	void lockPools(void) // Enters the critical section protecting the shared block pools
+		{
+		#if ALLOCATOR_USE_SPINLOCK
+		poolMutex.lock();
+		#else
+		while(poolLock.compareAndSwap(false,true))
+			;
+		#endif
+		}
+	void unlockPools(void) // Leaves the critical section protecting the shared block pools
+		{
+		#if ALLOCATOR_USE_SPINLOCK
+		poolMutex.unlock();
+		#else
+		poolLock.compareAndSwap(true,false);
+		#endif
+		}
+	void growPool(size_t newNumPools); // Grows the pool to the given new size; must be called with the shared pools locked
+	static ThreadCache* createThreadCache(void); // Creates a cache for the calling thread
+	static void flushThreadCache(ThreadCache* cache); // Returns all blocks in the given thread cache to the shared pool
+	static void destroyThreadCache(void* cache); // Flushes and destroys a thread cache when its thread terminates
+	BlockHeader* allocateShared(size_t poolIndex,ThreadCache* cache); // Returns a block from the shared pool, and refills the given thread cache in the same pass if it is not null
+	void releaseShared(BlockHeader* first,BlockHeader* last,size_t numBlocks,size_t poolIndex); // Puts the given list of blocks of the given length into the shared pool, or returns them to the operating system if the shared pools are full
+	static void freeList(BlockHeader* head); // Returns the given list of blocks to the operating system
+	void spill(ThreadCache* cache,size_t poolIndex); // Moves a batch of blocks from the given thread cache to the shared pool
 	
 	/* Constructors and destructors: */
 	public:
@@ -52,68 +133,78 @@ class Allocator
 	~Allocator(void); // Destroys the allocator and releases all unused memory
 	
 	/* Methods: */
+	static size_t getMaxFreeMemory(void) // Returns the maximum amount of memory held in unused blocks in the shared pools
+		{
+		return theAllocator.maxFreeMemory;
+		}
+	static void setMaxFreeMemory(size_t newMaxFreeMemory); // Sets the maximum amount of memory held in unused blocks in the shared pools; immediately returns excess blocks to the operating system
+	static size_t trim(void); // Returns unused blocks that have been idle since the previous call to the operating system; returns the amount of released memory
+	static void getStats(std::vector<PoolStats>& stats); // Returns occupancy statistics for all size classes
 	static void* allocate(size_t size) // Returns a memory block of the requested size
 		{
-		#if ALLOCATOR_USE_SPINLOCK
-		Threads::Spinlock::Lock poolLock(theAllocator.poolMutex);
-		#else
-		/* Enter critical section: */
-		while(theAllocator.poolLock.compareAndSwap(false,true))
-			;
-		#endif
-		
 		/* Find the index of the pool containing blocks of the requested size: */
 		size_t poolIndex=(size+sizeof(BlockHeader))/theAllocator.granularity; // Add room for a size marker (yes, I know malloc has it, but I need it)
 		
-		/* Grow the pool if necessary: */
-		if(poolIndex>=theAllocator.numPools)
-			theAllocator.growPool(poolIndex+1);
-		
-		/* Check if there is a block of the requested size already available: */
 		BlockHeader* block;
-		if(theAllocator.pools[poolIndex]!=0)
+		if(poolIndex<ALLOCATOR_NUM_CACHED_POOLS)
 			{
-			/* Remove the unused block from the pool and return it: */
-			block=theAllocator.pools[poolIndex];
-			theAllocator.pools[poolIndex]=theAllocator.pools[poolIndex]->succ;
+			/* Access the calling thread's cache: */
+			ThreadCache* cache=threadCache;
+			if(cache==0)
+				cache=createThreadCache();
+			
+			/* Check if there is a block of the requested size in the thread cache: */
+			block=cache->pools[poolIndex];
+			if(block!=0)
+				{
+				/* Remove the unused block from the thread cache without locking: */
+				cache->pools[poolIndex]=block->succ;
+				cache->setPoolSize(poolIndex,cache->poolSizes[poolIndex]-1);
+				}
+			else
+				{
+				/* Get a block from the shared pool and refill the thread cache: */
+				block=theAllocator.allocateShared(poolIndex,cache);
+				}
 			}
 		else
 			{
-			/* Allocate and return a new block: */
-			block=static_cast<BlockHeader*>(malloc((poolIndex+1)*theAllocator.granularity));
+			/* Get a block directly from the shared pool: */
+			block=theAllocator.allocateShared(poolIndex,0);
 			}
 		
-		#if !ALLOCATOR_USE_SPINLOCK
-		/* Leave critical section: */
-		theAllocator.poolLock.compareAndSwap(true,false);
-		#endif
-		
 		/* Remember the pool index whence the block came and return it: */
 		block->poolIndex=poolIndex;
 		return block+1;
 		}
 	static void release(void* block) // Puts the given memory block back into the pool for re-use
 		{
-		#if ALLOCATOR_USE_SPINLOCK
-		Threads::Spinlock::Lock poolLock(theAllocator.poolMutex);
-		#else
-		/* Enter critical section: */
-		while(theAllocator.poolLock.compareAndSwap(false,true))
-			;
-		#endif
-		
 		/* Access the block's header: */
 		BlockHeader* blockHeader=static_cast<BlockHeader*>(block)-1;
-		
-		/* Put the block back into the pool: */
 		size_t poolIndex=blockHeader->poolIndex;
-		blockHeader->succ=theAllocator.pools[poolIndex];
-		theAllocator.pools[poolIndex]=blockHeader;
 		
-		#if !ALLOCATOR_USE_SPINLOCK
-		/* Leave critical section: */
-		theAllocator.poolLock.compareAndSwap(true,false);
-		#endif
+		if(poolIndex<ALLOCATOR_NUM_CACHED_POOLS)
+			{
+			/* Access the calling thread's cache: */
+			ThreadCache* cache=threadCache;
+			if(cache==0)
+				cache=createThreadCache();
+			
+			/* Put the block into the calling thread's cache, even if it was allocated by another thread: */
+			blockHeader->succ=cache->pools[poolIndex];
+			cache->pools[poolIndex]=blockHeader;
+			
+			/* Hand a batch of blocks back to the shared pool if the thread cache is overflowing: */
+			unsigned int newPoolSize=cache->poolSizes[poolIndex]+1;
+			cache->setPoolSize(poolIndex,newPoolSize);
+			if(newPoolSize>=2*ALLOCATOR_BATCH_SIZE)
+				theAllocator.spill(cache,poolIndex);
+			}
+		else
+			{
+			/* Put the block directly back into the shared pool: */
+			theAllocator.releaseShared(blockHeader,blockHeader,1,poolIndex);
+			}
 		}
 	};
 
@@ -8,6 +8,12 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include <openssl/md5.h>
 #include <utility>
 #include <stdexcept>
@@ -83,161 +89,69 @@ bool Client::socketEvent(Threads::EventDispatcher::ListenerKey,int eventTypeMask
 			/* Read data from the socket: */
 			size_t unread=socket.readFromSocket();
 			
-			/* Process as much unread data as possible: */
-			bool readAgain;
-			do
+			if(state==ReadingPasswordRequest)
 				{
-				readAgain=false;
-				switch(state)
+				/* Check if there is enough unread data to read a password request message: */
+				if(unread>=PasswordRequestMsg::size)
 					{
-					case ReadingMessageID:
+					/* Extract the endianness marker: */
+					Misc::UInt32 endiannessMarker=socket.read<Misc::UInt32>();
+					if(endiannessMarker==0x78563412U)
+						{
+						socket.setSwapOnRead(true);
+						swapOnRead=true;
+						}
+					else if(endiannessMarker!=0x12345678U)
+						throw std::runtime_error("Invalid endianness marker in password request");
 						
-						/* Check if there is enough unread data to read a message ID: */
-						if(unread>=sizeof(MessageID))
-							{
-							/* Retrieve the message ID: */
-							messageId=socket.read<MessageID>();
+					/* Extract the protocol version: */
+					Misc::UInt32 serverProtocolVersion=socket.read<Misc::UInt32>();
+					if(serverProtocolVersion!=protocolVersion)
+						Misc::throwStdErr("Invalid protocol version %u",serverProtocolVersion);
 							
-							/* Check if the message ID is valid: */
-							MessageContinuationHandler& mh=tcpMessageHandlers[messageId];
-							if(messageId>=tcpMessageHandlers.size()||mh.handler==0)
-								throw std::runtime_error("Invalid message ID");
+					/* Create the session password hash: */
+					MD5_CTX md5Context;
+					MD5_Init(&md5Context);
 							
-							/* Check if the message handler requires a minimum message body: */
-							if(mh.minUnread>socket.getUnread())
-								{
-								/* Read the message body: */
-								state=ReadingMessageBody;
-								}
-							else
-								{
-								/* Handle the message: */
-								continuation=mh.handler(messageId,0,mh.handlerUserData);
-								if(continuation==0)
-									{
-									/* Handler is done processing the message; start reading the next one: */
-									state=ReadingMessageID;
+					/* Hash the nonce sent by the server: */
+					Byte nonce[PasswordRequestMsg::nonceLength];
+					socket.read(nonce,PasswordRequestMsg::nonceLength);
+					MD5_Update(&md5Context,nonce,PasswordRequestMsg::nonceLength);
 									
-									/* If there is unread data in the socket buffer at this point, read again: */
-									readAgain=(unread=socket.getUnread())>0;
-									}
-								else
-									{
-									/* Handler is not done processing the message; continue calling the message handler: */
-									state=HandlingMessage;
-									}
-								}
-							}
+					/* Hash the session password: */
+					if(!sessionPassword.empty())
+						MD5_Update(&md5Context,sessionPassword.data(),sessionPassword.size());
 						
-						break;
-					
-					case ReadingMessageBody:
-						{
-						/* Check if there is enough unread data for the message handler: */
-						MessageContinuationHandler& mh=tcpMessageHandlers[messageId];
-						if(unread>=mh.minUnread)
-							{
-							/* Handle the message: */
-							continuation=mh.handler(messageId,0,mh.handlerUserData);
-							if(continuation==0)
-								{
-								/* Handler is done processing the message; start reading the next one: */
-								state=ReadingMessageID;
-								
-								/* If there is unread data in the socket buffer at this point, read again: */
-								readAgain=(unread=socket.getUnread())>0;
-								}
-							else
-								{
-								/* Handler is not done processing the message; continue calling the message handler: */
-								state=HandlingMessage;
-								}
-							}
-						
-						break;
-						}
+					/* Retrieve the hash value: */
+					Byte hash[ConnectRequestMsg::hashLength];
+					MD5_Final(hash,&md5Context);
 					
-					case HandlingMessage:
+					/* Queue a connect request message to the server: */
+					{
+					MessageWriter connectRequest(ConnectRequestMsg::createMessage(plugins.size()));
+					connectRequest.write(Misc::UInt32(0x12345678U));
+					connectRequest.write(Misc::UInt32(protocolVersion));
+					connectRequest.write(hash,ConnectRequestMsg::hashLength);
+					stringToCharBuffer(clientName,connectRequest,ConnectRequestMsg::nameLength);
+					connectRequest.write(Misc::UInt16(plugins.size()));
+					for(PluginList::iterator pIt=plugins.begin();pIt!=plugins.end();++pIt)
 						{
-						/* Handle the message: */
-						MessageContinuationHandler& mh=tcpMessageHandlers[messageId];
-						continuation=mh.handler(messageId,continuation,mh.handlerUserData);
-						if(continuation==0)
-							{
-							/* Handler is done processing the message; start reading the next one: */
-							state=ReadingMessageID;
-							
-							/* If there is unread data in the socket buffer at this point, read again: */
-							readAgain=(unread=socket.getUnread())>0;
-							}
-						
-						break;
+						stringToCharBuffer((*pIt)->getName(),connectRequest,ConnectRequestMsg::ProtocolRequest::nameLength);
+						connectRequest.write(Misc::UInt32((*pIt)->getVersion()));
 						}
-					
-					case ReadingPasswordRequest:
-						
-						/* Check if there is enough unread data to read a password request message: */
-						if(unread>=PasswordRequestMsg::size)
-							{
-							/* Extract the endianness marker: */
-							Misc::UInt32 endiannessMarker=socket.read<Misc::UInt32>();
-							if(endiannessMarker==0x78563412U)
-								{
-								socket.setSwapOnRead(true);
-								swapOnRead=true;
-								}
-							else if(endiannessMarker!=0x12345678U)
-								throw std::runtime_error("Invalid endianness marker in password request");
-							
-							/* Extract the protocol version: */
-							Misc::UInt32 serverProtocolVersion=socket.read<Misc::UInt32>();
-							if(serverProtocolVersion!=protocolVersion)
-								Misc::throwStdErr("Invalid protocol version %u",serverProtocolVersion);
-							
-							/* Create the session password hash: */
-							MD5_CTX md5Context;
-							MD5_Init(&md5Context);
-							
-							/* Hash the nonce sent by the server: */
-							Byte nonce[PasswordRequestMsg::nonceLength];
-							socket.read(nonce,PasswordRequestMsg::nonceLength);
-							MD5_Update(&md5Context,nonce,PasswordRequestMsg::nonceLength);
-							
-							/* Hash the session password: */
-							if(!sessionPassword.empty())
-								MD5_Update(&md5Context,sessionPassword.data(),sessionPassword.size());
-							
-							/* Retrieve the hash value: */
-							Byte hash[ConnectRequestMsg::hashLength];
-							MD5_Final(hash,&md5Context);
-							
-							/* Queue a connect request message to the server: */
-							{
-							MessageWriter connectRequest(ConnectRequestMsg::createMessage(plugins.size()));
-							connectRequest.write(Misc::UInt32(0x12345678U));
-							connectRequest.write(Misc::UInt32(protocolVersion));
-							connectRequest.write(hash,ConnectRequestMsg::hashLength);
-							stringToCharBuffer(clientName,connectRequest,ConnectRequestMsg::nameLength);
-							connectRequest.write(Misc::UInt16(plugins.size()));
-							for(PluginList::iterator pIt=plugins.begin();pIt!=plugins.end();++pIt)
-								{
-								stringToCharBuffer((*pIt)->getName(),connectRequest,ConnectRequestMsg::ProtocolRequest::nameLength);
-								connectRequest.write(Misc::UInt32((*pIt)->getVersion()));
-								}
-							queueMessage(connectRequest.getBuffer());
-							}
-							
-							/* Start processing messages: */
-							state=ReadingMessageID;
-							}
-						
-						break;
-					
-					default:
-						; // Do nothing
+					queueMessage(connectRequest.getBuffer());
+					}
+								
+					/* Start processing messages: */
+					state=ReadingMessageID;
 					}
 				}
-			while(readAgain);
+			
+			if(state>=ReadingMessageID&&state<Disconnecting)
+				{
+				/* Process as many messages from the unread data as possible: */
+				handleMessages(state,messageId,continuation);
+				}
 			
 			/* Check if the server closed the connection: */
 			if(state<Disconnecting&&socket.eof())
@@ -274,29 +188,157 @@ bool Client::socketEvent(Threads::EventDispatcher::ListenerKey,int eventTypeMask
 	return state==Disconnected;
 	}
 
+void Client::handleMessages(State& streamState,unsigned int& streamMessageId,MessageContinuation*& streamContinuation)
+	{
+	/* Process as much unread data as possible: */
+	size_t unread=socket.getUnread();
+	bool readAgain;
+	do
+		{
+		readAgain=false;
+		switch(streamState)
+			{
+			case ReadingMessageID:
+			
+				/* Check if there is enough unread data to read a message ID: */
+				if(unread>=sizeof(MessageID))
+					{
+					/* Retrieve the message ID: */
+					streamMessageId=socket.read<MessageID>();
+					
+					/* Check if the message ID is valid: */
+					MessageContinuationHandler& mh=tcpMessageHandlers[streamMessageId];
+					if(streamMessageId>=tcpMessageHandlers.size()||mh.handler==0)
+						throw std::runtime_error("Invalid message ID");
+					
+					/* Check if the message handler requires a minimum message body: */
+					if(mh.minUnread>socket.getUnread())
+						{
+						/* Read the message body: */
+						streamState=ReadingMessageBody;
+						}
+					else
+						{
+						/* Handle the message: */
+						streamContinuation=mh.handler(streamMessageId,0,mh.handlerUserData);
+						if(streamContinuation==0)
+							{
+							/* Handler is done processing the message; start reading the next one: */
+							streamState=ReadingMessageID;
+							
+							/* If there is unread data in the socket buffer at this point, read again: */
+							readAgain=(unread=socket.getUnread())>0;
+							}
+						else
+							{
+							/* Handler is not done processing the message; continue calling the message handler: */
+							streamState=HandlingMessage;
+							}
+						}
+					}
+				
+				break;
+			
+			case ReadingMessageBody:
+				{
+				/* Check if there is enough unread data for the message handler: */
+				MessageContinuationHandler& mh=tcpMessageHandlers[streamMessageId];
+				if(unread>=mh.minUnread)
+					{
+					/* Handle the message: */
+					streamContinuation=mh.handler(streamMessageId,0,mh.handlerUserData);
+					if(streamContinuation==0)
+						{
+						/* Handler is done processing the message; start reading the next one: */
+						streamState=ReadingMessageID;
+						
+						/* If there is unread data in the socket buffer at this point, read again: */
+						readAgain=(unread=socket.getUnread())>0;
+						}
+					else
+						{
+						/* Handler is not done processing the message; continue calling the message handler: */
+						streamState=HandlingMessage;
+						}
+					}
+				
+				break;
+				}
+			
+			case HandlingMessage:
+				{
+				/* Handle the message: */
+				MessageContinuationHandler& mh=tcpMessageHandlers[streamMessageId];
+				streamContinuation=mh.handler(streamMessageId,streamContinuation,mh.handlerUserData);
+				if(streamContinuation==0)
+					{
+					/* Handler is done processing the message; start reading the next one: */
+					streamState=ReadingMessageID;
+					
+					/* If there is unread data in the socket buffer at this point, read again: */
+					readAgain=(unread=socket.getUnread())>0;
+					}
+				
+				break;
+				}
+			
+			default:
+				; // Do nothing
+			}
+		}
+	while(readAgain);
+	}
+
+void Client::dispatchUDPMessage(unsigned int messageId,MessageReader& message)
+	{
+	/* Check if the message ID is valid: */
+	if(messageId>=udpMessageHandlers.size()||udpMessageHandlers[messageId].handler==0)
+		throw std::runtime_error("Invalid message ID");
+	
+	/* Dispatch the message: */
+	const MessageReaderHandler& mh=udpMessageHandlers[messageId];
+	mh.handler(messageId,message,mh.handlerUserData);
+	}
+
 bool Client::udpSocketEvent(Threads::EventDispatcher::ListenerKey,int eventTypeMask)
 	{
 	try
 		{
 		if(eventTypeMask&Threads::EventDispatcher::Read)
 			{
-			/* Get the next pending message: */
-			UDPSocket::Address senderAddress;
-			MessageReader message(udpSocket.readFromSocket(senderAddress));
-			if(message.getBuffer()!=0)
+			/* Receive a batch of pending packets and dispatch them in order: */
+			unsigned int numPackets=udpSocket.readFromSocket();
+			for(unsigned int packetIndex=0;packetIndex<numPackets;++packetIndex)
 				{
-				/* Check if the message is from the server and contains at least a message ID: */
-				message.setSwapOnRead(swapOnRead);
-				if(senderAddress==udpServerAddress&&message.getUnread()>=sizeof(MessageID))
+				try
 					{
-					/* Read the message ID and check if it is valid: */
-					unsigned int messageId=message.read<MessageID>();
-					const MessageReaderHandler& mh=udpMessageHandlers[messageId];
-					if(messageId>=udpMessageHandlers.size()||mh.handler==0)
-						throw std::runtime_error("Invalid message ID");
-					
-					/* Dispatch the message: */
-					mh.handler(messageId,message,mh.handlerUserData);
+					MessageReader message(udpSocket.getPacket(packetIndex));
+					if(message.getBuffer()!=0)
+						{
+						/* Check if the message is from the server and contains at least a message ID: */
+						message.setSwapOnRead(swapOnRead);
+						if(udpSocket.getSenderAddress(packetIndex)==udpServerAddress&&message.getUnread()>=sizeof(MessageID))
+							{
+							/* Read the message ID: */
+							unsigned int messageId=message.read<MessageID>();
+							if(messageId==UDPSocket::aggregateMessageId)
+								{
+								/* Dispatch all messages contained in the aggregate packet in order: */
+								while(!message.eof())
+									{
+									MessageReader aggregatedMessage(UDPSocket::unpackMessage(message),swapOnRead);
+									dispatchUDPMessage(aggregatedMessage.read<MessageID>(),aggregatedMessage);
+									}
+								}
+							else
+								dispatchUDPMessage(messageId,message);
+							}
+						}
+					}
+				catch(const std::runtime_error& err)
+					{
+					/* This is UDP! Print an error message and carry on with the rest of the batch: */
+					Misc::formattedLogError("Client::udpSocketEvent: Caught exception %s",err.what());
 					}
 				}
 			}
@@ -355,12 +397,22 @@ bool Client::sendUDPConnectRequestCallback(Threads::EventDispatcher::ListenerKey
 
 bool Client::messageSignalCallback(Threads::EventDispatcher::ListenerKey signalKey,void* signalData)
 	{
-	/* Access the message: */
-	MessageBuffer* message=static_cast<MessageBuffer*>(signalData);
+	/* Take all queued messages in one batch: */
+	{
+	Threads::Spinlock::Lock serverQueueLock(serverQueueMutex);
+	std::swap(serverQueue,serverBatch);
+	}
 	
-	/* Send it to the server and release it: */
-	queueMessage(message);
-	message->unref();
+	/* Send the messages to the server over their respective sockets in the order in which they were queued and release them: */
+	for(std::vector<ServerQueueEntry>::iterator mIt=serverBatch.begin();mIt!=serverBatch.end();++mIt)
+		{
+		if(mIt->udp)
+			queueUDPMessage(mIt->message);
+		else
+			queueMessage(mIt->message);
+		mIt->message->unref();
+		}
+	serverBatch.clear();
 	
 	/* Keep listening: */
 	return false;
@@ -492,19 +544,6 @@ MessageContinuation* Client::connectRejectCallback(unsigned int messageId,Messag
 	return 0;
 	}
 
-bool Client::udpMessageSignalCallback(Threads::EventDispatcher::ListenerKey signalKey,void* signalData)
-	{
-	/* Access the message: */
-	MessageBuffer* message=static_cast<MessageBuffer*>(signalData);
-	
-	/* Send it to the server and release it: */
-	queueUDPMessage(message);
-	message->unref();
-	
-	/* Keep listening: */
-	return false;
-	}
-
 void Client::udpConnectReplyCallback(unsigned int messageId,MessageReader& message)
 	{
 	/* Bail out if the message has the wrong size: */
@@ -737,6 +776,68 @@ MessageContinuation* Client::clientDisconnectNotificationCallback(unsigned int m
 	return 0;
 	}
 
+MessageContinuation* Client::bulkChunkCallback(unsigned int messageId,MessageContinuation* continuation)
+	{
+	/* Embedded classes: */
+	class Cont:public MessageContinuation
+		{
+		/* Elements: */
+		public:
+		size_t chunkLeft; // Amount of chunk data that has not been read yet
+		bool final; // Flag if this is the last chunk of the bulk message
+		
+		/* Constructors and destructors: */
+		Cont(size_t sChunkLeft,bool sFinal)
+			:chunkLeft(sChunkLeft),final(sFinal)
+			{
+			}
+		};
+	
+	/* Check if this is the start of a new message: */
+	Cont* cont=static_cast<Cont*>(continuation);
+	if(cont==0)
+		{
+		/* Read the chunk header: */
+		size_t chunkSize=socket.read<Misc::UInt16>();
+		bool final=readBool(socket);
+		
+		cont=new Cont(chunkSize,final);
+		}
+	
+	/* Append a part of the chunk directly to the socket's bulk data: */
+	size_t readSize=Misc::min(socket.getUnread(),cont->chunkLeft);
+	socket.readRaw(socket.appendBulkData(readSize),readSize);
+	cont->chunkLeft-=readSize;
+	
+	/* Pass the new bulk data to the bulk message's handler right away, reading it through the socket's regular read methods: */
+	socket.swapBulkData();
+	try
+		{
+		handleMessages(bulkState,bulkMessageId,bulkContinuation);
+		}
+	catch(...)
+		{
+		/* Switch back to the regular read stream and bail out: */
+		socket.swapBulkData();
+		throw;
+		}
+	socket.swapBulkData();
+	
+	/* Check if the chunk was read completely: */
+	if(cont->chunkLeft==0)
+		{
+		/* Check that the final chunk completed the bulk message: */
+		if(cont->final&&(bulkState!=ReadingMessageID||socket.getBulkUnread()!=0))
+			throw std::runtime_error("Truncated bulk message");
+		
+		/* Done with the message: */
+		delete cont;
+		cont=0;
+		}
+	
+	return cont;
+	}
+
 bool Client::sendPingRequestCallback(Threads::EventDispatcher::ListenerKey eventKey)
 	{
 	/* Get the current time: */
@@ -768,7 +869,7 @@ MessageContinuation* Client::fixedSizeForwarderCallback(unsigned int messageId,M
 	{
 	MessageWriter message(MessageBuffer::create(messageId,fixedSize));
 	socket.readRaw(message.getWritePtr(),message.getSpace());
-	frontendPipe.write(message.getBuffer()->ref());
+	queueFrontendMessage(message.getBuffer());
 	}
 	
 	/* Done with message: */
@@ -782,15 +883,31 @@ Client::Client(void)
 	 pluginLoader(COLLABORATION_PLUGINDIR "/" COLLABORATION_PLUGINCLIENTDSONAMETEMPLATE),
 	 swapOnRead(false),
 	 udpSocket(0),numUDPConnectRequests(10),udpConnected(false),
-	 frontend(false),frontendPipe(true), // Create front-end pipe in non-blocking mode
+	 frontend(false),
 	 remoteClientMap(17),
 	 state(ReadingPasswordRequest),continuation(0),
+	 bulkState(ReadingMessageID),bulkMessageId(0),bulkContinuation(0),
 	 lastPingSequence(0)
 	{
 	/* Set the global client object if it does not exist yet: */
 	if(theClient==0)
 		theClient=this;
 	
+	/* Create a non-blocking file descriptor to signal the front end when messages are queued for it: */
+	#ifdef __linux__
+	frontendEventFds[0]=frontendEventFds[1]=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+	if(frontendEventFds[0]<0)
+		Misc::throwStdErr("Client::Client: Unable to create front-end event file descriptor due to error %d (%s)",errno,strerror(errno));
+	#else
+	if(pipe(frontendEventFds)<0)
+		Misc::throwStdErr("Client::Client: Unable to create front-end event pipe due to error %d (%s)",errno,strerror(errno));
+	for(int i=0;i<2;++i)
+		{
+		fcntl(frontendEventFds[i],F_SETFL,fcntl(frontendEventFds[i],F_GETFL,0)|O_NONBLOCK);
+		fcntl(frontendEventFds[i],F_SETFD,FD_CLOEXEC);
+		}
+	#endif
+	
 	/* Determine the default client name: */
 	const char* dcn=getenv("HOSTNAME");
 	if(dcn==0||dcn[0]=='\0')
@@ -825,14 +942,13 @@ Client::~Client(void)
 			delete *rcIt;
 			}
 		
-		/* Delete a remaining message continuation object: */
+		/* Delete remaining message continuation objects: */
 		delete continuation;
+		delete bulkContinuation;
 		
-		/* Delete all pending messages in the front-end pipe: */
-		MessageBuffer* message;
-		size_t readSize;
-		while((readSize=frontendPipe.read(&message,sizeof(MessageBuffer*)))==sizeof(MessageBuffer*))
-			message->unref();
+		/* Delete all pending messages in the front-end queue: */
+		for(std::vector<MessageBuffer*>::iterator mIt=frontendQueue.begin();mIt!=frontendQueue.end();++mIt)
+			(*mIt)->unref();
 		
 		/* Shut down all plug-in protocols in reverse order: */
 		for(PluginList::reverse_iterator pIt=plugins.rbegin();pIt!=plugins.rend();++pIt)
@@ -844,6 +960,15 @@ Client::~Client(void)
 			}
 		}
 	
+	/* Delete all messages that were queued for the server but not sent: */
+	for(std::vector<ServerQueueEntry>::iterator mIt=serverQueue.begin();mIt!=serverQueue.end();++mIt)
+		mIt->message->unref();
+	
+	/* Close the front-end event file descriptor: */
+	close(frontendEventFds[0]);
+	if(frontendEventFds[1]!=frontendEventFds[0])
+		close(frontendEventFds[1]);
+	
 	/* Reset the global client object if it was us: */
 	if(theClient==this)
 		theClient=0;
@@ -1010,6 +1135,59 @@ void Client::setMessageForwarder(unsigned int messageId,MessageReaderHandlerFunc
 	setTCPMessageHandler(messageId,wrapMethod<Client,&Client::fixedSizeForwarderCallback>,this,fixedMessageSize);
 	}
 
+void Client::queueServerMessage(MessageBuffer* message)
+	{
+	/* Append the message to the queue and check if the queue was empty before: */
+	bool wasEmpty;
+	{
+	Threads::Spinlock::Lock serverQueueLock(serverQueueMutex);
+	wasEmpty=serverQueue.empty();
+	serverQueue.push_back(ServerQueueEntry(message->refShared(),false));
+	}
+	
+	/* Wake up the communication thread if the queue was empty; otherwise, a wake-up is already pending: */
+	if(wasEmpty)
+		dispatcher.signal(messageSignalKey,0);
+	}
+
+void Client::queueServerUDPMessage(MessageBuffer* message)
+	{
+	/* Append the message to the same queue as TCP messages to retain the order of messages sent over either socket, and check if the queue was empty before: */
+	bool wasEmpty;
+	{
+	Threads::Spinlock::Lock serverQueueLock(serverQueueMutex);
+	wasEmpty=serverQueue.empty();
+	serverQueue.push_back(ServerQueueEntry(message->refShared(),true));
+	}
+	
+	/* Wake up the communication thread if the queue was empty; otherwise, a wake-up is already pending: */
+	if(wasEmpty)
+		dispatcher.signal(messageSignalKey,0);
+	}
+
+void Client::queueFrontendMessage(MessageBuffer* message)
+	{
+	/* Append the message to the front-end queue and check if the queue was empty before: */
+	bool wasEmpty;
+	{
+	Threads::Spinlock::Lock frontendQueueLock(frontendQueueMutex);
+	wasEmpty=frontendQueue.empty();
+	frontendQueue.push_back(message->refShared());
+	}
+	
+	/* Wake up the front end if the queue was empty; otherwise, a wake-up is already pending: */
+	if(wasEmpty)
+		{
+		#ifdef __linux__
+		Misc::UInt64 increment=1;
+		#else
+		char increment=0;
+		#endif
+		if(write(frontendEventFds[1],&increment,sizeof(increment))<0&&errno!=EAGAIN)
+			Misc::throwStdErr("Client::queueFrontendMessage: Unable to signal front end due to error %d (%s)",errno,strerror(errno));
+		}
+	}
+
 void Client::queueMessage(MessageBuffer* message)
 	{
 	/* Queue the message for sending and check if the socket was idle before: */
@@ -1045,8 +1223,8 @@ int Client::enableFrontendForwarding(void)
 	/* Remember that front-end forwarding is enabled: */
 	frontend=true;
 	
-	/* Return pipe read file descriptor: */
-	return frontendPipe.getReadFd();
+	/* Return the file descriptor that becomes readable when there are messages for the front end: */
+	return frontendEventFds[0];
 	}
 
 void Client::setPassword(const std::string& newSessionPassword)
@@ -1077,9 +1255,8 @@ void Client::start(const std::string& serverHostName,int serverPort)
 	/* Dispatch read events on the UDP socket: */
 	udpSocketKey=dispatcher.addIOEventListener(udpSocket.getFd(),Threads::EventDispatcher::Read,Threads::EventDispatcher::wrapMethod<Client,&Client::udpSocketEvent>,this);
 	
-	/* Create signals to queue messages for the server from a different thread: */
+	/* Create a signal to queue messages for the server from a different thread: */
 	messageSignalKey=dispatcher.addSignalListener(Threads::EventDispatcher::wrapMethod<Client,&Client::messageSignalCallback>,this);
-	udpMessageSignalKey=dispatcher.addSignalListener(Threads::EventDispatcher::wrapMethod<Client,&Client::udpMessageSignalCallback>,this);
 	
 	/* Register message handlers for core protocol messages: */
 	setTCPMessageHandler(ConnectReply,wrapMethod<Client,&Client::connectReplyCallback>,this,ConnectReplyMsg::size);
@@ -1091,6 +1268,7 @@ void Client::start(const std::string& serverHostName,int serverPort)
 	setTCPMessageHandler(ClientConnectNotification,wrapMethod<Client,&Client::clientConnectNotificationCallback>,this,ClientConnectNotificationMsg::size);
 	setTCPMessageHandler(NameChangeNotification,wrapMethod<Client,&Client::nameChangeNotificationCallback>,this,NameChangeNotificationMsg::size);
 	setTCPMessageHandler(ClientDisconnectNotification,wrapMethod<Client,&Client::clientDisconnectNotificationCallback>,this,ClientDisconnectNotificationMsg::size);
+	setTCPMessageHandler(BulkChunkNotification,wrapMethod<Client,&Client::bulkChunkCallback>,this,BulkChunkMsg::size);
 	
 	/* Start the client state machine: */
 	state=ReadingPasswordRequest;
@@ -1104,15 +1282,26 @@ void Client::run(void)
 
 void Client::dispatchFrontendMessages(void)
 	{
+	/* Reset the front-end event before taking messages from the queue so that no wake-up for later messages gets lost: */
+	char buffer[64];
+	while(read(frontendEventFds[0],buffer,sizeof(buffer))>0)
+		;
+	
+	/* Take all pending messages from the front-end queue in one batch: */
+	{
+	Threads::Spinlock::Lock frontendQueueLock(frontendQueueMutex);
+	std::swap(frontendQueue,frontendBatch);
+	}
+	
+	std::vector<MessageBuffer*>::iterator mIt=frontendBatch.begin();
 	try
 		{
-		/* Read message buffer pointers from the pipe until there are no more: */
-		MessageBuffer* message;
-		size_t readSize;
-		while((readSize=frontendPipe.read(&message,sizeof(MessageBuffer*)))==sizeof(MessageBuffer*))
+		/* Dispatch all messages in the batch in order: */
+		for(;mIt!=frontendBatch.end();++mIt)
 			{
-			/* Create a reader for the message and read the message ID: */
-			MessageReader reader(message,swapOnRead);
+			/* Create a reader for the message, which takes over its reference, and read the message ID: */
+			MessageReader reader(*mIt,swapOnRead);
+			*mIt=0;
 			unsigned int messageId=reader.read<MessageID>();
 			
 			/* Check if the message ID is valid: */
@@ -1123,28 +1312,28 @@ void Client::dispatchFrontendMessages(void)
 			/* Dispatch the message: */
 			mh.handler(messageId,reader,mh.handlerUserData);
 			}
-		
-		/* Check for a partial read (shouldn't happen and is a serious problem): */
-		if(readSize!=0)
-			throw std::runtime_error("Truncated read on front-end pipe");
 		}
 	catch(const std::runtime_error& err)
 		{
-		/* Delete all messages remaining on the pipe: */
-		MessageBuffer* message;
-		size_t readSize;
-		while((readSize=frontendPipe.read(&message,sizeof(MessageBuffer*)))==sizeof(MessageBuffer*))
-			message->unref();
-		
-		/* Drain the pipe of any message buffer fragments (should never happen): */
-		char buffer[sizeof(MessageBuffer*)];
-		frontendPipe.read(buffer,sizeof(MessageBuffer*));
+		/* Delete all messages remaining in the batch and in the queue: */
+		for(;mIt!=frontendBatch.end();++mIt)
+			if(*mIt!=0)
+				(*mIt)->unref();
+		{
+		Threads::Spinlock::Lock frontendQueueLock(frontendQueueMutex);
+		for(std::vector<MessageBuffer*>::iterator qIt=frontendQueue.begin();qIt!=frontendQueue.end();++qIt)
+			(*qIt)->unref();
+		frontendQueue.clear();
+		}
 		
 		/* Show an error message and shut down the connection: */
 		Misc::formattedUserError("Client::dispatchFrontendMessages: Caught exception %s",err.what());
 		dispatcher.stop();
 		state=Disconnected;
 		}
+	
+	/* Keep the batch's storage around for the next batch: */
+	frontendBatch.clear();
 	}
 
 void Client::shutdown(void)
@@ -11,9 +11,9 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #include <Misc/HashTable.h>
 #include <Misc/CallbackData.h>
 #include <Misc/CallbackList.h>
-#include <Misc/Pipe.h>
 #include <Misc/ConfigurationFile.h>
 #include <Realtime/Time.h>
+#include <Threads/Spinlock.h>
 #include <Threads/EventDispatcher.h>
 #include <Plugins/ObjectLoader.h>
 
@@ -101,7 +101,7 @@ class Client:public CoreProtocol
 	/* Type for handler functions for messages arriving on a non-blocking TCP socket: */
 	typedef MessageContinuation* (*MessageContinuationHandlerFunction)(unsigned int messageId,MessageContinuation* continuation,void* userData); // Returns a continuation object if the message handler is not done with the message
 	
-	/* Type for handler functions for messages arriving on a UDP socket or on a forwarding pipe from the back-end: */
+	/* Type for handler functions for messages arriving on a UDP socket or on the forwarding queue from the back-end: */
 	typedef void (*MessageReaderHandlerFunction)(unsigned int messageId,MessageReader& message,void* userData);
 	
 	/* Helper functions to wrap class methods as method handling functions: */
@@ -132,7 +132,7 @@ class Client:public CoreProtocol
 			}
 		};
 	
-	struct MessageReaderHandler // Structure containing a handler function for a specific message arriving on a UDP socket or forwarding pipe
+	struct MessageReaderHandler // Structure containing a handler function for a specific message arriving on a UDP socket or the forwarding queue
 		{
 		/* Elements: */
 		public:
@@ -146,6 +146,20 @@ class Client:public CoreProtocol
 			}
 		};
 	
+	struct ServerQueueEntry // Structure for messages queued for the server from different threads
+		{
+		/* Elements: */
+		public:
+		MessageBuffer* message; // The queued message
+		bool udp; // Flag whether to send the message over UDP instead of TCP
+		
+		/* Constructors and destructors: */
+		ServerQueueEntry(MessageBuffer* sMessage,bool sUdp)
+			:message(sMessage),udp(sUdp)
+			{
+			}
+		};
+	
 	typedef std::vector<RemoteClient*> RemoteClientList; // Type for lists of other clients connected to the same server
 	typedef Misc::HashTable<unsigned int,RemoteClient*> RemoteClientMap; // Type for hash tables mapping client IDs to remote client structures
 	typedef Plugins::ObjectLoader<PluginClient> PluginLoader; // Type for loader than can load plug-in protocols from DSOs
@@ -197,11 +211,16 @@ class Client:public CoreProtocol
 	std::vector<MessageReaderHandler> udpMessageHandlers; // List of message handlers for the UDP socket
 	
 	bool frontend; // Flag if the client supports front-end message forwarding
-	Misc::Pipe frontendPipe; // Pipe to send messages from the communications back-end to a front-end for synchronous processing
-	std::vector<MessageReaderHandler> frontendMessageHandlers; // List of message handlers for the front-end forwarding pipe
+	Threads::Spinlock frontendQueueMutex; // Mutex serializing access to the front-end message queue
+	std::vector<MessageBuffer*> frontendQueue; // Queue of messages sent from the communications back-end to a front-end for synchronous processing
+	std::vector<MessageBuffer*> frontendBatch; // Batch of messages taken from the front-end message queue in one go, to be dispatched by the front end
+	int frontendEventFds[2]; // Read and write ends of a file descriptor signaling the front end when the front-end message queue becomes non-empty; identical for an eventfd
+	std::vector<MessageReaderHandler> frontendMessageHandlers; // List of message handlers for the front-end forwarding queue
 	
-	Threads::EventDispatcher::ListenerKey messageSignalKey; // Key for a signal to queue server messages from a different thread; signal data is MessageBuffer pointer
-	Threads::EventDispatcher::ListenerKey udpMessageSignalKey; // Key for a signal to queue server messages over UDP from a different thread; signal data is MessageBuffer pointer
+	Threads::Spinlock serverQueueMutex; // Mutex serializing access to the queue of server messages sent from different threads
+	std::vector<ServerQueueEntry> serverQueue; // Queue of messages to send to the server over TCP or UDP from different threads, in the order in which they were queued
+	std::vector<ServerQueueEntry> serverBatch; // Batch of messages taken from the server message queue in one go
+	Threads::EventDispatcher::ListenerKey messageSignalKey; // Key for a signal raised when the queue of server messages sent from different threads becomes non-empty
 	
 	RemoteClientList remoteClients; // List of other clients connected to the same server
 	RemoteClientMap remoteClientMap; // Hash table mapping client IDs to remote client structures
@@ -209,16 +228,20 @@ class Client:public CoreProtocol
 	State state; // Current state in the communication protocol
 	unsigned int messageId; // ID of the message currently being read
 	MessageContinuation* continuation; // Message handler continuation state for the current partial message on the TCP socket
+	State bulkState; // Current state of the stream of bulk messages arriving in chunks on the TCP socket
+	unsigned int bulkMessageId; // ID of the bulk message currently being read
+	MessageContinuation* bulkContinuation; // Message handler continuation state for the current partial bulk message
 	
 	Realtime::TimePointRealtime lastPingTime; // System time when the last ping request was sent
 	Misc::SInt16 lastPingSequence; // Sequence number of last ping request
 	
 	/* Private methods: */
 	bool socketEvent(Threads::EventDispatcher::ListenerKey,int eventTypeMask); // Callback called when an I/O event occurs on the TCP socket
+	void handleMessages(State& streamState,unsigned int& streamMessageId,MessageContinuation*& streamContinuation); // Handles as many messages from the TCP socket's unread data as possible, using and updating the given message stream state
+	void dispatchUDPMessage(unsigned int messageId,MessageReader& message); // Dispatches a message from the server arriving on the UDP socket
 	bool udpSocketEvent(Threads::EventDispatcher::ListenerKey,int eventTypeMask); // Callback called when an I/O event occurs on the UDP socket
 	bool sendUDPConnectRequestCallback(Threads::EventDispatcher::ListenerKey eventKey); // Called at regular intervals to send a connect request to the server's UDP socket until a reply is received
-	bool messageSignalCallback(Threads::EventDispatcher::ListenerKey signalKey,void* signalData); // Called when another thread wants to send a message to the server; signal data is MessageBuffer pointer
-	bool udpMessageSignalCallback(Threads::EventDispatcher::ListenerKey signalKey,void* signalData); // Called when another thread wants to send a message to the server over UDP; signal data is MessageBuffer pointer
+	bool messageSignalCallback(Threads::EventDispatcher::ListenerKey signalKey,void* signalData); // Called when other threads queued messages to send to the server
 	MessageContinuation* connectReplyCallback(unsigned int messageId,MessageContinuation* continuation); // Handles the server's connect reply message
 	MessageContinuation* connectRejectCallback(unsigned int messageId,MessageContinuation* continuation); // Handles the server's connect reject message
 	void udpConnectReplyCallback(unsigned int messageId,MessageReader& message); // Handles the server's reply to a UDP connect request message
@@ -228,6 +251,7 @@ class Client:public CoreProtocol
 	MessageContinuation* clientConnectNotificationCallback(unsigned int messageId,MessageContinuation* continuation); // Handles a notification that another client connected
 	MessageContinuation* nameChangeNotificationCallback(unsigned int messageId,MessageContinuation* continuation); // Handles a name change notification for another client
 	MessageContinuation* clientDisconnectNotificationCallback(unsigned int messageId,MessageContinuation* continuation); // Handles a notification that another client disconnected
+	MessageContinuation* bulkChunkCallback(unsigned int messageId,MessageContinuation* continuation); // Handles a chunk of a bulk message by passing its data to the bulk message stream
 	bool sendPingRequestCallback(Threads::EventDispatcher::ListenerKey eventKey); // Called at regular intervals to send a ping request to the server
 	MessageContinuation* fixedSizeForwarderCallback(unsigned int messageId,MessageContinuation* continuation); // Callback called when a fixed-sized message arrives that needs to be forwarded to the front-end
 	
@@ -298,25 +322,13 @@ class Client:public CoreProtocol
 		}
 	void setTCPMessageHandler(unsigned int messageId,MessageContinuationHandlerFunction handler,void* handlerUserData,size_t minUnread); // Sets the message handler for the given message ID on the TCP socket
 	void setUDPMessageHandler(unsigned int messageId,MessageReaderHandlerFunction handler,void* handlerUserData); // Sets the message handler for the given message ID on the UDP socket
-	void setFrontendMessageHandler(unsigned int messageId,MessageReaderHandlerFunction handler,void* handlerUserData); // Sets the message handler for the given message ID on the front-end pipe
+	void setFrontendMessageHandler(unsigned int messageId,MessageReaderHandlerFunction handler,void* handlerUserData); // Sets the message handler for the given message ID on the front-end forwarding queue
 	void setMessageForwarder(unsigned int messageId,MessageReaderHandlerFunction handler,void* handlerUserData,size_t fixedMessageSize); // Installs a front-end forwarder for fixed-size messages with the given message ID and size
 	void queueMessage(MessageBuffer* message); // Queues the given message for sending on the socket; starts dispatching write events if necessary
 	void queueUDPMessage(MessageBuffer* message); // Queues the given message for sending on the UDP socket; starts dispatching write events if necessary
-	void queueServerMessage(MessageBuffer* message) // Queues the given message for sending on the socket from a different thread
-		{
-		/* Send a signal containing the message to the communication thread: */
-		dispatcher.signal(messageSignalKey,message->ref());
-		}
-	void queueServerUDPMessage(MessageBuffer* message) // Queues the given message for sending on the UDP socket from a different thread
-		{
-		/* Send a signal containing the message to the communication thread: */
-		dispatcher.signal(udpMessageSignalKey,message->ref());
-		}
-	void queueFrontendMessage(MessageBuffer* message) // Sends a message from the back end to the front end
-		{
-		/* Write a pointer to the message to the front-end pipe: */
-		frontendPipe.write(message->ref());
-		}
+	void queueServerMessage(MessageBuffer* message); // Queues the given message for sending on the socket from a different thread
+	void queueServerUDPMessage(MessageBuffer* message); // Queues the given message for sending on the UDP socket from a different thread, in order with messages queued for the TCP socket
+	void queueFrontendMessage(MessageBuffer* message); // Sends a message from the back end to the front end; can be called from any thread
 	RemoteClient* getRemoteClient(unsigned int clientId) // Returns the remote client structure associated with the given client ID
 		{
 		return remoteClientMap.getEntry(clientId).getDest();
@@ -37,6 +37,7 @@ class CoreProtocol // Class defining core protocol types and messages
 		ClientConnectNotification,
 		NameChangeNotification,
 		ClientDisconnectNotification,
+		BulkChunkNotification,
 		NumServerMessages
 		};
 	
@@ -130,6 +131,19 @@ class CoreProtocol // Class defining core protocol types and messages
 			}
 		};
 	
+	struct DisconnectRequestMsg // Request from a client to disconnect from the server
+		{
+		/* Elements: */
+		public:
+		static const size_t size=0;
+		
+		/* Methods: */
+		static MessageBuffer* createMessage(void) // Returns a message buffer for a disconnect request message, which must not overtake any messages the client sent before it
+			{
+			return MessageBuffer::create(DisconnectRequest,size)->setOrdered();
+			}
+		};
+	
 	struct UDPConnectRequestMsg // Connection request to a server's UDP socket
 		{
 		/* Elements: */
@@ -171,7 +185,7 @@ class CoreProtocol // Class defining core protocol types and messages
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int messageId) // Returns a message buffer for a ping request or reply message
 			{
-			return MessageBuffer::create(messageId,size);
+			return MessageBuffer::create<PingMsg>(messageId)->setSendPriority(MessageBuffer::RealTime);
 			}
 		};
 	
@@ -236,7 +250,7 @@ class CoreProtocol // Class defining core protocol types and messages
 		/* Methods: */
 		static MessageBuffer* createMessage(size_t numProtocols) // Returns a message buffer for a client connect notification message for the given number of protocols
 			{
-			return MessageBuffer::create(ClientConnectNotification,size+numProtocols*sizeof(Misc::UInt16));
+			return MessageBuffer::create(ClientConnectNotification,size+numProtocols*sizeof(Misc::UInt16))->setOrdered();
 			}
 		};
 	
@@ -250,12 +264,23 @@ class CoreProtocol // Class defining core protocol types and messages
 		/* Methods: */
 		static MessageBuffer* createMessage(void) // Returns a message buffer for a client disconnect notification message
 			{
-			return MessageBuffer::create(ClientDisconnectNotification,size);
+			return MessageBuffer::create(ClientDisconnectNotification,size)->setOrdered();
 			}
 		};
 	
+	struct BulkChunkMsg // Chunk of a bulk message that was split to let higher-priority messages pass
+		{
+		/* Elements: */
+		public:
+		static const size_t maxChunkSize=16384; // Maximum size of a chunk's payload
+		static const size_t size=sizeof(Misc::UInt16)+sizeof(Bool);
+		Misc::UInt16 chunkSize; // Size of the chunk's payload
+		Bool final; // !=0 if this is the last chunk of the bulk message
+		// Byte chunk[chunkSize]; // Next part of the bulk message, including its message ID
+		};
+	
 	/* Elements: */
-	static const unsigned int protocolVersion=1U<<16; // Version 1.0
+	static const unsigned int protocolVersion=(1U<<16)|2U; // Version 1.2
 	};
 
 #endif
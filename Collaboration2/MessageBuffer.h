@@ -7,9 +7,13 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #ifndef MESSAGEBUFFER_INCLUDED
 #define MESSAGEBUFFER_INCLUDED
 
-#define MESSAGEBUFFER_USE_ALLOCATOR 0
+#define MESSAGEBUFFER_USE_ALLOCATOR 1
+
+/* Use plain reference counting until a message buffer is handed to another thread: */
+#define MESSAGEBUFFER_BIASED_REFCOUNT 1
 
 #include <stddef.h>
+#include <new>
 #include <Threads/Atomic.h>
 
 #if MESSAGEBUFFER_USE_ALLOCATOR
@@ -18,16 +22,52 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #include <stdlib.h>
 #endif
 
+#include <Collaboration2/MessagePool.h>
 #include <Collaboration2/Protocol.h>
 
 class MessageBuffer
 	{
+	/* Embedded classes: */
+	public:
+	enum SendPriority // Enumerated type for priority classes in which messages are sent over a TCP socket
+		{
+		RealTime=0, // Latency-critical messages such as audio packets and pings
+		State, // Default class for state updates and control messages
+		Bulk, // Large messages that are split into chunks if the socket supports it, to let higher-priority messages pass
+		NumSendPriorities
+		};
+	
 	/* Elements: */
 	private:
+	#if MESSAGEBUFFER_BIASED_REFCOUNT
+	unsigned int localRefCount; // Number of objects referencing this message buffer while it is private to the thread that created it
+	bool shared; // Flag if this message buffer has been handed to another thread and uses the atomic reference count from now on
+	#endif
 	Threads::Atomic<unsigned int> refCount; // Number of objects referencing this message buffer; will be deleted when there are zero references
-	// unsigned int refCount; // Number of objects referencing this message buffer; will be deleted when there are zero references
 	unsigned int messageId; // ID of this message, replicated in network format at the beginning of actual buffer
 	size_t bufferSize; // Size of the actual message buffer in bytes
+	MessagePool* pool; // Slab pool whence this message buffer came, or null if it came from the general allocator
+	unsigned int numFragments; // Number of fragment message buffers if this is a composite message buffer; 0 otherwise
+	SendPriority sendPriority; // Priority class in which this message is sent over a TCP socket; messages are only delivered in order within the same class, or relative to ordered messages
+	bool ordered; // Flag if this message is delivered after all older and before all newer messages sent over the same TCP socket, regardless of their priority classes
+	Misc::UInt64 coalescingKey; // Key identifying the state this message updates, to replace older unsent messages with the same key in send queues; 0 if the message must always be delivered
+	
+	/* Private methods: */
+	#if MESSAGEBUFFER_BIASED_REFCOUNT
+	void makeShared(void) // Switches an unshared message buffer and its fragments to atomic reference counting
+		{
+		/* Move the thread-private reference count into the atomic one; this is safe as an unshared message buffer can only be referenced by the calling thread: */
+		refCount.preAdd(localRefCount);
+		localRefCount=0;
+		shared=true;
+		
+		/* Share a composite message buffer's fragments, which will be released by whichever thread releases the composite: */
+		MessageBuffer** fragments=reinterpret_cast<MessageBuffer**>(this+1);
+		for(unsigned int i=0;i<numFragments;++i)
+			if(fragments[i]!=0&&!fragments[i]->shared)
+				fragments[i]->makeShared();
+		}
+	#endif
 	
 	/* Constructors and destructors: */
 	public:
@@ -58,8 +98,51 @@ class MessageBuffer
 		/* Construct a message buffer header at the beginning of the buffer: */
 		return new(buffer) MessageBuffer(sMessageId,sBufferSize);
 		}
-	MessageBuffer(unsigned int sMessageId,size_t sBufferSize)
-		:refCount(1),messageId(sMessageId),bufferSize(sBufferSize)
+	template <class MsgParam>
+	static MessageBuffer* create(unsigned int sMessageId) // Creates a buffer for a fixed-size message of the given ID and message structure type from a slab pool, with a reference count of 1
+		{
+		/* Retrieve the slab pool for the message structure type once: */
+		static MessagePool* pool=MessagePool::getPool(sizeof(MessageBuffer)+sizeof(MessageID)+MsgParam::size);
+		
+		/* Construct a message buffer header at the beginning of a block from the slab pool: */
+		return new(pool->allocate()) MessageBuffer(sMessageId,sizeof(MessageID)+MsgParam::size,pool);
+		}
+	static MessageBuffer* createComposite(unsigned int sNumFragments) // Creates a composite message buffer for the given number of fragments, which must be set with setFragment before the message is queued, with a reference count of 1
+		{
+		/* Allocate a raw buffer holding a header and the fragment pointer array: */
+		#if MESSAGEBUFFER_USE_ALLOCATOR
+		void* buffer=Allocator::allocate(sizeof(MessageBuffer)+sNumFragments*sizeof(MessageBuffer*));
+		#else
+		void* buffer=malloc(sizeof(MessageBuffer)+sNumFragments*sizeof(MessageBuffer*));
+		#endif
+		
+		/* Construct an empty composite message buffer header at the beginning of the buffer: */
+		MessageBuffer* result=new(buffer) MessageBuffer(~0x0U,0);
+		result->numFragments=sNumFragments;
+		MessageBuffer** fragments=reinterpret_cast<MessageBuffer**>(result+1);
+		for(unsigned int i=0;i<sNumFragments;++i)
+			fragments[i]=0;
+		
+		return result;
+		}
+	static MessageBuffer* createComposite(MessageBuffer* header,MessageBuffer* body) // Creates a composite message buffer sending the given header and body back-to-back, with a reference count of 1
+		{
+		MessageBuffer* result=createComposite(2);
+		result->setFragment(0,header);
+		result->setFragment(1,body);
+		
+		/* Send the composite message in the header's priority class and ordering: */
+		result->sendPriority=header->sendPriority;
+		result->ordered=header->ordered;
+		return result;
+		}
+	MessageBuffer(unsigned int sMessageId,size_t sBufferSize,MessagePool* sPool =0)
+		#if MESSAGEBUFFER_BIASED_REFCOUNT
+		:localRefCount(1),shared(false),refCount(0),
+		#else
+		:refCount(1),
+		#endif
+		 messageId(sMessageId),bufferSize(sBufferSize),pool(sPool),numFragments(0),sendPriority(State),ordered(false),coalescingKey(0)
 		{
 		}
 	
@@ -67,25 +150,71 @@ class MessageBuffer
 	MessageBuffer* ref(void) // Increments the reference count and returns a pointer to the message buffer
 		{
 		/* Increment the reference counter: */
-		// ++refCount;
+		#if MESSAGEBUFFER_BIASED_REFCOUNT
+		if(!shared)
+			++localRefCount;
+		else
+		#endif
+			refCount.preAdd(1);
+		return this;
+		}
+	MessageBuffer* refShared(void) // Increments the reference count for handing the message buffer to another thread and returns a pointer to the message buffer
+		{
+		#if MESSAGEBUFFER_BIASED_REFCOUNT
+		if(!shared)
+			makeShared();
+		#endif
+		
+		/* Increment the reference counter: */
 		refCount.preAdd(1);
 		return this;
 		}
 	MessageBuffer* unref(void) // Decrements the reference count and returns a pointer to the message buffer; destroys the message buffer and returns null if the count hits zero
 		{
-		if(refCount.preSub(1)==0)
-		// if(--refCount==0)
+		#if MESSAGEBUFFER_BIASED_REFCOUNT
+		bool dead=shared?refCount.preSub(1)==0:--localRefCount==0;
+		#else
+		bool dead=refCount.preSub(1)==0;
+		#endif
+		if(dead)
 			{
-			#if MESSAGEBUFFER_USE_ALLOCATOR
-			Allocator::release(this);
-			#else
-			free(this);
-			#endif
+			/* Release a composite message buffer's fragments: */
+			MessageBuffer** fragments=reinterpret_cast<MessageBuffer**>(this+1);
+			for(unsigned int i=0;i<numFragments;++i)
+				if(fragments[i]!=0)
+					fragments[i]->unref();
+			
+			if(pool!=0)
+				pool->release(this);
+			else
+				{
+				#if MESSAGEBUFFER_USE_ALLOCATOR
+				Allocator::release(this);
+				#else
+				free(this);
+				#endif
+				}
 			return 0;
 			}
 		else
 			return this;
 		}
+	bool isUnique(void) const // Returns true if the caller holds the only reference to the message buffer
+		{
+		#if MESSAGEBUFFER_BIASED_REFCOUNT
+		return shared?refCount.get()==1:localRefCount==1;
+		#else
+		return refCount.get()==1;
+		#endif
+		}
+	void reset(size_t newBufferSize) // Re-uses a non-composite message buffer held only by the caller for a new ID-less message of the given size, which must not exceed the size with which the buffer was created
+		{
+		messageId=~0x0U;
+		bufferSize=newBufferSize;
+		sendPriority=State;
+		ordered=false;
+		coalescingKey=0;
+		}
 	unsigned int getMessageId(void) const // Returns the message ID
 		{
 		return messageId;
@@ -110,6 +239,61 @@ class MessageBuffer
 		{
 		bufferSize=newBufferSize;
 		}
+	SendPriority getSendPriority(void) const // Returns the message's send priority class
+		{
+		return sendPriority;
+		}
+	MessageBuffer* setSendPriority(SendPriority newSendPriority) // Sets the message's send priority class and returns a pointer to the message buffer
+		{
+		sendPriority=newSendPriority;
+		return this;
+		}
+	bool isOrdered(void) const // Returns true if the message is delivered in order relative to all other messages sent over the same TCP socket
+		{
+		return ordered;
+		}
+	MessageBuffer* setOrdered(void) // Marks the message as depending on all older, and as a dependency of all newer, messages sent over the same TCP socket, regardless of their priority classes; returns a pointer to the message buffer
+		{
+		ordered=true;
+		return this;
+		}
+	Misc::UInt64 getCoalescingKey(void) const // Returns the message's coalescing key, or 0 if the message must always be delivered
+		{
+		return coalescingKey;
+		}
+	void setCoalescingKey(unsigned int sourceId,unsigned int subId =0) // Marks the message as a state update that supersedes any older unsent message with the same message ID, source ID, and sub-ID
+		{
+		coalescingKey=(Misc::UInt64(messageId&0xffffU)<<48)|(Misc::UInt64(sourceId&0xffffU)<<32)|Misc::UInt64(subId&0xffffffffU);
+		}
+	
+	/* Methods for composite message buffers, which can only be queued for sending on sockets: */
+	bool isComposite(void) const // Returns true if this message buffer is composed of fragment message buffers
+		{
+		return numFragments!=0;
+		}
+	unsigned int getNumFragments(void) const // Returns the number of fragments in a composite message buffer
+		{
+		return numFragments;
+		}
+	const MessageBuffer* getFragment(unsigned int index) const // Returns the fragment of the given index
+		{
+		return reinterpret_cast<MessageBuffer* const*>(this+1)[index];
+		}
+	void setFragment(unsigned int index,MessageBuffer* newFragment) // Sets the fragment of the given index, which must be a non-composite message buffer, and adds a reference to it
+		{
+		MessageBuffer*& fragment=reinterpret_cast<MessageBuffer**>(this+1)[index];
+		if(fragment!=0)
+			{
+			bufferSize-=fragment->bufferSize;
+			fragment->unref();
+			}
+		#if MESSAGEBUFFER_BIASED_REFCOUNT
+		fragment=shared?newFragment->refShared():newFragment->ref();
+		#else
+		fragment=newFragment->ref();
+		#endif
+		bufferSize+=fragment->bufferSize;
+		}
 	};
 
 #endif
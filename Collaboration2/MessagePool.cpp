@@ -0,0 +1,66 @@
+/***********************************************************************
+MessagePool - Class for slab pools of cache-line aligned memory blocks
+of one fixed size, to hold message buffers for fixed-size messages.
+Copyright (c) 2020 Oliver Kreylos
+***********************************************************************/
+
+#include <Collaboration2/MessagePool.h>
+
+#include <stdlib.h>
+#include <new>
+
+/************************************
+Static elements of class MessagePool:
+************************************/
+
+Threads::Spinlock MessagePool::poolListMutex;
+MessagePool* MessagePool::poolList=0;
+
+/****************************
+Methods of class MessagePool:
+****************************/
+
+void MessagePool::allocateSlab(void)
+	{
+	/* Allocate a cache-line aligned slab holding a number of blocks; slabs are never released as message buffers can outlive the plug-ins that requested them: */
+	void* slab;
+	if(posix_memalign(&slab,MESSAGEPOOL_CACHELINESIZE,MESSAGEPOOL_SLABSIZE*blockSize)!=0)
+		throw std::bad_alloc();
+	
+	/* Push all blocks of the new slab onto the stack: */
+	char* blockPtr=static_cast<char*>(slab);
+	for(size_t i=0;i<MESSAGEPOOL_SLABSIZE;++i,blockPtr+=blockSize)
+		{
+		Block* block=reinterpret_cast<Block*>(blockPtr);
+		block->succ=head;
+		head=block;
+		}
+	}
+
+MessagePool::MessagePool(size_t sBlockSize,MessagePool* sSucc)
+	:blockSize(sBlockSize),succ(sSucc),
+	 head(0)
+	{
+	}
+
+MessagePool* MessagePool::getPool(size_t minBlockSize)
+	{
+	/* Round the requested block size up to the next multiple of the cache line size: */
+	size_t blockSize=((minBlockSize+MESSAGEPOOL_CACHELINESIZE-1)/MESSAGEPOOL_CACHELINESIZE)*MESSAGEPOOL_CACHELINESIZE;
+	
+	Threads::Spinlock::Lock poolListLock(poolListMutex);
+	
+	/* Check if there already is a pool for the requested block size: */
+	MessagePool* pool;
+	for(pool=poolList;pool!=0&&pool->blockSize!=blockSize;pool=pool->succ)
+		;
+	
+	if(pool==0)
+		{
+		/* Create a new pool and add it to the list: */
+		pool=new MessagePool(blockSize,poolList);
+		poolList=pool;
+		}
+	
+	return pool;
+	}
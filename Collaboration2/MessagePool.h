@@ -0,0 +1,77 @@
+/***********************************************************************
+MessagePool - Class for slab pools of cache-line aligned memory blocks
+of one fixed size, to hold message buffers for fixed-size messages.
+Copyright (c) 2020 Oliver Kreylos
+***********************************************************************/
+
+#ifndef MESSAGEPOOL_INCLUDED
+#define MESSAGEPOOL_INCLUDED
+
+/* Alignment and size granularity of memory blocks: */
+#define MESSAGEPOOL_CACHELINESIZE 64
+
+/* Number of memory blocks allocated in one slab: */
+#define MESSAGEPOOL_SLABSIZE 64
+
+#include <stddef.h>
+#include <Threads/Spinlock.h>
+
+class MessagePool
+	{
+	/* Embedded classes: */
+	private:
+	struct Block // Structure overlaid onto unused memory blocks
+		{
+		/* Elements: */
+		public:
+		Block* succ; // Pointer to the next unused block
+		};
+	
+	/* Elements: */
+	static Threads::Spinlock poolListMutex; // Mutex serializing access to the list of all pools
+	static MessagePool* poolList; // List of all pools
+	size_t blockSize; // Size of memory blocks in this pool, rounded up to a multiple of the cache line size
+	MessagePool* succ; // Pointer to the next pool in the list of all pools
+	Threads::Spinlock mutex; // Mutex serializing access to the pool
+	Block* head; // Stack of unused memory blocks
+	
+	/* Private methods: */
+	void allocateSlab(void); // Adds a new slab to the pool; must be called with the pool locked
+	
+	/* Constructors and destructors: */
+	MessagePool(size_t sBlockSize,MessagePool* sSucc); // Creates an empty pool for memory blocks of the given size
+	
+	public:
+	static MessagePool* getPool(size_t minBlockSize); // Returns the shared pool for memory blocks of at least the given size; pools are never destroyed
+	
+	/* Methods: */
+	size_t getBlockSize(void) const // Returns the pool's block size
+		{
+		return blockSize;
+		}
+	void* allocate(void) // Returns an unused memory block
+		{
+		Threads::Spinlock::Lock lock(mutex);
+		
+		/* Add a new slab if the pool is empty: */
+		if(head==0)
+			allocateSlab();
+		
+		/* Pop a block off the stack: */
+		Block* result=head;
+		head=result->succ;
+		
+		return result;
+		}
+	void release(void* block) // Returns the given memory block to the pool
+		{
+		Threads::Spinlock::Lock lock(mutex);
+		
+		/* Push the block onto the stack: */
+		Block* b=static_cast<Block*>(block);
+		b->succ=head;
+		head=b;
+		}
+	};
+
+#endif
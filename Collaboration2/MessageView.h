@@ -0,0 +1,102 @@
+/***********************************************************************
+MessageView - Class to read binary data in place from the read buffer of
+a non-blocking socket with endianness correction where necessary.
+Copyright (c) 2020 Oliver Kreylos
+***********************************************************************/
+
+#ifndef MESSAGEVIEW_INCLUDED
+#define MESSAGEVIEW_INCLUDED
+
+#include <stddef.h>
+#include <string.h>
+#include <Misc/Endianness.h>
+
+#include <Collaboration2/NonBlockSocket.h>
+
+class MessageView
+	{
+	/* Elements: */
+	private:
+	NonBlockSocket& socket; // Socket whose read buffer is being viewed
+	size_t size; // Size of the viewed data block
+	const char* bufferEnd; // Pointer to the end of the viewed data block
+	const char* readPtr; // Position to read next data
+	bool swapOnRead; // Flag whether data must be endianness-swapped on read
+	
+	/* Constructors and destructors: */
+	public:
+	MessageView(NonBlockSocket& sSocket,size_t sSize) // Creates a view of the given amount of unread data in the given socket's read buffer, which must be at least as large as the view
+		:socket(sSocket),size(sSize),
+		 bufferEnd(socket.getReadPtr()+size),
+		 readPtr(socket.getReadPtr()),
+		 swapOnRead(socket.getSwapOnRead())
+		{
+		}
+	~MessageView(void) // Destroys the view and consumes the viewed data from the socket's read buffer
+		{
+		socket.advanceReadPtr(size);
+		}
+	
+	/* Methods: */
+	size_t getSize(void) const // Returns the size of the viewed data block
+		{
+		return size;
+		}
+	bool getSwapOnRead(void) const // Returns true if values must be endianness-swapped after reading
+		{
+		return swapOnRead;
+		}
+	void rewind(void) // Rewinds the view's read pointer
+		{
+		readPtr=bufferEnd-size;
+		}
+	size_t getUnread(void) const // Returns the amount of unread data in the view
+		{
+		return bufferEnd-readPtr;
+		}
+	bool eof(void) const // Returns true if the viewed data block has been completely read
+		{
+		return readPtr==bufferEnd;
+		}
+	
+	/* Raw binary read interface: */
+	const char* getReadPtr(void) // Returns the current read pointer
+		{
+		return readPtr;
+		}
+	void advanceReadPtr(size_t readSize) // Advances the read pointer after data has been read by outside means
+		{
+		readPtr+=readSize;
+		}
+	
+	/* Endianness- and type-safe binary read interface: */
+	template <class DataParam>
+	DataParam read(void) // Reads the next value of the given data type from the view
+		{
+		DataParam result;
+		memcpy(&result,readPtr,sizeof(DataParam));
+		readPtr+=sizeof(DataParam);
+		if(swapOnRead)
+			Misc::swapEndianness(result);
+		return result;
+		}
+	template <class DataParam>
+	DataParam& read(DataParam& data) // Ditto
+		{
+		memcpy(&data,readPtr,sizeof(DataParam));
+		readPtr+=sizeof(DataParam);
+		if(swapOnRead)
+			Misc::swapEndianness(data);
+		return data;
+		}
+	template <class DataParam>
+	void read(DataParam* items,size_t numItems) // Reads an array of values of the given data type from the view
+		{
+		memcpy(items,readPtr,numItems*sizeof(DataParam));
+		readPtr+=numItems*sizeof(DataParam);
+		if(swapOnRead)
+			Misc::swapEndianness(items,numItems);
+		}
+	};
+
+#endif
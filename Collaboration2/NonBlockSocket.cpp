@@ -10,10 +10,14 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/uio.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <linux/errqueue.h>
 #include <netdb.h>
+#include <algorithm>
 #include <stdexcept>
 #include <Misc/PrintInteger.h>
 #include <Misc/ThrowStdErr.h>
@@ -26,12 +30,89 @@ Copyright (c) 2019-2020 Oliver Kreylos
 Methods of class NonBlockSocket:
 *******************************/
 
-void NonBlockSocket::init(size_t readBufferSize)
+char* NonBlockSocket::createReadBuffer(size_t size)
 	{
-	/* Set the socket to non-blocking mode: */
+	/* Create an anonymous shared memory file to back the ring buffer: */
+	int memFd=memfd_create("NonBlockSocket::readBuffer",MFD_CLOEXEC);
+	if(memFd<0)
+		Misc::throwStdErr("NonBlockSocket::createReadBuffer: Unable to create shared memory file due to error %d (%s)",errno,strerror(errno));
+	if(ftruncate(memFd,size)<0)
+		{
+		int error=errno;
+		close(memFd);
+		Misc::throwStdErr("NonBlockSocket::createReadBuffer: Unable to size shared memory file due to error %d (%s)",error,strerror(error));
+		}
+	
+	/* Reserve an address range twice the size of the ring buffer: */
+	void* base=mmap(0,2*size,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	bool ok=base!=MAP_FAILED;
+	
+	/* Map the shared memory file into both halves of the reserved range: */
+	if(ok)
+		ok=mmap(base,size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,memFd,0)!=MAP_FAILED;
+	if(ok)
+		ok=mmap(static_cast<char*>(base)+size,size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,memFd,0)!=MAP_FAILED;
+	
+	/* The mappings keep the shared memory file alive: */
+	int error=errno;
+	close(memFd);
+	if(!ok)
+		{
+		if(base!=MAP_FAILED)
+			munmap(base,2*size);
+		Misc::throwStdErr("NonBlockSocket::createReadBuffer: Unable to map ring buffer due to error %d (%s)",error,strerror(error));
+		}
+	
+	return static_cast<char*>(base);
+	}
+
+void NonBlockSocket::destroyReadBuffer(char* buffer,size_t size)
+	{
+	/* Unmap both halves of the ring buffer: */
+	munmap(buffer,2*size);
+	}
+
+void NonBlockSocket::growReadBuffer(size_t minSize)
+	{
+	/* Double the read buffer's size until it is large enough: */
+	size_t newReadBufferSize=readBufferSize;
+	while(newReadBufferSize<minSize)
+		newReadBufferSize*=2;
+	
+	/* Move the unread data to the beginning of a new ring buffer: */
+	char* newReadBuffer=createReadBuffer(newReadBufferSize);
+	memcpy(newReadBuffer,readPtr,unread);
+	destroyReadBuffer(readBuffer,readBufferSize);
+	readBuffer=newReadBuffer;
+	readBufferSize=newReadBufferSize;
+	readPtr=readBuffer;
+	}
+
+void NonBlockSocket::growBulkBuffer(size_t minSize)
+	{
+	/* Double the bulk data buffer's size, starting from the read buffer's initial size, until it is large enough: */
+	size_t newBulkBufferSize=bulkBufferSize!=0?bulkBufferSize:minReadBufferSize;
+	while(newBulkBufferSize<minSize)
+		newBulkBufferSize*=2;
+	
+	/* Move the unread bulk data to the beginning of a new ring buffer: */
+	char* newBulkBuffer=createReadBuffer(newBulkBufferSize);
+	if(bulkBuffer!=0)
+		{
+		memcpy(newBulkBuffer,bulkReadPtr,bulkUnread);
+		destroyReadBuffer(bulkBuffer,bulkBufferSize);
+		}
+	bulkBuffer=newBulkBuffer;
+	bulkBufferSize=newBulkBufferSize;
+	bulkReadPtr=bulkBuffer;
+	}
+
+void NonBlockSocket::init(size_t initialReadBufferSize)
+	{
+	/* Set the socket to non-blocking mode unless it was created that way: */
 	int flags=fcntl(fd,F_GETFL,0);
 	bool ok=flags>=0;
-	if(ok)
+	if(ok&&(flags&O_NONBLOCK)==0)
 		ok=fcntl(fd,F_SETFL,flags|O_NONBLOCK)>=0;
 	if(!ok)
 		{
@@ -53,41 +134,159 @@ void NonBlockSocket::init(size_t readBufferSize)
 	
 	/* Initialize socket state: */
 	peerClosed=false;
+	drained=true;
 	
-	/* Create the read buffer: */
+	/* Create the read buffer, rounding its size up to the next multiple of the page size: */
 	swapOnRead=false;
-	readBuffer=new char[readBufferSize];
-	readBufferEnd=readBuffer+readBufferSize;
-	writePtr=readBuffer;
+	if(readBuffer!=0)
+		destroyReadBuffer(readBuffer,readBufferSize);
+	readBuffer=0;
+	size_t pageSize=size_t(sysconf(_SC_PAGESIZE));
+	readBufferSize=((initialReadBufferSize+pageSize-1)/pageSize)*pageSize;
+	try
+		{
+		readBuffer=createReadBuffer(readBufferSize);
+		}
+	catch(...)
+		{
+		/* Close the socket again and bail out: */
+		close(fd);
+		fd=-1;
+		throw;
+		}
 	readPtr=readBuffer;
 	unread=0;
+	minReadBufferSize=readBufferSize;
+	readHighWater=0;
+	numSmallBursts=0;
+	bulkReadPtr=bulkBuffer;
+	bulkUnread=0;
 	
-	/* Create the write queue: */
+	/* Create the write queues: */
 	sendQueueSize=0;
+	sendingQueue=-1;
 	sent=0;
+	
+	/* Zero-copy writes must be enabled explicitly on each new connection: */
+	zeroCopyThreshold=0;
+	zeroCopySequence=0;
+	}
+
+iovec* NonBlockSocket::addFrame(iovec* iovPtr,iovec* iovEnd,const NonBlockSocket::SendQueueEntry& entry,size_t skip)
+	{
+	/* Bail out if the I/O vector array is already full: */
+	if(iovPtr==iovEnd)
+		return iovPtr;
+	
+	/* Send what remains of the frame's bulk chunk header: */
+	if(skip<entry.headerSize)
+		{
+		iovPtr->iov_base=entry.header->getBuffer()+skip;
+		iovPtr->iov_len=entry.headerSize-skip;
+		++iovPtr;
+		skip=0;
+		}
+	else
+		skip-=entry.headerSize;
+	
+	/* Send what remains of the frame's range of message data: */
+	size_t begin=entry.offset+skip;
+	size_t end=entry.offset+entry.size;
+	if(entry.message->isComposite())
+		{
+		/* Send the parts of all fragments overlapping the range in order: */
+		size_t fragmentBegin=0;
+		for(unsigned int i=0;i<entry.message->getNumFragments()&&fragmentBegin<end&&iovPtr!=iovEnd;++i)
+			{
+			const MessageBuffer* fragment=entry.message->getFragment(i);
+			size_t fragmentEnd=fragmentBegin+fragment->getBufferSize();
+			if(begin<fragmentEnd)
+				{
+				size_t partEnd=end<fragmentEnd?end:fragmentEnd;
+				iovPtr->iov_base=const_cast<char*>(fragment->getBuffer())+(begin-fragmentBegin);
+				iovPtr->iov_len=partEnd-begin;
+				++iovPtr;
+				begin=partEnd;
+				}
+			fragmentBegin=fragmentEnd;
+			}
+		}
+	else if(begin<end&&iovPtr!=iovEnd)
+		{
+		iovPtr->iov_base=entry.message->getBuffer()+begin;
+		iovPtr->iov_len=end-begin;
+		++iovPtr;
+		}
+	
+	return iovPtr;
+	}
+
+void NonBlockSocket::popFrame(NonBlockSocket::SendQueue& sq)
+	{
+	/* Remove a whole message's coalescing key from the map if the map still refers to it: */
+	SendQueueEntry& entry=sq.frames.front();
+	Misc::UInt64 key=entry.message->getCoalescingKey();
+	if(key!=0&&entry.headerSize==0)
+		{
+		CoalescingMap::Iterator cIt=sq.coalescable.findEntry(key);
+		if(!cIt.isFinished()&&cIt->getDest()==sq.getFrontPosition())
+			sq.coalescable.removeEntry(key);
+		}
+	
+	/* Release the frame's message and chunk header and remove the frame: */
+	entry.message->unref();
+	if(entry.header!=0)
+		entry.header->unref();
+	sq.frames.pop_front();
 	}
 
 NonBlockSocket::NonBlockSocket(void)
 	:fd(-1),
-	 readBuffer(0),
-	 sendQueue(4)
+	 readBuffer(0),readBufferSize(0),
+	 bulkBuffer(0),bulkBufferSize(0),bulkReadPtr(0),bulkUnread(0),
+	 sendQueueSize(0),sendingQueue(-1),orderedPending(4),sent(0),
+	 chunkMessageId(0),maxChunkSize(0),
+	 iovecs(0),
+	 zeroCopyThreshold(0),zeroCopySequence(0),zeroCopyPending(4)
 	{
+	/* Index the send queues by message send priority class: */
+	sendQueues[MessageBuffer::RealTime]=&realTimeSendQueue;
+	sendQueues[MessageBuffer::State]=&stateSendQueue;
+	sendQueues[MessageBuffer::Bulk]=&bulkSendQueue;
 	}
 
 NonBlockSocket::NonBlockSocket(Comm::ListeningTCPSocket& listenSocket,size_t readBufferSize)
 	:fd(-1),
-	 readBuffer(0),
-	 sendQueue(4)
+	 readBuffer(0),readBufferSize(0),
+	 bulkBuffer(0),bulkBufferSize(0),bulkReadPtr(0),bulkUnread(0),
+	 sendQueueSize(0),sendingQueue(-1),orderedPending(4),sent(0),
+	 chunkMessageId(0),maxChunkSize(0),
+	 iovecs(0),
+	 zeroCopyThreshold(0),zeroCopySequence(0),zeroCopyPending(4)
 	{
+	/* Index the send queues by message send priority class: */
+	sendQueues[MessageBuffer::RealTime]=&realTimeSendQueue;
+	sendQueues[MessageBuffer::State]=&stateSendQueue;
+	sendQueues[MessageBuffer::Bulk]=&bulkSendQueue;
+	
 	/* Initialize the connection: */
 	accept(listenSocket,readBufferSize);
 	}
 
 NonBlockSocket::NonBlockSocket(const char* peerHostName,int peerPortId,size_t readBufferSize)
 	:fd(-1),
-	 readBuffer(0),
-	 sendQueue(4)
+	 readBuffer(0),readBufferSize(0),
+	 bulkBuffer(0),bulkBufferSize(0),bulkReadPtr(0),bulkUnread(0),
+	 sendQueueSize(0),sendingQueue(-1),orderedPending(4),sent(0),
+	 chunkMessageId(0),maxChunkSize(0),
+	 iovecs(0),
+	 zeroCopyThreshold(0),zeroCopySequence(0),zeroCopyPending(4)
 	{
+	/* Index the send queues by message send priority class: */
+	sendQueues[MessageBuffer::RealTime]=&realTimeSendQueue;
+	sendQueues[MessageBuffer::State]=&stateSendQueue;
+	sendQueues[MessageBuffer::Bulk]=&bulkSendQueue;
+	
 	/* Initialize the connection: */
 	connect(peerHostName,peerPortId,readBufferSize);
 	}
@@ -98,25 +297,41 @@ NonBlockSocket::~NonBlockSocket(void)
 	if(fd>=0)
 		close(fd);
 	
-	/* Delete the read buffer: */
-	delete[] readBuffer;
+	/* Destroy the read and bulk data buffers: */
+	if(readBuffer!=0)
+		destroyReadBuffer(readBuffer,readBufferSize);
+	if(bulkBuffer!=0)
+		destroyReadBuffer(bulkBuffer,bulkBufferSize);
 	
-	/* Release all messages still in the send queue: */
-	for(SendQueue::iterator sqIt=sendQueue.begin();sqIt!=sendQueue.end();++sqIt)
-		(*sqIt)->unref();
+	/* Release all messages still in the send queues: */
+	for(int i=0;i<MessageBuffer::NumSendPriorities;++i)
+		for(std::deque<SendQueueEntry>::iterator fIt=sendQueues[i]->frames.begin();fIt!=sendQueues[i]->frames.end();++fIt)
+			{
+			fIt->message->unref();
+			if(fIt->header!=0)
+				fIt->header->unref();
+			}
+	
+	/* Release all messages still referenced by zero-copy writes, as the kernel dropped its references when the socket was closed: */
+	for(ZeroCopyQueue::iterator zcIt=zeroCopyPending.begin();zcIt!=zeroCopyPending.end();++zcIt)
+		if(zcIt->message!=0)
+			zcIt->message->unref();
+	
+	/* Destroy the I/O vector scratch array: */
+	delete[] iovecs;
 	}
 
 void NonBlockSocket::accept(Comm::ListeningTCPSocket& listenSocket,size_t readBufferSize)
 	{
-	/* Accept the listening socket's first pending connection: */
+	/* Accept the listening socket's first pending connection as a non-blocking socket: */
 	socklen_t peerAddressLen=sizeof(peerAddress);
-	fd=::accept(listenSocket.getFd(),reinterpret_cast<sockaddr*>(&peerAddress),&peerAddressLen);
+	fd=::accept4(listenSocket.getFd(),reinterpret_cast<sockaddr*>(&peerAddress),&peerAddressLen,SOCK_NONBLOCK|SOCK_CLOEXEC);
 	
 	/* Check for errors: */
 	if(fd<0)
 		{
 		if(errno==EAGAIN||errno==EWOULDBLOCK)
-			throw std::runtime_error("NonBlockSocket::accept: Spurious connection attempt");
+			throw NoPendingConnectionError();
 		else
 			Misc::throwStdErr("NonBlockSocket::accept: Unable to accept connection due to error %d (%s)",errno,strerror(errno));
 		}
@@ -200,92 +415,327 @@ void NonBlockSocket::shutdown(bool read,bool write)
 
 size_t NonBlockSocket::readFromSocket(void)
 	{
-	/* Calculate how much data can be read at once: */
-	size_t space;
-	if(writePtr>=readPtr)
+	if(unread==readBufferSize)
 		{
-		/* Check if the read buffer is full: */
-		if(writePtr==readPtr&&unread!=0)
+		/* Grow the read buffer if it is full, i.e., if the unread data does not contain a complete message part that can be handled: */
+		if(readBufferSize*2>NONBLOCKSOCKET_MAXREADBUFFERSIZE)
 			throw std::runtime_error("NonBlockSocket::readFromSocket: Read buffer is full");
-		
-		/* Can write until the end of the buffer: */
-		space=readBufferEnd-writePtr;
+		growReadBuffer(readBufferSize*2);
 		}
-	else
+	else if(unread==0&&readBufferSize>minReadBufferSize)
 		{
-		/* Can write until the read pointer: */
-		space=readPtr-writePtr;
+		/* Shrink a grown read buffer back to its initial size once a number of consecutive bursts of data used only a small part of it: */
+		if(readHighWater*4<=readBufferSize)
+			{
+			if(++numSmallBursts>=NONBLOCKSOCKET_SHRINKDELAY)
+				{
+				char* newReadBuffer=createReadBuffer(minReadBufferSize);
+				destroyReadBuffer(readBuffer,readBufferSize);
+				readBuffer=newReadBuffer;
+				readBufferSize=minReadBufferSize;
+				readPtr=readBuffer;
+				numSmallBursts=0;
+				}
+			}
+		else
+			numSmallBursts=0;
+		readHighWater=0;
 		}
 	
-	/* Read into the buffer: */
-	ssize_t readSize=::read(fd,writePtr,space);
+	/* Read into the contiguous free space of the buffer; any data that does not fit is left in the socket for the next read, after the unread data has been handled: */
+	size_t freeSize=readBufferSize-unread;
+	ssize_t readSize=::read(fd,readPtr+unread,freeSize);
+	
+	/* A short read means that the socket's receive queue is empty: */
+	drained=readSize<ssize_t(freeSize);
 	if(readSize>0)
 		{
 		/* Increase the amount of unread data: */
-		writePtr+=readSize;
-		if(writePtr==readBufferEnd)
-			writePtr=readBuffer;
 		unread+=size_t(readSize);
+		if(readHighWater<unread)
+			readHighWater=unread;
 		}
 	else if(readSize==0)
 		{
 		/* The peer closed the connection: */
 		peerClosed=true;
 		}
-	else if(errno==EAGAIN||errno==EWOULDBLOCK)
-		Misc::logWarning("NonBlockSocket::readFromSocket: Nothing to read");
-	else
+	else if(errno!=EAGAIN&&errno!=EWOULDBLOCK) // Nothing to read is not an error when draining the socket
 		Misc::throwStdErr("NonBlockSocket::readFromSocket: Error %d (%s)",errno,strerror(errno));
 	
 	return unread;
 	}
 
+char* NonBlockSocket::appendBulkData(size_t size)
+	{
+	/* Grow the bulk data buffer if the new data does not fit; only bulk data that was not handled yet counts against the limit: */
+	if(bulkUnread+size>bulkBufferSize)
+		{
+		if(bulkUnread+size>NONBLOCKSOCKET_MAXREADBUFFERSIZE)
+			throw std::runtime_error("NonBlockSocket::appendBulkData: Bulk data buffer is full");
+		growBulkBuffer(bulkUnread+size);
+		}
+	
+	/* Return room at the end of the unread bulk data; the room cannot straddle the buffer end due to the mirrored mapping: */
+	char* result=bulkReadPtr+bulkUnread;
+	bulkUnread+=size;
+	return result;
+	}
+
+void NonBlockSocket::swapBulkData(void)
+	{
+	std::swap(readBuffer,bulkBuffer);
+	std::swap(readBufferSize,bulkBufferSize);
+	std::swap(readPtr,bulkReadPtr);
+	std::swap(unread,bulkUnread);
+	}
+
 void NonBlockSocket::setSwapOnRead(bool newSwapOnRead)
 	{
 	swapOnRead=newSwapOnRead;
 	}
 
+void NonBlockSocket::enableBulkChunking(unsigned int newChunkMessageId,size_t newMaxChunkSize)
+	{
+	chunkMessageId=newChunkMessageId;
+	maxChunkSize=newMaxChunkSize;
+	
+	#ifdef TCP_NOTSENT_LOWAT
+	/* Limit the amount of unsent data in the kernel's send buffer so that higher-priority messages do not queue up behind bulk chunks there: */
+	int lowat=int(2*maxChunkSize);
+	if(setsockopt(fd,IPPROTO_TCP,TCP_NOTSENT_LOWAT,&lowat,sizeof(lowat))<0)
+		Misc::logWarning("NonBlockSocket::enableBulkChunking: Unable to limit unsent data in send buffer");
+	#endif
+	}
+
+bool NonBlockSocket::enableZeroCopy(size_t newZeroCopyThreshold)
+	{
+	#ifdef MSG_ZEROCOPY
+	/* Allow the socket to pin message data instead of copying it into the kernel: */
+	int zeroCopy=1;
+	if(setsockopt(fd,SOL_SOCKET,SO_ZEROCOPY,&zeroCopy,sizeof(zeroCopy))<0)
+		{
+		Misc::logWarning("NonBlockSocket::enableZeroCopy: Zero-copy writes not supported by socket");
+		return false;
+		}
+	
+	zeroCopyThreshold=newZeroCopyThreshold;
+	return true;
+	#else
+	return false;
+	#endif
+	}
+
+void NonBlockSocket::reapZeroCopyCompletions(void)
+	{
+	#ifdef MSG_ZEROCOPY
+	/* Read all pending completion notifications from the socket's error queue: */
+	while(!zeroCopyPending.empty())
+		{
+		char control[128];
+		msghdr msg;
+		memset(&msg,0,sizeof(msghdr));
+		msg.msg_control=control;
+		msg.msg_controllen=sizeof(control);
+		if(recvmsg(fd,&msg,MSG_ERRQUEUE)<0)
+			break;
+		
+		for(cmsghdr* cmsg=CMSG_FIRSTHDR(&msg);cmsg!=0;cmsg=CMSG_NXTHDR(&msg,cmsg))
+			if((cmsg->cmsg_level==IPPROTO_IP&&cmsg->cmsg_type==IP_RECVERR)||(cmsg->cmsg_level==IPPROTO_IPV6&&cmsg->cmsg_type==IPV6_RECVERR))
+				{
+				const sock_extended_err* err=reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+				if(err->ee_errno==0&&err->ee_origin==SO_EE_ORIGIN_ZEROCOPY)
+					{
+					/* Release the messages of all zero-copy writes in the completed sequence number range, which can arrive out of order: */
+					unsigned int first=err->ee_info;
+					unsigned int last=err->ee_data;
+					for(ZeroCopyQueue::iterator zcIt=zeroCopyPending.begin();zcIt!=zeroCopyPending.end();++zcIt)
+						if(zcIt->message!=0&&zcIt->sequence-first<=last-first)
+							{
+							zcIt->message->unref();
+							zcIt->message=0;
+							}
+					}
+				}
+		
+		/* Remove completed writes from the front of the queue: */
+		while(!zeroCopyPending.empty()&&zeroCopyPending.front().message==0)
+			zeroCopyPending.pop_front();
+		}
+	#endif
+	}
+
 size_t NonBlockSocket::writeToSocket(void)
 	{
-	/* Bail out if the send queue is empty (this shouldn't happen in event-driven I/O): */
-	if(sendQueue.empty())
+	/* Bail out if the send queues are empty (this shouldn't happen in event-driven I/O): */
+	if(sendQueueSize==0)
 		{
 		Misc::logWarning("NonBlockSocket::writeToSocket: Nothing to write");
 		return 0;
 		}
 	
-	/* Try sending all messages in the send queue en bloc, hopefully combining small messages into larger IP packets: */
-	size_t numMessages=sendQueue.size();
-	iovec* iovecs=new iovec[numMessages];
+	/* Release messages whose earlier zero-copy writes have completed: */
+	reapZeroCopyCompletions();
+	
+	/* Create the I/O vector scratch array on first use: */
+	if(iovecs==0)
+		iovecs=new iovec[NONBLOCKSOCKET_MAXIOVECS];
+	iovec* iovEnd=iovecs+NONBLOCKSOCKET_MAXIOVECS;
+	
+	/* Plan the order in which frames are sent as a list of (queue index, number of frames) runs: */
+	int runQueues[MessageBuffer::NumSendPriorities+2];
+	size_t runLengths[MessageBuffer::NumSendPriorities+2];
+	int numRuns=0;
+	
+	/* Finish sending a partially-sent frame first, as frames cannot be interleaved: */
 	iovec* iovPtr=iovecs;
+	if(sendingQueue>=0)
+		{
+		iovPtr=addFrame(iovPtr,iovEnd,sendQueues[sendingQueue]->frames.front(),sent);
+		runQueues[numRuns]=sendingQueue;
+		runLengths[numRuns]=1;
+		++numRuns;
+		}
+	
+	/* Hold back frames queued after the oldest ordered message that has not been sent completely: */
+	const OrderedMessage* ordered=!orderedPending.empty()?&orderedPending.front():0;
 	
-	/* Send what remains of the first packet in the queue: */
-	SendQueue::iterator sqIt=sendQueue.begin();
-	iovPtr->iov_base=(*sqIt)->getBuffer()+sent;
-	iovPtr->iov_len=(*sqIt)->getBufferSize()-sent;
+	/* Send the remaining frames in order of priority until the I/O vector array is full; a frame that does not fit completely will be finished by a later write: */
+	bool olderFramesPlanned=true;
+	for(int i=0;i<MessageBuffer::NumSendPriorities&&iovPtr!=iovEnd;++i)
+		{
+		SendQueue& sq=*sendQueues[i];
+		size_t position=sq.getFrontPosition();
+		if(i==sendingQueue)
+			++position;
+		size_t end=ordered!=0&&ordered->limits[i]<sq.numQueued?ordered->limits[i]:sq.numQueued;
+		size_t numFrames=0;
+		size_t runSize=0;
+		for(;position<end&&iovPtr!=iovEnd;++position)
+			{
+			/* Only send about one chunk's worth of bulk data at a time to give higher-priority messages a chance to pass: */
+			if(i==MessageBuffer::Bulk&&maxChunkSize!=0&&runSize>=maxChunkSize)
+				break;
+			
+			const SendQueueEntry& entry=sq.frames[position-sq.getFrontPosition()];
+			iovPtr=addFrame(iovPtr,iovEnd,entry,0);
+			++numFrames;
+			runSize+=entry.headerSize+entry.size;
+			}
+		if(position<end)
+			olderFramesPlanned=false;
+		if(numFrames!=0)
+			{
+			runQueues[numRuns]=i;
+			runLengths[numRuns]=numFrames;
+			++numRuns;
+			}
+		}
 	
-	/* Send all other queued packets in their entirety: */
-	for(++sqIt,++iovPtr;sqIt!=sendQueue.end();++sqIt,++iovPtr)
+	/* Send the oldest ordered message after all frames that were queued before it: */
+	if(ordered!=0&&olderFramesPlanned&&iovPtr!=iovEnd)
 		{
-		iovPtr->iov_base=(*sqIt)->getBuffer();
-		iovPtr->iov_len=(*sqIt)->getBufferSize();
+		SendQueue& sq=*sendQueues[ordered->queue];
+		size_t position=sq.getFrontPosition();
+		if(ordered->queue==sendingQueue)
+			++position;
+		if(position<ordered->limits[ordered->queue])
+			position=ordered->limits[ordered->queue];
+		size_t numFrames=0;
+		for(;position<ordered->end&&iovPtr!=iovEnd;++position)
+			{
+			iovPtr=addFrame(iovPtr,iovEnd,sq.frames[position-sq.getFrontPosition()],0);
+			++numFrames;
+			}
+		if(numFrames!=0)
+			{
+			runQueues[numRuns]=ordered->queue;
+			runLengths[numRuns]=numFrames;
+			++numRuns;
+			}
+		}
+	int numIovecs=int(iovPtr-iovecs);
+	
+	/* Check whether to send the queued-up data without copying it: */
+	bool zeroCopy=false;
+	if(zeroCopyThreshold!=0)
+		{
+		size_t totalSize=0;
+		for(int i=0;i<numIovecs;++i)
+			totalSize+=iovecs[i].iov_len;
+		zeroCopy=totalSize>=zeroCopyThreshold;
 		}
 	
 	/* Send the queued-up data: */
-	ssize_t writeSize=writev(fd,iovecs,int(numMessages));
-	delete[] iovecs;
+	ssize_t writeSize;
+	#ifdef MSG_ZEROCOPY
+	if(zeroCopy)
+		{
+		msghdr msg;
+		memset(&msg,0,sizeof(msghdr));
+		msg.msg_iov=iovecs;
+		msg.msg_iovlen=numIovecs;
+		writeSize=sendmsg(fd,&msg,MSG_ZEROCOPY);
+		if(writeSize<0&&errno==ENOBUFS)
+			{
+			/* The kernel ran out of memory to pin message data; fall back to copying: */
+			zeroCopy=false;
+			writeSize=writev(fd,iovecs,numIovecs);
+			}
+		}
+	else
+	#endif
+		writeSize=writev(fd,iovecs,numIovecs);
 	if(writeSize>=0)
 		{
-		/* Remove all messages that were completely sent from the send queue: */
-		sent+=writeSize;
-		while(!sendQueue.empty()&&sent>=sendQueue.front()->getBufferSize())
+		/* Remove all frames that were completely sent from the send queues, in the order in which they were sent: */
+		size_t written=size_t(writeSize)+sent;
+		sendingQueue=-1;
+		sent=0;
+		for(int run=0;run<numRuns&&written>0;++run)
 			{
-			/* Release the completely-sent message: */
-			sent-=sendQueue.front()->getBufferSize();
-			sendQueueSize-=sendQueue.front()->getBufferSize();
-			sendQueue.front()->unref();
-			sendQueue.pop_front();
+			SendQueue& sq=*sendQueues[runQueues[run]];
+			for(size_t i=0;i<runLengths[run]&&written>0;++i)
+				{
+				if(zeroCopy&&writeSize>0)
+					{
+					/* Keep the frame's message and chunk header alive until the kernel is done with the data it pinned during this write: */
+					ZeroCopyEntry zce;
+					zce.sequence=zeroCopySequence;
+					zce.message=sq.frames.front().message->ref();
+					zeroCopyPending.push_back(zce);
+					if(sq.frames.front().header!=0)
+						{
+						zce.message=sq.frames.front().header->ref();
+						zeroCopyPending.push_back(zce);
+						}
+					}
+				
+				size_t frameSize=sq.frames.front().headerSize+sq.frames.front().size;
+				if(written<frameSize)
+					{
+					/* Remember the partially-sent frame: */
+					sendingQueue=runQueues[run];
+					sent=written;
+					written=0;
+					}
+				else
+					{
+					/* Release the completely-sent frame: */
+					written-=frameSize;
+					sendQueueSize-=frameSize;
+					popFrame(sq);
+					}
+				}
 			}
+		
+		/* Retire ordered messages that were sent completely: */
+		while(!orderedPending.empty()&&sendQueues[orderedPending.front().queue]->getFrontPosition()>=orderedPending.front().end)
+			orderedPending.pop_front();
+		
+		/* Each successful zero-copy write consumes one completion sequence number: */
+		if(zeroCopy&&writeSize>0)
+			++zeroCopySequence;
 		}
 	else if(errno==EAGAIN||errno==EWOULDBLOCK)
 		{
@@ -302,10 +752,113 @@ size_t NonBlockSocket::queueMessage(MessageBuffer* message)
 	{
 	size_t result=sendQueueSize-sent;
 	
-	/* Append the message to the end of the send queue: */
-	message->ref();
-	sendQueue.push_back(message);
-	sendQueueSize+=message->getBufferSize();
+	/* Access the send queue for the message's priority class: */
+	int priority=message->getSendPriority();
+	SendQueue& sq=*sendQueues[priority];
+	
+	/* Check if the message supersedes an older message and the send queue is backed up; ordered messages are never coalesced: */
+	bool ordered=message->isOrdered();
+	Misc::UInt64 key=ordered?0:message->getCoalescingKey();
+	if(key!=0&&!sq.frames.empty())
+		{
+		/* Look up the most recently queued whole message with the same key: */
+		CoalescingMap::Iterator cIt=sq.coalescable.findEntry(key);
+		if(!cIt.isFinished())
+			{
+			/* Check that the older message has not started sending yet, and that no message that cannot be coalesced, such as a destruction notification, was queued after it: */
+			size_t position=cIt->getDest();
+			size_t firstReplaceable=sq.getFrontPosition();
+			if(sendingQueue==priority)
+				++firstReplaceable;
+			if(position>=firstReplaceable&&position>=sq.barrier)
+				{
+				/* Replace the older message in place: */
+				SendQueueEntry& entry=sq.frames[position-sq.getFrontPosition()];
+				sendQueueSize-=entry.size;
+				entry.message->unref();
+				entry.message=message->ref();
+				entry.size=message->getBufferSize();
+				sendQueueSize+=entry.size;
+				
+				return result;
+				}
+			}
+		}
+	
+	OrderedMessage om;
+	if(ordered)
+		{
+		/* Remember the frames that must be sent before the message, and keep newer messages from replacing older ones across it: */
+		om.queue=priority;
+		for(int i=0;i<MessageBuffer::NumSendPriorities;++i)
+			{
+			om.limits[i]=sendQueues[i]->numQueued;
+			sendQueues[i]->barrier=sendQueues[i]->numQueued;
+			}
+		}
+	
+	SendQueueEntry entry;
+	entry.offset=0;
+	if(priority==MessageBuffer::Bulk&&maxChunkSize!=0&&message->getBufferSize()>maxChunkSize)
+		{
+		/* Split the message into chunks, each preceded by a bulk chunk message header: */
+		entry.headerSize=sizeof(MessageID)+sizeof(Misc::UInt16)+sizeof(Bool);
+		MessageID chunkId(chunkMessageId);
+		while(entry.offset<message->getBufferSize())
+			{
+			/* Calculate the next chunk's size: */
+			entry.size=message->getBufferSize()-entry.offset;
+			if(entry.size>maxChunkSize)
+				entry.size=maxChunkSize;
+			
+			/* Write the chunk's header into a new message buffer: */
+			entry.header=MessageBuffer::create(entry.headerSize);
+			char* headerPtr=entry.header->getBuffer();
+			memcpy(headerPtr,&chunkId,sizeof(MessageID));
+			Misc::UInt16 chunkSize(entry.size);
+			memcpy(headerPtr+sizeof(MessageID),&chunkSize,sizeof(Misc::UInt16));
+			headerPtr[sizeof(MessageID)+sizeof(Misc::UInt16)]=entry.offset+entry.size==message->getBufferSize()?1:0;
+			
+			/* Append the chunk to the end of the send queue: */
+			entry.message=message->ref();
+			sq.frames.push_back(entry);
+			++sq.numQueued;
+			sendQueueSize+=entry.headerSize+entry.size;
+			entry.offset+=entry.size;
+			}
+		
+		/* Older messages cannot be replaced by newer ones that would overtake this message: */
+		sq.barrier=sq.numQueued;
+		}
+	else
+		{
+		/* Append the message to the end of the send queue: */
+		entry.message=message->ref();
+		entry.size=message->getBufferSize();
+		entry.headerSize=0;
+		entry.header=0;
+		sq.frames.push_back(entry);
+		sendQueueSize+=entry.size;
+		
+		if(key!=0)
+			{
+			/* Remember the message's position so that a newer message with the same key can replace it: */
+			sq.coalescable.setEntry(CoalescingMap::Entry(key,sq.numQueued));
+			}
+		else
+			{
+			/* Older messages cannot be replaced by newer ones that would overtake this message: */
+			sq.barrier=sq.numQueued+1;
+			}
+		++sq.numQueued;
+		}
+	
+	if(ordered)
+		{
+		/* Hold back all newer messages until the ordered message has been sent: */
+		om.end=sq.numQueued;
+		orderedPending.push_back(om);
+		}
 	
 	return result;
 	}
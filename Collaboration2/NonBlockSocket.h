@@ -6,45 +6,157 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #ifndef NONBLOCKSOCKET_INCLUDED
 #define NONBLOCKSOCKET_INCLUDED
 
+/* Maximum size to which a socket's read buffer can grow before the connection is considered broken: */
+#define NONBLOCKSOCKET_MAXREADBUFFERSIZE (16*1024*1024)
+
+/* Number of consecutive bursts of data using at most a quarter of a grown read buffer after which the buffer shrinks back to its initial size: */
+#define NONBLOCKSOCKET_SHRINKDELAY 64
+
+/* Maximum number of I/O vectors passed to a single write; must not exceed the operating system's IOV_MAX: */
+#define NONBLOCKSOCKET_MAXIOVECS 1024
+
 #include <stddef.h>
 #include <string.h>
+#include <stdexcept>
+#include <deque>
+#include <Misc/SizedTypes.h>
 #include <Misc/Endianness.h>
 #include <Misc/RingBuffer.h>
+#include <Misc/HashTable.h>
 #include <Comm/IPSocketAddress.h>
 
+#include <Collaboration2/MessageBuffer.h>
+
 /* Forward declarations: */
 namespace Comm {
 class ListeningTCPSocket;
 }
-class MessageBuffer;
+struct iovec;
 
 class NonBlockSocket
 	{
 	/* Embedded classes: */
 	private:
-	typedef Misc::RingBuffer<MessageBuffer*> SendQueue; // Type for queues of messages waiting to be sent
+	struct SendQueueEntry // Structure for frames waiting to be sent
+		{
+		/* Elements: */
+		public:
+		MessageBuffer* message; // Message whose data is sent in this frame; each frame holds a reference to its message
+		size_t offset; // Offset of the first byte of message data sent in this frame
+		size_t size; // Amount of message data sent in this frame
+		size_t headerSize; // Size of the bulk chunk header preceding the message data, or 0 if the frame contains the entire message
+		MessageBuffer* header; // Bulk chunk header in its own message buffer, to be kept alive by zero-copy writes independently of the frame, or null if the frame contains the entire message
+		};
+	
+	struct CoalescingKeyHash // Hash function for message coalescing keys
+		{
+		/* Methods: */
+		public:
+		static size_t hash(const Misc::UInt64& source,size_t tableSize)
+			{
+			return size_t(source^(source>>29))%tableSize;
+			}
+		};
+	
+	typedef Misc::HashTable<Misc::UInt64,size_t,CoalescingKeyHash> CoalescingMap; // Type for hash tables mapping coalescing keys to positions of queued frames
+	
+	struct SendQueue // Structure for a queue of frames waiting to be sent in one message send priority class
+		{
+		/* Elements: */
+		public:
+		std::deque<SendQueueEntry> frames; // Frames in the order in which they are sent; a deque to access frames by position in constant time
+		size_t numQueued; // Total number of frames ever appended to the queue, i.e., the position of the next appended frame
+		size_t barrier; // Position after the most recently appended frame that cannot be coalesced; frames before it must not be replaced
+		CoalescingMap coalescable; // Map from coalescing keys to the positions of the most recently appended whole messages with those keys
+		
+		/* Constructors and destructors: */
+		SendQueue(void)
+			:numQueued(0),barrier(0),coalescable(17)
+			{
+			}
+		
+		/* Methods: */
+		size_t getFrontPosition(void) const // Returns the position of the first frame in the queue
+			{
+			return numQueued-frames.size();
+			}
+		};
+	
+	struct OrderedMessage // Structure for ordered messages that have not been sent completely
+		{
+		/* Elements: */
+		public:
+		int queue; // Index of the send queue containing the message's frames
+		size_t end; // Position after the message's last frame in its send queue
+		size_t limits[MessageBuffer::NumSendPriorities]; // Positions after the last frames queued before the message in each send queue
+		};
+	
+	typedef Misc::RingBuffer<OrderedMessage> OrderedQueue; // Type for queues of ordered messages that have not been sent completely
+	
+	struct ZeroCopyEntry // Structure for messages whose data is still referenced by the kernel after a zero-copy write
+		{
+		/* Elements: */
+		public:
+		unsigned int sequence; // Sequence number of the zero-copy write that referenced the message
+		MessageBuffer* message; // Message referenced by the zero-copy write, or null if the write has completed
+		};
+	
+	typedef Misc::RingBuffer<ZeroCopyEntry> ZeroCopyQueue; // Type for queues of messages waiting for zero-copy write completion
+	
+	public:
+	class NoPendingConnectionError:public std::runtime_error // Exception class thrown when accepting from a listening socket that has no pending connection requests
+		{
+		/* Constructors and destructors: */
+		public:
+		NoPendingConnectionError(void)
+			:std::runtime_error("NonBlockSocket::accept: Spurious connection attempt")
+			{
+			}
+		};
 	
 	/* Elements: */
 	private:
 	int fd; // Socket file descriptor
 	Comm::IPSocketAddress peerAddress; // IP address and TCP port of the connected socket
 	bool peerClosed; // Flag whether the peer closed the connection
+	bool drained; // Flag whether the most recent read emptied the socket's receive queue
 	
 	/* Reading interface state: */
 	bool swapOnRead; // Flag if binary data from the other end must be endianness-swapped
-	char* readBuffer; // A ring buffer to read data from the socket
-	char* readBufferEnd; // Pointer to the end of the ring buffer
-	char* writePtr; // Position at which new data from the socket will be written into the buffer
-	char* readPtr; // Position from which data will be read from the buffer
-	size_t unread; // Amount of unread data currently in the buffer
+	char* readBuffer; // A ring buffer to read data from the socket, mapped twice back-to-back such that unread data is always contiguous in memory
+	size_t readBufferSize; // Size of the ring buffer, a multiple of the page size
+	char* readPtr; // Position from which data will be read from the buffer, always inside the first mapping
+	size_t unread; // Amount of unread data currently in the buffer; new data from the socket will be written at readPtr+unread
+	size_t minReadBufferSize; // Size of the ring buffer when the socket was initialized, to which a grown buffer shrinks back
+	size_t readHighWater; // Maximum amount of unread data since the buffer was last empty
+	unsigned int numSmallBursts; // Number of consecutive bursts of data since the buffer was last empty that used at most a quarter of a grown buffer
+	char* bulkBuffer; // A mirrored ring buffer holding data of bulk messages that arrived in chunks, to be read as a separate message stream; null if not yet created
+	size_t bulkBufferSize; // Size of the bulk data buffer, a multiple of the page size
+	char* bulkReadPtr; // Position from which bulk data will be read, always inside the first mapping
+	size_t bulkUnread; // Amount of unread bulk data
 	
 	/* Writing interface state: */
-	SendQueue sendQueue; // Queue of messages waiting to be sent
-	size_t sendQueueSize; // Total size of all messages currently in the send queue
-	size_t sent; // Amount of already-sent data from the first message in the queue
+	SendQueue realTimeSendQueue,stateSendQueue,bulkSendQueue; // Queues of frames waiting to be sent in each message send priority class
+	SendQueue* sendQueues[MessageBuffer::NumSendPriorities]; // Send queues indexed by message send priority class
+	size_t sendQueueSize; // Total size of all frames currently in the send queues
+	int sendingQueue; // Index of the send queue whose first frame has been partially sent, or -1 if there is no partially-sent frame
+	OrderedQueue orderedPending; // Queue of ordered messages that have not been sent completely, in the order in which they were queued
+	size_t sent; // Amount of already-sent data from the partially-sent frame
+	unsigned int chunkMessageId; // Message ID of bulk chunk messages
+	size_t maxChunkSize; // Maximum amount of message data in a bulk chunk, or 0 if bulk messages are sent whole
+	iovec* iovecs; // Scratch array of I/O vectors to gather frames for a single write
+	size_t zeroCopyThreshold; // Minimum amount of data in a single write to send it without copying, or 0 if zero-copy writes are disabled
+	unsigned int zeroCopySequence; // Sequence number of the next zero-copy write
+	ZeroCopyQueue zeroCopyPending; // Queue of messages referenced by zero-copy writes that have not completed yet
 	
 	/* Private methods: */
-	void init(size_t readBufferSize); // Initializes the socket after connect or accept
+	static char* createReadBuffer(size_t size); // Creates a mirrored ring buffer of the given size, which must be a multiple of the page size
+	static void destroyReadBuffer(char* buffer,size_t size); // Destroys a mirrored ring buffer of the given size
+	void growReadBuffer(size_t minSize); // Grows the read buffer to at least the given size, preserving unread data
+	void growBulkBuffer(size_t minSize); // Grows the bulk data buffer to at least the given size, preserving unread bulk data
+	void init(size_t initialReadBufferSize); // Initializes the socket after connect or accept
+	static iovec* addFrame(iovec* iovPtr,iovec* iovEnd,const SendQueueEntry& entry,size_t skip); // Adds I/O vectors for the given frame, minus the given number of already-sent bytes, until the given I/O vector array end is reached; returns the updated I/O vector pointer
+	static void popFrame(SendQueue& sq); // Removes the first frame from the given send queue and releases its message
 	
 	/* Constructors and destructors: */
 	public:
@@ -58,7 +170,7 @@ class NonBlockSocket
 		{
 		return fd>=0;
 		}
-	void accept(Comm::ListeningTCPSocket& listenSocket,size_t readBufferSize =8192); // Creates a TCP socket by accepting the next pending connection request on the given listening socket
+	void accept(Comm::ListeningTCPSocket& listenSocket,size_t readBufferSize =8192); // Creates a TCP socket by accepting the next pending connection request on the given non-blocking listening socket; throws NoPendingConnectionError if there is none
 	void connect(const char* peerHostName,int peerPortId,size_t readBufferSize =8192); // Creates a TCP socket by connecting to the given IP address and port number
 	int getFd(void) const // Returns the socket's file descriptor
 		{
@@ -71,29 +183,34 @@ class NonBlockSocket
 	void shutdown(bool read,bool write); // Shuts down one or both directions of the connection in preparation for a close
 	
 	/* Read methods: */
-	size_t readFromSocket(void); // Reads more data into the buffer; returns the new total amount of unread data in the buffer
+	size_t readFromSocket(void); // Reads more data into the free space of the buffer; returns the new total amount of unread data in the buffer
+	const char* getReadPtr(void) const // Returns a pointer to the contiguous block of unread data in the buffer; valid until the next call to readFromSocket
+		{
+		return readPtr;
+		}
+	void advanceReadPtr(size_t readSize) // Advances the read pointer after data has been read in place
+		{
+		/* Advance the read pointer and wrap it back into the first mapping: */
+		readPtr+=readSize;
+		if(readPtr>=readBuffer+readBufferSize)
+			readPtr-=readBufferSize;
+		unread-=readSize;
+		}
 	void readRaw(void* destPtr,size_t destSize) // Reads the given number of bytes into the given destination
 		{
-		/* Check if the read straddles the read buffer end: */
-		size_t endSpace=size_t(readBufferEnd-readPtr);
-		if(destSize>endSpace)
-			{
-			/* Copy from the read pointer to the end of the read buffer first: */
-			memcpy(destPtr,readPtr,endSpace);
-			destPtr=reinterpret_cast<char*>(destPtr)+endSpace;
-			destSize-=endSpace;
-			
-			/* Wrap around the read pointer: */
-			readPtr=readBuffer;
-			unread-=endSpace;
-			}
-		
-		/* Copy from the read pointer: */
+		/* Copy from the read pointer; the read cannot straddle the read buffer end due to the mirrored mapping: */
 		memcpy(destPtr,readPtr,destSize);
-		readPtr+=destSize;
-		if(readPtr==readBufferEnd)
-			readPtr=readBuffer;
-		unread-=destSize;
+		advanceReadPtr(destSize);
+		}
+	char* appendBulkData(size_t size); // Returns a pointer to room for the given amount of data, about to be read from the socket, at the end of the unread bulk data; throws an exception if the unread bulk data would exceed the maximum read buffer size
+	void swapBulkData(void); // Exchanges the unread data and the unread bulk data, such that bulk messages can be read through the regular read methods; must be called again to switch back
+	size_t getBulkUnread(void) const // Returns the amount of unread bulk data
+		{
+		return bulkUnread;
+		}
+	bool isDrained(void) const // Returns true if the most recent call to readFromSocket read all data that had arrived on the socket; otherwise, the buffer was filled and more data can be read once unread data has been handled
+		{
+		return drained;
 		}
 	bool eof(void) const // Returns true if the peer closed the connection and there is no more unread data
 		{
@@ -136,12 +253,15 @@ class NonBlockSocket
 		}
 	
 	/* Write methods: */
+	void enableBulkChunking(unsigned int newChunkMessageId,size_t newMaxChunkSize); // Splits bulk messages larger than the given size into chunk messages of the given message ID, which the peer must read as a separate message stream
+	bool enableZeroCopy(size_t newZeroCopyThreshold); // Sends writes of at least the given size without copying message data into the kernel; returns false if the operating system does not support zero-copy writes
+	void reapZeroCopyCompletions(void); // Releases messages whose zero-copy writes have completed; must be called on every event on the socket, as unread completion notifications keep the socket signaling an error condition
 	size_t writeToSocket(void); // Writes data from the current buffer to the socket; returns the new total amount of unsent data
 	size_t getUnsent(void) const // Returns the total amount of data that still needs to be written
 		{
 		return sendQueueSize-sent;
 		}
-	size_t queueMessage(MessageBuffer* message); // Queues the given message for sending; returns the previous total amount of unsent data
+	size_t queueMessage(MessageBuffer* message); // Queues the given message for sending in its send priority class, replacing an older unsent message with the same non-zero coalescing key in place unless a message without coalescing key was queued in between, and holding back newer messages of all priority classes behind ordered messages; returns the previous total amount of unsent data
 	};
 
 #endif
@@ -385,7 +385,7 @@ void AgoraClient::RemoteClient::enqueuePacket(const Threads::EventDispatcher::Ti
 	if(playbackStopped)
 		{
 		/* Initialize the jitter buffer and latency conditioner: */
-		jitterBuffer.init(sequenceNumber,packet->ref());
+		jitterBuffer.init(sequenceNumber,packet->refShared());
 		headArrival=arrival;
 		
 		// DEBUGGING
@@ -398,7 +398,7 @@ void AgoraClient::RemoteClient::enqueuePacket(const Threads::EventDispatcher::Ti
 	else
 		{
 		/* Enqueue the packet into the jitter buffer and update the latency conditioner: */
-		jitterBuffer.enqueue(sequenceNumber,packet->ref());
+		jitterBuffer.enqueue(sequenceNumber,packet->refShared());
 		TimeStamp expectedArrival=headArrival+TimeStamp(Sequence(sequenceNumber-jitterBuffer.getHeadSequence()))*period;
 		headArrival+=TimeStamp(TimeStamp(TimeStamp(arrival-expectedArrival)*arrivalFilterGain)+32768)>>16;
 		
@@ -73,7 +73,7 @@ class AgoraProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int serverMessageBase) // Returns a message buffer for a connect notification message
 			{
-			return MessageBuffer::create(serverMessageBase+ConnectNotification,size);
+			return MessageBuffer::create(serverMessageBase+ConnectNotification,size)->setOrdered();
 			}
 		};
 	
@@ -93,7 +93,7 @@ class AgoraProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int messageId,size_t audioPacketLen) // Returns a message buffer for an audio packet request or reply message with the given encoded audio packet size
 			{
-			return MessageBuffer::create(messageId,size+audioPacketLen);
+			return MessageBuffer::create(messageId,size+audioPacketLen)->setSendPriority(MessageBuffer::RealTime);
 			}
 		};
 	
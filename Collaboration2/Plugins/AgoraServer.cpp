@@ -150,6 +150,7 @@ void AgoraServer::udpAudioPacketRequestCallback(unsigned int messageId,unsigned
 	
 	/* Re-write the message header to set the proper message ID, exchange destination for source client, and fix potential endianness difference: */
 	message.getBuffer()->setMessageId(serverMessageBase+AudioPacketReply);
+	message.getBuffer()->setSendPriority(MessageBuffer::RealTime);
 	{
 	MessageWriter writer(message.getBuffer()->ref()); // Add another reference for the writer
 	writer.write(ClientID(clientId));
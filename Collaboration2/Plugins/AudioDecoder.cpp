@@ -187,5 +187,5 @@ void AudioDecoder::enqueuePacket(MessageBuffer* newPacket)
 		jitterBuffer.pop_front();
 	
 	/* Put the new packet into the jitter buffer: */
-	jitterBuffer.push_back(newPacket->ref());
+	jitterBuffer.push_back(newPacket->refShared());
 	}
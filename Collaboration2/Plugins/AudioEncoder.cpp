@@ -58,7 +58,7 @@ void* AudioEncoder::encoderThreadMethod(void)
 				audioPacketMessage.write(Misc::UInt16(encodedSize));
 				
 				/* Hand the audio packet to the main thread: */
-				dispatcher->signal(signalKey,audioPacketMessage.getBuffer()->ref());
+				dispatcher->signal(signalKey,audioPacketMessage.getBuffer()->refShared());
 				}
 			else if(encodedSize<0)
 				Misc::throwStdErr("Encoder: Error %d (%s) while encoding an audio packet",encodedSize,opus_strerror(encodedSize));
@@ -80,25 +80,53 @@ MessageContinuation* EnsomatosisServer::avatarStateUpdateRequestCallback(unsigne
 	/* Validate the client's avatar state: */
 	eClient->avatarValid=true;
 	
-	/* Broadcast an avatar state update notification to all connected clients: */
+	/* Send an avatar state update notification to all connected clients to which the update is relevant based on their distance to the client: */
 	{
 	MessageWriter avatarStateUpdateNotification(AvatarStateUpdateMsg::createMessage(serverMessageBase+AvatarStateUpdateNotification));
 	avatarStateUpdateNotification.write(ClientID(clientId));
 	writeAvatarState(eClient->avatarState,avatarStateUpdateNotification);
-	broadcastMessage(clientId,avatarStateUpdateNotification.getBuffer());
+	
+	/* Let a newer avatar state update from the same client replace this one in backed-up send queues: */
+	avatarStateUpdateNotification.getBuffer()->setCoalescingKey(clientId);
+	unsigned int updateCounter=eClient->stateUpdateCounter++;
+	for(ClientIDList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
+		if(*cIt!=clientId&&vruiCore->isRelevantUpdate(vruiCore->getInterestTier(clientId,*cIt),updateCounter))
+			server->getClient(*cIt)->queueMessage(avatarStateUpdateNotification.getBuffer());
 	}
 	
 	/* Done with message: */
 	return 0;
 	}
 
+void EnsomatosisServer::interestRaisedCallback(VruiCoreServer::InterestRaisedCallbackData* cbData)
+	{
+	/* Access the Ensomatosis client state objects of both clients, if they participate in the Ensomatosis protocol: */
+	Client* eClient=server->testAndGetPlugin<Client>(cbData->sourceClientId,pluginIndex);
+	if(eClient==0||server->testAndGetPlugin<Client>(cbData->destClientId,pluginIndex)==0)
+		return;
+	
+	/* Send the source client's current avatar state, as the destination client might have missed its most recent decimated update: */
+	if(eClient->avatarValid)
+		{
+		MessageWriter avatarStateUpdateNotification(AvatarStateUpdateMsg::createMessage(serverMessageBase+AvatarStateUpdateNotification));
+		avatarStateUpdateNotification.write(ClientID(cbData->sourceClientId));
+		writeAvatarState(eClient->avatarState,avatarStateUpdateNotification);
+		avatarStateUpdateNotification.getBuffer()->setCoalescingKey(cbData->sourceClientId);
+		server->getClient(cbData->destClientId)->queueMessage(avatarStateUpdateNotification.getBuffer());
+		}
+	}
+
 EnsomatosisServer::EnsomatosisServer(Server* sServer)
-	:PluginServer(sServer)
+	:PluginServer(sServer),
+	 vruiCore(VruiCoreServer::requestServer(server))
 	{
+	/* Re-send avatar states to clients that might have missed decimated updates: */
+	vruiCore->getInterestRaisedCallbacks().add(this,&EnsomatosisServer::interestRaisedCallback);
 	}
 
 EnsomatosisServer::~EnsomatosisServer(void)
 	{
+	vruiCore->getInterestRaisedCallbacks().remove(this,&EnsomatosisServer::interestRaisedCallback);
 	}
 
 const char* EnsomatosisServer::getName(void) const
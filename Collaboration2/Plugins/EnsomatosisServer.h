@@ -8,6 +8,7 @@ Copyright (c) 2020 Oliver Kreylos
 #define ENSOMATOSISSERVER_INCLUDED
 
 #include <Collaboration2/PluginServer.h>
+#include <Collaboration2/Plugins/VruiCoreServer.h>
 #include <Collaboration2/Plugins/EnsomatosisProtocol.h>
 
 /* Forward declarations: */
@@ -28,18 +29,24 @@ class EnsomatosisServer:public PluginServer,public EnsomatosisProtocol
 		Vrui::Scalar avatarScale; // Scale factor for user's avatar
 		Vrui::IKAvatar::State avatarState; // Current avatar state of the user
 		bool avatarValid; // Flag if the current avatar state is valid, i.e., matches the avatar definition
+		unsigned int stateUpdateCounter; // Number of avatar state updates received from the user, to decimate updates sent to distant clients
 		
 		/* Constructors and destructors: */
 		Client(void)
 			:avatarScale(1),
-			 avatarValid(false)
+			 avatarValid(false),
+			 stateUpdateCounter(0)
 			{
 			}
 		};
 	
+	/* Elements: */
+	VruiCoreServer* vruiCore; // Pointer to the Vrui Core server plug-in
+	
 	/* Private methods: */
 	MessageContinuation* avatarUpdateRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* avatarStateUpdateRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
+	void interestRaisedCallback(VruiCoreServer::InterestRaisedCallbackData* cbData); // Called when a client's avatar state updates become more relevant to another client
 	
 	/* Constructors and destructors: */
 	public:
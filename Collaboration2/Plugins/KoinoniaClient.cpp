@@ -812,7 +812,7 @@ KoinoniaProtocol::ObjectID KoinoniaClient::shareObject(const std::string& name,c
 	else
 		{
 		/* Queue the CreateObjectRequest message to be sent once the protocol starts: */
-		startupMessages.push_back(createObjectRequest.getBuffer()->ref());
+		startupMessages.push_back(createObjectRequest.getBuffer()->refShared());
 		}
 	}
 	}
@@ -903,7 +903,7 @@ KoinoniaClient::shareNamespace(
 	else
 		{
 		/* Queue the CreateNamespaceRequest message to be sent once the protocol starts: */
-		startupMessages.push_back(createNamespaceRequest.getBuffer()->ref());
+		startupMessages.push_back(createNamespaceRequest.getBuffer()->refShared());
 		}
 	}
 	}
@@ -950,7 +950,7 @@ KoinoniaProtocol::ObjectID KoinoniaClient::createNsObject(KoinoniaProtocol::Name
 	else
 		{
 		/* Queue the CreateNsObjectRequest message to be sent once the namespace receives its server-side ID: */
-		ns->startupMessages.push_back(createNsObjectRequest.getBuffer()->ref());
+		ns->startupMessages.push_back(createNsObjectRequest.getBuffer()->refShared());
 		}
 	}
 	}
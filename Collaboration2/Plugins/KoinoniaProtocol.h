@@ -89,7 +89,7 @@ class KoinoniaProtocol
 			if(explicitSize)
 				bodySize+=Misc::getVarInt32Size(objectSize);
 			bodySize+=objectSize;
-			return MessageBuffer::create(clientMessageBase+CreateObjectRequest,bodySize);
+			return MessageBuffer::create(clientMessageBase+CreateObjectRequest,bodySize)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -104,7 +104,7 @@ class KoinoniaProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int serverMessageBase) // Returns a message buffer for a create object reply message
 			{
-			return MessageBuffer::create(serverMessageBase+CreateObjectReply,size);
+			return MessageBuffer::create(serverMessageBase+CreateObjectReply,size)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -126,7 +126,7 @@ class KoinoniaProtocol
 			if(explicitSize)
 				bodySize+=Misc::getVarInt32Size(objectSize);
 			bodySize+=objectSize;
-			return MessageBuffer::create(clientMessageBase+ReplaceObjectRequest,bodySize);
+			return MessageBuffer::create(clientMessageBase+ReplaceObjectRequest,bodySize)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -142,7 +142,7 @@ class KoinoniaProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int serverMessageBase) // Returns a message buffer for a create object reply message
 			{
-			return MessageBuffer::create(serverMessageBase+ReplaceObjectReply,size);
+			return MessageBuffer::create(serverMessageBase+ReplaceObjectReply,size)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -164,7 +164,7 @@ class KoinoniaProtocol
 			if(explicitSize)
 				bodySize+=Misc::getVarInt32Size(objectSize);
 			bodySize+=objectSize;
-			return MessageBuffer::create(serverMessageBase+ReplaceObjectNotification,bodySize);
+			return MessageBuffer::create(serverMessageBase+ReplaceObjectNotification,bodySize)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -185,7 +185,7 @@ class KoinoniaProtocol
 			size_t bodySize=size;
 			bodySize+=name.length()*sizeof(Char);
 			bodySize+=dataType.calcDataTypeSize();
-			return MessageBuffer::create(clientMessageBase+CreateNamespaceRequest,bodySize);
+			return MessageBuffer::create(clientMessageBase+CreateNamespaceRequest,bodySize)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -200,7 +200,7 @@ class KoinoniaProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int serverMessageBase) // Returns a message buffer for a create object reply message
 			{
-			return MessageBuffer::create(serverMessageBase+CreateNamespaceReply,size);
+			return MessageBuffer::create(serverMessageBase+CreateNamespaceReply,size)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -223,7 +223,7 @@ class KoinoniaProtocol
 			if(explicitSize)
 				bodySize+=Misc::getVarInt32Size(objectSize);
 			bodySize+=objectSize;
-			return MessageBuffer::create(messageId,bodySize);
+			return MessageBuffer::create(messageId,bodySize)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -239,7 +239,7 @@ class KoinoniaProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int serverMessageBase) // Returns a message buffer for a create namespace object reply message
 			{
-			return MessageBuffer::create(serverMessageBase+CreateNsObjectReply,size);
+			return MessageBuffer::create(serverMessageBase+CreateNsObjectReply,size)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -255,7 +255,7 @@ class KoinoniaProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int serverMessageBase) // Returns a message buffer for a create namespace object notification message
 			{
-			return MessageBuffer::create(serverMessageBase+CreateNsObjectNotification,size);
+			return MessageBuffer::create(serverMessageBase+CreateNsObjectNotification,size)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -278,7 +278,7 @@ class KoinoniaProtocol
 			if(explicitSize)
 				bodySize+=Misc::getVarInt32Size(objectSize);
 			bodySize+=objectSize;
-			return MessageBuffer::create(messageId,bodySize);
+			return MessageBuffer::create(messageId,bodySize)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -295,7 +295,7 @@ class KoinoniaProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int serverMessageBase) // Returns a message buffer for a replace namespace object reply message
 			{
-			return MessageBuffer::create(serverMessageBase+ReplaceNsObjectReply,size);
+			return MessageBuffer::create<ReplaceNsObjectReplyMsg>(serverMessageBase+ReplaceNsObjectReply)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
@@ -310,7 +310,7 @@ class KoinoniaProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int messageId) // Returns a message buffer for a destroy namespace object request or notification message
 			{
-			return MessageBuffer::create(messageId,size);
+			return MessageBuffer::create(messageId,size)->setSendPriority(MessageBuffer::Bulk);
 			}
 		};
 	
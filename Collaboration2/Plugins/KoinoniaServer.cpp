@@ -7,6 +7,7 @@ Copyright (c) 2019-2020 Oliver Kreylos
 
 #include <ctype.h>
 #include <string.h>
+#include <vector>
 #include <stdexcept>
 #include <iostream>
 #include <Misc/Utility.h>
@@ -29,6 +30,17 @@ Copyright (c) 2019-2020 Oliver Kreylos
 Methods of class KoinoniaServer:
 *******************************/
 
+void KoinoniaServer::addSharingClient(KoinoniaServer::ClientIDList& clients,std::vector<unsigned int>& membershipIndices,unsigned int clientId)
+	{
+	/* Record the client's entry in the client list in the client's membership list: */
+	Client* client=server->getPlugin<Client>(clientId,pluginIndex);
+	membershipIndices.push_back(client->memberships.size());
+	client->memberships.push_back(Client::Membership(clients,membershipIndices));
+	
+	/* Add the client to the client list: */
+	clients.push_back(clientId);
+	}
+
 void KoinoniaServer::listObjectsCommand(const char* argumentsBegin,const char* argumentsEnd)
 	{
 	std::cout<<"Koinonia::listObjects:"<<std::endl;
@@ -250,7 +262,7 @@ void KoinoniaServer::deleteObjectCommand(const char* argumentsBegin,const char*
 MessageContinuation* KoinoniaServer::createObjectRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
 	{
 	/* Embedded classes: */
-	class Cont:public MessageContinuation
+	class Cont:public MessageContinuation,public Server::Job
 		{
 		/* Embedded classes: */
 		public:
@@ -263,16 +275,22 @@ MessageContinuation* KoinoniaServer::createObjectRequestCallback(unsigned int me
 		
 		/* Elements: */
 		public:
+		KoinoniaServer* koinonia; // Pointer to the plug-in protocol to finish the request
+		unsigned int clientId; // ID of the requesting client
 		State state;
 		ObjectID clientObjectId;
 		SharedObject* so;
 		MessageContinuation* subCont; // Message continuation object to read the data type dictionary or the shared object's initial value
 		size_t remaining; // Number of bytes or elements left to read in current state
+		bool swapEndianness; // Flag whether the shared object's initial value must be endianness-swapped
+		MessageBuffer* object; // The shared object's finished initial value, held by the object reader
 		
 		/* Constructors and destructors: */
-		Cont(NonBlockSocket& socket)
-			:so(new SharedObject),
-			 subCont(0)
+		Cont(KoinoniaServer* sKoinonia,unsigned int sClientId,NonBlockSocket& socket)
+			:koinonia(sKoinonia),clientId(sClientId),
+			 so(new SharedObject),
+			 subCont(0),
+			 swapEndianness(socket.getSwapOnRead()),object(0)
 			{
 			/* Read the client-side object ID: */
 			clientObjectId=socket.read<ObjectID>();
@@ -295,6 +313,85 @@ MessageContinuation* KoinoniaServer::createObjectRequestCallback(unsigned int me
 			/* Delete a potential sub-continuation object: */
 			delete subCont;
 			}
+		
+		/* Methods from class Server::Job: */
+		virtual void run(void)
+			{
+			/* Check the requested initial object value: */
+			object=static_cast<ReadObjectCont*>(subCont)->finishObject(so->dataType,so->type,swapEndianness);
+			}
+		virtual void finish(void)
+			{
+			Server* server=koinonia->server;
+			
+			/* Check if a shared object with the requested name already exists: */
+			SharedObjectNameMap::Iterator sonIt=koinonia->sharedObjectNames.findEntry(so->name);
+			if(!sonIt.isFinished())
+				{
+				/* Access the existing shared object: */
+				SharedObject* existing=sonIt->getDest();
+				
+				/* Check if the object creation request matches the existing shared object: */
+				bool grantRequest=so->dataType==existing->dataType&&so->type==existing->type;
+				
+				/* Send a CreateObjectReply message: */
+				{
+				MessageWriter createObjectReply(CreateObjectReplyMsg::createMessage(koinonia->serverMessageBase));
+				createObjectReply.write(clientObjectId);
+				createObjectReply.write(grantRequest?existing->id:ObjectID(0));
+				server->queueMessage(clientId,createObjectReply.getBuffer());
+				}
+				
+				if(grantRequest)
+					{
+					/* Add the client to the existing object's share list: */
+					koinonia->addSharingClient(existing->clients,existing->membershipIndices,clientId);
+					
+					/* Send the existing object's current value to the requesting client: */
+					server->queueMessage(clientId,existing->object);
+					}
+				}
+			else
+				{
+				/* Find an unused object ID for the new shared object: */
+				do
+					{
+					++koinonia->lastObjectId;
+					}
+				while(koinonia->lastObjectId==ObjectID(0)||koinonia->sharedObjects.isEntry(koinonia->lastObjectId));
+				so->id=koinonia->lastObjectId;
+				
+				/* Finalize the new shared object's initial value: */
+				so->object=object->ref();
+				
+				/* Write the correct message header into the object's representation: */
+				so->object->setMessageId(koinonia->serverMessageBase+ReplaceObjectNotification);
+				so->object->setSendPriority(MessageBuffer::Bulk);
+				{
+				MessageWriter writer(so->object->ref());
+				writer.write(so->id);
+				writer.write(so->version);
+				}
+				
+				/* Add the new shared object to the shared object and shared object names maps: */
+				koinonia->sharedObjects.setEntry(SharedObjectMap::Entry(so->id,so));
+				koinonia->sharedObjectNames.setEntry(SharedObjectNameMap::Entry(so->name,so));
+				
+				/* Send a CreateObjectReply message: */
+				{
+				MessageWriter createObjectReply(CreateObjectReplyMsg::createMessage(koinonia->serverMessageBase));
+				createObjectReply.write(clientObjectId);
+				createObjectReply.write(so->id);
+				server->queueMessage(clientId,createObjectReply.getBuffer());
+				}
+				
+				/* Add the client to the new object's share list: */
+				koinonia->addSharingClient(so->clients,so->membershipIndices,clientId);
+				
+				/* Remove the new shared object from the continuation so it doesn't get deleted: */
+				so=0;
+				}
+			}
 		};
 	
 	Server::Client* client=server->getClient(clientId);
@@ -305,7 +402,7 @@ MessageContinuation* KoinoniaServer::createObjectRequestCallback(unsigned int me
 	if(cont==0)
 		{
 		/* Create a continuation object: */
-		cont=new Cont(socket);
+		cont=new Cont(this,clientId,socket);
 		}
 	
 	/* Check if the object name is not completely read: */
@@ -357,86 +454,14 @@ MessageContinuation* KoinoniaServer::createObjectRequestCallback(unsigned int me
 	/* Check if the object is not completely read: */
 	if(cont->state==Cont::ReadObject)
 		{
-		/* Access the object reader: */
-		ReadObjectCont* roCont=static_cast<ReadObjectCont*>(cont->subCont);
-		
 		/* Continue reading the object's initial value and bail out if it is not complete: */
-		if(!roCont->read(socket))
+		if(!static_cast<ReadObjectCont*>(cont->subCont)->read(socket))
 			return cont;
 		
-		/* Check if a shared object with the requested name already exists: */
-		SharedObjectNameMap::Iterator sonIt=sharedObjectNames.findEntry(cont->so->name);
-		if(!sonIt.isFinished())
-			{
-			/* Access the existing shared object: */
-			SharedObject* so=sonIt->getDest();
-			
-			/* Check if the requested initial object value is valid: */
-			roCont->finishObject(cont->so->dataType,cont->so->type,socket.getSwapOnRead());
-			
-			/* Check if the object creation request matches the existing shared object: */
-			bool grantRequest=cont->so->dataType==so->dataType&&cont->so->type==so->type;
-			
-			/* Send a CreateObjectReply message: */
-			{
-			MessageWriter createObjectReply(CreateObjectReplyMsg::createMessage(serverMessageBase));
-			createObjectReply.write(cont->clientObjectId);
-			createObjectReply.write(grantRequest?so->id:ObjectID(0));
-			client->queueMessage(createObjectReply.getBuffer());
-			}
-			
-			if(grantRequest)
-				{
-				/* Add the client to the existing object's share list: */
-				so->clients.push_back(clientId);
-				
-				/* Send the existing object's current value to the requesting client: */
-				client->queueMessage(so->object);
-				}
-			}
-		else
-			{
-			/* Find an unused object ID for the new shared object: */
-			SharedObject* so=cont->so;
-			do
-				{
-				++lastObjectId;
-				}
-			while(lastObjectId==ObjectID(0)||sharedObjects.isEntry(lastObjectId));
-			so->id=lastObjectId;
-			
-			/* Check and finalize the new shared object's initial value: */
-			so->object=roCont->finishObject(so->dataType,so->type,socket.getSwapOnRead())->ref();
-			
-			/* Write the correct message header into the object's representation: */
-			so->object->setMessageId(serverMessageBase+ReplaceObjectNotification);
-			{
-			MessageWriter writer(so->object->ref());
-			writer.write(so->id);
-			writer.write(so->version);
-			}
-			
-			/* Add the new shared object to the shared object and shared object names maps: */
-			sharedObjects.setEntry(SharedObjectMap::Entry(lastObjectId,so));
-			sharedObjectNames.setEntry(SharedObjectNameMap::Entry(so->name,so));
-			
-			/* Send a CreateObjectReply message: */
-			{
-			MessageWriter createObjectReply(CreateObjectReplyMsg::createMessage(serverMessageBase));
-			createObjectReply.write(cont->clientObjectId);
-			createObjectReply.write(so->id);
-			client->queueMessage(createObjectReply.getBuffer());
-			}
-			
-			/* Add the client to the new object's share list: */
-			so->clients.push_back(clientId);
-			
-			/* Remove the new shared object from the continuation so it doesn't get deleted: */
-			cont->so=0;
-			}
+		/* Check the object's initial value in a worker thread and finish the request afterwards: */
+		server->submitJob(clientId,cont);
 		
 		/* Done with the message: */
-		delete cont;
 		cont=0;
 		}
 	
@@ -446,19 +471,81 @@ MessageContinuation* KoinoniaServer::createObjectRequestCallback(unsigned int me
 MessageContinuation* KoinoniaServer::replaceObjectRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
 	{
 	/* Embedded classes: */
-	class Cont:public ReadObjectCont
+	class Cont:public ReadObjectCont,public Server::Job
 		{
 		/* Elements: */
 		public:
-		SharedObject* so;
+		KoinoniaServer* koinonia; // Pointer to the plug-in protocol to finish the request
+		unsigned int clientId; // ID of the requesting client
+		ObjectID objectId; // ID of the shared object to be replaced
+		DataType dataType; // Copy of the shared object's data type dictionary, to check the new value in a worker thread
+		DataType::TypeID type; // The shared object's type
 		VersionNumber objectVersion;
+		bool swapEndianness; // Flag whether the new object value must be endianness-swapped
+		MessageBuffer* object; // The finished new object value, held by the object reader
 		
 		/* Constructors and destructors: */
-		Cont(Misc::UInt32 sObjectSize,SharedObject* sSo,VersionNumber sObjectVersion)
+		Cont(Misc::UInt32 sObjectSize,KoinoniaServer* sKoinonia,unsigned int sClientId,SharedObject* sSo,VersionNumber sObjectVersion,bool sSwapEndianness)
 			:ReadObjectCont(sizeof(MessageID)+sizeof(ObjectID)+sizeof(VersionNumber),sObjectSize),
-			 so(sSo),
-			 objectVersion(sObjectVersion)
+			 koinonia(sKoinonia),clientId(sClientId),
+			 objectId(sSo->id),dataType(sSo->dataType),type(sSo->type),
+			 objectVersion(sObjectVersion),
+			 swapEndianness(sSwapEndianness),object(0)
+			{
+			}
+		
+		/* Methods from class Server::Job: */
+		virtual void run(void)
+			{
+			/* Check and finalize the updated object value: */
+			object=finishObject(dataType,type,swapEndianness);
+			}
+		virtual void finish(void)
+			{
+			Server* server=koinonia->server;
+			
+			/* Ignore the request if the shared object was deleted in the meantime: */
+			SharedObjectMap::Iterator soIt=koinonia->sharedObjects.findEntry(objectId);
+			if(soIt.isFinished())
+				return;
+			SharedObject* so=soIt->getDest();
+			
+			/* Check if the client's version number matches the current object's: */
+			bool grantRequest=objectVersion==so->version;
+			
+			/* Send a request object reply message: */
 			{
+			MessageWriter replaceObjectReply(ReplaceObjectReplyMsg::createMessage(koinonia->serverMessageBase));
+			replaceObjectReply.write(so->id);
+			replaceObjectReply.write(objectVersion);
+			replaceObjectReply.write(grantRequest?Bool(1):Bool(0));
+			server->queueMessage(clientId,replaceObjectReply.getBuffer());
+			}
+			
+			if(grantRequest)
+				{
+				/* Replace the shared object's value: */
+				if(so->object!=0)
+					so->object->unref();
+				++so->version;
+				
+				/* Write the correct message header into the new object's representation: */
+				object->setMessageId(koinonia->serverMessageBase+ReplaceObjectNotification);
+				object->setSendPriority(MessageBuffer::Bulk);
+				{
+				MessageWriter writer(object->ref());
+				writer.write(so->id);
+				writer.write(so->version);
+				}
+				
+				/* Store the new object representation: */
+				so->object=object->ref();
+				
+				/* Send the new value of the shared object to all clients sharing it: */
+				for(ClientIDList::iterator cIt=so->clients.begin();cIt!=so->clients.end();++cIt)
+					if(*cIt!=clientId)
+						server->queueMessage(*cIt,so->object);
+				}
 			}
 		};
 	
@@ -481,54 +568,16 @@ MessageContinuation* KoinoniaServer::replaceObjectRequestCallback(unsigned int m
 			objectSize=Misc::UInt32(so->dataType.getMinSize(so->type));
 		
 		/* Create a continuation object: */
-		cont=new Cont(objectSize,so,objectVersion);
+		cont=new Cont(objectSize,this,clientId,so,objectVersion,socket.getSwapOnRead());
 		}
 	
 	/* Read the object and check if it is complete: */
 	if(cont->read(socket))
 		{
-		/* Check and finalize the updated object value: */
-		SharedObject* so=cont->so;
-		MessageBuffer* object=cont->finishObject(so->dataType,so->type,socket.getSwapOnRead());
-		
-		/* Check if the client's version number matches the current object's: */
-		bool grantRequest=cont->objectVersion==so->version;
-		
-		/* Send a request object reply message: */
-		{
-		MessageWriter replaceObjectReply(ReplaceObjectReplyMsg::createMessage(serverMessageBase));
-		replaceObjectReply.write(so->id);
-		replaceObjectReply.write(cont->objectVersion);
-		replaceObjectReply.write(grantRequest?Bool(1):Bool(0));
-		client->queueMessage(replaceObjectReply.getBuffer());
-		}
-		
-		if(grantRequest)
-			{
-			/* Replace the shared object's value: */
-			if(so->object!=0)
-				so->object->unref();
-			++so->version;
-			
-			/* Write the correct message header into the new object's representation: */
-			object->setMessageId(serverMessageBase+ReplaceObjectNotification);
-			{
-			MessageWriter writer(object->ref());
-			writer.write(so->id);
-			writer.write(so->version);
-			}
-			
-			/* Store the new object representation: */
-			so->object=object->ref();
-			
-			/* Send the new value of the shared object to all clients sharing it: */
-			for(ClientIDList::iterator cIt=so->clients.begin();cIt!=so->clients.end();++cIt)
-				if(*cIt!=clientId)
-					server->queueMessage(*cIt,so->object);
-			}
+		/* Check the updated object value in a worker thread and finish the request afterwards: */
+		server->submitJob(clientId,cont);
 		
 		/* Done with the message: */
-		delete cont;
 		cont=0;
 		}
 	
@@ -605,6 +654,92 @@ void KoinoniaServer::printNamespaceObjectCommand(const char* argumentsBegin,cons
 
 void KoinoniaServer::saveNamespaceCommand(const char* argumentsBegin,const char* argumentsEnd)
 	{
+	/* Embedded classes: */
+	class SaveJob:public Server::Job // Job to write a snapshot of a namespace to a file in a worker thread
+		{
+		/* Embedded classes: */
+		public:
+		struct Object // Structure for a snapshot of a namespace object
+			{
+			/* Elements: */
+			public:
+			DataType::TypeID type; // The object's type
+			MessageBuffer* object; // The object's serialization, referenced for sharing with the worker thread
+			};
+		
+		/* Elements: */
+		std::string fileName; // Name of the file to which to write the namespace
+		std::string name; // The namespace's name
+		DataType dataType; // Copy of the namespace's data type dictionary
+		std::vector<Object> objects; // Snapshots of all objects in the namespace
+		
+		/* Constructors and destructors: */
+		SaveJob(const std::string& sFileName,Namespace& ns)
+			:fileName(sFileName),name(ns.name),dataType(ns.dataType)
+			{
+			/* Take snapshots of all objects currently existing inside the namespace: */
+			objects.reserve(ns.sharedObjects.getNumEntries());
+			for(Namespace::SharedObjectMap::Iterator soIt=ns.sharedObjects.begin();!soIt.isFinished();++soIt)
+				{
+				Object o;
+				o.type=soIt->getDest().type;
+				o.object=soIt->getDest().object->refShared();
+				objects.push_back(o);
+				}
+			}
+		virtual ~SaveJob(void)
+			{
+			/* Release the object snapshots: */
+			for(std::vector<Object>::iterator oIt=objects.begin();oIt!=objects.end();++oIt)
+				oIt->object->unref();
+			}
+		
+		/* Methods from class Server::Job: */
+		virtual void run(void)
+			{
+			/* Open the output file: */
+			IO::FilePtr file=IO::openFile(fileName.c_str(),IO::File::WriteOnly);
+			file->setEndianness(Misc::LittleEndian);
+			
+			/* Write the file header: */
+			char header[32];
+			memset(header,0,sizeof(header));
+			strcpy(header,"Koinonia Namespace v1.0");
+			file->writeRaw(header,sizeof(header));
+			
+			/* Write the namespace's name and data type dictionary: */
+			Misc::write(name,*file);
+			dataType.write(*file);
+			
+			/* Write all object snapshots: */
+			for(std::vector<Object>::iterator oIt=objects.begin();oIt!=objects.end();++oIt)
+				{
+				/* Write the object's type: */
+				file->write(oIt->type);
+				
+				/* Attach a message reader to the object's serialization to write it: */
+				MessageReader reader(oIt->object->ref());
+				
+				/* Determine the size of the object's serialization: */
+				Misc::UInt32 objectSize(dataType.getMinSize(oIt->type));
+				if(!dataType.hasFixedSize(oIt->type))
+					{
+					objectSize=Misc::readVarInt32(reader);
+					
+					/* Write the object's size: */
+					Misc::writeVarInt32(objectSize,*file);
+					}
+				
+				/* Write the object's serialization: */
+				file->writeRaw(reader.getReadPtr(),objectSize);
+				}
+			}
+		virtual void finish(void)
+			{
+			std::cout<<"Koinonia::saveNamespace: Saved namespace "<<name<<" to file "<<fileName<<std::endl;
+			}
+		};
+	
 	/* Retrieve the ID of the namespace to save and the name of the file to which to save it: */
 	NamespaceID namespaceId(Misc::ValueCoder<unsigned int>::decode(argumentsBegin,argumentsEnd,&argumentsBegin));
 	const char* fnBegin=Misc::skipWhitespace(argumentsBegin,argumentsEnd);
@@ -616,47 +751,8 @@ void KoinoniaServer::saveNamespaceCommand(const char* argumentsBegin,const char*
 	/* Access the namespace: */
 	Namespace& ns=*namespaces.getEntry(namespaceId).getDest();
 	
-	/* Open the output file: */
-	IO::FilePtr file=IO::openFile(fileName.c_str(),IO::File::WriteOnly);
-	file->setEndianness(Misc::LittleEndian);
-	
-	/* Write the file header: */
-	char header[32];
-	memset(header,0,sizeof(header));
-	strcpy(header,"Koinonia Namespace v1.0");
-	file->writeRaw(header,sizeof(header));
-	
-	/* Write the namespace's name and data type dictionary: */
-	Misc::write(ns.name,*file);
-	ns.dataType.write(*file);
-	
-	/* Write all objects currently existing inside the namespace: */
-	for(Namespace::SharedObjectMap::Iterator soIt=ns.sharedObjects.begin();!soIt.isFinished();++soIt)
-		{
-		/* Access the shared object: */
-		Namespace::SharedObject& so=soIt->getDest();
-		
-		/* Write the object's type: */
-		file->write(so.type);
-		
-		/* Attach a message reader to the object's serialization to write it: */
-		{
-		MessageReader reader(so.object->ref());
-		
-		/* Determine the size of the object's serialization: */
-		Misc::UInt32 objectSize(ns.dataType.getMinSize(so.type));
-		if(!ns.dataType.hasFixedSize(so.type))
-			{
-			objectSize=Misc::readVarInt32(reader);
-			
-			/* Write the object's size: */
-			Misc::writeVarInt32(objectSize,*file);
-			}
-		
-		/* Write the object's serialization: */
-		file->writeRaw(reader.getReadPtr(),objectSize);
-		}
-		}
+	/* Write a snapshot of the namespace in a worker thread: */
+	server->submitJob(0,new SaveJob(fileName,ns));
 	}
 
 void KoinoniaServer::loadNamespaceCommand(const char* argumentsBegin,const char* argumentsEnd)
@@ -751,19 +847,16 @@ void KoinoniaServer::loadNamespaceCommand(const char* argumentsBegin,const char*
 		if(!ns->clients.empty())
 			{
 			/* Create a message header for a CreateNsObjectNotification message: */
-			MessageWriter headerWriter(MessageBuffer::create(serverMessageBase+CreateNsObjectNotification,CreateNsObjectMsg::size));
+			MessageWriter headerWriter(MessageBuffer::create(serverMessageBase+CreateNsObjectNotification,CreateNsObjectMsg::size)->setSendPriority(MessageBuffer::Bulk));
 			headerWriter.write(ns->id);
 			headerWriter.write(ns->lastObjectId);
 			headerWriter.write(type);
 			
 			/* Send the message header/body combination to all clients sharing the namespace: */
+			MessageBuffer* notification=MessageBuffer::createComposite(headerWriter.getBuffer(),objectWriter.getBuffer());
 			for(ClientIDList::iterator cIt=ns->clients.begin();cIt!=ns->clients.end();++cIt)
-				{
-				/* Send the message header and body separately: */
-				Server::Client* c=server->getClient(*cIt);
-				c->queueMessage(headerWriter.getBuffer());
-				c->queueMessage(objectWriter.getBuffer());
-				}
+				server->queueMessage(*cIt,notification);
+			notification->unref();
 			}
 		}
 		}
@@ -894,24 +987,23 @@ MessageContinuation* KoinoniaServer::createNamespaceRequestCallback(unsigned int
 			if(grantRequest)
 				{
 				/* Add the client to the existing namespace's share list: */
-				ns->clients.push_back(clientId);
+				addSharingClient(ns->clients,ns->membershipIndices,clientId);
 				
 				/* Send the existing namespace's shared objects to the requesting client: */
 				for(Namespace::SharedObjectMap::Iterator soIt=ns->sharedObjects.begin();!soIt.isFinished();++soIt)
 					{
 					Namespace::SharedObject& so=soIt->getDest();
 					
-					/* Create and send a message buffer containing the header of a CreateNsObjectNotification message: */
-					{
-					MessageWriter headerWriter(MessageBuffer::create(serverMessageBase+CreateNsObjectNotification,CreateNsObjectMsg::size));
+					/* Create a message buffer containing the header of a CreateNsObjectNotification message: */
+					MessageWriter headerWriter(MessageBuffer::create(serverMessageBase+CreateNsObjectNotification,CreateNsObjectMsg::size)->setSendPriority(MessageBuffer::Bulk));
 					headerWriter.write(ns->id);
 					headerWriter.write(so.id);
 					headerWriter.write(so.type);
-					client->queueMessage(headerWriter.getBuffer());
-					}
 					
-					/* Send the shared object's representation as the CreateNsObjectNotification message's body: */
-					client->queueMessage(so.object);
+					/* Send the header followed by the shared object's representation as the message's body: */
+					MessageBuffer* notification=MessageBuffer::createComposite(headerWriter.getBuffer(),so.object);
+					client->queueMessage(notification);
+					notification->unref();
 					}
 				}
 			}
@@ -939,7 +1031,7 @@ MessageContinuation* KoinoniaServer::createNamespaceRequestCallback(unsigned int
 			}
 			
 			/* Add the client to the new namespace's share list: */
-			cont->ns->clients.push_back(clientId);
+			addSharingClient(cont->ns->clients,cont->ns->membershipIndices,clientId);
 			
 			/* Remove the new namespace from the continuation so it doesn't get deleted: */
 			cont->ns=0;
@@ -956,19 +1048,77 @@ MessageContinuation* KoinoniaServer::createNamespaceRequestCallback(unsigned int
 MessageContinuation* KoinoniaServer::createNsObjectRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
 	{
 	/* Embedded classes: */
-	class Cont:public ReadObjectCont
+	class Cont:public ReadObjectCont,public Server::Job
 		{
 		/* Elements: */
 		public:
-		Namespace* ns; // Pointer to namespace to which to add the object
+		KoinoniaServer* koinonia; // Pointer to the plug-in protocol to finish the request
+		unsigned int clientId; // ID of the requesting client
+		NamespaceID namespaceId; // ID of namespace to which to add the object
+		DataType dataType; // Copy of the namespace's data type dictionary, to check the new object in a worker thread
 		ObjectID objectId; // Client-side ID of the new object
 		DataType::TypeID type; // Type of the new object
+		bool swapEndianness; // Flag whether the new object's initial value must be endianness-swapped
+		MessageBuffer* object; // The new object's finished initial value, held by the object reader
 		
 		/* Constructors and destructors: */
-		Cont(Misc::UInt32 sObjectSize,Namespace* sNs,ObjectID sObjectId,DataType::TypeID sType)
+		Cont(Misc::UInt32 sObjectSize,KoinoniaServer* sKoinonia,unsigned int sClientId,Namespace* sNs,ObjectID sObjectId,DataType::TypeID sType,bool sSwapEndianness)
 			:ReadObjectCont(0,sObjectSize),
-			 ns(sNs),objectId(sObjectId),type(sType)
+			 koinonia(sKoinonia),clientId(sClientId),
+			 namespaceId(sNs->id),dataType(sNs->dataType),objectId(sObjectId),type(sType),
+			 swapEndianness(sSwapEndianness),object(0)
+			{
+			}
+		
+		/* Methods from class Server::Job: */
+		virtual void run(void)
+			{
+			/* Check and finalize the new shared object's initial value: */
+			object=finishObject(dataType,type,swapEndianness);
+			}
+		virtual void finish(void)
+			{
+			Server* server=koinonia->server;
+			
+			/* Ignore the request if the namespace was deleted in the meantime: */
+			NamespaceMap::Iterator nsIt=koinonia->namespaces.findEntry(namespaceId);
+			if(nsIt.isFinished())
+				return;
+			Namespace* ns=nsIt->getDest();
+			
+			/* Find an unused object ID for the new shared object: */
+			do
+				{
+				++ns->lastObjectId;
+				}
+			while(ns->lastObjectId==ObjectID(0)||ns->sharedObjects.isEntry(ns->lastObjectId));
+			
+			/* Add a new shared object to the namespace's shared object map: */
+			ns->sharedObjects.setEntry(Namespace::SharedObjectMap::Entry(ns->lastObjectId,Namespace::SharedObject(ns->lastObjectId,type,object)));
+			
+			/* Send a CreateNsObjectReply message to the requesting client: */
 			{
+			MessageWriter createNsObjectReply(CreateNsObjectReplyMsg::createMessage(koinonia->serverMessageBase));
+			createNsObjectReply.write(ns->id);
+			createNsObjectReply.write(objectId);
+			createNsObjectReply.write(ns->lastObjectId);
+			server->queueMessage(clientId,createNsObjectReply.getBuffer());
+			}
+			
+			/* Send CreateNsObjectNotification messages to all other clients sharing the namespace: */
+			{
+			MessageWriter headerWriter(MessageBuffer::create(koinonia->serverMessageBase+CreateNsObjectNotification,CreateNsObjectMsg::size)->setSendPriority(MessageBuffer::Bulk));
+			headerWriter.write(ns->id);
+			headerWriter.write(ns->lastObjectId);
+			headerWriter.write(type);
+			
+			/* Send the message header and body as one composite message: */
+			MessageBuffer* notification=MessageBuffer::createComposite(headerWriter.getBuffer(),object);
+			for(ClientIDList::iterator cIt=ns->clients.begin();cIt!=ns->clients.end();++cIt)
+				if(*cIt!=clientId)
+					server->queueMessage(*cIt,notification);
+			notification->unref();
+			}
 			}
 		};
 	
@@ -996,54 +1146,16 @@ MessageContinuation* KoinoniaServer::createNsObjectRequestCallback(unsigned int
 			objectSize=Misc::UInt32(ns->dataType.getMinSize(type));
 		
 		/* Create a continuation object: */
-		cont=new Cont(objectSize,ns,objectId,type);
+		cont=new Cont(objectSize,this,clientId,ns,objectId,type,socket.getSwapOnRead());
 		}
 	
 	/* Read the object and check if it is complete: */
 	if(cont->read(socket))
 		{
-		/* Find an unused object ID for the new shared object: */
-		Namespace* ns=cont->ns;
-		do
-			{
-			++ns->lastObjectId;
-			}
-		while(ns->lastObjectId==ObjectID(0)||ns->sharedObjects.isEntry(ns->lastObjectId));
-		
-		/* Check and finalize the new shared object's initial value: */
-		MessageBuffer* object=cont->finishObject(ns->dataType,cont->type,socket.getSwapOnRead());
-		
-		/* Add a new shared object to the namespace's shared object map: */
-		ns->sharedObjects.setEntry(Namespace::SharedObjectMap::Entry(ns->lastObjectId,Namespace::SharedObject(ns->lastObjectId,cont->type,object)));
-		
-		/* Send a CreateNsObjectReply message to the requesting client: */
-		{
-		MessageWriter createNsObjectReply(CreateNsObjectReplyMsg::createMessage(serverMessageBase));
-		createNsObjectReply.write(ns->id);
-		createNsObjectReply.write(cont->objectId);
-		createNsObjectReply.write(ns->lastObjectId);
-		client->queueMessage(createNsObjectReply.getBuffer());
-		}
-		
-		/* Send CreateNsObjectNotification messages to all other clients sharing the namespace: */
-		{
-		MessageWriter headerWriter(MessageBuffer::create(serverMessageBase+CreateNsObjectNotification,CreateNsObjectMsg::size));
-		headerWriter.write(ns->id);
-		headerWriter.write(ns->lastObjectId);
-		headerWriter.write(cont->type);
-		
-		for(ClientIDList::iterator cIt=ns->clients.begin();cIt!=ns->clients.end();++cIt)
-			if(*cIt!=clientId)
-				{
-				/* Send the message header and body separately: */
-				Server::Client* c=server->getClient(*cIt);
-				c->queueMessage(headerWriter.getBuffer());
-				c->queueMessage(object);
-				}
-		}
+		/* Check the new object's initial value in a worker thread and finish the request afterwards: */
+		server->submitJob(clientId,cont);
 		
 		/* Done with the message: */
-		delete cont;
 		cont=0;
 		}
 	
@@ -1053,19 +1165,87 @@ MessageContinuation* KoinoniaServer::createNsObjectRequestCallback(unsigned int
 MessageContinuation* KoinoniaServer::replaceNsObjectRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
 	{
 	/* Embedded classes: */
-	class Cont:public ReadObjectCont
+	class Cont:public ReadObjectCont,public Server::Job
 		{
 		/* Elements: */
 		public:
-		Namespace* ns; // Pointer to namespace in which to replace the object
-		Namespace::SharedObject& so; // The object that is to be replaced
+		KoinoniaServer* koinonia; // Pointer to the plug-in protocol to finish the request
+		unsigned int clientId; // ID of the requesting client
+		NamespaceID namespaceId; // ID of namespace in which to replace the object
+		DataType dataType; // Copy of the namespace's data type dictionary, to check the new value in a worker thread
+		ObjectID objectId; // ID of the object that is to be replaced
+		DataType::TypeID type; // Type of the object that is to be replaced
 		VersionNumber clientVersion; // Client's version number of the shared object
+		bool swapEndianness; // Flag whether the new object value must be endianness-swapped
+		MessageBuffer* object; // The finished new object value, held by the object reader
 		
 		/* Constructors and destructors: */
-		Cont(Misc::UInt32 sObjectSize,Namespace* sNs,Namespace::SharedObject& sSo,VersionNumber sClientVersion)
+		Cont(Misc::UInt32 sObjectSize,KoinoniaServer* sKoinonia,unsigned int sClientId,Namespace* sNs,Namespace::SharedObject& sSo,VersionNumber sClientVersion,bool sSwapEndianness)
 			:ReadObjectCont(0,sObjectSize),
-			 ns(sNs),so(sSo),clientVersion(sClientVersion)
+			 koinonia(sKoinonia),clientId(sClientId),
+			 namespaceId(sNs->id),dataType(sNs->dataType),objectId(sSo.id),type(sSo.type),clientVersion(sClientVersion),
+			 swapEndianness(sSwapEndianness),object(0)
+			{
+			}
+		
+		/* Methods from class Server::Job: */
+		virtual void run(void)
+			{
+			/* Check and finalize the shared object's new value: */
+			object=finishObject(dataType,type,swapEndianness);
+			}
+		virtual void finish(void)
+			{
+			Server* server=koinonia->server;
+			
+			/* Ignore the request if the namespace or the object were deleted in the meantime: */
+			NamespaceMap::Iterator nsIt=koinonia->namespaces.findEntry(namespaceId);
+			if(nsIt.isFinished())
+				return;
+			Namespace* ns=nsIt->getDest();
+			Namespace::SharedObjectMap::Iterator soIt=ns->sharedObjects.findEntry(objectId);
+			if(soIt.isFinished())
+				return;
+			Namespace::SharedObject& so=soIt->getDest();
+			
+			/* Check if the client's version number matches the current object's: */
+			bool grantRequest=clientVersion==so.version;
+			
+			/* Send a replace namespace object reply message: */
 			{
+			MessageWriter replaceNsObjectReply(ReplaceNsObjectReplyMsg::createMessage(koinonia->serverMessageBase));
+			replaceNsObjectReply.write(ns->id);
+			replaceNsObjectReply.write(so.id);
+			replaceNsObjectReply.write(clientVersion);
+			replaceNsObjectReply.write(grantRequest?Bool(1):Bool(0));
+			server->queueMessage(clientId,replaceNsObjectReply.getBuffer());
+			}
+			
+			if(grantRequest)
+				{
+				/* Replace the shared object's value: */
+				if(so.object!=0)
+					so.object->unref();
+				++so.version;
+				
+				/* Store the new object representation: */
+				so.object=object->ref();
+				
+				/* Send a ReplaceNsObjectNotification message to all clients sharing the namespace: */
+				{
+				MessageWriter headerWriter(MessageBuffer::create(koinonia->serverMessageBase+ReplaceNsObjectNotification,ReplaceNsObjectMsg::size)->setSendPriority(MessageBuffer::Bulk));
+				headerWriter.write(ns->id);
+				headerWriter.write(so.id);
+				headerWriter.write(so.version);
+				
+				/* Send the message header and body as one composite message: */
+				MessageBuffer* notification=MessageBuffer::createComposite(headerWriter.getBuffer(),so.object);
+				for(ClientIDList::iterator cIt=ns->clients.begin();cIt!=ns->clients.end();++cIt)
+					if(*cIt!=clientId)
+						server->queueMessage(*cIt,notification);
+				notification->unref();
+				}
+				}
 			}
 		};
 	
@@ -1091,61 +1271,16 @@ MessageContinuation* KoinoniaServer::replaceNsObjectRequestCallback(unsigned int
 			objectSize=Misc::UInt32(ns->dataType.getMinSize(so.type));
 		
 		/* Create a continuation object: */
-		cont=new Cont(objectSize,ns,so,clientVersion);
+		cont=new Cont(objectSize,this,clientId,ns,so,clientVersion,socket.getSwapOnRead());
 		}
 	
 	/* Read the object and check if it is complete: */
 	if(cont->read(socket))
 		{
-		Namespace* ns=cont->ns;
-		Namespace::SharedObject& so=cont->so;
-		
-		/* Check and finalize the shared object's new value: */
-		MessageBuffer* object=cont->finishObject(ns->dataType,so.type,socket.getSwapOnRead());
-		
-		/* Check if the client's version number matches the current object's: */
-		bool grantRequest=cont->clientVersion==so.version;
-		
-		/* Send a replace namespace object reply message: */
-		{
-		MessageWriter replaceNsObjectReply(ReplaceNsObjectReplyMsg::createMessage(serverMessageBase));
-		replaceNsObjectReply.write(ns->id);
-		replaceNsObjectReply.write(so.id);
-		replaceNsObjectReply.write(cont->clientVersion);
-		replaceNsObjectReply.write(grantRequest?Bool(1):Bool(0));
-		client->queueMessage(replaceNsObjectReply.getBuffer());
-		}
-		
-		if(grantRequest)
-			{
-			/* Replace the shared object's value: */
-			if(so.object!=0)
-				so.object->unref();
-			++so.version;
-			
-			/* Store the new object representation: */
-			so.object=object->ref();
-			
-			/* Send a ReplaceNsObjectNotification message to all clients sharing the namespace: */
-			{
-			MessageWriter headerWriter(MessageBuffer::create(serverMessageBase+ReplaceNsObjectNotification,ReplaceNsObjectMsg::size));
-			headerWriter.write(ns->id);
-			headerWriter.write(so.id);
-			headerWriter.write(so.version);
-			
-			for(ClientIDList::iterator cIt=ns->clients.begin();cIt!=ns->clients.end();++cIt)
-				if(*cIt!=clientId)
-					{
-					/* Send the message header and body separately: */
-					Server::Client* c=server->getClient(*cIt);
-					c->queueMessage(headerWriter.getBuffer());
-					c->queueMessage(so.object);
-					}
-			}
-			}
+		/* Check the shared object's new value in a worker thread and finish the request afterwards: */
+		server->submitJob(clientId,cont);
 		
 		/* Done with the message: */
-		delete cont;
 		cont=0;
 		}
 	
@@ -1266,18 +1401,42 @@ void KoinoniaServer::setMessageBases(unsigned int newClientMessageBase,unsigned
 	cd.addCommandCallback("Koinonia::deleteNamespace",Misc::CommandDispatcher::wrapMethod<KoinoniaServer,&KoinoniaServer::deleteNamespaceCommand>,this,"<namespace ID>","Deletes the shared namespace of the given ID");
 	}
 
+void KoinoniaServer::clientConnected(unsigned int clientId)
+	{
+	/* Call the base class method: */
+	PluginServer::clientConnected(clientId);
+	
+	/* Set the new client's state structure: */
+	server->getClient(clientId)->setPlugin(pluginIndex,new Client);
+	}
+
 void KoinoniaServer::clientDisconnected(unsigned int clientId)
 	{
 	/* Call the base class method: */
 	PluginServer::clientDisconnected(clientId);
 	
-	/* Remove the disconnected client from all shared objects: */
-	for(SharedObjectMap::Iterator soIt=sharedObjects.begin();!soIt.isFinished();++soIt)
-		removeClientFromList(soIt->getDest()->clients,clientId);
+	/* Remove the disconnected client from the client lists of all shared objects and shared namespaces it shares: */
+	Client* client=server->getPlugin<Client>(clientId,pluginIndex);
+	for(std::vector<Client::Membership>::iterator mIt=client->memberships.begin();mIt!=client->memberships.end();++mIt)
+		{
+		ClientIDList& clients=*mIt->clients;
+		std::vector<unsigned int>& membershipIndices=*mIt->membershipIndices;
 	
-	/* Remove the disconnected client from all shared namespaces: */
-	for(NamespaceMap::Iterator nsIt=namespaces.begin();!nsIt.isFinished();++nsIt)
-		removeClientFromList(nsIt->getDest()->clients,clientId);
+		/* Move the last entry of the client list into the client's entry: */
+		unsigned int lastIndex=clients.size()-1;
+		if(mIt->listIndex!=lastIndex)
+			{
+			clients[mIt->listIndex]=clients[lastIndex];
+			membershipIndices[mIt->listIndex]=membershipIndices[lastIndex];
+			
+			/* Update the moved entry's membership record: */
+			Client* movedClient=server->getPlugin<Client>(clients[mIt->listIndex],pluginIndex);
+			movedClient->memberships[membershipIndices[mIt->listIndex]].listIndex=mIt->listIndex;
+			}
+		clients.pop_back();
+		membershipIndices.pop_back();
+		}
+	client->memberships.clear();
 	}
 
 /***********************
@@ -7,6 +7,7 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #define PLUGINS_KOINONIASERVER_INCLUDED
 
 #include <string>
+#include <vector>
 #include <Misc/SizedTypes.h>
 #include <Misc/StringHashFunctions.h>
 #include <Misc/HashTable.h>
@@ -23,6 +24,32 @@ class KoinoniaServer:public PluginServer,public KoinoniaProtocol
 	{
 	/* Embedded classes: */
 	private:
+	class Client:public PluginServer::Client // Class representing a client participating in the Koinonia protocol
+		{
+		friend class KoinoniaServer;
+		
+		/* Embedded classes: */
+		private:
+		struct Membership // Structure recording a client's entry in the client list of a shared object or shared namespace
+			{
+			/* Elements: */
+			public:
+			ClientIDList* clients; // Client list of the shared object or namespace
+			std::vector<unsigned int>* membershipIndices; // Indices of the sharing clients' membership records, parallel to the client list
+			unsigned int listIndex; // Index of the client's entry in the client list
+			
+			/* Constructors and destructors: */
+			Membership(ClientIDList& sClients,std::vector<unsigned int>& sMembershipIndices)
+				:clients(&sClients),membershipIndices(&sMembershipIndices),
+				 listIndex(sClients.size())
+				{
+				}
+			};
+		
+		/* Elements: */
+		std::vector<Membership> memberships; // List of the client's entries in the client lists of shared objects and shared namespaces
+		};
+	
 	struct SharedObject // Structure representing a globally-shared static object
 		{
 		/* Elements: */
@@ -34,6 +61,7 @@ class KoinoniaServer:public PluginServer,public KoinoniaProtocol
 		VersionNumber version; // Version number of the shared object
 		MessageBuffer* object; // Pointer to a message buffer holding the object's serialization as a ReplaceObjectNotification message
 		ClientIDList clients; // List of IDs of clients sharing this object
+		std::vector<unsigned int> membershipIndices; // Indices of the sharing clients' membership records, parallel to the client list
 		
 		/* Constructors and destructors: */
 		SharedObject(void) // Creates an uninitialized shared object
@@ -91,6 +119,7 @@ class KoinoniaServer:public PluginServer,public KoinoniaProtocol
 		ObjectID lastObjectId; // ID that was assigned to the most recently created shared object
 		SharedObjectMap sharedObjects; // Map of current shared objects
 		ClientIDList clients; // List of IDs of clients sharing this namespace
+		std::vector<unsigned int> membershipIndices; // Indices of the sharing clients' membership records, parallel to the client list
 		
 		/* Constructors and destructors: */
 		Namespace(void) // Creates an uninitialized namespace, to be filled in by message handler
@@ -111,6 +140,7 @@ class KoinoniaServer:public PluginServer,public KoinoniaProtocol
 	NamespaceNameMap namespaceNames; // Secondary map from namespace names to shared namespaces
 	
 	/* Private methods: */
+	void addSharingClient(ClientIDList& clients,std::vector<unsigned int>& membershipIndices,unsigned int clientId); // Adds the client of the given ID to the given client list of a shared object or shared namespace
 	void listObjectsCommand(const char* argumentsBegin,const char* argumentsEnd);
 	void printObjectCommand(const char* argumentsBegin,const char* argumentsEnd);
 	void saveObjectCommand(const char* argumentsBegin,const char* argumentsEnd);
@@ -143,6 +173,7 @@ class KoinoniaServer:public PluginServer,public KoinoniaProtocol
 	virtual unsigned int getNumClientMessages(void) const;
 	virtual unsigned int getNumServerMessages(void) const;
 	virtual void setMessageBases(unsigned int newClientMessageBase,unsigned int newServerMessageBase);
+	virtual void clientConnected(unsigned int clientId);
 	virtual void clientDisconnected(unsigned int clientId);
 	};
 
@@ -0,0 +1,121 @@
+/***********************************************************************
+TransformInterpolator - Class to reconstruct a smooth trajectory of a
+rigid-body transformation from a stream of time-stamped samples, by
+interpolating between buffered samples and extrapolating past the most
+recent one.
+Copyright (c) 2020 Oliver Kreylos
+***********************************************************************/
+
+#include <Collaboration2/Plugins/TransformInterpolator.h>
+
+/**************************************
+Methods of class TransformInterpolator:
+**************************************/
+
+TransformInterpolator::Rotation TransformInterpolator::blend(const TransformInterpolator::Rotation& r0,const TransformInterpolator::Rotation& r1,TransformInterpolator::Scalar w)
+	{
+	/* Scale the rotation from r0 to r1 around its axis: */
+	Rotation delta=r1*Geometry::invert(r0);
+	Rotation result=Rotation::rotateScaledAxis(delta.getScaledAxis()*w)*r0;
+	result.renormalize();
+	return result;
+	}
+
+void TransformInterpolator::reset(const TransformInterpolator::ONTransform& transform)
+	{
+	/* Replace all samples with the given transformation: */
+	newest=0;
+	samples[newest].time=0.0;
+	samples[newest].transform=transform;
+	numSamples=1;
+	held=true;
+	}
+
+void TransformInterpolator::addSample(double time,const TransformInterpolator::ONTransform& transform)
+	{
+	/* Discard an un-timed held transformation: */
+	if(held)
+		{
+		numSamples=0;
+		held=false;
+		}
+	
+	/* Ignore the sample if it is not newer than the most recent one: */
+	if(numSamples>0&&time<=getSample(0).time)
+		return;
+	
+	/* Append the sample to the ring buffer, overwriting the oldest sample if the buffer is full: */
+	newest=(newest+1)%maxNumSamples;
+	samples[newest].time=time;
+	samples[newest].transform=transform;
+	if(numSamples<maxNumSamples)
+		++numSamples;
+	}
+
+TransformInterpolator::ONTransform TransformInterpolator::evaluate(double time,double maxExtrapolation) const
+	{
+	/* Return the most recent transformation if there is nothing to interpolate: */
+	if(numSamples<2)
+		return getSample(0).transform;
+	
+	const Sample& s0=getSample(0);
+	if(time>=s0.time)
+		{
+		/*******************************************************************
+		Dead-reckon past the most recent sample using the velocities between
+		the two most recent samples for at most the maximum extrapolation
+		interval, then fade back to the most recent sample over the same
+		interval so that a source that stopped sending updates because it
+		stopped moving does not remain overshot.
+		*******************************************************************/
+		
+		double extrapolation=time-s0.time;
+		if(extrapolation>=2.0*maxExtrapolation)
+			return s0.transform;
+		if(extrapolation>maxExtrapolation)
+			extrapolation=2.0*maxExtrapolation-extrapolation;
+		
+		const Sample& s1=getSample(1);
+		Scalar w=Scalar(extrapolation/(s0.time-s1.time));
+		Vector translation=s0.transform.getTranslation()+(s0.transform.getTranslation()-s1.transform.getTranslation())*w;
+		return ONTransform(translation,blend(s1.transform.getRotation(),s0.transform.getRotation(),Scalar(1)+w));
+		}
+	
+	/* Find the pair of buffered samples bracketing the given time: */
+	int age;
+	for(age=1;age<numSamples&&getSample(age).time>time;++age)
+		;
+	if(age==numSamples)
+		{
+		/* Hold the oldest sample: */
+		return getSample(numSamples-1).transform;
+		}
+	const Sample& p0=getSample(age);
+	const Sample& p1=getSample(age-1);
+	double dt=p1.time-p0.time;
+	Scalar w=Scalar((time-p0.time)/dt);
+	
+	/* Calculate Catmull-Rom tangents for the translations at both samples, falling back to the secant at the ends of the buffer: */
+	Vector secant=p1.transform.getTranslation()-p0.transform.getTranslation();
+	Vector m0=secant;
+	if(age+1<numSamples)
+		{
+		const Sample& pm=getSample(age+1);
+		m0=(p1.transform.getTranslation()-pm.transform.getTranslation())*Scalar(dt/(p1.time-pm.time));
+		}
+	Vector m1=secant;
+	if(age>=2)
+		{
+		const Sample& p2=getSample(age-2);
+		m1=(p2.transform.getTranslation()-p0.transform.getTranslation())*Scalar(dt/(p2.time-p0.time));
+		}
+	
+	/* Interpolate the translations with a cubic Hermite spline, and the rotations spherically: */
+	Scalar w2=w*w;
+	Scalar w3=w2*w;
+	Vector translation=p0.transform.getTranslation()*(Scalar(2)*w3-Scalar(3)*w2+Scalar(1));
+	translation+=m0*(w3-Scalar(2)*w2+w);
+	translation+=p1.transform.getTranslation()*(Scalar(3)*w2-Scalar(2)*w3);
+	translation+=m1*(w3-w2);
+	return ONTransform(translation,blend(p0.transform.getRotation(),p1.transform.getRotation(),w));
+	}
@@ -0,0 +1,64 @@
+/***********************************************************************
+TransformInterpolator - Class to reconstruct a smooth trajectory of a
+rigid-body transformation from a stream of time-stamped samples, by
+interpolating between buffered samples and extrapolating past the most
+recent one.
+Copyright (c) 2020 Oliver Kreylos
+***********************************************************************/
+
+#ifndef TRANSFORMINTERPOLATOR_INCLUDED
+#define TRANSFORMINTERPOLATOR_INCLUDED
+
+#include <Collaboration2/Plugins/VruiCoreProtocol.h>
+
+class TransformInterpolator
+	{
+	/* Embedded classes: */
+	public:
+	typedef VruiCoreProtocol::Scalar Scalar;
+	typedef VruiCoreProtocol::Vector Vector;
+	typedef VruiCoreProtocol::Rotation Rotation;
+	typedef VruiCoreProtocol::ONTransform ONTransform;
+	
+	private:
+	struct Sample // Structure for a time-stamped transformation sample
+		{
+		/* Elements: */
+		public:
+		double time; // Sampling time in the source's time frame
+		ONTransform transform; // Sampled transformation
+		};
+	
+	static const int maxNumSamples=4; // Maximum number of buffered samples
+	
+	/* Elements: */
+	Sample samples[maxNumSamples]; // Ring buffer of the most recent samples, in order of increasing sampling time
+	int newest; // Index of the most recent sample in the ring buffer
+	int numSamples; // Number of samples currently in the ring buffer
+	bool held; // Flag whether the ring buffer contains a single un-timed transformation set by reset
+	
+	/* Private methods: */
+	const Sample& getSample(int age) const // Returns the sample of the given age, where 0 is the most recent sample
+		{
+		return samples[(newest+maxNumSamples-age)%maxNumSamples];
+		}
+	static Rotation blend(const Rotation& r0,const Rotation& r1,Scalar w); // Spherically interpolates or extrapolates between the two given rotations
+	
+	/* Constructors and destructors: */
+	public:
+	TransformInterpolator(void) // Creates an empty interpolator
+		:newest(0),numSamples(0),held(false)
+		{
+		}
+	
+	/* Methods: */
+	void reset(const ONTransform& transform); // Discards all buffered samples and holds the given un-timed transformation until the next sample arrives
+	void addSample(double time,const ONTransform& transform); // Adds a sample taken at the given time; samples that are not newer than the most recent one are ignored
+	bool isAnimating(double time,double maxExtrapolation) const // Returns true if the reconstructed transformation still changes at or after the given time
+		{
+		return numSamples>=2&&time<getSample(0).time+2.0*maxExtrapolation;
+		}
+	ONTransform evaluate(double time,double maxExtrapolation) const; // Returns the reconstructed transformation at the given time, extrapolating for at most the given time interval past the most recent sample
+	};
+
+#endif
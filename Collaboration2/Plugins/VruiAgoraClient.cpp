@@ -449,7 +449,7 @@ void VruiAgoraClient::RemoteClient::enqueuePacket(const Threads::EventDispatcher
 	if(state==PlaybackThreadSuspended)
 		{
 		/* Initialize the jitter buffer and latency conditioner: */
-		jitterBuffer.init(sequenceNumber,packet->ref());
+		jitterBuffer.init(sequenceNumber,packet->refShared());
 		
 		// DEBUGGING
 		// Misc::formattedLogNote("Enqueue,%d,%f,%f",sequenceNumber,double(TimeStamp(arrival-timebase))/1.0e3,double(TimeStamp(arrival-timebase))/1.0e3);
@@ -463,7 +463,7 @@ void VruiAgoraClient::RemoteClient::enqueuePacket(const Threads::EventDispatcher
 	else if(state==PlaybackThreadRunning)
 		{
 		/* Enqueue the packet into the jitter buffer and update the latency conditioner: */
-		jitterBuffer.enqueue(sequenceNumber,packet->ref());
+		jitterBuffer.enqueue(sequenceNumber,packet->refShared());
 		TimeStamp expectedArrival=headArrival+TimeStamp(Sequence(sequenceNumber-jitterBuffer.getHeadSequence()))*period;
 		
 		// DEBUGGING
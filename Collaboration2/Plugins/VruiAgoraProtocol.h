@@ -82,7 +82,7 @@ class VruiAgoraProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int serverMessageBase) // Returns a message buffer for a connect notification message
 			{
-			return MessageBuffer::create(serverMessageBase+ConnectNotification,size);
+			return MessageBuffer::create(serverMessageBase+ConnectNotification,size)->setOrdered();
 			}
 		};
 	
@@ -102,7 +102,7 @@ class VruiAgoraProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int messageId,size_t audioPacketLen) // Returns a message buffer for an audio packet request or reply message with the given encoded audio packet size
 			{
-			return MessageBuffer::create(messageId,size+audioPacketLen);
+			return MessageBuffer::create(messageId,size+audioPacketLen)->setSendPriority(MessageBuffer::RealTime);
 			}
 		};
 	
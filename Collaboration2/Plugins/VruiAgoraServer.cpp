@@ -136,9 +136,10 @@ MessageContinuation* VruiAgoraServer::audioPacketRequestCallback(unsigned int me
 			/* Check if the message is a broadcast message: */
 			if(cont->destClientId==0)
 				{
-				/* Send the message to all clients receiving audio data from the source client: */
+				/* Send the message to all clients receiving audio data from the source client that are within audibility range: */
 				for(ClientIDList::iterator cIt=vaClient->receivers.begin();cIt!=vaClient->receivers.end();++cIt)
-					server->queueUDPMessageFallback(*cIt,cont->audioPacketReply.getBuffer());
+					if(vruiCore->isAudible(clientId,*cIt))
+						server->queueUDPMessageFallback(*cIt,cont->audioPacketReply.getBuffer());
 				}
 			else
 				{
@@ -177,6 +178,7 @@ void VruiAgoraServer::udpAudioPacketRequestCallback(unsigned int messageId,unsig
 	
 	/* Re-write the message header to set the proper message ID, exchange destination for source client, and fix potential endianness difference: */
 	message.getBuffer()->setMessageId(serverMessageBase+AudioPacketReply);
+	message.getBuffer()->setSendPriority(MessageBuffer::RealTime);
 	{
 	MessageWriter writer(message.getBuffer()->ref()); // Add another reference for the writer
 	writer.write(ClientID(clientId));
@@ -191,9 +193,10 @@ void VruiAgoraServer::udpAudioPacketRequestCallback(unsigned int messageId,unsig
 		/* Check if the message is a broadcast message: */
 		if(destClientId==0)
 			{
-			/* Send the message to all clients receiving audio data from the source client: */
+			/* Send the message to all clients receiving audio data from the source client that are within audibility range: */
 			for(ClientIDList::iterator cIt=vaClient->receivers.begin();cIt!=vaClient->receivers.end();++cIt)
-				server->queueUDPMessageFallback(*cIt,message.getBuffer());
+				if(vruiCore->isAudible(clientId,*cIt))
+					server->queueUDPMessageFallback(*cIt,message.getBuffer());
 			}
 		else
 			{
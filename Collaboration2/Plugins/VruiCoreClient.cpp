@@ -8,6 +8,9 @@ Copyright (c) 2019-2020 Oliver Kreylos
 
 #include <Collaboration2/Plugins/VruiCoreClient.h>
 
+#include <string.h>
+#include <stdexcept>
+#include <Misc/Utility.h>
 #include <Misc/ThrowStdErr.h>
 #include <Misc/MessageLogger.h>
 #include <Misc/CommandDispatcher.h>
@@ -45,7 +48,9 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #include <Collaboration2/Config.h>
 #include <Collaboration2/MessageReader.h>
 #include <Collaboration2/MessageWriter.h>
+#include <Collaboration2/MessageContinuation.h>
 #include <Collaboration2/NonBlockSocket.h>
+#include <Collaboration2/MessageView.h>
 
 /*********************************************
 Methods of class VruiCoreClient::RemoteClient:
@@ -119,20 +124,72 @@ void VruiCoreClient::RemoteClient::updateViewerConfig(MessageReader& message)
 		}
 	}
 
-void VruiCoreClient::RemoteClient::updateViewerState(MessageReader& message)
+void VruiCoreClient::RemoteClient::updateViewerState(MessageReader& message,bool quantized)
 	{
 	/* Read the viewer state: */
-	viewerState.read(message);
+	viewerState.read(message,quantized,environment);
 	
 	/* Update the scene graph: */
 	headRoot->transform.setValue(viewerState.headTransform);
 	headRoot->update();
 	}
 
+double VruiCoreClient::RemoteClient::getSampleTime(VruiCoreProtocol::TimeStamp timeStamp,double receiveTime)
+	{
+	/* Start the remote client's time line at the first received time stamp: */
+	if(!haveTimeStamp)
+		{
+		lastTimeStamp=timeStamp;
+		lastTime=0.0;
+		timeOffset=receiveTime;
+		haveTimeStamp=true;
+		}
+	
+	/* Unwrap the time stamp relative to the most recent one: */
+	double time=double(Misc::SInt32(timeStamp-lastTimeStamp))*1.0e-6+lastTime;
+	if(time>lastTime)
+		{
+		lastTimeStamp=timeStamp;
+		lastTime=time;
+		}
+	
+	/*********************************************************************
+	Track the smallest observed offset between sampling and receive times,
+	which corresponds to the minimal network latency, and let the estimate
+	creep up slowly to follow clock drift and lasting latency increases.
+	*********************************************************************/
+	
+	double offset=receiveTime-time;
+	if(offset<timeOffset)
+		timeOffset=offset;
+	else
+		timeOffset+=(offset-timeOffset)*0.01;
+	
+	return time;
+	}
+
+void VruiCoreClient::RemoteClient::updateDeviceTransform(DeviceState& device,const ONTransform& transform)
+	{
+	/* Check if the device is enabled and the client is showing devices: */
+	if(device.enabled&&hideDevicesCount==0)
+		{
+		/* Update the device's scene graph: */
+		ONTransform t=transform;
+		t*=device.glyphTransform;
+		device.root->translation.setValue(t.getTranslation());
+		device.root->rotation.setValue(t.getRotation());
+		device.root->update();
+		}
+	}
+
 VruiCoreClient::RemoteClient::RemoteClient(unsigned int sId)
 	:id(sId),
 	 sharedEnvironment(0),
+	 viewerSequence(0),
+	 haveTimeStamp(false),lastTimeStamp(0),lastTime(0.0),timeOffset(0.0),
+	 trackingDirty(false),trackingAnimating(false),
 	 navLockedClient(0),
+	 navDirty(true),navResolvePass(0),navChanged(false),
 	 deviceIndexMap(5),
 	 hideMainViewerCount(0),hideDevicesCount(0)
 	{
@@ -141,7 +198,11 @@ VruiCoreClient::RemoteClient::RemoteClient(unsigned int sId)
 VruiCoreClient::RemoteClient::RemoteClient(VruiCoreClient* client,MessageReader& message)
 	:id(message.read<ClientID>()),
 	 sharedEnvironment(0),
+	 viewerSequence(0),
+	 haveTimeStamp(false),lastTimeStamp(0),lastTime(0.0),timeOffset(0.0),
+	 trackingDirty(false),trackingAnimating(false),
 	 navLockedClient(0),
+	 navDirty(true),navResolvePass(0),navChanged(false),
 	 deviceIndexMap(5),
 	 hideMainViewerCount(client->drawRemoteMainViewers?0:1),
 	 hideNameTagCount(client->drawRemoteNameTags?0:1),
@@ -210,6 +271,42 @@ VruiCoreClient::RemoteClient::RemoteClient(VruiCoreClient* client,MessageReader&
 	/* The client's scene graph will be fully initialized and added to the main scene graph once its Vrui Core connect notification message has arrived */
 	}
 
+bool VruiCoreClient::RemoteClient::resolveNavTransform(unsigned int pass)
+	{
+	/* Return the cached result if the client was already resolved during this pass, which also breaks lock cycles: */
+	if(navResolvePass==pass)
+		return navChanged;
+	navResolvePass=pass;
+	
+	/* The full navigation transformation changed if the client's own changed, or if that of the client it is locked to changed: */
+	navChanged=navDirty;
+	navDirty=false;
+	if(navLockedClient!=0&&navLockedClient->resolveNavTransform(pass))
+		navChanged=true;
+	
+	if(navChanged)
+		{
+		/* Append the lock client's already resolved full navigation transformation: */
+		fullNavTransform=navTransform;
+		if(navLockedClient!=0)
+			{
+			fullNavTransform*=navLockedClient->fullNavTransform;
+			fullNavTransform.renormalize();
+			}
+		
+		/* Update the client's physical-space scene graph; the local client does not have one: */
+		if(physicalRoot.getPointer()!=0)
+			{
+			NavTransform inverseNav=fullNavTransform;
+			inverseNav.doInvert();
+			physicalRoot->transform.setValue(inverseNav);
+			physicalRoot->update();
+			}
+		}
+	
+	return navChanged;
+	}
+
 void VruiCoreClient::RemoteClient::hideMainViewer(void)
 	{
 	if(hideMainViewerCount==0)
@@ -279,6 +376,9 @@ void VruiCoreClient::RemoteClient::showDevices(void)
 			if(dIt->enabled)
 				physicalRoot->children.appendValue(dIt->root);
 		physicalRoot->update();
+		
+		/* Bring the devices' interpolated transformations up to date: */
+		trackingDirty=true;
 		}
 	}
 
@@ -319,6 +419,118 @@ void VruiCoreClient::sendNavTransform(const VruiCoreProtocol::NavTransform& newN
 	}
 	}
 
+void VruiCoreClient::sendTrackingUpdates(void)
+	{
+	/* Send the main viewer's state and the transformations of all changed devices in as few batched updates as possible: */
+	bool sendViewerState=viewerDirty;
+	TimeStamp timeStamp=TimeStamp(Misc::UInt64(Vrui::getApplicationTime()*1.0e6+0.5));
+	RemoteClient::DeviceList::iterator dIt=self.devices.begin();
+	while(true)
+		{
+		/* Find the range of devices to send in the next batched update: */
+		RemoteClient::DeviceList::iterator dEnd=dIt;
+		size_t numDevices=0;
+		bool quantized=quantizeTrackingUpdates&&(!sendViewerState||canQuantize(self.viewerState.headTransform,self.environment));
+		for(;dEnd!=self.devices.end()&&numDevices<UpdateInputDevicesMsg::maxNumDevices;++dEnd)
+			if(dEnd->dirty)
+				{
+				++numDevices;
+				
+				/* Fall back to full precision for the entire batch if any device is outside the quantized range: */
+				quantized=quantized&&canQuantize(dEnd->transform,self.environment);
+				}
+		
+		/* Bail out if there is nothing left to send: */
+		if(!sendViewerState&&numDevices==0)
+			break;
+		
+		/* Send a batched update: */
+		{
+		MessageWriter updateInputDevicesRequest(UpdateInputDevicesMsg::createMessage(clientMessageBase+UpdateInputDevicesRequest,sendViewerState,quantized,numDevices));
+		updateInputDevicesRequest.write(ClientID(client->getId()));
+		updateInputDevicesRequest.write(UpdateSequence(++lastUpdateSequence));
+		updateInputDevicesRequest.write(timeStamp);
+		writeBool(sendViewerState,updateInputDevicesRequest);
+		writeBool(quantized,updateInputDevicesRequest);
+		updateInputDevicesRequest.write(Misc::UInt8(numDevices));
+		if(sendViewerState)
+			self.viewerState.write(quantized,self.environment,updateInputDevicesRequest);
+		for(;dIt!=dEnd;++dIt)
+			if(dIt->dirty)
+				{
+				updateInputDevicesRequest.write(InputDeviceID(dIt->id));
+				writeTransform(dIt->transform,quantized,self.environment,updateInputDevicesRequest);
+				dIt->dirty=false;
+				}
+		queueStateUpdate(updateInputDevicesRequest.getBuffer());
+		}
+		
+		sendViewerState=false;
+		}
+	
+	viewerDirty=false;
+	devicesDirty=false;
+	}
+
+bool VruiCoreClient::applyTrackingUpdates(MessageReader& message)
+	{
+	/* Read the batched update's header: */
+	unsigned int sourceClientId=message.read<ClientID>();
+	UpdateSequence sequence=message.read<UpdateSequence>();
+	TimeStamp timeStamp=message.read<TimeStamp>();
+	bool haveViewerState=readBool(message);
+	bool quantized=readBool(message);
+	unsigned int numDevices=message.read<Misc::UInt8>();
+	
+	/* Find the remote client; ignore the update if it overtook the client's connect notification on the TCP socket: */
+	RemoteClientMap::Iterator rcIt=remoteClientMap.findEntry(sourceClientId);
+	if(rcIt.isFinished())
+		{
+		message.advanceReadPtr(UpdateInputDevicesMsg::getBodySize(haveViewerState,quantized,numDevices));
+		return false;
+		}
+	RemoteClient* rc=rcIt->getDest();
+	double sampleTime=rc->getSampleTime(timeStamp,Vrui::getApplicationTime());
+	rc->trackingDirty=true;
+	
+	/* Update the remote client's viewer state unless the update was overtaken by a newer one: */
+	if(haveViewerState)
+		{
+		if(isNewerUpdate(sequence,rc->viewerSequence))
+			{
+			rc->viewerSequence=sequence;
+			rc->updateViewerState(message,quantized);
+			rc->headInterpolator.addSample(sampleTime,rc->viewerState.headTransform);
+			}
+		else
+			message.advanceReadPtr(ClientViewerState::getSize(quantized));
+		}
+	
+	/* Update the transformations of all devices in the message: */
+	bool complete=true;
+	for(unsigned int i=0;i<numDevices;++i)
+		{
+		/* Ignore the update if it overtook the device's creation notification on the TCP socket, or was overtaken by a newer one for the same device: */
+		RemoteClient::DeviceIndexMap::Iterator diIt=rc->deviceIndexMap.findEntry(message.read<InputDeviceID>());
+		if(!diIt.isFinished()&&isNewerUpdate(sequence,rc->devices[diIt->getDest()].sequence))
+			{
+			/* Update the device's transformation and scene graph: */
+			RemoteClient::DeviceState& device=rc->devices[diIt->getDest()];
+			device.sequence=sequence;
+			device.transform=readTransform(message,quantized,rc->environment);
+			device.interpolator.addSample(sampleTime,device.transform);
+			rc->updateDeviceTransform(device,device.transform);
+			}
+		else
+			{
+			message.advanceReadPtr(getTransformSize(quantized));
+			complete=complete&&!diIt.isFinished();
+			}
+		}
+	
+	return complete;
+	}
+
 void VruiCoreClient::nameChangeReplyCallback(Client::NameChangeReplyCallbackData* cbData)
 	{
 	/* Create a name change reply notification message and send it to the front end: */
@@ -339,6 +551,187 @@ void VruiCoreClient::nameChangeNotificationCallback(Client::NameChangeNotificati
 	client->queueFrontendMessage(clientNameChangeNotification.getBuffer());
 	}
 
+void VruiCoreClient::udpViewerUpdateNotificationCallback(unsigned int messageId,MessageReader& message)
+	{
+	/* Give the message a basic smell test: */
+	if(message.getUnread()!=ViewerUpdateMsg::size)
+		throw std::runtime_error("VruiCoreClient: Wrong-size viewer update message");
+	
+	/* Forward the message to the front end: */
+	client->queueFrontendMessage(message.getBuffer());
+	}
+
+void VruiCoreClient::udpUpdateInputDeviceNotificationCallback(unsigned int messageId,MessageReader& message)
+	{
+	/* Give the message a basic smell test: */
+	if(message.getUnread()!=UpdateInputDeviceMsg::size)
+		throw std::runtime_error("VruiCoreClient: Wrong-size update input device message");
+	
+	/* Forward the message to the front end: */
+	client->queueFrontendMessage(message.getBuffer());
+	}
+
+MessageContinuation* VruiCoreClient::updateInputDevicesForwarderCallback(unsigned int messageId,MessageContinuation* continuation)
+	{
+	/* Embedded classes: */
+	class Cont:public MessageContinuation
+		{
+		/* Elements: */
+		public:
+		MessageWriter message; // Writer to assemble the complete message
+		
+		/* Constructors and destructors: */
+		Cont(unsigned int messageId,size_t messageSize)
+			:message(MessageBuffer::create(messageId,messageSize))
+			{
+			}
+		};
+	
+	NonBlockSocket& socket=client->getSocket();
+	
+	/* Check if this is the start of a new message: */
+	Cont* cont=static_cast<Cont*>(continuation);
+	if(cont==0)
+		{
+		/* Parse the fixed-size message header in place in the TCP socket's read buffer to determine the message's total size: */
+		MessageView header(socket,UpdateInputDevicesMsg::size);
+		header.read<ClientID>();
+		header.read<UpdateSequence>();
+		header.read<TimeStamp>();
+		bool haveViewerState=header.read<Bool>()!=0;
+		bool quantized=header.read<Bool>()!=0;
+		size_t numDevices=header.read<Misc::UInt8>();
+		
+		/* Create a message continuation and copy the unmodified message header into it: */
+		cont=new Cont(messageId,UpdateInputDevicesMsg::size+UpdateInputDevicesMsg::getBodySize(haveViewerState,quantized,numDevices));
+		header.rewind();
+		memcpy(cont->message.getWritePtr(),header.getReadPtr(),header.getSize());
+		cont->message.advanceWritePtr(header.getSize());
+		}
+	
+	/* Read a chunk of the message body: */
+	size_t readSize=Misc::min(socket.getUnread(),cont->message.getSpace());
+	socket.readRaw(cont->message.getWritePtr(),readSize);
+	cont->message.advanceWritePtr(readSize);
+	
+	/* Check if the message was read completely: */
+	if(cont->message.eof())
+		{
+		/* Forward the message to the front end: */
+		client->queueFrontendMessage(cont->message.getBuffer());
+		
+		/* Done with the message: */
+		delete cont;
+		cont=0;
+		}
+	
+	return cont;
+	}
+
+void VruiCoreClient::udpUpdateInputDevicesNotificationCallback(unsigned int messageId,MessageReader& message)
+	{
+	/* Give the message a basic smell test: */
+	if(message.getUnread()<UpdateInputDevicesMsg::size)
+		throw std::runtime_error("VruiCoreClient: Truncated update input devices message");
+	message.read<ClientID>();
+	message.read<UpdateSequence>();
+	message.read<TimeStamp>();
+	bool haveViewerState=readBool(message);
+	bool quantized=readBool(message);
+	size_t numDevices=message.read<Misc::UInt8>();
+	if(message.getUnread()!=UpdateInputDevicesMsg::getBodySize(haveViewerState,quantized,numDevices))
+		throw std::runtime_error("VruiCoreClient: Wrong-size update input devices message");
+	
+	/* Forward the message to the front end: */
+	client->queueFrontendMessage(message.getBuffer());
+	}
+
+MessageContinuation* VruiCoreClient::snapshotForwarderCallback(unsigned int messageId,MessageContinuation* continuation)
+	{
+	/* Embedded classes: */
+	class Cont:public MessageContinuation
+		{
+		/* Elements: */
+		public:
+		MessageWriter message; // Writer to assemble the complete message
+		
+		/* Constructors and destructors: */
+		Cont(unsigned int messageId,size_t messageSize)
+			:message(MessageBuffer::create(messageId,messageSize))
+			{
+			}
+		};
+	
+	NonBlockSocket& socket=client->getSocket();
+	
+	/* Check if this is the start of a new message: */
+	Cont* cont=static_cast<Cont*>(continuation);
+	if(cont==0)
+		{
+		/* Parse the fixed-size message header in place in the TCP socket's read buffer to determine the message's total size: */
+		MessageView header(socket,SnapshotMsg::size);
+		header.read<UpdateSequence>();
+		header.read<Misc::UInt16>();
+		size_t bodySize=header.read<Misc::UInt16>();
+		
+		/* Create a message continuation and copy the unmodified message header into it: */
+		cont=new Cont(messageId,SnapshotMsg::size+bodySize);
+		header.rewind();
+		memcpy(cont->message.getWritePtr(),header.getReadPtr(),header.getSize());
+		cont->message.advanceWritePtr(header.getSize());
+		}
+	
+	/* Read a chunk of the message body: */
+	size_t readSize=Misc::min(socket.getUnread(),cont->message.getSpace());
+	socket.readRaw(cont->message.getWritePtr(),readSize);
+	cont->message.advanceWritePtr(readSize);
+	
+	/* Check if the message was read completely: */
+	if(cont->message.eof())
+		{
+		/* Forward the message to the front end: */
+		client->queueFrontendMessage(cont->message.getBuffer());
+		
+		/* Done with the message: */
+		delete cont;
+		cont=0;
+		}
+	
+	return cont;
+	}
+
+void VruiCoreClient::udpSnapshotNotificationCallback(unsigned int messageId,MessageReader& message)
+	{
+	/* Give the message a basic smell test: */
+	if(message.getUnread()<SnapshotMsg::size)
+		throw std::runtime_error("VruiCoreClient: Truncated snapshot message");
+	message.read<UpdateSequence>();
+	message.read<Misc::UInt16>();
+	size_t bodySize=message.read<Misc::UInt16>();
+	if(message.getUnread()!=bodySize)
+		throw std::runtime_error("VruiCoreClient: Wrong-size snapshot message");
+	
+	/* Check that the message body consists of well-formed batched updates, as the front end must not choke on it: */
+	while(!message.eof())
+		{
+		if(message.getUnread()<UpdateInputDevicesMsg::size)
+			throw std::runtime_error("VruiCoreClient: Truncated batched update in snapshot message");
+		message.read<ClientID>();
+		message.read<UpdateSequence>();
+		message.read<TimeStamp>();
+		bool haveViewerState=readBool(message);
+		bool quantized=readBool(message);
+		size_t numDevices=message.read<Misc::UInt8>();
+		size_t updateBodySize=UpdateInputDevicesMsg::getBodySize(haveViewerState,quantized,numDevices);
+		if(message.getUnread()<updateBodySize)
+			throw std::runtime_error("VruiCoreClient: Truncated batched update in snapshot message");
+		message.advanceReadPtr(updateBodySize);
+		}
+	
+	/* Forward the message to the front end: */
+	client->queueFrontendMessage(message.getBuffer());
+	}
+
 void VruiCoreClient::startNotificationCallback(unsigned int messageId,MessageReader& message)
 	{
 	/* Put this client's self-representation into the remote client map, as a sentinel: */
@@ -703,6 +1096,7 @@ void VruiCoreClient::clientDisconnectNotificationCallback(unsigned int messageId
 		self.navLockedClient=0;
 		self.navTransform*=disconnectedNavTransform;
 		self.navTransform.renormalize();
+		self.navDirty=true;
 		}
 	
 	/* Check if any remaining remote clients hold navigation locks on the disconnected client: */
@@ -715,6 +1109,7 @@ void VruiCoreClient::clientDisconnectNotificationCallback(unsigned int messageId
 			(*rcIt)->navLockedClient=0;
 			(*rcIt)->navTransform*=disconnectedNavTransform;
 			(*rcIt)->navTransform.renormalize();
+			(*rcIt)->navDirty=true;
 			}
 		}
 	
@@ -756,6 +1151,7 @@ void VruiCoreClient::connectReplyCallback(unsigned int messageId,MessageReader&
 	
 	/* Read the shared environment's current navigation transformation: */
 	Misc::read(message,self.navTransform);
+	self.navDirty=true;
 	
 	/* Update Vrui's navigation transformation: */
 	setNavTransform(self.navTransform);
@@ -793,6 +1189,7 @@ void VruiCoreClient::connectNotificationCallback(unsigned int messageId,MessageR
 	newClient->updateEnvironment(message);
 	newClient->updateViewerConfig(message);
 	newClient->updateViewerState(message);
+	newClient->headInterpolator.reset(newClient->viewerState.headTransform);
 	Misc::read(message,newClient->navTransform);
 	
 	/* Insert the new client into the front-end client list and the remote client list box in alphabetical order by name: */
@@ -802,11 +1199,7 @@ void VruiCoreClient::connectNotificationCallback(unsigned int messageId,MessageR
 	remoteClients.insert(remoteClients.begin()+insertIndex,newClient);
 	remoteClientList->insertItem(insertIndex,newClient->name.c_str(),true);
 	
-	/* Initialize the new client's scene graph and add it to the main scene graph: */
-	NavTransform inverseNav=newClient->getNavTransform();
-	inverseNav.doInvert();
-	newClient->physicalRoot->transform.setValue(inverseNav);
-	newClient->physicalRoot->update();
+	/* Add the new client's scene graph to the main scene graph; its navigation transformation is resolved during the next frame: */
 	navigationalRoot->children.appendValue(newClient->physicalRoot);
 	navigationalRoot->update();
 	
@@ -832,8 +1225,21 @@ void VruiCoreClient::viewerConfigUpdateNotificationCallback(unsigned int message
 
 void VruiCoreClient::viewerUpdateNotificationCallback(unsigned int messageId,MessageReader& message)
 	{
-	/* Update the remote client's viewer state: */
-	getRemoteClient(message)->updateViewerState(message);
+	/* Find the remote client; ignore the update if it overtook the client's connect notification on the TCP socket: */
+	RemoteClientMap::Iterator rcIt=remoteClientMap.findEntry(message.read<ClientID>());
+	if(rcIt.isFinished())
+		return;
+	RemoteClient* rc=rcIt->getDest();
+	
+	/* Ignore the update if it was overtaken by a newer one from the same client: */
+	UpdateSequence sequence=message.read<UpdateSequence>();
+	if(!isNewerUpdate(sequence,rc->viewerSequence))
+		return;
+	rc->viewerSequence=sequence;
+	
+	/* Update the remote client's viewer state; un-timed updates are shown as they arrive: */
+	rc->updateViewerState(message);
+	rc->headInterpolator.reset(rc->viewerState.headTransform);
 	}
 
 void VruiCoreClient::startNavSequenceReplyCallback(unsigned int messageId,MessageReader& message)
@@ -1002,7 +1408,7 @@ void VruiCoreClient::navTransformUpdateNotificationCallback(unsigned int message
 	else
 		{
 		/* Update the remote client's navigation transformation: */
-		Misc::read(message,rc->navTransform);
+		rc->setNavTransform(Misc::Marshaller<NavTransform>::read(message));
 		
 		/* Check if this client is locked to the remote client: */
 		RemoteClient* lockClient=self.navLockedClient;
@@ -1068,7 +1474,7 @@ void VruiCoreClient::lockNavTransformReplyCallback(unsigned int messageId,Messag
 			{
 			/* Activate the navigation lock: */
 			self.navLockedClient=lockClient;
-			self.navTransform=lockTransform;
+			self.setNavTransform(lockTransform);
 			}
 		
 		/* Stop sending navigation update callbacks: */
@@ -1131,7 +1537,7 @@ void VruiCoreClient::lockNavTransformNotificationCallback(unsigned int messageId
 		{
 		/* Lock the remote client to the lock client: */
 		rc->navLockedClient=getRemoteClient(message);
-		Misc::read(message,rc->navTransform);
+		rc->setNavTransform(Misc::Marshaller<NavTransform>::read(message));
 		}
 	
 	/* Check if this client is locked to the remote client: */
@@ -1187,7 +1593,7 @@ void VruiCoreClient::unlockNavTransformNotificationCallback(unsigned int message
 		{
 		/* Unlock the remote client: */
 		rc->navLockedClient=0;
-		Misc::read(message,rc->navTransform);
+		rc->setNavTransform(Misc::Marshaller<NavTransform>::read(message));
 		}
 	
 	/* Check if this client is locked to the remote client: */
@@ -1219,6 +1625,8 @@ void VruiCoreClient::createInputDeviceNotificationCallback(unsigned int messageI
 	
 	/* Create the device in disabled state: */
 	newDevice.enabled=false;
+	newDevice.sequence=0;
+	newDevice.dirty=false;
 	
 	/* Create a scene graph to represent the new device: */
 	newDevice.root=new SceneGraph::TransformNode;
@@ -1265,24 +1673,64 @@ void VruiCoreClient::updateInputDeviceRayNotificationCallback(unsigned int messa
 
 void VruiCoreClient::updateInputDeviceNotificationCallback(unsigned int messageId,MessageReader& message)
 	{
-	/* Find the remote client: */
-	RemoteClient* rc=getRemoteClient(message);
+	/* Find the remote client and the device state structure; ignore the update if it overtook the client's connect or the device's creation notification on the TCP socket: */
+	RemoteClientMap::Iterator rcIt=remoteClientMap.findEntry(message.read<ClientID>());
+	if(rcIt.isFinished())
+		return;
+	RemoteClient* rc=rcIt->getDest();
+	RemoteClient::DeviceIndexMap::Iterator diIt=rc->deviceIndexMap.findEntry(message.read<InputDeviceID>());
+	if(diIt.isFinished())
+		return;
+	RemoteClient::DeviceState& device=rc->devices[diIt->getDest()];
 	
-	/* Find the device state structure: */
-	RemoteClient::DeviceState& device=rc->devices[rc->deviceIndexMap.getEntry(message.read<InputDeviceID>()).getDest()];
+	/* Ignore the update if it was overtaken by a newer one for the same device: */
+	UpdateSequence sequence=message.read<UpdateSequence>();
+	if(!isNewerUpdate(sequence,device.sequence))
+		return;
+	device.sequence=sequence;
 	
-	/* Update the device's transformation: */
+	/* Update the device's transformation and scene graph; un-timed updates are shown as they arrive: */
 	Misc::read(message,device.transform);
+	device.interpolator.reset(device.transform);
+	rc->updateDeviceTransform(device,device.transform);
+	}
 	
-	/* Check if the device is enabled and the remote client is showing devices: */
-	if(device.enabled&&rc->hideDevicesCount==0)
+void VruiCoreClient::updateInputDevicesNotificationCallback(unsigned int messageId,MessageReader& message)
+	{
+	/* Apply the batched update: */
+	applyTrackingUpdates(message);
+	}
+	
+void VruiCoreClient::snapshotNotificationCallback(unsigned int messageId,MessageReader& message)
+	{
+	/* Read the snapshot part's header: */
+	UpdateSequence tick=message.read<UpdateSequence>();
+	unsigned int numParts=message.read<Misc::UInt16>();
+	message.read<Misc::UInt16>();
+	
+	/* Start tracking a new snapshot if the part belongs to a newer snapshot than the most recent one: */
+	if(isNewerUpdate(tick,snapshotTick))
 		{
-		/* Update the device's scene graph: */
-		ONTransform t=device.transform;
-		t*=device.glyphTransform;
-		device.root->translation.setValue(t.getTranslation());
-		device.root->rotation.setValue(t.getRotation());
-		device.root->update();
+		snapshotTick=tick;
+		numSnapshotParts=0;
+		snapshotComplete=true;
+		}
+	
+	/* Apply all batched updates in the snapshot part; updates from older snapshots are filtered by their sequence numbers: */
+	bool complete=true;
+	while(!message.eof())
+		complete=applyTrackingUpdates(message)&&complete;
+	
+	/* Acknowledge the snapshot once all its parts arrived and were applied completely, so that the server can use it as the new baseline: */
+	if(tick==snapshotTick)
+		{
+		snapshotComplete=snapshotComplete&&complete;
+		if(++numSnapshotParts==numParts&&snapshotComplete)
+			{
+			MessageWriter snapshotAckRequest(SnapshotAckMsg::createMessage(clientMessageBase));
+			snapshotAckRequest.write(tick);
+			queueStateUpdate(snapshotAckRequest.getBuffer());
+			}
 		}
 	}
 
@@ -1316,6 +1764,7 @@ void VruiCoreClient::enableInputDeviceNotificationCallback(unsigned int messageI
 	
 	/* Re-initialize the device's transformation: */
 	Misc::read(message,device.transform);
+	device.interpolator.reset(device.transform);
 	
 	/* Check if the device needs to be shown: */
 	if(!device.enabled&&rc->hideDevicesCount==0)
@@ -1410,30 +1859,16 @@ void VruiCoreClient::mainViewerConfigurationChangedCallback(Vrui::Viewer::Config
 	client->queueServerMessage(viewerConfigUpdateRequest.getBuffer());
 	}
 	
-	/* Update the client's own viewer state: */
+	/* Update the client's own viewer state and send it to the server with the next batched update: */
 	self.viewerState.headTransform=ONTransform(Vrui::getMainViewer()->getHeadTransformation());
-	
-	/* Send the new viewer state to the server: */
-	{
-	MessageWriter viewerUpdateRequest(ViewerUpdateMsg::createMessage(clientMessageBase+ViewerUpdateRequest));
-	viewerUpdateRequest.write(ClientID(client->getId()));
-	self.viewerState.write(viewerUpdateRequest);
-	client->queueServerMessage(viewerUpdateRequest.getBuffer());
-	}
+	viewerDirty=true;
 	}
 
 void VruiCoreClient::mainViewerTrackingCallback(Vrui::InputDevice::CallbackData* cbData)
 	{
-	/* Update the client's own viewer state: */
+	/* Update the client's own viewer state and send it to the server with the next batched update: */
 	self.viewerState.headTransform=ONTransform(Vrui::getMainViewer()->getHeadTransformation());
-	
-	/* Send the new viewer state to the server: */
-	{
-	MessageWriter viewerUpdateRequest(ViewerUpdateMsg::createMessage(clientMessageBase+ViewerUpdateRequest));
-	viewerUpdateRequest.write(ClientID(client->getId()));
-	self.viewerState.write(viewerUpdateRequest);
-	client->queueServerMessage(viewerUpdateRequest.getBuffer());
-	}
+	viewerDirty=true;
 	}
 
 void VruiCoreClient::navigationTransformationChangedCallback(Vrui::NavigationTransformationChangedCallbackData* cbData)
@@ -1493,7 +1928,7 @@ void VruiCoreClient::navigationTransformationChangedCallback(Vrui::NavigationTra
 	else
 		{
 		/* Update the client's own navigation transformation: */
-		self.navTransform=NavTransform(cbData->newTransform);
+		self.setNavTransform(NavTransform(cbData->newTransform));
 		
 		/* Send the new navigation transformation to the server: */
 		sendNavTransform(self.navTransform);
@@ -1606,6 +2041,8 @@ unsigned int VruiCoreClient::addInputDevice(Vrui::InputDevice* inputDevice,bool
 		
 		/* Check if the device is enabled: */
 		newDevice.enabled=igm->isEnabled(inputDevice);
+		newDevice.sequence=0;
+		newDevice.dirty=false;
 		if(newDevice.enabled)
 			{
 			/* Retrieve the device's transformation: */
@@ -1773,22 +2210,17 @@ void VruiCoreClient::inputDeviceRayDirectionCallback(Vrui::InputDevice::Callback
 void VruiCoreClient::inputDeviceTrackingCallback(Vrui::InputDevice::CallbackData* cbData)
 	{
 	/* Find the input device in the device list: */
-	ClientInputDeviceState& device=self.devices[inputDeviceIndexMap.getEntry(cbData->inputDevice).getDest()];
+	RemoteClient::DeviceState& device=self.devices[inputDeviceIndexMap.getEntry(cbData->inputDevice).getDest()];
 	
 	/* Update the device's transformation: */
 	device.transform=ONTransform(cbData->inputDevice->getTransformation());
 	
-	/* Check whether the back end is ready and the device is enabled: */
+	/* Check whether the device is enabled: */
 	if(device.enabled)
 		{
-		/* Send the new device transformation to the server: */
-		{
-		MessageWriter updateInputDeviceRequest(UpdateInputDeviceMsg::createMessage(clientMessageBase+UpdateInputDeviceRequest));
-		updateInputDeviceRequest.write(ClientID(client->getId()));
-		updateInputDeviceRequest.write(InputDeviceID(device.id));
-		Misc::write(device.transform,updateInputDeviceRequest);
-		client->queueServerMessage(updateInputDeviceRequest.getBuffer());
-		}
+		/* Send the new device transformation to the server with the next batched update: */
+		device.dirty=true;
+		devicesDirty=true;
 		}
 	}
 
@@ -1843,7 +2275,7 @@ void VruiCoreClient::unlockNavTransform(bool sendMessage)
 		{
 		/* Unlock the navigation transformation: */
 		self.navLockedClient=0;
-		self.navTransform=newNavTransform;
+		self.setNavTransform(newNavTransform);
 		}
 	
 	/* Unlock Vrui's navigation transformation: */
@@ -2381,6 +2813,14 @@ VruiCoreClient::VruiCoreClient(Client* sClient)
 	 navigationTransformationLocked(false),noNavigationUpdateCallback(0),navSequenceState(Idle),
 	 lastDeviceId(0),inputDeviceIndexMap(5),
 	 mainViewerHeadDevice(0),
+	 viewerDirty(false),devicesDirty(false),lastUpdateSequence(0),
+	 trackingUpdateInterval(0.0),nextTrackingUpdateTime(0.0),
+	 quantizeTrackingUpdates(vruiCoreConfig.retrieveValue<bool>("./quantizeTrackingUpdates",true)),
+	 interpolateRemoteTracking(vruiCoreConfig.retrieveValue<bool>("./interpolateRemoteTracking",true)),
+	 interpolationDelay(vruiCoreConfig.retrieveValue<double>("./interpolationDelay",0.05)),
+	 maxExtrapolationTime(vruiCoreConfig.retrieveValue<double>("./maxExtrapolationTime",0.1)),
+	 navResolvePass(0),
+	 snapshotTick(0),numSnapshotParts(0),snapshotComplete(false),
 	 drawRemoteMainViewers(vruiCoreConfig.retrieveValue<bool>("./drawRemoteMainViewers",true)),
 	 drawRemoteNameTags(vruiCoreConfig.retrieveValue<bool>("./drawRemoteNameTags",true)),
 	 drawRemoteDevices(vruiCoreConfig.retrieveValue<bool>("./drawRemoteDevices",true)),
@@ -2388,6 +2828,10 @@ VruiCoreClient::VruiCoreClient(Client* sClient)
 	 collaborationToolBase(0),
 	 physicalRoot(new SceneGraph::GroupNode)
 	{
+	/* Calculate the minimum interval between batched updates from the configured maximum update rate: */
+	double maxTrackingUpdateRate=vruiCoreConfig.retrieveValue<double>("./maxTrackingUpdateRate",0.0);
+	if(maxTrackingUpdateRate>0.0)
+		trackingUpdateInterval=1.0/maxTrackingUpdateRate;
 	}
 
 VruiCoreClient::~VruiCoreClient(void)
@@ -2432,6 +2876,7 @@ void VruiCoreClient::setMessageBases(unsigned int newClientMessageBase,unsigned
 	client->setMessageForwarder(serverMessageBase+EnvironmentUpdateNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::environmentUpdateNotificationCallback>,this,EnvironmentUpdateMsg::size);
 	client->setMessageForwarder(serverMessageBase+ViewerConfigUpdateNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::viewerConfigUpdateNotificationCallback>,this,ViewerConfigUpdateMsg::size);
 	client->setMessageForwarder(serverMessageBase+ViewerUpdateNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::viewerUpdateNotificationCallback>,this,ViewerUpdateMsg::size);
+	client->setUDPMessageHandler(serverMessageBase+ViewerUpdateNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::udpViewerUpdateNotificationCallback>,this);
 	client->setMessageForwarder(serverMessageBase+StartNavSequenceReply,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::startNavSequenceReplyCallback>,this,StartNavSequenceReplyMsg::size);
 	client->setMessageForwarder(serverMessageBase+StartNavSequenceNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::startNavSequenceNotificationCallback>,this,NavSequenceNotificationMsg::size);
 	client->setMessageForwarder(serverMessageBase+NavTransformUpdateNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::navTransformUpdateNotificationCallback>,this,NavTransformUpdateMsg::size);
@@ -2442,6 +2887,13 @@ void VruiCoreClient::setMessageBases(unsigned int newClientMessageBase,unsigned
 	client->setMessageForwarder(serverMessageBase+CreateInputDeviceNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::createInputDeviceNotificationCallback>,this,CreateInputDeviceMsg::size);
 	client->setMessageForwarder(serverMessageBase+UpdateInputDeviceRayNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::updateInputDeviceRayNotificationCallback>,this,UpdateInputDeviceRayMsg::size);
 	client->setMessageForwarder(serverMessageBase+UpdateInputDeviceNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::updateInputDeviceNotificationCallback>,this,UpdateInputDeviceMsg::size);
+	client->setUDPMessageHandler(serverMessageBase+UpdateInputDeviceNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::udpUpdateInputDeviceNotificationCallback>,this);
+	client->setFrontendMessageHandler(serverMessageBase+UpdateInputDevicesNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::updateInputDevicesNotificationCallback>,this);
+	client->setTCPMessageHandler(serverMessageBase+UpdateInputDevicesNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::updateInputDevicesForwarderCallback>,this,UpdateInputDevicesMsg::size);
+	client->setUDPMessageHandler(serverMessageBase+UpdateInputDevicesNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::udpUpdateInputDevicesNotificationCallback>,this);
+	client->setFrontendMessageHandler(serverMessageBase+SnapshotNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::snapshotNotificationCallback>,this);
+	client->setTCPMessageHandler(serverMessageBase+SnapshotNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::snapshotForwarderCallback>,this,SnapshotMsg::size);
+	client->setUDPMessageHandler(serverMessageBase+SnapshotNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::udpSnapshotNotificationCallback>,this);
 	client->setMessageForwarder(serverMessageBase+DisableInputDeviceNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::disableInputDeviceNotificationCallback>,this,DisableInputDeviceMsg::size);
 	client->setMessageForwarder(serverMessageBase+EnableInputDeviceNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::enableInputDeviceNotificationCallback>,this,EnableInputDeviceMsg::size);
 	client->setMessageForwarder(serverMessageBase+DestroyInputDeviceNotification,Client::wrapMethod<VruiCoreClient,&VruiCoreClient::destroyInputDeviceNotificationCallback>,this,DestroyInputDeviceMsg::size);
@@ -2489,13 +2941,64 @@ void VruiCoreClient::clientDisconnected(unsigned int clientId)
 
 void VruiCoreClient::frame(void)
 	{
-	/* Update the scene graphs of all connected clients (this is inefficient and should not be done: */
+	/* Check if the main viewer or any input devices changed since the last batched update: */
+	if(viewerDirty||devicesDirty)
+		{
+		/* Check if the minimum update interval has passed: */
+		double now=Vrui::getApplicationTime();
+		if(now>=nextTrackingUpdateTime)
+			{
+			/* Send a batched update to the server: */
+			sendTrackingUpdates();
+			nextTrackingUpdateTime=now+trackingUpdateInterval;
+			}
+		else
+			{
+			/* Request another Vrui frame to send the pending batched update: */
+			Vrui::scheduleUpdate(nextTrackingUpdateTime);
+			}
+		}
+	
+	/* Update the physical-space scene graphs of all remote clients whose full navigation transformations changed, resolving each lock chain once: */
+	++navResolvePass;
 	for(RemoteClientList::iterator rcIt=remoteClients.begin();rcIt!=remoteClients.end();++rcIt)
+		(*rcIt)->resolveNavTransform(navResolvePass);
+	
+	/* Render remote clients' heads and input devices along trajectories reconstructed from their time-stamped updates: */
+	if(interpolateRemoteTracking)
 		{
-		NavTransform inverseNav=(*rcIt)->getNavTransform();
-		inverseNav.doInvert();
-		(*rcIt)->physicalRoot->transform.setValue(inverseNav);
-		(*rcIt)->physicalRoot->update();
+		double now=Vrui::getApplicationTime();
+		bool animating=false;
+		for(RemoteClientList::iterator rcIt=remoteClients.begin();rcIt!=remoteClients.end();++rcIt)
+			{
+			/* Skip clients that never sent time-stamped samples, or whose trajectories came to rest and did not receive new samples: */
+			RemoteClient* rc=*rcIt;
+			if(!rc->haveTimeStamp||(!rc->trackingDirty&&!rc->trackingAnimating))
+				continue;
+			rc->trackingDirty=false;
+			
+			/* Convert the delayed rendering time into the remote client's application time: */
+			double time=now-interpolationDelay-rc->timeOffset;
+			
+			/* Update the main viewer's scene graph: */
+			rc->headRoot->transform.setValue(rc->headInterpolator.evaluate(time,maxExtrapolationTime));
+			rc->headRoot->update();
+			rc->trackingAnimating=rc->headInterpolator.isAnimating(time,maxExtrapolationTime);
+			
+			/* Update the scene graphs of all shown input devices: */
+			if(rc->hideDevicesCount==0)
+				for(RemoteClient::DeviceList::iterator dIt=rc->devices.begin();dIt!=rc->devices.end();++dIt)
+					if(dIt->enabled)
+						{
+						rc->updateDeviceTransform(*dIt,dIt->interpolator.evaluate(time,maxExtrapolationTime));
+						rc->trackingAnimating=rc->trackingAnimating||dIt->interpolator.isAnimating(time,maxExtrapolationTime);
+						}
+			animating=animating||rc->trackingAnimating;
+			}
+		
+		/* Keep rendering frames while any trajectory is still moving: */
+		if(animating)
+			Vrui::scheduleUpdate(Vrui::getNextAnimationTime());
 		}
 	
 	/* Call all dependent protocols: */
@@ -36,6 +36,7 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #include <Collaboration2/Client.h>
 #include <Collaboration2/VruiPluginClient.h>
 #include <Collaboration2/Plugins/VruiCoreProtocol.h>
+#include <Collaboration2/Plugins/TransformInterpolator.h>
 
 /* Forward declarations: */
 class GLContextData;
@@ -77,6 +78,8 @@ class VruiCoreClient:public VruiPluginClient,public VruiCoreProtocol
 			private:
 			SceneGraph::TransformNodePointer root; // Root node of device's scene graph
 			ONTransform glyphTransform; // Transformation from device to its scene graph
+			bool dirty; // Flag whether the device's transformation changed since the last batched update was sent to the server; only used for the local client's own devices
+			TransformInterpolator interpolator; // Interpolator reconstructing a smooth trajectory from the device's received transformations
 			};
 		
 		typedef std::vector<DeviceState> DeviceList; // Type for lists of input devices
@@ -92,8 +95,20 @@ class VruiCoreClient:public VruiPluginClient,public VruiCoreProtocol
 		Rotation baseRotation; // Rotation from client's physical space to a frame where z is the up direction, the (y, z) plane contains the forward direction, and x points to the right
 		ClientViewerConfig viewerConfig; // Client's viewer state configuration
 		ClientViewerState viewerState; // Client's viewer state
+		UpdateSequence viewerSequence; // Sequence number of the most recently sent or accepted viewer update
+		TransformInterpolator headInterpolator; // Interpolator reconstructing a smooth trajectory from the main viewer's received head transformations
+		bool haveTimeStamp; // Flag whether a time-stamped batched update has been received from the client
+		TimeStamp lastTimeStamp; // Most recent time stamp received from the client
+		double lastTime; // Client's application time corresponding to the most recent time stamp in seconds
+		double timeOffset; // Estimated offset from the client's application time to this client's application time, including minimal network latency
+		bool trackingDirty; // Flag whether new time-stamped samples arrived since the client's interpolated scene graphs were last updated
+		bool trackingAnimating; // Flag whether the client's interpolated scene graphs were still changing during the most recent frame
 		RemoteClient* navLockedClient; // Another client to whom this client's navigation transformation is locked, or null if unlocked
 		NavTransform navTransform; // Client's current navigation transformation, or relative transformation if locked to another client
+		bool navDirty; // Flag whether the client's navigation transformation or lock changed since its full navigation transformation was last resolved
+		unsigned int navResolvePass; // Index of the most recent pass during which the client's full navigation transformation was resolved
+		bool navChanged; // Flag whether the client's full navigation transformation changed during the most recent resolution pass
+		NavTransform fullNavTransform; // Client's full navigation transformation following its lock chain, as of the most recent resolution pass
 		DeviceList devices; // List of client's input devices
 		DeviceIndexMap deviceIndexMap; // Map from input device IDs to indices in the device list
 		unsigned int hideMainViewerCount; // Counter to hide main viewer glyph; is only drawn when count is zero
@@ -112,7 +127,10 @@ class VruiCoreClient:public VruiPluginClient,public VruiCoreProtocol
 		void updateEnvironment(MessageReader& message); // Updates the client's environment definition from an environment structure pending in the given message
 		void updateViewerConfigFromVrui(void); // Updates the client's viewer configuration by reading Vrui's current main viewer configuration
 		void updateViewerConfig(MessageReader& message); // Updates the client's viewer configuration from a viewer configuration structure pending in the given message
-		void updateViewerState(MessageReader& message); // Updates the client's viewer state from a viewer state structure pending in the given message
+		void updateViewerState(MessageReader& message,bool quantized =false); // Updates the client's viewer state from a full-precision or quantized viewer state structure pending in the given message
+		double getSampleTime(TimeStamp timeStamp,double receiveTime); // Returns the client's application time for the given time stamp received at this client's given application time, and updates the clock offset estimate
+		void updateDeviceTransform(DeviceState& device,const ONTransform& transform); // Updates the scene graph of the given device to show the given transformation
+		bool resolveNavTransform(unsigned int pass); // Updates the client's full navigation transformation and physical-space scene graph if it or any client along its lock chain changed; returns true if the full navigation transformation changed
 		
 		/* Constructors and destructors: */
 		RemoteClient(unsigned int sId); // Creates an uninitialized remote client state with the given ID
@@ -135,6 +153,7 @@ class VruiCoreClient:public VruiPluginClient,public VruiCoreProtocol
 		void setNavTransform(const NavTransform& newNavTransform) // Sets the client's current absolute or relative navigation transformation
 			{
 			navTransform=newNavTransform;
+			navDirty=true;
 			}
 		NavTransform getNavTransform(void) const // Returns the client's navigation transformation
 			{
@@ -238,6 +257,19 @@ class VruiCoreClient:public VruiPluginClient,public VruiCoreProtocol
 	InputDeviceIndexMap inputDeviceIndexMap; // Map from Vrui input device pointers to indices in the self-representation's device list
 	int followMode; // Mode in which the local client follows the nav-locked client: 0: free, 1: aligned, 2: facing 1:1
 	Vrui::InputDevice* mainViewerHeadDevice; // Pointer to input device currently tracking the main viewer, or null if main viewer is not head-tracked
+	bool viewerDirty; // Flag whether the main viewer's state changed since the last batched update was sent to the server
+	bool devicesDirty; // Flag whether any input device's transformation changed since the last batched update was sent to the server
+	UpdateSequence lastUpdateSequence; // Sequence number of the most recent batched update sent to the server
+	double trackingUpdateInterval; // Minimum time between batched updates sent to the server in seconds, or 0 to send one batched update per Vrui frame
+	double nextTrackingUpdateTime; // Application time at which the next batched update can be sent to the server
+	bool quantizeTrackingUpdates; // Flag whether to send batched updates in quantized encoding when all transformations are inside the quantized range
+	bool interpolateRemoteTracking; // Flag whether to render remote clients' heads and input devices along trajectories reconstructed from time-stamped updates
+	double interpolationDelay; // Delay in seconds by which remote tracking updates are rendered to leave room for interpolation between late updates
+	double maxExtrapolationTime; // Maximum time in seconds to extrapolate remote tracking past the most recent update before fading back to it
+	unsigned int navResolvePass; // Index of the most recent pass resolving remote clients' full navigation transformations
+	UpdateSequence snapshotTick; // Snapshot tick of the most recent snapshot received from the server
+	unsigned int numSnapshotParts; // Number of parts of the most recent snapshot received so far
+	bool snapshotComplete; // Flag whether all received parts of the most recent snapshot were applied completely
 	bool drawRemoteMainViewers; // Flag whether to draw representations of remote users' main viewers
 	bool drawRemoteNameTags; // Flag whether to draw remote users' name tags
 	bool drawRemoteDevices; // Flag whether to draw representations of remote users' input devices
@@ -273,10 +305,25 @@ class VruiCoreClient:public VruiPluginClient,public VruiCoreProtocol
 		--noNavigationUpdateCallback;
 		}
 	void sendNavTransform(const NavTransform& newNavTransform); // Sends the given navigation transformation to the server as an update request
+	void sendTrackingUpdates(void); // Sends the states of the main viewer and all input devices that changed since the last batched update to the server
+	void queueStateUpdate(MessageBuffer* message) // Sends the given high-rate state update message to the server over UDP, or over TCP if the client does not have UDP connectivity
+		{
+		if(client->haveUDP())
+			client->queueServerUDPMessage(message);
+		else
+			client->queueServerMessage(message);
+		}
+	bool applyTrackingUpdates(MessageReader& message); // Applies the batched update pending in the given message; returns false if some of its updates referred to unknown remote clients or devices
 	
 	/* Methods receiving messages from the server: */
 	void nameChangeReplyCallback(Client::NameChangeReplyCallbackData* cbData); // Called from the back end when the server sends a reply to this client's name change request
 	void nameChangeNotificationCallback(Client::NameChangeNotificationCallbackData* cbData); // Called from the back end when a remote client changed its name
+	void udpViewerUpdateNotificationCallback(unsigned int messageId,MessageReader& message); // Called from the back end when a viewer update arrives on the UDP socket
+	void udpUpdateInputDeviceNotificationCallback(unsigned int messageId,MessageReader& message); // Called from the back end when an input device update arrives on the UDP socket
+	MessageContinuation* updateInputDevicesForwarderCallback(unsigned int messageId,MessageContinuation* continuation); // Called from the back end when a batched update arrives on the TCP socket
+	void udpUpdateInputDevicesNotificationCallback(unsigned int messageId,MessageReader& message); // Called from the back end when a batched update arrives on the UDP socket
+	MessageContinuation* snapshotForwarderCallback(unsigned int messageId,MessageContinuation* continuation); // Called from the back end when a snapshot part arrives on the TCP socket
+	void udpSnapshotNotificationCallback(unsigned int messageId,MessageReader& message); // Called from the back end when a snapshot part arrives on the UDP socket
 	
 	/* Methods receiving status messages from the back-end: */
 	void startNotificationCallback(unsigned int messageId,MessageReader& message); // Notification that the Vrui Core client is connected to a server and ready to forward server messages
@@ -302,6 +349,8 @@ class VruiCoreClient:public VruiPluginClient,public VruiCoreProtocol
 	void createInputDeviceNotificationCallback(unsigned int messageId,MessageReader& message);
 	void updateInputDeviceRayNotificationCallback(unsigned int messageId,MessageReader& message);
 	void updateInputDeviceNotificationCallback(unsigned int messageId,MessageReader& message);
+	void updateInputDevicesNotificationCallback(unsigned int messageId,MessageReader& message);
+	void snapshotNotificationCallback(unsigned int messageId,MessageReader& message);
 	void disableInputDeviceNotificationCallback(unsigned int messageId,MessageReader& message);
 	void enableInputDeviceNotificationCallback(unsigned int messageId,MessageReader& message);
 	void destroyInputDeviceNotificationCallback(unsigned int messageId,MessageReader& message);
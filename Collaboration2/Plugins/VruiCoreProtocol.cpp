@@ -6,9 +6,105 @@ Copyright (c) 2019-2020 Oliver Kreylos
 
 #include <Collaboration2/Plugins/VruiCoreProtocol.h>
 
+#include <Math/Math.h>
+
 /*****************************************
 Static elements of class VruiCoreProtocol:
 *****************************************/
 
 const char* VruiCoreProtocol::protocolName=VRUICORE_PROTOCOLNAME;
 const unsigned int VruiCoreProtocol::protocolVersion=VRUICORE_PROTOCOLVERSION;
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const int compactRotationBits=10; // Number of bits per quantized quaternion component
+const Misc::UInt32 compactRotationMax=(1U<<compactRotationBits)-1U; // Largest quantized quaternion component
+const VruiCoreProtocol::Scalar compactRotationRange=VruiCoreProtocol::Scalar(0.70710678118654752440); // Largest absolute value of the three smallest components of a normalized quaternion
+const int compactPositionMax=32767; // Largest absolute quantized translation component
+
+inline VruiCoreProtocol::Scalar getPositionScale(const VruiCoreProtocol::ClientEnvironment& environment) // Returns the factor to convert translations relative to the display center to quantized units
+	{
+	return VruiCoreProtocol::Scalar(compactPositionMax)/(VruiCoreProtocol::Scalar(VruiCoreProtocol::compactPositionRange)*environment.displaySize);
+	}
+
+}
+
+/****************************************
+Static methods of class VruiCoreProtocol:
+****************************************/
+
+bool VruiCoreProtocol::canQuantize(const VruiCoreProtocol::ONTransform& transform,const VruiCoreProtocol::ClientEnvironment& environment)
+	{
+	/* Check the translation against the quantized range around the display center: */
+	Scalar range=Scalar(compactPositionRange)*environment.displaySize;
+	const Vector& t=transform.getTranslation();
+	for(int i=0;i<3;++i)
+		if(Math::abs(t[i]-environment.displayCenter[i])>=range)
+			return false;
+	return true;
+	}
+
+void VruiCoreProtocol::quantize(const VruiCoreProtocol::ONTransform& transform,const VruiCoreProtocol::ClientEnvironment& environment,Misc::UInt32& rotation,Misc::SInt16 translation[3])
+	{
+	/* Quantize the translation to fixed point relative to the display center, clamping it to the quantized range: */
+	Scalar positionScale=getPositionScale(environment);
+	const Vector& t=transform.getTranslation();
+	for(int i=0;i<3;++i)
+		{
+		int q=int(Math::floor((t[i]-environment.displayCenter[i])*positionScale+Scalar(0.5)));
+		translation[i]=Misc::SInt16(Math::clamp(q,-compactPositionMax,compactPositionMax));
+		}
+	
+	/* Find the quaternion component with the largest absolute value: */
+	const Scalar* q=transform.getRotation().getQuaternion();
+	int largest=0;
+	for(int i=1;i<4;++i)
+		if(Math::abs(q[i])>Math::abs(q[largest]))
+			largest=i;
+	
+	/* Encode the index of the largest component and the three smallest components, negating the quaternion if the largest component is negative: */
+	Scalar componentScale=Scalar(compactRotationMax)/(Scalar(2)*compactRotationRange);
+	if(q[largest]<Scalar(0))
+		componentScale=-componentScale;
+	rotation=Misc::UInt32(largest);
+	for(int i=0;i<4;++i)
+		if(i!=largest)
+			{
+			int c=int(Math::floor(q[i]*componentScale+Scalar(compactRotationMax)*Scalar(0.5)+Scalar(0.5)));
+			rotation=(rotation<<compactRotationBits)|Misc::UInt32(Math::clamp(c,0,int(compactRotationMax)));
+			}
+	}
+
+VruiCoreProtocol::ONTransform VruiCoreProtocol::dequantize(Misc::UInt32 rotation,const Misc::SInt16 translation[3],const VruiCoreProtocol::ClientEnvironment& environment)
+	{
+	/* Reconstruct the translation: */
+	Scalar positionStep=Scalar(1)/getPositionScale(environment);
+	Vector t;
+	for(int i=0;i<3;++i)
+		t[i]=environment.displayCenter[i]+Scalar(translation[i])*positionStep;
+	
+	/* Decode the three smallest quaternion components in reverse order of encoding: */
+	int largest=int(rotation>>(3*compactRotationBits));
+	Scalar q[4];
+	Scalar componentStep=(Scalar(2)*compactRotationRange)/Scalar(compactRotationMax);
+	Scalar sqrLen(0);
+	for(int i=3;i>=0;--i)
+		if(i!=largest)
+			{
+			q[i]=Scalar(rotation&compactRotationMax)*componentStep-compactRotationRange;
+			sqrLen+=q[i]*q[i];
+			rotation>>=compactRotationBits;
+			}
+	
+	/* Reconstruct the largest component from the unit length constraint and renormalize to absorb quantization error: */
+	q[largest]=sqrLen<Scalar(1)?Math::sqrt(Scalar(1)-sqrLen):Scalar(0);
+	Scalar len=Math::sqrt(sqrLen+q[largest]*q[largest]);
+	for(int i=0;i<4;++i)
+		q[i]/=len;
+	
+	return ONTransform(t,Rotation(q));
+	}
@@ -21,7 +21,7 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #include <Collaboration2/MessageBuffer.h>
 
 #define VRUICORE_PROTOCOLNAME "VruiCore"
-#define VRUICORE_PROTOCOLVERSION 1U<<16
+#define VRUICORE_PROTOCOLVERSION ((2U<<16)|0U)
 
 class VruiCoreProtocol
 	{
@@ -43,9 +43,11 @@ class VruiCoreProtocol
 		CreateInputDeviceRequest,
 		UpdateInputDeviceRayRequest,
 		UpdateInputDeviceRequest,
+		UpdateInputDevicesRequest,
 		DisableInputDeviceRequest,
 		EnableInputDeviceRequest,
 		DestroyInputDeviceRequest,
+		SnapshotAckRequest,
 		
 		NumClientMessages
 		};
@@ -76,9 +78,11 @@ class VruiCoreProtocol
 		CreateInputDeviceNotification,
 		UpdateInputDeviceRayNotification,
 		UpdateInputDeviceNotification,
+		UpdateInputDevicesNotification,
 		DisableInputDeviceNotification,
 		EnableInputDeviceNotification,
 		DestroyInputDeviceNotification,
+		SnapshotNotification,
 		
 		NumServerMessages
 		};
@@ -86,6 +90,8 @@ class VruiCoreProtocol
 	/* Protocol data type declarations: */
 	public:
 	typedef Misc::UInt8 InputDeviceID; // Type for ID numbers of input devices
+	typedef Misc::UInt32 UpdateSequence; // Type for per-source sequence numbers of high-rate state updates, which can arrive out of order over UDP
+	typedef Misc::UInt32 TimeStamp; // Type for source clients' sampling times of high-rate state updates in microseconds, wrapping around
 	typedef Misc::Float32 Scalar; // Scalar type for 3D geometry
 	static const size_t scalarSize=sizeof(Scalar); // Wire size of a scalar
 	typedef Geometry::Point<Scalar,3> Point; // Type for affine points
@@ -102,6 +108,8 @@ class VruiCoreProtocol
 	static const size_t ogTransformSize=vectorSize+rotationSize+scalarSize; // Wire size of a 3D uniformly-scaled rigid-body transformation
 	typedef Geometry::OrthogonalTransformation<Misc::Float64,3> NavTransform; // Type for Vrui navigation transformations; need to be double precision
 	static const size_t navTransformSize=3*sizeof(Misc::Float64)+4*sizeof(Misc::Float64)+sizeof(Misc::Float64); // Wire size of a Vrui navigation transformation
+	static const size_t compactONTransformSize=sizeof(Misc::UInt32)+3*sizeof(Misc::SInt16); // Wire size of a quantized 3D rigid-body transformation
+	static const int compactPositionRange=4; // Range of quantized translations around a client's display center in multiples of its display size
 	
 	struct ClientEnvironment // Semi-static definition of a client's physical-space environment
 		{
@@ -180,6 +188,10 @@ class VruiCoreProtocol
 		ONTransform headTransform; // Position and orientation of client's main viewer in client's physical space
 		
 		/* Methods: */
+		static size_t getSize(bool quantized) // Returns the wire size of a client viewer state structure in full precision or quantized encoding
+			{
+			return quantized?compactONTransformSize:onTransformSize;
+			}
 		template <class SourceParam>
 		ClientViewerState& read(SourceParam& source) // Reads a client viewer state structure from a binary source
 			{
@@ -193,6 +205,19 @@ class VruiCoreProtocol
 			/* Write viewer state components to the sink: */
 			Misc::write(headTransform,sink);
 			}
+		template <class SourceParam>
+		ClientViewerState& read(SourceParam& source,bool quantized,const ClientEnvironment& environment) // Reads a client viewer state structure in full precision or quantized relative to the given client environment from a binary source
+			{
+			/* Read viewer state components from the source: */
+			headTransform=readTransform(source,quantized,environment);
+			return *this;
+			}
+		template <class SinkParam>
+		void write(bool quantized,const ClientEnvironment& environment,SinkParam& sink) const // Writes a client viewer state structure in full precision or quantized relative to the given client environment to a binary sink
+			{
+			/* Write viewer state components to the sink: */
+			writeTransform(headTransform,quantized,environment,sink);
+			}
 		};
 	
 	struct ClientInputDeviceState // Dynamic state of one of a client's input devices
@@ -204,8 +229,53 @@ class VruiCoreProtocol
 		Scalar rayStart; // Origin of device's pointing ray along its pointing direction
 		bool enabled; // Enable flag to temporarily disable devices due to tracking outages etc.
 		ONTransform transform; // Device's current position and orientation in client's physical space
+		UpdateSequence sequence; // Sequence number of the most recently sent or accepted transformation update
 		};
 	
+	/* Protocol helper functions: */
+	static bool isNewerUpdate(UpdateSequence sequence,UpdateSequence lastSequence) // Returns true if a state update with the given sequence number supersedes the update with the given last sequence number, accounting for wrap-around
+		{
+		return Misc::SInt32(sequence-lastSequence)>0;
+		}
+	static bool canQuantize(const ONTransform& transform,const ClientEnvironment& environment); // Returns true if the given transformation's translation is inside the range of quantized transformations relative to the given client environment
+	static void quantize(const ONTransform& transform,const ClientEnvironment& environment,Misc::UInt32& rotation,Misc::SInt16 translation[3]); // Quantizes the given transformation relative to the given client environment
+	static ONTransform dequantize(Misc::UInt32 rotation,const Misc::SInt16 translation[3],const ClientEnvironment& environment); // Returns the transformation represented by the given quantized components relative to the given client environment
+	static size_t getTransformSize(bool quantized) // Returns the wire size of a rigid-body transformation in full precision or quantized encoding
+		{
+		return quantized?compactONTransformSize:onTransformSize;
+		}
+	template <class SinkParam>
+	static void writeTransform(const ONTransform& transform,bool quantized,const ClientEnvironment& environment,SinkParam& sink) // Writes a rigid-body transformation in full precision or quantized relative to the given client environment to a binary sink
+		{
+		if(quantized)
+			{
+			Misc::UInt32 rotation;
+			Misc::SInt16 translation[3];
+			quantize(transform,environment,rotation,translation);
+			sink.write(rotation);
+			sink.write(translation,3);
+			}
+		else
+			Misc::write(transform,sink);
+		}
+	template <class SourceParam>
+	static ONTransform readTransform(SourceParam& source,bool quantized,const ClientEnvironment& environment) // Reads a rigid-body transformation in full precision or quantized relative to the given client environment from a binary source
+		{
+		if(quantized)
+			{
+			Misc::UInt32 rotation=source.template read<Misc::UInt32>();
+			Misc::SInt16 translation[3];
+			source.read(translation,3);
+			return dequantize(rotation,translation,environment);
+			}
+		else
+			{
+			ONTransform result;
+			Misc::read(source,result);
+			return result;
+			}
+		}
+	
 	/* Protocol message data structure declarations: */
 	protected:
 	struct ConnectRequestMsg
@@ -257,7 +327,7 @@ class VruiCoreProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int serverMessageBase) // Returns a message buffer for a connect notification message
 			{
-			return MessageBuffer::create(serverMessageBase+ConnectNotification,size);
+			return MessageBuffer::create(serverMessageBase+ConnectNotification,size)->setOrdered();
 			}
 		};
 	
@@ -287,7 +357,7 @@ class VruiCoreProtocol
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int messageId) // Returns a message buffer for a viewer update request or notification message
 			{
-			return MessageBuffer::create(messageId,size);
+			return MessageBuffer::create<ViewerConfigUpdateMsg>(messageId);
 			}
 		};
 	
@@ -295,14 +365,15 @@ class VruiCoreProtocol
 		{
 		/* Elements: */
 		public:
-		static const size_t size=sizeof(ClientID)+ClientViewerState::size;
+		static const size_t size=sizeof(ClientID)+sizeof(UpdateSequence)+ClientViewerState::size;
 		ClientID sourceClientID; // Source client of this message
+		UpdateSequence sequence; // Source client's sequence number of this viewer update
 		ClientViewerState viewerState; // Client's viewer state
 		
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int messageId) // Returns a message buffer for a viewer update request or notification message
 			{
-			return MessageBuffer::create(messageId,size);
+			return MessageBuffer::create<ViewerUpdateMsg>(messageId);
 			}
 		};
 	
@@ -444,15 +515,58 @@ class VruiCoreProtocol
 		{
 		/* Elements: */
 		public:
-		static const size_t size=sizeof(ClientID)+sizeof(InputDeviceID)+onTransformSize;
+		static const size_t size=sizeof(ClientID)+sizeof(InputDeviceID)+sizeof(UpdateSequence)+onTransformSize;
 		ClientID sourceClientID; // Source client of this message
 		InputDeviceID deviceId; // ID of affected input device
+		UpdateSequence sequence; // Source client's sequence number of this device update
 		ONTransform transform; // The device's new position and orientation
 		
 		/* Methods: */
 		static MessageBuffer* createMessage(unsigned int messageId) // Returns a message buffer for an update input device request or notification message
 			{
-			return MessageBuffer::create(messageId,size);
+			return MessageBuffer::create<UpdateInputDeviceMsg>(messageId);
+			}
+		};
+	
+	struct UpdateInputDevicesMsg
+		{
+		/* Embedded classes: */
+		public:
+		struct DeviceUpdate // Structure for the updated transformation of a single input device
+			{
+			/* Elements: */
+			public:
+			static const size_t size=sizeof(InputDeviceID)+onTransformSize;
+			InputDeviceID deviceId; // ID of affected input device
+			ONTransform transform; // The device's new position and orientation; quantized relative to the source client's environment if the message is quantized
+			
+			/* Methods: */
+			static size_t getSize(bool quantized) // Returns the wire size of a device update in full precision or quantized encoding
+				{
+				return sizeof(InputDeviceID)+getTransformSize(quantized);
+				}
+			};
+		
+		/* Elements: */
+		static const size_t maxNumDevices=32; // Maximum number of device updates in a single message, to fit the message into a single UDP packet
+		static const size_t size=sizeof(ClientID)+sizeof(UpdateSequence)+sizeof(TimeStamp)+2*sizeof(Bool)+sizeof(Misc::UInt8); // Size up to and including the number of device updates
+		ClientID sourceClientID; // Source client of this message
+		UpdateSequence sequence; // Source client's sequence number of this batched update
+		TimeStamp timeStamp; // Source client's application time at which the batched update's state was sampled
+		Bool haveViewerState; // !=0 if the message contains the source client's viewer state
+		Bool quantized; // !=0 if all transformations in the message are quantized relative to the source client's environment
+		Misc::UInt8 numDevices; // Number of device updates in the message
+		// ClientViewerState viewerState; // Client's viewer state if haveViewerState!=0
+		// DeviceUpdate devices[numDevices]; // Device updates
+		
+		/* Methods: */
+		static size_t getBodySize(bool haveViewerState,bool quantized,size_t numDevices) // Returns the size of the variable-size part of a batched update message
+			{
+			return (haveViewerState?ClientViewerState::getSize(quantized):0)+numDevices*DeviceUpdate::getSize(quantized);
+			}
+		static MessageBuffer* createMessage(unsigned int messageId,bool haveViewerState,bool quantized,size_t numDevices) // Returns a message buffer for a batched update input devices request or notification message
+			{
+			return MessageBuffer::create(messageId,size+getBodySize(haveViewerState,quantized,numDevices));
 			}
 		};
 	
@@ -502,6 +616,38 @@ class VruiCoreProtocol
 			}
 		};
 	
+	struct SnapshotMsg
+		{
+		/* Elements: */
+		public:
+		static const size_t maxBodySize=1200; // Maximum size of a snapshot part's body, to fit the message into a single UDP packet
+		static const size_t size=sizeof(UpdateSequence)+2*sizeof(Misc::UInt16); // Size up to and including the body size
+		UpdateSequence tick; // Server's snapshot tick
+		Misc::UInt16 numParts; // Total number of parts of the snapshot
+		Misc::UInt16 bodySize; // Size of the snapshot part's body
+		// UpdateInputDevicesMsg updates[]; // Sequence of batched updates without message IDs, each delta-encoded against the receiver's acknowledged baseline snapshot
+		
+		/* Methods: */
+		static MessageBuffer* createMessage(unsigned int serverMessageBase,size_t bodySize) // Returns a message buffer for a snapshot notification message with the given body size
+			{
+			return MessageBuffer::create(serverMessageBase+SnapshotNotification,size+bodySize);
+			}
+		};
+	
+	struct SnapshotAckMsg
+		{
+		/* Elements: */
+		public:
+		static const size_t size=sizeof(UpdateSequence);
+		UpdateSequence tick; // Snapshot tick of the most recent snapshot the client received and applied completely
+		
+		/* Methods: */
+		static MessageBuffer* createMessage(unsigned int clientMessageBase) // Returns a message buffer for a snapshot acknowledgment request message
+			{
+			return MessageBuffer::create(clientMessageBase+SnapshotAckRequest,size);
+			}
+		};
+	
 	/* Elements: */
 	static const char* protocolName;
 	static const unsigned int protocolVersion;
@@ -7,10 +7,17 @@ Copyright (c) 2019-2020 Oliver Kreylos
 
 #include <Collaboration2/Plugins/VruiCoreServer.h>
 
+#include <string.h>
+#include <algorithm>
+#include <Misc/Utility.h>
 #include <Misc/Marshaller.h>
+#include <Math/Math.h>
 
+#include <Collaboration2/MessageReader.h>
 #include <Collaboration2/MessageWriter.h>
+#include <Collaboration2/MessageContinuation.h>
 #include <Collaboration2/NonBlockSocket.h>
+#include <Collaboration2/MessageView.h>
 
 /***************************************
 Methods of class VruiCoreServer::Client:
@@ -18,8 +25,12 @@ Methods of class VruiCoreServer::Client:
 
 VruiCoreServer::Client::Client(VruiCoreServer::PhysicalEnvironment* sPhysicalEnvironment,NonBlockSocket& socket)
 	:physicalEnvironment(sPhysicalEnvironment),
+	 viewerSequence(0),viewerChangeTick(0),lastUpdateSequence(0),lastUpdateTimeStamp(0),frameCounter(0),
 	 deviceIndexMap(5)
 	{
+	for(int i=0;i<NumInterestTiers;++i)
+		snapshotAcks[i]=0;
+	
 	/* Extract the new client's initial state from the connect request message: */
 	environment.read(socket);
 	viewerConfig.read(socket);
@@ -54,6 +65,201 @@ VruiCoreServer::Client::Client(VruiCoreServer::PhysicalEnvironment* sPhysicalEnv
 Methods of class VruiCoreServer:
 *******************************/
 
+void VruiCoreServer::broadcastTrackingUpdate(unsigned int clientId,VruiCoreServer::Client* vcClient,unsigned int updateCounter,MessageBuffer* message)
+	{
+	/* Send the update to all other clients if it is relevant even at minimal interest: */
+	if(isRelevantUpdate(MinimalInterest,updateCounter))
+		broadcastUDPMessageFallback(clientId,message);
+	else
+		{
+		/* Send the update to those other clients within the far interest radius to which it is relevant: */
+		for(Client::InterestList::iterator iIt=vcClient->interests.begin();iIt!=vcClient->interests.end();++iIt)
+			if(isRelevantUpdate(iIt->tier,updateCounter))
+				server->queueUDPMessageFallback(iIt->clientId,message);
+		}
+	}
+
+void VruiCoreServer::sendTrackingState(unsigned int clientId,VruiCoreServer::Client* vcClient,unsigned int destClientId)
+	{
+	Server::Client* destClient=server->getClient(destClientId);
+	
+	/* Send the client's viewer state with the sequence number of its most recent update, which the destination client ignores if it is already up-to-date: */
+	{
+	MessageWriter viewerUpdateNotification(ViewerUpdateMsg::createMessage(serverMessageBase+ViewerUpdateNotification));
+	viewerUpdateNotification.write(ClientID(clientId));
+	viewerUpdateNotification.write(vcClient->viewerSequence);
+	vcClient->viewerState.write(viewerUpdateNotification);
+	viewerUpdateNotification.getBuffer()->setCoalescingKey(clientId);
+	destClient->queueMessage(viewerUpdateNotification.getBuffer());
+	}
+	
+	/* Send the transformations of all enabled input devices: */
+	for(Client::DeviceList::iterator dIt=vcClient->devices.begin();dIt!=vcClient->devices.end();++dIt)
+		if(dIt->enabled)
+			{
+			MessageWriter updateInputDeviceNotification(UpdateInputDeviceMsg::createMessage(serverMessageBase+UpdateInputDeviceNotification));
+			updateInputDeviceNotification.write(ClientID(clientId));
+			updateInputDeviceNotification.write(InputDeviceID(dIt->id));
+			updateInputDeviceNotification.write(dIt->sequence);
+			Misc::write(dIt->transform,updateInputDeviceNotification);
+			updateInputDeviceNotification.getBuffer()->setCoalescingKey(clientId,dIt->id);
+			destClient->queueMessage(updateInputDeviceNotification.getBuffer());
+			}
+	}
+
+void VruiCoreServer::updateViewer(unsigned int clientId,Client* vcClient,UpdateSequence sequence,const ClientViewerState& newViewerState)
+	{
+	/* Ignore the update if it was overtaken by a newer one from the same client: */
+	if(!isNewerUpdate(sequence,vcClient->viewerSequence))
+		return;
+	
+	/* Update the client's viewer state: */
+	vcClient->viewerSequence=sequence;
+	vcClient->viewerState=newViewerState;
+	if(isNewerUpdate(sequence,vcClient->lastUpdateSequence))
+		vcClient->lastUpdateSequence=sequence;
+	
+	/* Leave the viewer state for the next snapshot when in snapshot mode: */
+	if(snapshotMode)
+		{
+		vcClient->viewerChangeTick=getChangeTick();
+		return;
+		}
+	
+	/* Forward the client's viewer state to all other Vrui Core clients: */
+	{
+	MessageWriter viewerUpdateNotification(ViewerUpdateMsg::createMessage(serverMessageBase+ViewerUpdateNotification));
+	viewerUpdateNotification.write(ClientID(clientId));
+	viewerUpdateNotification.write(sequence);
+	vcClient->viewerState.write(viewerUpdateNotification);
+	
+	/* Let a newer viewer update from the same client replace this one in backed-up TCP send queues: */
+	viewerUpdateNotification.getBuffer()->setCoalescingKey(clientId);
+	broadcastTrackingUpdate(clientId,vcClient,sequence,viewerUpdateNotification.getBuffer());
+	}
+	}
+
+void VruiCoreServer::updateInputDevice(unsigned int clientId,Client* vcClient,Client::DeviceState& device,UpdateSequence sequence,const ONTransform& newTransform)
+	{
+	/* Ignore the update if it was overtaken by a newer one for the same device: */
+	if(!isNewerUpdate(sequence,device.sequence))
+		return;
+	
+	/* Update the device's transformation: */
+	device.sequence=sequence;
+	device.transform=newTransform;
+	if(isNewerUpdate(sequence,vcClient->lastUpdateSequence))
+		vcClient->lastUpdateSequence=sequence;
+	
+	/* Leave the transformation for the next snapshot when in snapshot mode: */
+	if(snapshotMode)
+		device.changeTick=getChangeTick();
+	
+	/* Check whether the device is enabled: */
+	else if(device.enabled)
+		{
+		/* Forward the update to all other clients: */
+		{
+		MessageWriter updateInputDeviceNotification(UpdateInputDeviceMsg::createMessage(serverMessageBase+UpdateInputDeviceNotification));
+		updateInputDeviceNotification.write(ClientID(clientId));
+		updateInputDeviceNotification.write(InputDeviceID(device.id));
+		updateInputDeviceNotification.write(sequence);
+		Misc::write(device.transform,updateInputDeviceNotification);
+		
+		/* Let a newer update of the same device replace this one in backed-up TCP send queues: */
+		updateInputDeviceNotification.getBuffer()->setCoalescingKey(clientId,device.id);
+		broadcastTrackingUpdate(clientId,vcClient,sequence,updateInputDeviceNotification.getBuffer());
+		}
+		}
+	}
+
+void VruiCoreServer::updateInputDevices(unsigned int clientId,MessageReader& message)
+	{
+	/* Access the Vrui Core client state object: */
+	Client* vcClient=getClient(clientId);
+	
+	/* Read the message header: */
+	message.read<ClientID>();
+	UpdateSequence sequence=message.read<UpdateSequence>();
+	TimeStamp timeStamp=message.read<TimeStamp>();
+	bool haveViewerState=readBool(message);
+	bool quantized=readBool(message);
+	unsigned int numDevices=message.read<Misc::UInt8>();
+	if(numDevices>UpdateInputDevicesMsg::maxNumDevices||message.getUnread()!=UpdateInputDevicesMsg::getBodySize(haveViewerState,quantized,numDevices))
+		throw std::runtime_error("VruiCoreServer: Malformed update input devices message");
+	
+	/* Update the client's viewer state unless the update was overtaken by a newer one: */
+	bool forwardViewerState=false;
+	if(haveViewerState)
+		{
+		ClientViewerState newViewerState;
+		newViewerState.read(message,quantized,vcClient->environment);
+		if(isNewerUpdate(sequence,vcClient->viewerSequence))
+			{
+			vcClient->viewerSequence=sequence;
+			vcClient->viewerState=newViewerState;
+			vcClient->viewerChangeTick=getChangeTick();
+			forwardViewerState=true;
+			}
+		}
+	
+	/* Update the transformations of all devices in the message and collect enabled devices to forward: */
+	ClientInputDeviceState* forwardDevices[UpdateInputDevicesMsg::maxNumDevices];
+	unsigned int numForwardDevices=0;
+	for(unsigned int i=0;i<numDevices;++i)
+		{
+		/* Read the device update: */
+		unsigned int deviceId=message.read<InputDeviceID>();
+		ONTransform newTransform=readTransform(message,quantized,vcClient->environment);
+		
+		/* Ignore the update if it overtook the device's creation request on the TCP socket, or was overtaken by a newer one for the same device: */
+		Client::DeviceIndexMap::Iterator diIt=vcClient->deviceIndexMap.findEntry(deviceId);
+		if(!diIt.isFinished())
+			{
+			Client::DeviceState& device=vcClient->devices[diIt->getDest()];
+			if(isNewerUpdate(sequence,device.sequence))
+				{
+				/* Update the device's transformation: */
+				device.sequence=sequence;
+				device.transform=newTransform;
+				device.changeTick=getChangeTick();
+				
+				if(device.enabled)
+					forwardDevices[numForwardDevices++]=&device;
+				}
+			}
+		}
+	if(isNewerUpdate(sequence,vcClient->lastUpdateSequence))
+		{
+		/* Start a new frame if this is the client's first batched update with a new time stamp; a frame with many changed devices is sent as multiple batches: */
+		if(timeStamp!=vcClient->lastUpdateTimeStamp)
+			++vcClient->frameCounter;
+		
+		vcClient->lastUpdateSequence=sequence;
+		vcClient->lastUpdateTimeStamp=timeStamp;
+		}
+	
+	/* Forward all accepted updates to all other clients in a single batched notification, in the same encoding the source client chose, unless they are left for the next snapshot: */
+	if(!snapshotMode&&(forwardViewerState||numForwardDevices>0))
+		{
+		MessageWriter updateInputDevicesNotification(UpdateInputDevicesMsg::createMessage(serverMessageBase+UpdateInputDevicesNotification,forwardViewerState,quantized,numForwardDevices));
+		updateInputDevicesNotification.write(ClientID(clientId));
+		updateInputDevicesNotification.write(sequence);
+		updateInputDevicesNotification.write(timeStamp);
+		writeBool(forwardViewerState,updateInputDevicesNotification);
+		writeBool(quantized,updateInputDevicesNotification);
+		updateInputDevicesNotification.write(Misc::UInt8(numForwardDevices));
+		if(forwardViewerState)
+			vcClient->viewerState.write(quantized,vcClient->environment,updateInputDevicesNotification);
+		for(unsigned int i=0;i<numForwardDevices;++i)
+			{
+			updateInputDevicesNotification.write(InputDeviceID(forwardDevices[i]->id));
+			writeTransform(forwardDevices[i]->transform,quantized,vcClient->environment,updateInputDevicesNotification);
+			}
+		broadcastTrackingUpdate(clientId,vcClient,vcClient->frameCounter,updateInputDevicesNotification.getBuffer());
+		}
+	}
+
 MessageContinuation* VruiCoreServer::connectRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
 	{
 	/* Access the base client state object and its TCP socket: */
@@ -89,6 +295,11 @@ MessageContinuation* VruiCoreServer::connectRequestCallback(unsigned int message
 	/* Create a new Vrui Core client structure by reading the message: */
 	Client* newClient=new Client(environment,socket);
 	
+	/* The new client receives all other clients' current states below, which serves as its initial baseline snapshot: */
+	newClient->viewerChangeTick=getChangeTick();
+	for(int i=0;i<NumInterestTiers;++i)
+		newClient->snapshotAcks[i]=snapshotTick;
+	
 	if(environment!=0)
 		{
 		/* Add the client to its shared physical environment: */
@@ -195,6 +406,10 @@ MessageContinuation* VruiCoreServer::connectRequestCallback(unsigned int message
 	/* Set the new client's state structure: */
 	client->setPlugin(pluginIndex,newClient);
 	
+	/* Sort the new client into the interest grid right away so that it receives updates from nearby clients: */
+	if(interestManagement)
+		updateInterests(clientId);
+	
 	/* Done with message: */
 	return 0;
 	}
@@ -251,29 +466,52 @@ MessageContinuation* VruiCoreServer::viewerConfigUpdateRequestCallback(unsigned
 
 MessageContinuation* VruiCoreServer::viewerUpdateRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
 	{
-	/* Access the base client state object, its TCP socket, and the Vrui Core client state object: */
+	/* Access the base client state object and the Vrui Core client state object: */
 	Server::Client* client=server->getClient(clientId);
-	NonBlockSocket& socket=client->getSocket();
 	Client* vcClient=client->getPlugin<Client>(pluginIndex);
 	
-	/* Skip the message's placeholder client ID: */
-	socket.read<ClientID>();
+	UpdateSequence sequence;
+	ClientViewerState newViewerState;
+	{
+	/* Parse the fixed-size message in place in the TCP socket's read buffer: */
+	MessageView message(client->getSocket(),ViewerUpdateMsg::size);
 	
-	/* Update the client's viewer state: */
-	vcClient->viewerState.read(socket);
+	/* Skip the message's placeholder client ID: */
+	message.read<ClientID>();
 	
-	/* Forward the client's viewer state to all other Vrui Core clients: */
-	{
-	MessageWriter viewerUpdateNotification(ViewerUpdateMsg::createMessage(serverMessageBase+ViewerUpdateNotification));
-	viewerUpdateNotification.write(ClientID(clientId));
-	vcClient->viewerState.write(viewerUpdateNotification);
-	broadcastMessage(clientId,viewerUpdateNotification.getBuffer());
+	/* Read the update's sequence number and the client's new viewer state: */
+	sequence=message.read<UpdateSequence>();
+	newViewerState.read(message);
 	}
 	
+	/* Update the client's viewer state: */
+	updateViewer(clientId,vcClient,sequence,newViewerState);
+	
 	/* Done with the message: */
 	return 0;
 	}
 
+void VruiCoreServer::udpViewerUpdateRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message)
+	{
+	/* Give the message a basic smell test: */
+	if(message.getUnread()!=ViewerUpdateMsg::size)
+		throw std::runtime_error("VruiCoreServer: Wrong-size viewer update message");
+	
+	/* Access the Vrui Core client state object: */
+	Client* vcClient=getClient(clientId);
+	
+	/* Skip the message's placeholder client ID: */
+	message.read<ClientID>();
+	
+	/* Read the update's sequence number and the client's new viewer state: */
+	UpdateSequence sequence=message.read<UpdateSequence>();
+	ClientViewerState newViewerState;
+	newViewerState.read(message);
+	
+	/* Update the client's viewer state: */
+	updateViewer(clientId,vcClient,sequence,newViewerState);
+	}
+
 MessageContinuation* VruiCoreServer::startNavSequenceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
 	{
 	/* Access the base client state object, the Vrui Core client state object, and its shared physical environment: */
@@ -597,11 +835,13 @@ MessageContinuation* VruiCoreServer::createInputDeviceRequestCallback(unsigned i
 	socket.read<ClientID>();
 	
 	/* Create a new device structure in disabled state and read the new device's ID and pointing ray: */
-	ClientInputDeviceState newDevice;
+	Client::DeviceState newDevice;
 	newDevice.id=socket.read<InputDeviceID>();
 	Misc::read(socket,newDevice.rayDirection);
 	newDevice.rayStart=socket.read<Scalar>();
 	newDevice.enabled=false;
+	newDevice.sequence=0;
+	newDevice.changeTick=snapshotTick;
 	
 	/* Check if the device ID already exists: */
 	if(vcClient->deviceIndexMap.isEntry(newDevice.id))
@@ -635,7 +875,7 @@ MessageContinuation* VruiCoreServer::updateInputDeviceRayRequestCallback(unsigne
 	socket.read<ClientID>();
 	
 	/* Retrieve the input device structure: */
-	ClientInputDeviceState& device=vcClient->devices[vcClient->deviceIndexMap.getEntry(socket.read<InputDeviceID>()).getDest()];
+	Client::DeviceState& device=vcClient->devices[vcClient->deviceIndexMap.getEntry(socket.read<InputDeviceID>()).getDest()];
 	
 	/* Update the device's pointing ray: */
 	Misc::read(socket,device.rayDirection);
@@ -662,33 +902,124 @@ MessageContinuation* VruiCoreServer::updateInputDeviceRayRequestCallback(unsigne
 MessageContinuation* VruiCoreServer::updateInputDeviceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
 	{
 	Server::Client* client=server->getClient(clientId);
-	NonBlockSocket& socket=client->getSocket();
 	Client* vcClient=client->getPlugin<Client>(pluginIndex);
 	
+	/* Parse the fixed-size message in place in the TCP socket's read buffer: */
+	MessageView message(client->getSocket(),UpdateInputDeviceMsg::size);
+	
 	/* Skip the placeholder client ID: */
-	socket.read<ClientID>();
+	message.read<ClientID>();
 	
 	/* Retrieve the input device structure: */
-	ClientInputDeviceState& device=vcClient->devices[vcClient->deviceIndexMap.getEntry(socket.read<InputDeviceID>()).getDest()];
+	Client::DeviceState& device=vcClient->devices[vcClient->deviceIndexMap.getEntry(message.read<InputDeviceID>()).getDest()];
+	
+	/* Read the update's sequence number and the device's new transformation: */
+	UpdateSequence sequence=message.read<UpdateSequence>();
+	ONTransform newTransform;
+	Misc::read(message,newTransform);
 	
 	/* Update the device's transformation: */
-	Misc::read(socket,device.transform);
+	updateInputDevice(clientId,vcClient,device,sequence,newTransform);
 	
-	/* Check whether the device is enabled: */
-	if(device.enabled)
+	/* Done with the message: */
+	return 0;
+	}
+
+void VruiCoreServer::udpUpdateInputDeviceRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message)
+	{
+	/* Give the message a basic smell test: */
+	if(message.getUnread()!=UpdateInputDeviceMsg::size)
+		throw std::runtime_error("VruiCoreServer: Wrong-size update input device message");
+	
+	/* Access the Vrui Core client state object: */
+	Client* vcClient=getClient(clientId);
+	
+	/* Skip the placeholder client ID: */
+	message.read<ClientID>();
+	
+	/* Retrieve the input device structure; ignore the update if it overtook the device's creation request on the TCP socket: */
+	Client::DeviceIndexMap::Iterator diIt=vcClient->deviceIndexMap.findEntry(message.read<InputDeviceID>());
+	if(diIt.isFinished())
+		return;
+	Client::DeviceState& device=vcClient->devices[diIt->getDest()];
+	
+	/* Read the update's sequence number and the device's new transformation: */
+	UpdateSequence sequence=message.read<UpdateSequence>();
+	ONTransform newTransform;
+	Misc::read(message,newTransform);
+	
+	/* Update the device's transformation: */
+	updateInputDevice(clientId,vcClient,device,sequence,newTransform);
+	}
+
+MessageContinuation* VruiCoreServer::updateInputDevicesRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
+	{
+	/* Embedded classes: */
+	class Cont:public MessageContinuation
 		{
-		/* Forward the request to all other clients: */
+		/* Elements: */
+		public:
+		MessageWriter message; // Writer to assemble the complete message
+		
+		/* Constructors and destructors: */
+		Cont(size_t messageSize)
+			:message(MessageBuffer::create(messageSize))
+			{
+			}
+		};
+	
+	NonBlockSocket& socket=server->getClient(clientId)->getSocket();
+	
+	/* Check if this is the start of a new message: */
+	Cont* cont=static_cast<Cont*>(continuation);
+	if(cont==0)
 		{
-		MessageWriter updateInputDeviceNotification(UpdateInputDeviceMsg::createMessage(serverMessageBase+UpdateInputDeviceNotification));
-		updateInputDeviceNotification.write(ClientID(clientId));
-		updateInputDeviceNotification.write(InputDeviceID(device.id));
-		Misc::write(device.transform,updateInputDeviceNotification);
-		broadcastMessage(clientId,updateInputDeviceNotification.getBuffer());
+		/* Parse the fixed-size message header in place in the TCP socket's read buffer to determine the message's total size: */
+		MessageView header(socket,UpdateInputDevicesMsg::size);
+		header.read<ClientID>();
+		header.read<UpdateSequence>();
+		header.read<TimeStamp>();
+		bool haveViewerState=header.read<Bool>()!=0;
+		bool quantized=header.read<Bool>()!=0;
+		size_t numDevices=header.read<Misc::UInt8>();
+		
+		/* Create a message continuation and copy the unmodified message header into it: */
+		cont=new Cont(UpdateInputDevicesMsg::size+UpdateInputDevicesMsg::getBodySize(haveViewerState,quantized,numDevices));
+		header.rewind();
+		memcpy(cont->message.getWritePtr(),header.getReadPtr(),header.getSize());
+		cont->message.advanceWritePtr(header.getSize());
+		}
+	
+	/* Read a chunk of the message body: */
+	size_t readSize=Misc::min(socket.getUnread(),cont->message.getSpace());
+	socket.readRaw(cont->message.getWritePtr(),readSize);
+	cont->message.advanceWritePtr(readSize);
+	
+	/* Check if the message was read completely: */
+	if(cont->message.eof())
+		{
+		/* Apply the batched update: */
+		{
+		MessageReader message(cont->message.getBuffer()->ref(),socket.getSwapOnRead());
+		updateInputDevices(clientId,message);
 		}
+		
+		/* Done with the message: */
+		delete cont;
+		cont=0;
 		}
 	
-	/* Done with the message: */
-	return 0;
+	return cont;
+	}
+
+void VruiCoreServer::udpUpdateInputDevicesRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message)
+	{
+	/* Give the message a basic smell test: */
+	if(message.getUnread()<UpdateInputDevicesMsg::size)
+		throw std::runtime_error("VruiCoreServer: Truncated update input devices message");
+	
+	/* Apply the batched update: */
+	updateInputDevices(clientId,message);
 	}
 
 MessageContinuation* VruiCoreServer::disableInputDeviceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
@@ -701,7 +1032,7 @@ MessageContinuation* VruiCoreServer::disableInputDeviceRequestCallback(unsigned
 	socket.read<ClientID>();
 	
 	/* Retrieve the input device structure: */
-	ClientInputDeviceState& device=vcClient->devices[vcClient->deviceIndexMap.getEntry(socket.read<InputDeviceID>()).getDest()];
+	Client::DeviceState& device=vcClient->devices[vcClient->deviceIndexMap.getEntry(socket.read<InputDeviceID>()).getDest()];
 	
 	/* Check whether the device is enabled: */
 	if(device.enabled)
@@ -734,7 +1065,7 @@ MessageContinuation* VruiCoreServer::enableInputDeviceRequestCallback(unsigned i
 	socket.read<ClientID>();
 	
 	/* Retrieve the input device structure: */
-	ClientInputDeviceState& device=vcClient->devices[vcClient->deviceIndexMap.getEntry(socket.read<InputDeviceID>()).getDest()];
+	Client::DeviceState& device=vcClient->devices[vcClient->deviceIndexMap.getEntry(socket.read<InputDeviceID>()).getDest()];
 	
 	/* Check whether the device is disabled: */
 	if(!device.enabled)
@@ -805,14 +1136,294 @@ MessageContinuation* VruiCoreServer::destroyInputDeviceRequestCallback(unsigned
 	return 0;
 	}
 
+void VruiCoreServer::snapshotAck(VruiCoreServer::Client* vcClient,VruiCoreProtocol::UpdateSequence tick)
+	{
+	/* Advance the client's baseline snapshot unless the acknowledgment was overtaken by a newer one or refers to a snapshot that was never sent: */
+	if(isNewerUpdate(tick,vcClient->snapshotAcks[FullInterest])&&!isNewerUpdate(tick,snapshotTick))
+		{
+		vcClient->snapshotAcks[FullInterest]=tick;
+		
+		/* Advance the baseline snapshots of the decimated relevance tiers if the acknowledged snapshot contained their updates: */
+		for(int tier=ReducedInterest;tier<NumInterestTiers;++tier)
+			if(isRelevantUpdate(InterestTier(tier),tick))
+				vcClient->snapshotAcks[tier]=tick;
+		}
+	}
+
+MessageContinuation* VruiCoreServer::snapshotAckRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation)
+	{
+	Server::Client* client=server->getClient(clientId);
+	
+	/* Advance the client's baseline snapshot: */
+	snapshotAck(client->getPlugin<Client>(pluginIndex),client->getSocket().read<UpdateSequence>());
+	
+	/* Done with the message: */
+	return 0;
+	}
+
+void VruiCoreServer::udpSnapshotAckRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message)
+	{
+	/* Give the message a basic smell test: */
+	if(message.getUnread()!=SnapshotAckMsg::size)
+		throw std::runtime_error("VruiCoreServer: Wrong-size snapshot acknowledgment message");
+	
+	/* Advance the client's baseline snapshot: */
+	snapshotAck(getClient(clientId),message.read<UpdateSequence>());
+	}
+
+void VruiCoreServer::sendSnapshot(unsigned int clientId,VruiCoreServer::Client* vcClient)
+	{
+	/* Collect batched updates for all state of other clients that changed since the client's baseline snapshot: */
+	snapshotBlocks.clear();
+	for(ClientIDList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
+		if(*cIt!=clientId)
+			{
+			Client* source=getClient(*cIt);
+			
+			/* Determine the baseline snapshot against which to delta-encode the other client's state: */
+			UpdateSequence baseline=vcClient->snapshotAcks[FullInterest];
+			if(interestManagement)
+				{
+				/* Skip the other client if its updates are decimated away in this snapshot: */
+				const Client::InterestEntry* interest=vcClient->findInterest(*cIt);
+				InterestTier tier=interest!=0?interest->tier:MinimalInterest;
+				if(!isRelevantUpdate(tier,snapshotTick))
+					continue;
+				
+				/* Use the baseline of the other client's tier, or the minimal-interest baseline, which contains all clients, if the two clients moved closer since the former: */
+				baseline=vcClient->snapshotAcks[tier];
+				if(interest!=0&&isNewerUpdate(interest->tierSince,baseline))
+					baseline=vcClient->snapshotAcks[MinimalInterest];
+				}
+			
+			/* Check whether the other client's viewer state changed: */
+			SnapshotBlock block;
+			block.sourceClientId=*cIt;
+			block.source=source;
+			block.baseline=baseline;
+			block.haveViewerState=isNewerUpdate(source->viewerChangeTick,baseline);
+			block.quantized=quantizeSnapshots&&(!block.haveViewerState||canQuantize(source->viewerState.headTransform,source->environment));
+			block.devicesBegin=0;
+			block.numDevices=0;
+			
+			/* Split the other client's changed enabled devices into batched updates of at most the maximum number of device updates: */
+			for(size_t deviceIndex=0;deviceIndex<source->devices.size();++deviceIndex)
+				{
+				const Client::DeviceState& device=source->devices[deviceIndex];
+				if(device.enabled&&isNewerUpdate(device.changeTick,baseline))
+					{
+					/* Finish the current batched update if it is full: */
+					if(block.numDevices==UpdateInputDevicesMsg::maxNumDevices)
+						{
+						block.devicesEnd=deviceIndex;
+						block.size=UpdateInputDevicesMsg::size+UpdateInputDevicesMsg::getBodySize(block.haveViewerState,block.quantized,block.numDevices);
+						snapshotBlocks.push_back(block);
+						
+						block.haveViewerState=false;
+						block.quantized=quantizeSnapshots;
+						block.devicesBegin=deviceIndex;
+						block.numDevices=0;
+						}
+					
+					/* Add the device to the current batched update: */
+					++block.numDevices;
+					block.quantized=block.quantized&&canQuantize(device.transform,source->environment);
+					}
+				}
+			
+			/* Finish the last batched update: */
+			if(block.haveViewerState||block.numDevices>0)
+				{
+				block.devicesEnd=source->devices.size();
+				block.size=UpdateInputDevicesMsg::size+UpdateInputDevicesMsg::getBodySize(block.haveViewerState,block.quantized,block.numDevices);
+				snapshotBlocks.push_back(block);
+				}
+			}
+	
+	/* Bail out if nothing changed; the client's baseline stays valid: */
+	if(snapshotBlocks.empty())
+		return;
+	
+	/* Count the number of parts required to send all batched updates: */
+	unsigned int numParts=1;
+	size_t partSize=0;
+	for(std::vector<SnapshotBlock>::iterator bIt=snapshotBlocks.begin();bIt!=snapshotBlocks.end();++bIt)
+		{
+		if(partSize>0&&partSize+bIt->size>SnapshotMsg::maxBodySize)
+			{
+			++numParts;
+			partSize=0;
+			}
+		partSize+=bIt->size;
+		}
+	
+	/* Send the snapshot's parts: */
+	std::vector<SnapshotBlock>::iterator bIt=snapshotBlocks.begin();
+	for(unsigned int partIndex=0;partIndex<numParts;++partIndex)
+		{
+		/* Find the range of batched updates contained in this part: */
+		std::vector<SnapshotBlock>::iterator bEnd=bIt;
+		size_t bodySize=0;
+		for(;bEnd!=snapshotBlocks.end()&&(bodySize==0||bodySize+bEnd->size<=SnapshotMsg::maxBodySize);++bEnd)
+			bodySize+=bEnd->size;
+		
+		/* Write the snapshot part: */
+		{
+		MessageWriter snapshotNotification(SnapshotMsg::createMessage(serverMessageBase,bodySize));
+		snapshotNotification.write(snapshotTick);
+		snapshotNotification.write(Misc::UInt16(numParts));
+		snapshotNotification.write(Misc::UInt16(bodySize));
+		for(;bIt!=bEnd;++bIt)
+			{
+			/* Write the batched update's header, using the other client's most recent update sequence number and time stamp: */
+			Client* source=bIt->source;
+			snapshotNotification.write(ClientID(bIt->sourceClientId));
+			snapshotNotification.write(source->lastUpdateSequence);
+			snapshotNotification.write(source->lastUpdateTimeStamp);
+			writeBool(bIt->haveViewerState,snapshotNotification);
+			writeBool(bIt->quantized,snapshotNotification);
+			snapshotNotification.write(Misc::UInt8(bIt->numDevices));
+			
+			/* Write the batched update's body: */
+			if(bIt->haveViewerState)
+				source->viewerState.write(bIt->quantized,source->environment,snapshotNotification);
+			for(size_t deviceIndex=bIt->devicesBegin;deviceIndex<bIt->devicesEnd;++deviceIndex)
+				{
+				const Client::DeviceState& device=source->devices[deviceIndex];
+				if(device.enabled&&isNewerUpdate(device.changeTick,bIt->baseline))
+					{
+					snapshotNotification.write(InputDeviceID(device.id));
+					writeTransform(device.transform,bIt->quantized,source->environment,snapshotNotification);
+					}
+				}
+			}
+		server->queueUDPMessageFallback(clientId,snapshotNotification.getBuffer());
+		}
+		}
+	}
+
+bool VruiCoreServer::snapshotTimerCallback(Threads::EventDispatcher::ListenerKey eventKey)
+	{
+	/* Start a new snapshot; all state that changed since the previous snapshot now carries the new snapshot's tick: */
+	++snapshotTick;
+	
+	/* Send the snapshot to all clients, each delta-encoded against the client's own baseline snapshot: */
+	for(ClientIDList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
+		sendSnapshot(*cIt,getClient(*cIt));
+	
+	/* Keep repeating the timer event: */
+	return false;
+	}
+
+void VruiCoreServer::updateInterests(unsigned int newClientId)
+	{
+	/* Sort all clients into a uniform grid whose cells are as large as the far interest radius, based on their main viewers' positions in navigational space: */
+	interestGrid.clear();
+	for(ClientIDList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
+		{
+		Client* vcClient=getClient(*cIt);
+		vcClient->navHeadPosition=vcClient->getNavTransform().inverseTransform(NavTransform::Point(vcClient->getHeadTransform().getOrigin()));
+		
+		InterestGridEntry entry;
+		for(int i=0;i<3;++i)
+			entry.cell[i]=int(Math::floor(vcClient->navHeadPosition[i]/interestFarRadius));
+		entry.clientId=*cIt;
+		entry.client=vcClient;
+		interestGrid.push_back(entry);
+		}
+	std::sort(interestGrid.begin(),interestGrid.end());
+	
+	/* Find each client's nearby clients in its own grid cell and the 26 adjacent ones: */
+	NavTransform::Scalar near2=Math::sqr(interestNearRadius);
+	NavTransform::Scalar far2=Math::sqr(interestFarRadius);
+	Client::InterestList oldInterests;
+	for(std::vector<InterestGridEntry>::iterator gIt=interestGrid.begin();gIt!=interestGrid.end();++gIt)
+		{
+		Client* vcClient=gIt->client;
+		std::swap(oldInterests,vcClient->interests);
+		vcClient->interests.clear();
+		
+		InterestGridEntry key;
+		for(key.cell[0]=gIt->cell[0]-1;key.cell[0]<=gIt->cell[0]+1;++key.cell[0])
+			for(key.cell[1]=gIt->cell[1]-1;key.cell[1]<=gIt->cell[1]+1;++key.cell[1])
+				for(key.cell[2]=gIt->cell[2]-1;key.cell[2]<=gIt->cell[2]+1;++key.cell[2])
+					{
+					/* Check all clients in the grid cell: */
+					for(std::vector<InterestGridEntry>::iterator oIt=std::lower_bound(interestGrid.begin(),interestGrid.end(),key);oIt!=interestGrid.end()&&oIt->sameCell(key);++oIt)
+						if(oIt!=gIt)
+							{
+							/* Assign a relevance tier based on the two clients' distance: */
+							NavTransform::Scalar dist2=Geometry::sqrDist(vcClient->navHeadPosition,oIt->client->navHeadPosition);
+							if(dist2<far2)
+								{
+								Client::InterestEntry interest;
+								interest.clientId=oIt->clientId;
+								interest.tier=dist2<near2?FullInterest:ReducedInterest;
+								
+								/* Keep the tick since which the two clients have been at this or a closer tier, or start a new one if they moved closer: */
+								interest.tierSince=getChangeTick();
+								InterestTier oldTier=MinimalInterest;
+								for(Client::InterestList::iterator iIt=oldInterests.begin();iIt!=oldInterests.end();++iIt)
+									if(iIt->clientId==interest.clientId)
+										{
+										oldTier=iIt->tier;
+										if(iIt->tier<=interest.tier)
+											interest.tierSince=iIt->tierSince;
+										break;
+										}
+								
+								/* Remember the pair if the other client might have missed decimated updates at the old tier that it must now receive: */
+								if(interest.tier<oldTier&&interestDecimations[oldTier]!=1&&gIt->clientId!=newClientId&&interest.clientId!=newClientId)
+									raisedInterests.push_back(InterestRaisedCallbackData(gIt->clientId,interest.clientId,oldTier,interest.tier));
+								
+								vcClient->interests.push_back(interest);
+								}
+							}
+					}
+		}
+	
+	/* Bring all clients whose relevance tiers were raised up-to-date, as the most recent updates they skipped might have been the last ones: */
+	for(std::vector<InterestRaisedCallbackData>::iterator riIt=raisedInterests.begin();riIt!=raisedInterests.end();++riIt)
+		{
+		/* Snapshots already re-send all state changed since the baseline of the new tier: */
+		if(!snapshotMode)
+			sendTrackingState(riIt->sourceClientId,getClient(riIt->sourceClientId),riIt->destClientId);
+		
+		/* Let dependent protocols re-send their own decimated state: */
+		interestRaisedCallbacks.call(&*riIt);
+		}
+	raisedInterests.clear();
+	}
+
+bool VruiCoreServer::interestTimerCallback(Threads::EventDispatcher::ListenerKey eventKey)
+	{
+	/* Recalculate all clients' relevance tiers: */
+	updateInterests(0);
+	
+	/* Keep repeating the timer event: */
+	return false;
+	}
+
 VruiCoreServer::VruiCoreServer(Server* sServer)
 	:PluginServer(sServer),
-	 lastPhysicalEnvironmentId(0),physicalEnvironmentMap(5)
+	 lastPhysicalEnvironmentId(0),physicalEnvironmentMap(5),
+	 snapshotMode(false),quantizeSnapshots(true),snapshotTick(0),
+	 interestManagement(false),interestNearRadius(0),interestFarRadius(0)
 	{
+	/* Send all updates to all clients unless interest management is enabled: */
+	for(int i=0;i<NumInterestTiers;++i)
+		interestDecimations[i]=1;
 	}
 
 VruiCoreServer::~VruiCoreServer(void)
 	{
+	/* Stop sending snapshots: */
+	if(snapshotMode)
+		server->getDispatcher().removeTimerEventListener(snapshotTimerKey);
+	
+	/* Stop updating the interest grid: */
+	if(interestManagement)
+		server->getDispatcher().removeTimerEventListener(interestTimerKey);
 	}
 
 const char* VruiCoreServer::getName(void) const
@@ -844,6 +1455,7 @@ void VruiCoreServer::setMessageBases(unsigned int newClientMessageBase,unsigned
 	server->setMessageHandler(clientMessageBase+ConnectRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::connectRequestCallback>,this,ConnectRequestMsg::size);
 	server->setMessageHandler(clientMessageBase+EnvironmentUpdateRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::environmentUpdateRequestCallback>,this,EnvironmentUpdateMsg::size);
 	server->setMessageHandler(clientMessageBase+ViewerUpdateRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::viewerUpdateRequestCallback>,this,ViewerUpdateMsg::size);
+	server->setUDPMessageHandler(clientMessageBase+ViewerUpdateRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::udpViewerUpdateRequestCallback>,this);
 	server->setMessageHandler(clientMessageBase+ViewerConfigUpdateRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::viewerConfigUpdateRequestCallback>,this,ViewerConfigUpdateMsg::size);
 	server->setMessageHandler(clientMessageBase+StartNavSequenceRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::startNavSequenceRequestCallback>,this,NavSequenceRequestMsg::size);
 	server->setMessageHandler(clientMessageBase+NavTransformUpdateRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::navTransformUpdateRequestCallback>,this,NavTransformUpdateMsg::size);
@@ -853,13 +1465,52 @@ void VruiCoreServer::setMessageBases(unsigned int newClientMessageBase,unsigned
 	server->setMessageHandler(clientMessageBase+CreateInputDeviceRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::createInputDeviceRequestCallback>,this,CreateInputDeviceMsg::size);
 	server->setMessageHandler(clientMessageBase+UpdateInputDeviceRayRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::updateInputDeviceRayRequestCallback>,this,UpdateInputDeviceRayMsg::size);
 	server->setMessageHandler(clientMessageBase+UpdateInputDeviceRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::updateInputDeviceRequestCallback>,this,UpdateInputDeviceMsg::size);
+	server->setUDPMessageHandler(clientMessageBase+UpdateInputDeviceRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::udpUpdateInputDeviceRequestCallback>,this);
+	server->setMessageHandler(clientMessageBase+UpdateInputDevicesRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::updateInputDevicesRequestCallback>,this,UpdateInputDevicesMsg::size);
+	server->setUDPMessageHandler(clientMessageBase+UpdateInputDevicesRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::udpUpdateInputDevicesRequestCallback>,this);
 	server->setMessageHandler(clientMessageBase+DisableInputDeviceRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::disableInputDeviceRequestCallback>,this,DisableInputDeviceMsg::size);
 	server->setMessageHandler(clientMessageBase+EnableInputDeviceRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::enableInputDeviceRequestCallback>,this,EnableInputDeviceMsg::size);
 	server->setMessageHandler(clientMessageBase+DestroyInputDeviceRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::destroyInputDeviceRequestCallback>,this,DestroyInputDeviceMsg::size);
+	server->setMessageHandler(clientMessageBase+SnapshotAckRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::snapshotAckRequestCallback>,this,SnapshotAckMsg::size);
+	server->setUDPMessageHandler(clientMessageBase+SnapshotAckRequest,Server::wrapMethod<VruiCoreServer,&VruiCoreServer::udpSnapshotAckRequestCallback>,this);
 	}
 
 void VruiCoreServer::start(void)
 	{
+	/* Check whether to send tracking updates as periodic delta-compressed snapshots instead of forwarding them as they arrive: */
+	Misc::ConfigurationFileSection config=server->getPluginConfig(this);
+	double snapshotRate=config.retrieveValue<double>("./snapshotRate",0.0);
+	if(snapshotRate>0.0)
+		{
+		snapshotMode=true;
+		quantizeSnapshots=config.retrieveValue<bool>("./quantizeSnapshots",quantizeSnapshots);
+		
+		/* Send snapshots at the configured rate: */
+		long snapshotInterval=long(1.0e6/snapshotRate+0.5);
+		Threads::EventDispatcher::Time interval(snapshotInterval/1000000L,snapshotInterval%1000000L);
+		Threads::EventDispatcher::Time first=Threads::EventDispatcher::Time::now();
+		snapshotTimerKey=server->getDispatcher().addTimerEventListener(first,interval,Threads::EventDispatcher::wrapMethod<VruiCoreServer,&VruiCoreServer::snapshotTimerCallback>,this);
+		}
+	
+	/* Check whether to limit the fan-out of state updates by the clients' distances in navigational space: */
+	interestNearRadius=config.retrieveValue<NavTransform::Scalar>("./interestNearRadius",interestNearRadius);
+	if(interestNearRadius>NavTransform::Scalar(0))
+		{
+		interestManagement=true;
+		interestFarRadius=Math::max(config.retrieveValue<NavTransform::Scalar>("./interestFarRadius",interestNearRadius*NavTransform::Scalar(4)),interestNearRadius);
+		
+		/* Read the decimation factors of the reduced and minimal tiers; the latter is rounded up to a multiple of the former such that every snapshot containing minimal-interest updates contains all updates: */
+		unsigned int reducedDecimation=Math::max(config.retrieveValue<unsigned int>("./reducedInterestDecimation",4U),1U);
+		unsigned int minimalDecimation=config.retrieveValue<unsigned int>("./minimalInterestDecimation",16U);
+		interestDecimations[ReducedInterest]=reducedDecimation;
+		interestDecimations[MinimalInterest]=((minimalDecimation+reducedDecimation-1)/reducedDecimation)*reducedDecimation;
+		
+		/* Update the interest grid at the configured interval: */
+		long interestInterval=long(config.retrieveValue<double>("./interestUpdateInterval",0.5)*1.0e6+0.5);
+		Threads::EventDispatcher::Time interval(interestInterval/1000000L,interestInterval%1000000L);
+		Threads::EventDispatcher::Time first=Threads::EventDispatcher::Time::now();
+		interestTimerKey=server->getDispatcher().addTimerEventListener(first,interval,Threads::EventDispatcher::wrapMethod<VruiCoreServer,&VruiCoreServer::interestTimerCallback>,this);
+		}
 	}
 
 void VruiCoreServer::clientConnected(unsigned int clientId)
@@ -879,6 +1530,22 @@ void VruiCoreServer::clientDisconnected(unsigned int clientId)
 		/* Calculate the disconnected client's full navigation transformation: */
 		NavTransform disconnectedNavTransform=vcClient->getNavTransform();
 		
+		/* Remove the disconnected client from the interest lists of all nearby clients: */
+		for(Client::InterestList::iterator iIt=vcClient->interests.begin();iIt!=vcClient->interests.end();++iIt)
+			{
+			Client::InterestList& otherInterests=getClient(iIt->clientId)->interests;
+			for(Client::InterestList::iterator oiIt=otherInterests.begin();oiIt!=otherInterests.end();++oiIt)
+				if(oiIt->clientId==clientId)
+					{
+					/* Move the last entry to the disconnected client's slot and remove the duplicated last entry: */
+					*oiIt=otherInterests.back();
+					otherInterests.pop_back();
+					
+					/* Stop looking: */
+					break;
+					}
+			}
+		
 		/* Check if the client is part of a shared physical environment: */
 		PhysicalEnvironment* pe=vcClient->physicalEnvironment;
 		if(pe!=0)
@@ -12,6 +12,8 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #include <vector>
 #include <Misc/StringHashFunctions.h>
 #include <Misc/HashTable.h>
+#include <Misc/CallbackData.h>
+#include <Misc/CallbackList.h>
 
 #include <Collaboration2/PluginServer.h>
 #include <Collaboration2/Server.h>
@@ -28,6 +30,29 @@ class VruiCoreServer:public PluginServer,public VruiCoreProtocol
 	public:
 	class Client; // Forward declaration
 	
+	enum InterestTier // Enumerated type for the relevance of one client's state updates to another client, based on their distance in navigational space
+		{
+		FullInterest=0, // Clients are close to each other; all updates are sent
+		ReducedInterest, // Clients are at medium distance; updates are decimated
+		MinimalInterest, // Clients are far apart; updates are strongly decimated or dropped, and audio is not sent
+		NumInterestTiers
+		};
+	
+	class InterestRaisedCallbackData:public Misc::CallbackData // Callback data when updates from one client become more relevant to another client, which might have missed decimated updates
+		{
+		/* Elements: */
+		public:
+		unsigned int sourceClientId; // ID of the client whose updates became more relevant
+		unsigned int destClientId; // ID of the client to which the updates became more relevant
+		InterestTier oldTier,newTier; // Relevance tiers before and after the change
+		
+		/* Constructors and destructors: */
+		InterestRaisedCallbackData(unsigned int sSourceClientId,unsigned int sDestClientId,InterestTier sOldTier,InterestTier sNewTier)
+			:sourceClientId(sSourceClientId),destClientId(sDestClientId),oldTier(sOldTier),newTier(sNewTier)
+			{
+			}
+		};
+	
 	private:
 	struct ClientIdentifier // Class to identify a client by ID and state object pointer
 		{
@@ -84,6 +109,42 @@ class VruiCoreServer:public PluginServer,public VruiCoreProtocol
 	
 	typedef Misc::HashTable<std::string,PhysicalEnvironment*> PhysicalEnvironmentMap; // Type for hash tables mapping names to shared physical environments
 	
+	struct SnapshotBlock // Structure describing a batched update for one other client inside a snapshot
+		{
+		/* Elements: */
+		public:
+		unsigned int sourceClientId; // ID of the client whose state is sent in the batched update
+		Client* source; // State object of that client
+		bool haveViewerState; // Flag whether the batched update contains the client's viewer state
+		bool quantized; // Flag whether the batched update's transformations are quantized
+		UpdateSequence baseline; // Snapshot tick of the receiving client's baseline snapshot for the other client
+		size_t devicesBegin,devicesEnd; // Index range in the client's device list containing the batched update's device updates
+		size_t numDevices; // Number of device updates in the batched update
+		size_t size; // Wire size of the batched update
+		};
+	
+	struct InterestGridEntry // Structure for a client sorted into the interest grid
+		{
+		/* Elements: */
+		public:
+		int cell[3]; // Index of the grid cell containing the client's main viewer in navigational space
+		unsigned int clientId; // Client's ID
+		Client* client; // Client's state object
+		
+		/* Methods: */
+		bool operator<(const InterestGridEntry& other) const // Orders grid entries lexicographically by grid cell index
+			{
+			for(int i=0;i<2;++i)
+				if(cell[i]!=other.cell[i])
+					return cell[i]<other.cell[i];
+			return cell[2]<other.cell[2];
+			}
+		bool sameCell(const InterestGridEntry& other) const // Returns true if the two entries are in the same grid cell
+			{
+			return cell[0]==other.cell[0]&&cell[1]==other.cell[1]&&cell[2]==other.cell[2];
+			}
+		};
+	
 	public:
 	class Client:public PluginServer::Client // Class representing a client participating in the Vrui Core protocol
 		{
@@ -91,18 +152,44 @@ class VruiCoreServer:public PluginServer,public VruiCoreProtocol
 		
 		/* Embedded classes: */
 		private:
-		typedef std::vector<ClientInputDeviceState> DeviceList; // Type for lists of input devices
+		struct DeviceState:public ClientInputDeviceState // Structure for input device states with snapshot change tracking
+			{
+			/* Elements: */
+			public:
+			UpdateSequence changeTick; // Snapshot tick of the first snapshot that must contain the device's current transformation
+			};
+		
+		typedef std::vector<DeviceState> DeviceList; // Type for lists of input devices
 		typedef Misc::HashTable<unsigned int,size_t> DeviceIndexMap; // Type for hash tables mapping input device IDs to indices in the device list
 		
+		struct InterestEntry // Structure for another client within this client's far interest radius
+			{
+			/* Elements: */
+			public:
+			unsigned int clientId; // Other client's ID
+			InterestTier tier; // Relevance tier between this client and the other client
+			UpdateSequence tierSince; // Snapshot tick of the first snapshot since which the two clients have been at this or a closer tier
+			};
+		
+		typedef std::vector<InterestEntry> InterestList; // Type for lists of other clients within the far interest radius
+		
 		/* Elements: */
 		PhysicalEnvironment* physicalEnvironment; // Pointer to a shared physical environment in which this client is located, or 0
 		ClientEnvironment environment; // Client's physical environment
 		ClientViewerConfig viewerConfig; // Client's viewer configuration
 		ClientViewerState viewerState; // Client's viewer state
+		UpdateSequence viewerSequence; // Sequence number of the most recently accepted viewer update
+		UpdateSequence viewerChangeTick; // Snapshot tick of the first snapshot that must contain the client's current viewer state
+		UpdateSequence lastUpdateSequence; // Sequence number of the most recently accepted viewer or device update
+		TimeStamp lastUpdateTimeStamp; // Time stamp of the most recently accepted batched update
+		unsigned int frameCounter; // Running count of the client's frames that sent batched updates, to decimate updates per frame instead of per batch
+		UpdateSequence snapshotAcks[NumInterestTiers]; // Snapshot ticks of the most recent snapshots the client acknowledged that contained all other clients of each relevance tier, or of the client's connection
 		ClientIdentifier navLockClient; // Client to whom this client has locked its navigation transformation
 		NavTransform navTransform; // Client's navigation transformation relative to physical space if unlocked, or relative to navLockClient's navigation transformation
 		DeviceList devices; // List of client's input devices
 		DeviceIndexMap deviceIndexMap; // Map from input device IDs to indices in the device list
+		NavTransform::Point navHeadPosition; // Main viewer position in navigational space as of the most recent interest update
+		InterestList interests; // List of other clients within the far interest radius as of the most recent interest update
 		
 		/* Constructors and destructors: */
 		Client(PhysicalEnvironment* sPhysicalEnvironment,NonBlockSocket& socket); // Creates a client from a connect request message pending on the given socket
@@ -141,18 +228,47 @@ class VruiCoreServer:public PluginServer,public VruiCoreProtocol
 			{
 			return devices[deviceIndexMap.getEntry(deviceId).getDest()];
 			}
+		const InterestEntry* findInterest(unsigned int otherClientId) const // Returns the interest entry for the other client of the given ID, or null if the other client is outside the far interest radius
+			{
+			for(InterestList::const_iterator iIt=interests.begin();iIt!=interests.end();++iIt)
+				if(iIt->clientId==otherClientId)
+					return &*iIt;
+			return 0;
+			}
 		};
 	
 	/* Elements: */
 	private:
 	Misc::UInt16 lastPhysicalEnvironmentId; // Last ID assigned to a new shared physical environment
 	PhysicalEnvironmentMap physicalEnvironmentMap; // Map of shared physical environments currently used on the server
+	bool snapshotMode; // Flag whether tracking updates are sent to clients as periodic delta-compressed snapshots instead of being forwarded as they arrive
+	bool quantizeSnapshots; // Flag whether to quantize transformations in snapshots whenever possible
+	Threads::EventDispatcher::ListenerKey snapshotTimerKey; // Key for the timer event sending snapshots
+	UpdateSequence snapshotTick; // Snapshot tick of the most recently sent snapshot
+	std::vector<SnapshotBlock> snapshotBlocks; // List of batched updates in the snapshot currently being sent
+	bool interestManagement; // Flag whether the fan-out of state updates is limited by the clients' distances in navigational space
+	NavTransform::Scalar interestNearRadius,interestFarRadius; // Distances in navigational space up to which clients are at full or reduced interest, respectively
+	unsigned int interestDecimations[NumInterestTiers]; // Only every n-th update is sent to clients at each relevance tier; 0 sends no updates
+	Threads::EventDispatcher::ListenerKey interestTimerKey; // Key for the timer event updating the interest grid
+	std::vector<InterestGridEntry> interestGrid; // List of clients sorted by the grid cells containing their main viewers
+	std::vector<InterestRaisedCallbackData> raisedInterests; // List of pairs of clients whose relevance tiers were raised during the most recent interest update
+	Misc::CallbackList interestRaisedCallbacks; // List of callbacks to be called when updates from one client become more relevant to another client
 	
 	/* Private methods: */
+	UpdateSequence getChangeTick(void) const // Returns the snapshot tick of the next snapshot, to be assigned to changed state
+		{
+		return snapshotTick+1;
+		}
+	void broadcastTrackingUpdate(unsigned int clientId,Client* vcClient,unsigned int updateCounter,MessageBuffer* message); // Sends a tracking update of the given running count from the given client to all other clients to which it is relevant
+	void sendTrackingState(unsigned int clientId,Client* vcClient,unsigned int destClientId); // Sends the given client's current viewer state and input device transformations to the given destination client
+	void updateViewer(unsigned int clientId,Client* vcClient,UpdateSequence sequence,const ClientViewerState& newViewerState); // Updates the given client's viewer state and forwards it to all other clients unless the update is stale
+	void updateInputDevice(unsigned int clientId,Client* vcClient,Client::DeviceState& device,UpdateSequence sequence,const ONTransform& newTransform); // Updates the given input device's transformation and forwards it to all other clients unless the update is stale
+	void updateInputDevices(unsigned int clientId,MessageReader& message); // Applies a batched update from the given client whose header is pending in the given message, and forwards all non-stale updates to all other clients as a single batched update
 	MessageContinuation* connectRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* environmentUpdateRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* viewerConfigUpdateRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* viewerUpdateRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
+	void udpViewerUpdateRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message);
 	MessageContinuation* startNavSequenceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* navTransformUpdateRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* stopNavSequenceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
@@ -161,9 +277,19 @@ class VruiCoreServer:public PluginServer,public VruiCoreProtocol
 	MessageContinuation* createInputDeviceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* updateInputDeviceRayRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* updateInputDeviceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
+	void udpUpdateInputDeviceRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message);
+	MessageContinuation* updateInputDevicesRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
+	void udpUpdateInputDevicesRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message);
 	MessageContinuation* disableInputDeviceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* enableInputDeviceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
 	MessageContinuation* destroyInputDeviceRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
+	void snapshotAck(Client* vcClient,UpdateSequence tick); // Advances the given client's baseline snapshot
+	MessageContinuation* snapshotAckRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation);
+	void udpSnapshotAckRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message);
+	void sendSnapshot(unsigned int clientId,Client* vcClient); // Sends the current snapshot to the given client, delta-encoded against the client's acknowledged baseline snapshot
+	bool snapshotTimerCallback(Threads::EventDispatcher::ListenerKey eventKey); // Called at regular intervals to send snapshots to all clients
+	void updateInterests(unsigned int newClientId); // Sorts all clients into the interest grid and recalculates their relevance tiers to all nearby clients; re-sends current state between clients whose tiers were raised, except to and from the given newly-connected client, which already received full state
+	bool interestTimerCallback(Threads::EventDispatcher::ListenerKey eventKey); // Called at regular intervals to update the interest grid
 	
 	/* Constructors and destructors: */
 	public:
@@ -195,6 +321,33 @@ class VruiCoreServer:public PluginServer,public VruiCoreProtocol
 		{
 		return server->getClient(clientId)->getPlugin<Client>(pluginIndex);
 		}
+	bool isInterestManaged(void) const // Returns true if the fan-out of state updates is limited by the clients' distances in navigational space
+		{
+		return interestManagement;
+		}
+	InterestTier getInterestTier(unsigned int sourceClientId,unsigned int destClientId) // Returns the relevance tier of updates from the given source client to the given destination client
+		{
+		/* All updates are fully relevant if interest management is disabled or the source client is not fully connected yet: */
+		Client* source=interestManagement?server->testAndGetPlugin<Client>(sourceClientId,pluginIndex):0;
+		if(source==0)
+			return FullInterest;
+		
+		/* Look for the destination client in the source client's interest list: */
+		const Client::InterestEntry* interest=source->findInterest(destClientId);
+		return interest!=0?interest->tier:MinimalInterest;
+		}
+	bool isRelevantUpdate(InterestTier tier,unsigned int updateCounter) const // Returns true if the update of the given running count is sent to clients at the given relevance tier
+		{
+		return interestDecimations[tier]!=0&&updateCounter%interestDecimations[tier]==0;
+		}
+	bool isAudible(unsigned int sourceClientId,unsigned int destClientId) // Returns true if the given destination client is within audibility range of the given source client
+		{
+		return getInterestTier(sourceClientId,destClientId)!=MinimalInterest;
+		}
+	Misc::CallbackList& getInterestRaisedCallbacks(void) // Returns the list of callbacks called when updates from one client become more relevant to another client
+		{
+		return interestRaisedCallbacks;
+		}
 	};
 
 #endif
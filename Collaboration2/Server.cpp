@@ -28,6 +28,7 @@ Copyright (c) 2019-2020 Oliver Kreylos
 #include <Comm/IPSocketAddress.h>
 
 #include <Collaboration2/Config.h>
+#include <Collaboration2/Allocator.h>
 #include <Collaboration2/Protocol.h>
 #include <Collaboration2/MessageReader.h>
 #include <Collaboration2/MessageWriter.h>
@@ -39,11 +40,17 @@ Static elements of class Server::Client:
 
 const std::runtime_error Server::Client::missingPluginError("Server::Client::getPlugin: Missing plug-in requested");
 
+/********************************
+Static elements of class Server:
+********************************/
+
+const std::runtime_error Server::missingClientError("Server::getClient: Missing client requested");
+
 /*******************************
 Methods of class Server::Client:
 *******************************/
 
-bool Server::Client::socketEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask)
+void Server::Client::processMessages(size_t unread)
 	{
 	/* Embedded classes: */
 	class ConnectRequestContinuation:public MessageContinuation
@@ -59,338 +66,374 @@ bool Server::Client::socketEvent(Threads::EventDispatcher::ListenerKey eventKey,
 			}
 		};
 	
-	try
+	/* Process as much unread data as possible: */
+	bool readAgain=false;
+	do
 		{
-		/* Handle the client communication protocol: */
-		if(eventTypeMask&Threads::EventDispatcher::Read)
+		readAgain=false;
+		switch(clientState)
 			{
-			/* Read data from the socket: */
-			size_t unread=socket.readFromSocket();
+			case Client::ReadingMessageID:
 			
-			/* Process as much unread data as possible: */
-			bool readAgain=false;
-			do
-				{
-				readAgain=false;
-				switch(clientState)
+				/* Check if there is enough unread data to read a message ID: */
+				if(unread>=sizeof(MessageID))
 					{
-					case Client::ReadingMessageID:
-						
-						/* Check if there is enough unread data to read a message ID: */
-						if(unread>=sizeof(MessageID))
-							{
-							/* Retrieve the message ID: */
-							messageId=socket.read<MessageID>();
-							
-							/* Check if the message ID is valid: */
-							const MessageHandler& mh=server->messageHandlers[messageId];
-							if(messageId>=server->messageHandlers.size()||mh.callback==0)
-								throw std::runtime_error("Invalid message ID");
-							
-							/* Check if the message handler requires a minimum message body: */
-							if(mh.minUnread>socket.getUnread())
-								{
-								/* Read the message body: */
-								clientState=Client::ReadingMessageBody;
-								}
-							else
-								{
-								/* Handle the message: */
-								continuation=mh.callback(messageId,id,0,mh.callbackUserData);
-								if(continuation==0)
-									{
-									/* Handler is done processing the message; start reading the next one: */
-									clientState=Client::ReadingMessageID;
-									
-									/* If there is unread data in the socket buffer at this point, read again: */
-									readAgain=(unread=socket.getUnread())>0;
-									}
-								else
-									{
-									/* Handler is not done processing the message; continue calling the message handler: */
-									clientState=Client::HandlingMessage;
-									}
-								}
-							}
-						
-						break;
+					/* Retrieve the message ID: */
+					messageId=socket.read<MessageID>();
+					
+					/* Check if the message ID is valid: */
+					const MessageHandler& mh=server->messageHandlers[messageId];
+					if(messageId>=server->messageHandlers.size()||mh.callback==0)
+						throw std::runtime_error("Invalid message ID");
 					
-					case Client::ReadingMessageBody:
+					/* Check if the message handler requires a minimum message body: */
+					if(mh.minUnread>socket.getUnread())
 						{
-						/* Check if there is enough unread data for the message handler: */
-						const MessageHandler& mh=server->messageHandlers[messageId];
-						if(unread>=mh.minUnread)
-							{
-							/* Handle the message: */
-							continuation=mh.callback(messageId,id,0,mh.callbackUserData);
-							if(continuation==0)
-								{
-								/* Handler is done processing the message; start reading the next one: */
-								clientState=Client::ReadingMessageID;
-								
-								/* If there is unread data in the socket buffer at this point, read again: */
-								readAgain=(unread=socket.getUnread())>0;
-								}
-							else
-								{
-								/* Handler is not done processing the message; continue calling the message handler: */
-								clientState=Client::HandlingMessage;
-								}
-							}
-						
-						break;
+						/* Read the message body: */
+						clientState=Client::ReadingMessageBody;
 						}
-					
-					case Client::HandlingMessage:
+					else
 						{
 						/* Handle the message: */
-						const MessageHandler& mh=server->messageHandlers[messageId];
-						continuation=mh.callback(messageId,id,continuation,mh.callbackUserData);
+						continuation=mh.callback(messageId,id,0,mh.callbackUserData);
 						if(continuation==0)
 							{
 							/* Handler is done processing the message; start reading the next one: */
-							clientState=Client::ReadingMessageID;
-							
-							/* If there is unread data in the socket buffer at this point, read again: */
-							readAgain=(unread=socket.getUnread())>0;
+							readAgain=startNextMessage(unread);
 							}
-						
-						break;
+						else
+							{
+							/* Handler is not done processing the message; continue calling the message handler: */
+							clientState=Client::HandlingMessage;
+							}
+						}
+					}
+				
+				break;
+			
+			case Client::ReadingMessageBody:
+				{
+				/* Check if there is enough unread data for the message handler: */
+				const MessageHandler& mh=server->messageHandlers[messageId];
+				if(unread>=mh.minUnread)
+					{
+					/* Handle the message: */
+					continuation=mh.callback(messageId,id,0,mh.callbackUserData);
+					if(continuation==0)
+						{
+						/* Handler is done processing the message; start reading the next one: */
+						readAgain=startNextMessage(unread);
+						}
+					else
+						{
+						/* Handler is not done processing the message; continue calling the message handler: */
+						clientState=Client::HandlingMessage;
+						}
+					}
+				
+				break;
+				}
+			
+			case Client::HandlingMessage:
+				{
+				/* Handle the message: */
+				const MessageHandler& mh=server->messageHandlers[messageId];
+				continuation=mh.callback(messageId,id,continuation,mh.callbackUserData);
+				if(continuation==0)
+					{
+					/* Handler is done processing the message; start reading the next one: */
+					readAgain=startNextMessage(unread);
+					}
+				
+				break;
+				}
+			
+			case Client::ReadingClientConnectRequest:
+			
+				/* Check if there is enough unread data to process a connection request message: */
+				if(unread>=ConnectRequestMsg::size)
+					{
+					/* Extract the endianness marker: */
+					Misc::UInt32 endiannessMarker=socket.read<Misc::UInt32>();
+					if(endiannessMarker==0x78563412U)
+						{
+						socket.setSwapOnRead(true);
+						swapOnRead=true;
 						}
+					else if(endiannessMarker!=0x12345678U)
+						throw std::runtime_error("Invalid endianness marker in connect request");
+					
+					/* Extract the protocol version: */
+					Misc::UInt32 clientProtocolVersion=socket.read<Misc::UInt32>();
+					if(clientProtocolVersion!=protocolVersion)
+						Misc::throwStdErr("Invalid protocol version %u",clientProtocolVersion);
+					
+					/* Authenticate the password hash sent by the client: */
+					MD5_CTX md5Context;
+					MD5_Init(&md5Context);
+					
+					/* Hash the nonce sent to the client: */
+					MD5_Update(&md5Context,nonce,PasswordRequestMsg::nonceLength);
 					
-					case Client::ReadingClientConnectRequest:
+					/* Hash the session password: */
+					if(!server->sessionPassword.empty())
+						MD5_Update(&md5Context,server->sessionPassword.data(),server->sessionPassword.size());
+					
+					/* Retrieve the hash value: */
+					Byte hash[ConnectRequestMsg::hashLength];
+					MD5_Final(hash,&md5Context);
+					
+					/* Compare the hash value to the hash sent by the client: */
+					Byte clientHash[ConnectRequestMsg::hashLength];
+					socket.read(clientHash,ConnectRequestMsg::hashLength);
+					if(memcmp(hash,clientHash,ConnectRequestMsg::hashLength)!=0)
+						{
+						/* Queue a connect reject message to the client and disconnect the client: */
+						{
+						MessageWriter connectReject(MessageBuffer::create(ConnectReject,0));
+						queueMessage(connectReject.getBuffer());
+						}
 						
-						/* Check if there is enough unread data to process a connection request message: */
-						if(unread>=ConnectRequestMsg::size)
+						/* Ignore further messages and disconnect the client when the connect reject message has been sent: */
+						server->dispatcher.setIOEventListenerEventTypeMaskFromCallback(socketKey,Threads::EventDispatcher::Write);
+						clientState=Drain;
+						throw std::runtime_error("Wrong session password");
+						}
+					
+					/* Extract the client name: */
+					name.clear();
+					charBufferToString(socket,ConnectRequestMsg::nameLength,name);
+					
+					/* Check if the client name is a valid non-empty UTF-8 encoded string: */
+					if(name.empty()||!Misc::UTF8::isValid(name.begin(),name.end()))
+						{
+						/* Assign the client a default name: */
+						name="Client";
+						}
+					
+					/* Check if the requested client name is unique: */
+					bool nameUnique=true;
+					for(ClientList::iterator cIt=server->clients.begin();cIt!=server->clients.end()&&nameUnique;++cIt)
+						nameUnique=*cIt==this||(*cIt)->name!=name;
+					if(!nameUnique)
+						{
+						/* Shorten the client name until there's room for a uniquifying suffix (underscore and 4 digits): */
+						while(name.length()>27)
 							{
-							/* Extract the endianness marker: */
-							Misc::UInt32 endiannessMarker=socket.read<Misc::UInt32>();
-							if(endiannessMarker==0x78563412U)
+							/* Check for a UTF-8 continuation character: */
+							if(name.back()&0x80)
 								{
-								socket.setSwapOnRead(true);
-								swapOnRead=true;
-								}
-							else if(endiannessMarker!=0x12345678U)
-								throw std::runtime_error("Invalid endianness marker in connect request");
-							
-							/* Extract the protocol version: */
-							Misc::UInt32 clientProtocolVersion=socket.read<Misc::UInt32>();
-							if(clientProtocolVersion!=protocolVersion)
-								Misc::throwStdErr("Invalid protocol version %u",clientProtocolVersion);
-							
-							/* Authenticate the password hash sent by the client: */
-							MD5_CTX md5Context;
-							MD5_Init(&md5Context);
-							
-							/* Hash the nonce sent to the client: */
-							MD5_Update(&md5Context,nonce,PasswordRequestMsg::nonceLength);
-							
-							/* Hash the session password: */
-							if(!server->sessionPassword.empty())
-								MD5_Update(&md5Context,server->sessionPassword.data(),server->sessionPassword.size());
-							
-							/* Retrieve the hash value: */
-							Byte hash[ConnectRequestMsg::hashLength];
-							MD5_Final(hash,&md5Context);
-							
-							/* Compare the hash value to the hash sent by the client: */
-							Byte clientHash[ConnectRequestMsg::hashLength];
-							socket.read(clientHash,ConnectRequestMsg::hashLength);
-							if(memcmp(hash,clientHash,ConnectRequestMsg::hashLength)!=0)
-								{
-								/* Queue a connect reject message to the client and disconnect the client: */
-								{
-								MessageWriter connectReject(MessageBuffer::create(ConnectReject,0));
-								socket.queueMessage(connectReject.getBuffer());
-								}
-								
-								/* Ignore further messages and disconnect the client when the connect reject message has been sent: */
-								server->dispatcher.setIOEventListenerEventTypeMaskFromCallback(socketKey,Threads::EventDispatcher::Write);
-								clientState=Drain;
-								throw std::runtime_error("Wrong session password");
+								/* Remove the entire code sequence (safe because the name is valid UTF-8): */
+								while(name.back()&0x80)
+									name.pop_back();
 								}
-							
-							/* Extract the client name: */
-							name.clear();
-							charBufferToString(socket,ConnectRequestMsg::nameLength,name);
-							
-							/* Check if the client name is a valid non-empty UTF-8 encoded string: */
-							if(name.empty()||!Misc::UTF8::isValid(name.begin(),name.end()))
-								{
-								/* Assign the client a default name: */
-								name="Client";
-								}
-							
-							/* Check if the requested client name is unique: */
-							bool nameUnique=true;
-							for(ClientList::iterator cIt=server->clients.begin();cIt!=server->clients.end()&&nameUnique;++cIt)
-								nameUnique=*cIt==this||(*cIt)->name!=name;
-							if(!nameUnique)
+							else
+								name.pop_back();
+							}
+						
+						/* Collect all numerical suffixes of names that match this name: */
+						Misc::HashTable<unsigned int,void> suffixes(17);
+						name.push_back('_');
+						for(ClientList::iterator cIt=server->clients.begin();cIt!=server->clients.end()&&nameUnique;++cIt)
+							if(*cIt!=this)
 								{
-								/* Shorten the client name until there's room for a uniquifying suffix (underscore and 4 digits): */
-								while(name.length()>27)
+								/* Check if the name prefix matches: */
+								std::string::iterator nIt=name.begin();
+								std::string::iterator onIt=(*cIt)->name.begin();
+								for(;nIt!=name.end()&&onIt!=(*cIt)->name.end()&&*nIt==*onIt;++nIt,++onIt)
+									;
+								if(nIt==name.end())
 									{
-									/* Check for a UTF-8 continuation character: */
-									if(name.back()&0x80)
-										{
-										/* Remove the entire code sequence (safe because the name is valid UTF-8): */
-										while(name.back()&0x80)
-											name.pop_back();
-										}
-									else
-										name.pop_back();
+									/* Check if the other name ends in a 4-digit number: */
+									unsigned int otherSuffix=0;
+									unsigned int numDigits=0;
+									for(;onIt!=(*cIt)->name.end()&&isdigit(*onIt);++onIt,++numDigits)
+										otherSuffix=otherSuffix*10+(*onIt-'0');
+									if(onIt==(*cIt)->name.end()&&numDigits==4)
+										suffixes.setEntry(Misc::HashTable<unsigned int,void>::Entry(otherSuffix));
 									}
-								
-								/* Collect all numerical suffixes of names that match this name: */
-								Misc::HashTable<unsigned int,void> suffixes(17);
-								name.push_back('_');
-								for(ClientList::iterator cIt=server->clients.begin();cIt!=server->clients.end()&&nameUnique;++cIt)
-									if(*cIt!=this)
-										{
-										/* Check if the name prefix matches: */
-										std::string::iterator nIt=name.begin();
-										std::string::iterator onIt=(*cIt)->name.begin();
-										for(;nIt!=name.end()&&onIt!=(*cIt)->name.end()&&*nIt==*onIt;++nIt,++onIt)
-											;
-										if(nIt==name.end())
-											{
-											/* Check if the other name ends in a 4-digit number: */
-											unsigned int otherSuffix=0;
-											unsigned int numDigits=0;
-											for(;onIt!=(*cIt)->name.end()&&isdigit(*onIt);++onIt,++numDigits)
-												otherSuffix=otherSuffix*10+(*onIt-'0');
-											if(onIt==(*cIt)->name.end()&&numDigits==4)
-												suffixes.setEntry(Misc::HashTable<unsigned int,void>::Entry(otherSuffix));
-											}
-										}
-								
-								/* Find the smallest unused suffix: */
-								unsigned int suffix;
-								for(suffix=1;suffixes.isEntry(suffix);++suffix)
-									;
-								
-								/* Append the suffix to the name: */
-								char suffixString[4];
-								for(char* suffixPtr=suffixString+3;suffixPtr>=suffixString;--suffixPtr,suffix/=10)
-									*suffixPtr=suffix%10+'0';
-								name.append(suffixString,4);
 								}
-							
-							/* Read the number of protocol requests: */
-							unsigned int numProtocolRequests=socket.read<Misc::UInt16>();
-							
-							/* Create a continuation object to read the rest of the message: */
-							ConnectRequestContinuation* cont=new ConnectRequestContinuation(numProtocolRequests);
-							continuation=cont;
-							
-							/* Start the connect reply message to be sent to the new client: */
-							stringToCharBuffer(server->name,cont->connectReply,ConnectReplyMsg::nameLength);
-							cont->connectReply.write(ClientID(id));
-							stringToCharBuffer(name,cont->connectReply,ConnectReplyMsg::nameLength);
-							cont->connectReply.write(udpConnectionTicket);
-							cont->connectReply.write(Misc::UInt16(numProtocolRequests));
-							
-							/* Read the protocol requests: */
-							clientState=Client::ReadingProtocolRequests;
-							readAgain=(unread=socket.getUnread())>0||numProtocolRequests==0;
-							}
 						
-						break;
+						/* Find the smallest unused suffix: */
+						unsigned int suffix;
+						for(suffix=1;suffixes.isEntry(suffix);++suffix)
+							;
+						
+						/* Append the suffix to the name: */
+						char suffixString[4];
+						for(char* suffixPtr=suffixString+3;suffixPtr>=suffixString;--suffixPtr,suffix/=10)
+							*suffixPtr=suffix%10+'0';
+						name.append(suffixString,4);
+						}
+					
+					/* Read the number of protocol requests: */
+					unsigned int numProtocolRequests=socket.read<Misc::UInt16>();
+					
+					/* Create a continuation object to read the rest of the message: */
+					ConnectRequestContinuation* cont=new ConnectRequestContinuation(numProtocolRequests);
+					continuation=cont;
+					
+					/* Start the connect reply message to be sent to the new client: */
+					stringToCharBuffer(server->name,cont->connectReply,ConnectReplyMsg::nameLength);
+					cont->connectReply.write(ClientID(id));
+					stringToCharBuffer(name,cont->connectReply,ConnectReplyMsg::nameLength);
+					cont->connectReply.write(udpConnectionTicket);
+					cont->connectReply.write(Misc::UInt16(numProtocolRequests));
+					
+					/* Read the protocol requests: */
+					clientState=Client::ReadingProtocolRequests;
+					readAgain=(unread=socket.getUnread())>0||numProtocolRequests==0;
+					}
+				
+				break;
+			
+			case Client::ReadingProtocolRequests:
+				{
+				/* Read all complete protocol requests that can be read: */
+				ConnectRequestContinuation* cont=static_cast<ConnectRequestContinuation*>(continuation);
+				while(unread>=ConnectRequestMsg::ProtocolRequest::size&&!cont->connectReply.eof())
+					{
+					/* Read the requested protocol name and version: */
+					std::string protocolName;
+					charBufferToString(socket,ConnectRequestMsg::ProtocolRequest::nameLength,protocolName);
+					unsigned int protocolVersion=socket.read<Misc::UInt32>();
 					
-					case Client::ReadingProtocolRequests:
+					/* Request the plug-in protocol: */
+					PluginServer* requestedPlugin=server->requestPluginProtocol(protocolName.c_str(),protocolVersion);
+					if(requestedPlugin!=0)
 						{
-						/* Read all complete protocol requests that can be read: */
-						ConnectRequestContinuation* cont=static_cast<ConnectRequestContinuation*>(continuation);
-						while(unread>=ConnectRequestMsg::ProtocolRequest::size&&!cont->connectReply.eof())
-							{
-							/* Read the requested protocol name and version: */
-							std::string protocolName;
-							charBufferToString(socket,ConnectRequestMsg::ProtocolRequest::nameLength,protocolName);
-							unsigned int protocolVersion=socket.read<Misc::UInt32>();
-							
-							/* Request the plug-in protocol: */
-							PluginServer* requestedPlugin=server->requestPluginProtocol(protocolName.c_str(),protocolVersion);
-							if(requestedPlugin!=0)
-								{
-								/* Grant the request: */
-								cont->connectReply.write(Misc::UInt8(ConnectReplyMsg::ProtocolReply::Success));
-								cont->connectReply.write(Misc::UInt32(requestedPlugin->getVersion()));
-								cont->connectReply.write(Misc::UInt16(requestedPlugin->getIndex()));
-								cont->connectReply.write(MessageID(requestedPlugin->getClientMessageBase()));
-								cont->connectReply.write(MessageID(requestedPlugin->getServerMessageBase()));
-								
-								/* Mark the client as participating in the protocol: */
-								pluginIndices.push_back(requestedPlugin->getIndex());
-								}
-							else
-								{
-								/* Deny the request with an unknown protocol error: */
-								cont->connectReply.write(Misc::UInt8(ConnectReplyMsg::ProtocolReply::UnknownProtocol));
-								cont->connectReply.write(Misc::UInt32(0));
-								cont->connectReply.write(Misc::UInt16(0));
-								cont->connectReply.write(MessageID(0));
-								cont->connectReply.write(MessageID(0));
-								}
-							
-							unread-=ConnectRequestMsg::ProtocolRequest::size;
-							}
+						/* Grant the request: */
+						cont->connectReply.write(Misc::UInt8(ConnectReplyMsg::ProtocolReply::Success));
+						cont->connectReply.write(Misc::UInt32(requestedPlugin->getVersion()));
+						cont->connectReply.write(Misc::UInt16(requestedPlugin->getIndex()));
+						cont->connectReply.write(MessageID(requestedPlugin->getClientMessageBase()));
+						cont->connectReply.write(MessageID(requestedPlugin->getServerMessageBase()));
 						
-						/* Check if all protocol request sub-messages have been read: */
-						if(cont->connectReply.eof())
+						/* Mark the client as participating in the protocol: */
+						pluginIndices.push_back(requestedPlugin->getIndex());
+						++server->pluginNumClients[requestedPlugin->getIndex()];
+						}
+					else
+						{
+						/* Deny the request with an unknown protocol error: */
+						cont->connectReply.write(Misc::UInt8(ConnectReplyMsg::ProtocolReply::UnknownProtocol));
+						cont->connectReply.write(Misc::UInt32(0));
+						cont->connectReply.write(Misc::UInt16(0));
+						cont->connectReply.write(MessageID(0));
+						cont->connectReply.write(MessageID(0));
+						}
+					
+					unread-=ConnectRequestMsg::ProtocolRequest::size;
+					}
+				
+				/* Check if all protocol request sub-messages have been read: */
+				if(cont->connectReply.eof())
+					{
+					/* Send the connect reply message: */
+					queueMessage(cont->connectReply.getBuffer());
+					delete cont;
+					
+					/* Send a client connect notification to all other clients: */
+					{
+					MessageWriter clientConnectNotification(ClientConnectNotificationMsg::createMessage(pluginIndices.size()));
+					clientConnectNotification.write(ClientID(id));
+					stringToCharBuffer(name,clientConnectNotification,ClientConnectNotificationMsg::nameLength);
+					clientConnectNotification.write(Misc::UInt16(pluginIndices.size()));
+					for(std::vector<unsigned int>::iterator piIt=pluginIndices.begin();piIt!=pluginIndices.end();++piIt)
+						clientConnectNotification.write(Misc::UInt16(*piIt));
+					for(ClientList::iterator cIt=server->clients.begin();cIt!=server->clients.end();++cIt)
+						if((*cIt)->clientState>=Client::ReadingMessageID)
 							{
-							/* Send the connect reply message: */
-							queueMessage(cont->connectReply.getBuffer());
-							delete cont;
+							/* Tell the other client about the new client: */
+							(*cIt)->queueMessage(clientConnectNotification.getBuffer());
 							
-							/* Send a client connect notification to all other clients: */
+							/* Tell the new client about the other client: */
 							{
-							MessageWriter clientConnectNotification(ClientConnectNotificationMsg::createMessage(pluginIndices.size()));
-							clientConnectNotification.write(ClientID(id));
-							stringToCharBuffer(name,clientConnectNotification,ClientConnectNotificationMsg::nameLength);
-							clientConnectNotification.write(Misc::UInt16(pluginIndices.size()));
-							for(std::vector<unsigned int>::iterator piIt=pluginIndices.begin();piIt!=pluginIndices.end();++piIt)
-								clientConnectNotification.write(Misc::UInt16(*piIt));
-							for(ClientList::iterator cIt=server->clients.begin();cIt!=server->clients.end();++cIt)
-								if((*cIt)->clientState>=Client::ReadingMessageID)
-									{
-									/* Tell the other client about the new client: */
-									(*cIt)->queueMessage(clientConnectNotification.getBuffer());
-									
-									/* Tell the new client about the other client: */
-									{
-									MessageWriter clientConnectNotification2(ClientConnectNotificationMsg::createMessage((*cIt)->pluginIndices.size()));
-									clientConnectNotification2.write(ClientID((*cIt)->id));
-									stringToCharBuffer((*cIt)->name,clientConnectNotification2,ClientConnectNotificationMsg::nameLength);
-									clientConnectNotification2.write(Misc::UInt16((*cIt)->pluginIndices.size()));
-									for(std::vector<unsigned int>::iterator piIt=(*cIt)->pluginIndices.begin();piIt!=(*cIt)->pluginIndices.end();++piIt)
-										clientConnectNotification2.write(Misc::UInt16(*piIt));
-									queueMessage(clientConnectNotification2.getBuffer());
-									}
-									}
+							MessageWriter clientConnectNotification2(ClientConnectNotificationMsg::createMessage((*cIt)->pluginIndices.size()));
+							clientConnectNotification2.write(ClientID((*cIt)->id));
+							stringToCharBuffer((*cIt)->name,clientConnectNotification2,ClientConnectNotificationMsg::nameLength);
+							clientConnectNotification2.write(Misc::UInt16((*cIt)->pluginIndices.size()));
+							for(std::vector<unsigned int>::iterator piIt=(*cIt)->pluginIndices.begin();piIt!=(*cIt)->pluginIndices.end();++piIt)
+								clientConnectNotification2.write(Misc::UInt16(*piIt));
+							queueMessage(clientConnectNotification2.getBuffer());
 							}
-							
-							/* Notify all plug-in protocols in which the new client is participating: */
-							for(std::vector<unsigned int>::iterator piIt=pluginIndices.begin();piIt!=pluginIndices.end();++piIt)
-								server->plugins[*piIt]->clientConnected(id);
-							
-							/* Go to connected state: */
-							Misc::formattedLogNote("Server: Serving client %s from %s",name.c_str(),clientAddress.c_str());
-							continuation=0;
-							connected=true;
-							clientState=Client::ReadingMessageID;
-							
-							/* If there is unread data in the socket buffer at this point, read again: */
-							readAgain=unread>0;
 							}
-						
-						break;
-						}
+					}
 					
-					default:
-						; // Never reached; just to make compiler happy
+					/* Notify all plug-in protocols in which the new client is participating: */
+					for(std::vector<unsigned int>::iterator piIt=pluginIndices.begin();piIt!=pluginIndices.end();++piIt)
+						server->plugins[*piIt]->clientConnected(id);
+					
+					/* Go to connected state: */
+					Misc::formattedLogNote("Server: Serving client %s from %s",name.c_str(),clientAddress.c_str());
+					continuation=0;
+					connected=true;
+					clientState=Client::ReadingMessageID;
+					
+					/* If there is unread data in the socket buffer at this point, read again: */
+					readAgain=unread>0;
 					}
+				
+				break;
+				}
+			
+			default:
+				; // Never reached; just to make compiler happy
+			}
+		}
+	while(readAgain);
+	}
+
+bool Server::Client::startNextMessage(size_t& unread)
+	{
+	if(!jobs.empty())
+		{
+		/* Suspend processing messages, and stop reading from the socket, until all jobs are finished: */
+		clientState=WaitingForJob;
+		server->dispatcher.setIOEventListenerEventTypeMaskFromCallback(socketKey,socket.getUnsent()>0?Threads::EventDispatcher::Write:0);
+		return false;
+		}
+	
+	/* Start reading the next message, and read again if there is unread data in the socket buffer: */
+	clientState=ReadingMessageID;
+	return (unread=socket.getUnread())>0;
+	}
+
+void Server::Client::resumeMessages(void)
+	{
+	/* Resume reading from the socket: */
+	clientState=ReadingMessageID;
+	server->dispatcher.setIOEventListenerEventTypeMaskFromCallback(socketKey,socket.getUnsent()>0?Threads::EventDispatcher::ReadWrite:Threads::EventDispatcher::Read);
+	
+	/* Process any data that arrived before the client was suspended: */
+	if(socket.getUnread()>0)
+		processMessages(socket.getUnread());
+	}
+
+bool Server::Client::socketEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask)
+	{
+	try
+		{
+		/* Release messages whose zero-copy writes have completed on every event, as pending completion notifications keep the socket signaling an error condition: */
+		socket.reapZeroCopyCompletions();
+		
+		/* Handle the client communication protocol: */
+		if(eventTypeMask&Threads::EventDispatcher::Read)
+			{
+			/* Read data from the socket and process as much of it as possible until the socket is drained or the client used up its read budget: */
+			size_t budget=server->maxReadPerEvent;
+			while(true)
+				{
+				size_t unreadBefore=socket.getUnread();
+				size_t unread=socket.readFromSocket();
+				size_t readSize=unread-unreadBefore;
+				processMessages(unread);
+				
+				/* Stop if the socket is drained, the budget is used up, or the client stopped processing messages: */
+				if(socket.isDrained()||readSize>=budget||clientState>=WaitingForJob)
+					break;
+				budget-=readSize;
 				}
-			while(readAgain);
 			
 			/* Check if the client closed the connection: */
 			if(clientState<Drain&&socket.eof())
@@ -409,7 +452,7 @@ bool Server::Client::socketEvent(Threads::EventDispatcher::ListenerKey eventKey,
 				if(clientState!=Drain)
 					{
 					/* There is no more pending data; stop dispatching write events on the socket: */
-					server->dispatcher.setIOEventListenerEventTypeMaskFromCallback(socketKey,Threads::EventDispatcher::Read);
+					server->dispatcher.setIOEventListenerEventTypeMaskFromCallback(socketKey,clientState!=WaitingForJob?Threads::EventDispatcher::Read:0);
 					}
 				else
 					{
@@ -455,6 +498,12 @@ Server::Client::Client(Server* sServer,Comm::ListeningTCPSocket& listenSocket)
 	clientAddress.push_back(':');
 	clientAddress.append(Misc::print(socket.getPeerAddress().getPort(),clientSocketPort+5));
 	
+	/* Split large bulk messages into chunks so that they don't hold up real-time and state messages: */
+	socket.enableBulkChunking(BulkChunkNotification,BulkChunkMsg::maxChunkSize);
+	
+	/* Send writes carrying at least a full bulk chunk without copying, as bulk messages are typically sent to many clients: */
+	socket.enableZeroCopy(BulkChunkMsg::maxChunkSize);
+	
 	/* Dispatch read and write events on the listening socket: */
 	socketKey=server->dispatcher.addIOEventListener(socket.getFd(),Threads::EventDispatcher::ReadWrite,Threads::EventDispatcher::wrapMethod<Client,&Client::socketEvent>,this);
 	
@@ -501,6 +550,14 @@ Server::Client::~Client(void)
 	
 	/* Delete a remaining message continuation object: */
 	delete continuation;
+	
+	/* Delete all jobs waiting behind the client's running job, which will be deleted when its work is done: */
+	if(!jobs.empty())
+		{
+		for(std::deque<Job*>::iterator jIt=jobs.begin()+1;jIt!=jobs.end();++jIt)
+			delete *jIt;
+		server->numJobs-=jobs.size()-1;
+		}
 	}
 
 void Server::Client::setPlugin(unsigned int pluginIndex,PluginServer::Client* newPlugin)
@@ -523,7 +580,7 @@ void Server::Client::queueMessage(MessageBuffer* message)
 	if(socket.queueMessage(message)==0)
 		{
 		/* There is pending data; start dispatching write events on the socket: */
-		server->dispatcher.setIOEventListenerEventTypeMaskFromCallback(socketKey,Threads::EventDispatcher::ReadWrite);
+		server->dispatcher.setIOEventListenerEventTypeMaskFromCallback(socketKey,clientState!=WaitingForJob?Threads::EventDispatcher::ReadWrite:Threads::EventDispatcher::Write);
 		}
 	}
 
@@ -531,62 +588,173 @@ void Server::Client::queueMessage(MessageBuffer* message)
 Methods of class Server:
 ***********************/
 
-void Server::disconnect(Server::Client* client)
+void Server::startJob(Server::Job* job)
 	{
-	if(client->connected)
+	/* Append the job to the queue and wake up a worker thread: */
+	Threads::MutexCond::Lock jobQueueLock(jobQueueCond);
+	jobQueue.push_back(job);
+	jobQueueCond.signal();
+	}
+
+void* Server::jobThreadMethod(void)
+	{
+	while(true)
 		{
-		/* Notify all plug-in protocols in which the client was participating in reverse order: */
-		for(std::vector<unsigned int>::reverse_iterator piIt=client->pluginIndices.rbegin();piIt!=client->pluginIndices.rend();++piIt)
-			plugins[*piIt]->clientDisconnected(client->id);
+		/* Wait for the next job or for shutdown: */
+		Job* job;
+		{
+		Threads::MutexCond::Lock jobQueueLock(jobQueueCond);
+		while(!stopJobThreads&&jobQueue.empty())
+			jobQueueCond.wait(jobQueueLock);
+		if(stopJobThreads)
+			break;
+		job=jobQueue.front();
+		jobQueue.pop_front();
+		}
+		
+		/* Do the job's work: */
+		try
+			{
+			job->run();
+			}
+		catch(const std::exception& err)
+			{
+			/* Remember the error to report it in the main thread: */
+			job->failed=true;
+			job->error=err.what();
+			}
+		catch(...)
+			{
+			/* Don't let an unknown exception terminate the server; fail the job instead: */
+			job->failed=true;
+			job->error="Unknown exception";
+			}
+		
+		/* Hand the job back to the main thread and check if the queue was empty before: */
+		bool wasEmpty;
+		{
+		Threads::Spinlock::Lock doneJobsLock(doneJobsMutex);
+		wasEmpty=doneJobs.empty();
+		doneJobs.push_back(job);
+		}
+		
+		/* Wake up the main thread if the queue was empty, as it already has a pending signal otherwise: */
+		if(wasEmpty)
+			dispatcher.signal(jobSignalKey,0);
 		}
 	
-	/* Remove the client from the client map: */
-	clientMap.removeEntry(client->id);
-	if(client->udpConnected)
-		clientAddressMap.removeEntry(client->udpAddress);
+	return 0;
+	}
+
+bool Server::jobSignalCallback(Threads::EventDispatcher::ListenerKey signalKey,void* signalData)
+	{
+	/* Take all done jobs in one go: */
+	{
+	Threads::Spinlock::Lock doneJobsLock(doneJobsMutex);
+	std::swap(doneJobs,doneJobBatch);
+	}
 	
-	if(client->connected)
-		{
-		/* Remove the disconnected client from the list, and send a disconnect notification to all other clients: */
+	/* Finish the jobs in order: */
+	for(std::vector<Job*>::iterator jIt=doneJobBatch.begin();jIt!=doneJobBatch.end();++jIt)
 		{
-		MessageWriter clientDisconnectNotification(ClientDisconnectNotificationMsg::createMessage());
-		clientDisconnectNotification.write(ClientID(client->id));
-		for(ClientList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
+		Job* job=*jIt;
+		--numJobs;
+		
+		if(job->clientId!=0)
 			{
-			if(*cIt!=client)
+			/* Check if the job's client is still connected and waiting for the job: */
+			Client* client=testAndGetClient(job->clientId);
+			if(client!=0&&!client->jobs.empty()&&client->jobs.front()==job)
 				{
-				if((*cIt)->clientState>=Client::ReadingMessageID)
+				try
 					{
-					/* Send the disconnect notification: */
-					(*cIt)->queueMessage(clientDisconnectNotification.getBuffer());
+					/* Finish the job unless its work failed: */
+					if(job->failed)
+						throw std::runtime_error(job->error);
+					job->finish();
+					
+					/* Start the client's next job, or resume processing the client's messages: */
+					client->jobs.pop_front();
+					if(!client->jobs.empty())
+						startJob(client->jobs.front());
+					else if(client->clientState==Client::WaitingForJob)
+						client->resumeMessages();
+					}
+				catch(const std::runtime_error& err)
+					{
+					/* There was a fatal error; shut down the connection: */
+					Misc::formattedLogWarning("Server: Disconnecting client %s from %s due to exception %s",client->name.c_str(),client->clientAddress.c_str(),err.what());
+					client->clientState=Client::Disconnect;
 					}
+				
+				if(client->clientState==Client::Disconnect)
+					{
+					/* Stop listening on the client's socket, and disconnect the client: */
+					dispatcher.removeIOEventListener(client->socketKey);
+					disconnect(client);
+					}
+				}
+			}
+		else
+			{
+			try
+				{
+				/* Finish the job unless its work failed: */
+				if(job->failed)
+					throw std::runtime_error(job->error);
+				job->finish();
 				}
-			else
+			catch(const std::runtime_error& err)
 				{
-				/* Remove the client from the list: */
-				*cIt=clients.back();
-				clients.pop_back();
-				--cIt;
+				Misc::formattedLogWarning("Server: Job failed due to exception %s",err.what());
 				}
 			}
+		
+		/* Destroy the job: */
+		delete job;
 		}
+	doneJobBatch.clear();
+	
+	return false;
+	}
+
+void Server::disconnect(Server::Client* client)
+	{
+	if(client->connected)
+		{
+		/* Notify all plug-in protocols in which the client was participating in reverse order: */
+		for(std::vector<unsigned int>::reverse_iterator piIt=client->pluginIndices.rbegin();piIt!=client->pluginIndices.rend();++piIt)
+			plugins[*piIt]->clientDisconnected(client->id);
 		}
-	else
+	
+	/* Remove the client from the participant counts of all plug-in protocols it requested: */
+	for(std::vector<unsigned int>::iterator piIt=client->pluginIndices.begin();piIt!=client->pluginIndices.end();++piIt)
+		--pluginNumClients[*piIt];
+	
+	/* Remove the client from the client slot table: */
+	clientSlots[client->id&(clientSlots.size()-1)]=0;
+	if(client->udpConnected)
+		clientAddressMap.removeEntry(client->udpAddress);
+	
+	/* Remove the client from the list by moving the last client into its place: */
+	Client* lastClient=clients.back();
+	clients[client->listIndex]=lastClient;
+	lastClient->listIndex=client->listIndex;
+	clients.pop_back();
+	
+	if(client->connected)
 		{
-		/* Remove the disconnected client from the list: */
+		/* Send a disconnect notification to all other clients: */
+		MessageWriter clientDisconnectNotification(ClientDisconnectNotificationMsg::createMessage());
+		clientDisconnectNotification.write(ClientID(client->id));
 		for(ClientList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
-			if(*cIt==client)
+			if((*cIt)->clientState>=Client::ReadingMessageID)
 				{
-				/* Remove the client from the list: */
-				*cIt=clients.back();
-				clients.pop_back();
-				
-				/* Stop looking: */
-				break;
+				/* Send the disconnect notification: */
+				(*cIt)->queueMessage(clientDisconnectNotification.getBuffer());
 				}
 		}
 	
-	
 	/* Destroy the client object: */
 	delete client;
 	}
@@ -645,7 +813,7 @@ void Server::disconnectClientCommand(const char* argumentBegin,const char* argum
 	{
 	/* Retrieve client to be disconnected: */
 	unsigned int clientId=Misc::ValueCoder<unsigned int>::decode(argumentBegin,argumentEnd);
-	Client* client=clientMap.getEntry(clientId).getDest();
+	Client* client=getClient(clientId);
 	
 	/* Stop listening on the client's socket, and disconnect the client: */
 	dispatcher.removeIOEventListener(client->socketKey);
@@ -659,18 +827,9 @@ void Server::listPluginsCommand(const char* argumentBegin,const char* argumentEn
 	unsigned int pluginIndex=0;
 	for(PluginList::iterator pIt=plugins.begin();pIt!=plugins.end();++pIt,++pluginIndex)
 		{
-		/* Count the number of clients participating in this plug-in protocol: */
-		unsigned int numParticipants=0;
-		for(ClientList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
-			{
-			for(std::vector<unsigned int>::iterator piIt=(*cIt)->pluginIndices.begin();piIt!=(*cIt)->pluginIndices.end();++piIt)
-				if(*piIt==pluginIndex)
-					++numParticipants;
-			}
-		
 		unsigned int protocolMajor=(*pIt)->getVersion()>>16;
 		unsigned int protocolMinor=(*pIt)->getVersion()&0xffffU;
-		std::cout<<"\tPlug-in \""<<(*pIt)->getName()<<"\", version "<<protocolMajor<<'.'<<protocolMinor<<", "<<numParticipants<<" participating clients"<<std::endl;
+		std::cout<<"\tPlug-in \""<<(*pIt)->getName()<<"\", version "<<protocolMajor<<'.'<<protocolMinor<<", "<<pluginNumClients[pluginIndex]<<" participating clients"<<std::endl;
 		}
 	}
 
@@ -707,25 +866,46 @@ void Server::unloadPluginCommand(const char* argumentBegin,const char* argumentE
 	if(pIt==plugins.end())
 		Misc::throwStdErr("Plug-in %s not found",pluginName.c_str());
 	
-	/* Count the number of clients participating in this plug-in protocol: */
-	unsigned int numParticipants=0;
-	for(ClientList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
-		{
-		for(std::vector<unsigned int>::iterator piIt=(*cIt)->pluginIndices.begin();piIt!=(*cIt)->pluginIndices.end();++piIt)
-			if(*piIt==pluginIndex)
-				++numParticipants;
-		}
+	/* Jobs might be running code from the plug-in protocol's DSO: */
+	if(numJobs!=0)
+		Misc::throwStdErr("Plug-in %s can not be unloaded while %u job(s) are pending",pluginName.c_str(),numJobs);
 	
+	/* Check the number of clients participating in this plug-in protocol: */
+	unsigned int numParticipants=pluginNumClients[pluginIndex];
 	if(numParticipants==0)
 		{
 		/* Remove the plug-in protocol: */
 		pluginLoader.destroyObject(*pIt);
 		plugins.erase(pIt);
+		pluginNumClients.erase(pluginNumClients.begin()+pluginIndex);
 		}
 	else
 		Misc::throwStdErr("Plug-in %s still used by %u client(s)",pluginName.c_str(),numParticipants);
 	}
 
+void Server::memstatCommand(const char* argumentBegin,const char* argumentEnd)
+	{
+	/* Retrieve the allocator's occupancy statistics: */
+	std::vector<Allocator::PoolStats> stats;
+	Allocator::getStats(stats);
+	
+	/* Print the statistics of all size classes that have been used: */
+	size_t totalHeld=0;
+	size_t totalFree=0;
+	std::cout<<"Server::memstat: Block size, live/free/cached/held blocks, high-water mark"<<std::endl;
+	for(std::vector<Allocator::PoolStats>::iterator sIt=stats.begin();sIt!=stats.end();++sIt)
+		if(sIt->maxBlocks!=0)
+			{
+			std::cout<<"\t"<<sIt->blockSize<<": "<<sIt->numLive<<'/'<<sIt->numFree<<'/'<<sIt->numCached<<'/'<<sIt->numBlocks<<", "<<sIt->maxBlocks<<std::endl;
+			totalHeld+=sIt->numBlocks*sIt->blockSize;
+			totalFree+=(sIt->numFree+sIt->numCached)*sIt->blockSize;
+			}
+	std::cout<<"Server::memstat: "<<totalHeld<<" bytes held, "<<totalFree<<" bytes unused";
+	if(Allocator::getMaxFreeMemory()!=~size_t(0))
+		std::cout<<", shared pool limit "<<Allocator::getMaxFreeMemory()<<" bytes";
+	std::cout<<std::endl;
+	}
+
 void Server::quitCommand(const char* argumentBegin,const char* argumentEnd)
 	{
 	/* Shut down the event dispatcher to terminate the server: */
@@ -758,108 +938,171 @@ bool Server::commandPipeEvent(Threads::EventDispatcher::ListenerKey eventKey,int
 	return result;
 	}
 
+bool Server::trimAllocatorCallback(Threads::EventDispatcher::ListenerKey eventKey)
+	{
+	/* Return memory blocks that were not used since the last trim to the operating system: */
+	Allocator::trim();
+	
+	/* Keep repeating the timer event: */
+	return false;
+	}
+
 bool Server::listenSocketEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask)
 	{
-	try
+	/* Accept pending connection requests until the backlog is empty: */
+	while(true)
 		{
-		/* Connect a new client: */
-		Misc::SelfDestructPointer<Client> newClient(new Client(this,listenSocket));
-		Misc::formattedLogNote("Server: Accepting incoming connection from %s",newClient->clientAddress.c_str());
-		
-		/* Assign a unique ID to the client: */
-		do
+		try
 			{
-			++nextClientId;
+			/* Connect a new client: */
+			Misc::SelfDestructPointer<Client> newClient(new Client(this,listenSocket));
+			Misc::formattedLogNote("Server: Accepting incoming connection from %s",newClient->clientAddress.c_str());
+			
+			/* Reject the connection if all client IDs are in use: */
+			if(clients.size()>=65535U)
+				throw std::runtime_error("All client IDs are in use");
+			
+			/* Grow the client slot table while it is at least half full, and move all clients into their slots in the larger table: */
+			if(clientSlots.size()<65536U&&(clients.size()+1)*2>=clientSlots.size())
+				{
+				ClientList newClientSlots(clientSlots.size()*2U,0);
+				for(ClientList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
+					newClientSlots[(*cIt)->id&(newClientSlots.size()-1)]=*cIt;
+				clientSlots.swap(newClientSlots);
+				}
+			
+			/* Assign the next client ID in sequence whose slot is free, so that IDs of disconnected clients are not reused until the 16-bit ID space wraps around: */
+			do
+				{
+				++nextClientId;
+				}
+			while(nextClientId==0||clientSlots[nextClientId&(clientSlots.size()-1)]!=0);
+			newClient->id=nextClientId;
+			
+			/* Add the client to the client slot table: */
+			clientSlots[newClient->id&(clientSlots.size()-1)]=newClient.getTarget();
+			
+			newClient->listIndex=clients.size();
+			clients.push_back(newClient.releaseTarget());
+			}
+		catch(const NonBlockSocket::NoPendingConnectionError& err)
+			{
+			/* The backlog is empty: */
+			break;
+			}
+		catch(const std::runtime_error& err)
+			{
+			/* Try again on the next event, as the error might persist: */
+			Misc::formattedLogWarning("Server: Rejecting incoming connection due to exception %s",err.what());
+			break;
 			}
-		while(nextClientId==0||clientMap.isEntry(nextClientId));
-		newClient->id=nextClientId;
-		
-		/* Add the client to the client map: */
-		clientMap.setEntry(ClientMap::Entry(newClient->id,newClient.getTarget()));
-		
-		clients.push_back(newClient.releaseTarget());
-		}
-	catch(const std::runtime_error& err)
-		{
-		Misc::formattedLogWarning("Server: Rejecting incoming connection due to exception %s",err.what());
 		}
 	
 	/* Keep listening: */
 	return false;
 	}
 
+void Server::dispatchUDPMessage(unsigned int messageId,Server::Client* client,MessageReader& message)
+	{
+	/* Check if the message ID is valid: */
+	if(messageId>=udpMessageHandlers.size()||udpMessageHandlers[messageId].callback==0)
+		{
+		/* A bad message ID from a known and connected client is an error: */
+		Misc::formattedLogWarning("Server::udpSocketEvent: Invalid message ID from client %u",client->id);
+		return;
+		}
+	
+	/* Dispatch the message: */
+	const UDPMessageHandler& mh=udpMessageHandlers[messageId];
+	mh.callback(messageId,client->id,message,mh.callbackUserData);
+	}
+
 bool Server::udpSocketEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask)
 	{
 	try
 		{
 		if(eventTypeMask&Threads::EventDispatcher::Read)
 			{
-			/* Get the next pending message: */
-			UDPSocket::Address senderAddress;
-			MessageReader message(udpSocket.readFromSocket(senderAddress));
-			
-			/* Check if the message contains at least a message ID: */
-			if(message.getUnread()>=sizeof(MessageID))
+			/* Receive a batch of pending packets and dispatch them in order: */
+			unsigned int numPackets=udpSocket.readFromSocket();
+			for(unsigned int packetIndex=0;packetIndex<numPackets;++packetIndex)
 				{
-				/* Find the client who sent the message: */
-				ClientAddressMap::Iterator cIt=clientAddressMap.findEntry(senderAddress);
-				if(!cIt.isFinished())
+				try
 					{
-					/* Read the message ID and check if the message ID is valid: */
-					message.setSwapOnRead(cIt->getDest()->swapOnRead);
-					unsigned int messageId=message.read<MessageID>();
-					const UDPMessageHandler& mh=udpMessageHandlers[messageId];
-					if(messageId>=udpMessageHandlers.size()||mh.callback==0)
-						{
-						/* A bad message ID from a known and connected client is an error: */
-						Misc::formattedLogWarning("Server::udpSocketEvent: Invalid message ID from client %u",cIt->getDest()->id);
-						}
-					
-					/* Dispatch the message: */
-					mh.callback(messageId,cIt->getDest()->id,message,mh.callbackUserData);
-					}
-				else
-					{
-					/* The message is not from a known and connected client; check if it's a UDP connect request: */
-					MessageID swappedUDPConnectRequest(UDPConnectRequest);
-					Misc::swapEndianness(swappedUDPConnectRequest); // We don't know the sender's endianness at this point, unfortunately
-					unsigned int messageId=message.read<MessageID>();
-					if((messageId==UDPConnectRequest||messageId==swappedUDPConnectRequest)&&message.getUnread()==UDPConnectRequestMsg::size)
+					const UDPSocket::Address& senderAddress=udpSocket.getSenderAddress(packetIndex);
+					MessageReader message(udpSocket.getPacket(packetIndex));
+			
+					/* Check if the message contains at least a message ID: */
+					if(message.getUnread()>=sizeof(MessageID))
 						{
-						/* Set the message's endianness: */
-						message.setSwapOnRead(messageId==swappedUDPConnectRequest);
-						
-						/* Read the client ID and UDP connection ticket: */
-						unsigned int clientId=message.read<ClientID>();
-						Misc::UInt32 udpConnectionTicket=message.read<Misc::UInt32>();
-						
-						/* Check if the credentials are valid: */
-						ClientMap::Iterator cIt=clientMap.findEntry(clientId);
-						if(!cIt.isFinished()&&cIt->getDest()->udpConnectionTicket==udpConnectionTicket)
+						/* Find the client who sent the message: */
+						ClientAddressMap::Iterator cIt=clientAddressMap.findEntry(senderAddress);
+						if(!cIt.isFinished())
 							{
+							/* Read the message ID: */
 							Client* client=cIt->getDest();
+							message.setSwapOnRead(client->swapOnRead);
+							unsigned int messageId=message.read<MessageID>();
+							if(messageId==UDPSocket::aggregateMessageId)
+								{
+								/* Dispatch all messages contained in the aggregate packet in order: */
+								while(!message.eof())
+									{
+									MessageReader aggregatedMessage(UDPSocket::unpackMessage(message),client->swapOnRead);
+									dispatchUDPMessage(aggregatedMessage.read<MessageID>(),client,aggregatedMessage);
+									}
+								}
+							else
+								dispatchUDPMessage(messageId,client,message);
+							}
+						else
+							{
+							/* The message is not from a known and connected client; check if it's a UDP connect request: */
+							MessageID swappedUDPConnectRequest(UDPConnectRequest);
+							Misc::swapEndianness(swappedUDPConnectRequest); // We don't know the sender's endianness at this point, unfortunately
+							unsigned int messageId=message.read<MessageID>();
+							if((messageId==UDPConnectRequest||messageId==swappedUDPConnectRequest)&&message.getUnread()==UDPConnectRequestMsg::size)
+								{
+								/* Set the message's endianness: */
+								message.setSwapOnRead(messageId==swappedUDPConnectRequest);
+						
+								/* Read the client ID and UDP connection ticket: */
+								unsigned int clientId=message.read<ClientID>();
+								Misc::UInt32 udpConnectionTicket=message.read<Misc::UInt32>();
+						
+								/* Check if the credentials are valid: */
+								Client* client=testAndGetClient(clientId);
+								if(client!=0&&client->udpConnectionTicket==udpConnectionTicket)
+									{
 							
-							#if 0
-							std::string clientUDPAddress=senderAddress.getAddress().getHostname();
-							clientUDPAddress.push_back(':');
-							char portBuffer[6];
-							clientUDPAddress.append(Misc::print(senderAddress.getPort(),portBuffer+5));
-							Misc::formattedLogNote("Server::udpSocketEvent: UDP connect request from client %u from address %s",clientId,clientUDPAddress.c_str());
-							#endif
+									#if 0
+									std::string clientUDPAddress=senderAddress.getAddress().getHostname();
+									clientUDPAddress.push_back(':');
+									char portBuffer[6];
+									clientUDPAddress.append(Misc::print(senderAddress.getPort(),portBuffer+5));
+									Misc::formattedLogNote("Server::udpSocketEvent: UDP connect request from client %u from address %s",clientId,clientUDPAddress.c_str());
+									#endif
 							
-							/* Message checks out; remember the client's UDP socket address and send a UDP connect reply: */
-							client->udpAddress=senderAddress;
-							client->udpConnected=true;
-							clientAddressMap.setEntry(ClientAddressMap::Entry(senderAddress,client));
+									/* Message checks out; remember the client's UDP socket address and send a UDP connect reply: */
+									client->udpAddress=senderAddress;
+									client->udpConnected=true;
+									clientAddressMap.setEntry(ClientAddressMap::Entry(senderAddress,client));
 							
-							{
-							MessageWriter udpConnectReply(UDPConnectReplyMsg::createMessage());
-							udpConnectReply.write(udpConnectionTicket);
-							queueUDPMessage(senderAddress,udpConnectReply.getBuffer());
-							}
+									{
+									MessageWriter udpConnectReply(UDPConnectReplyMsg::createMessage());
+									udpConnectReply.write(udpConnectionTicket);
+									queueUDPMessage(senderAddress,udpConnectReply.getBuffer());
+									}
+									}
+								}
 							}
 						}
 					}
+				catch(const std::runtime_error& err)
+					{
+					/* This is UDP! Print an error message and carry on with the rest of the batch: */
+					Misc::formattedLogError("Server::udpSocketEvent: Caught exception %s",err.what());
+					}
 				}
 			}
 		
@@ -886,7 +1129,7 @@ bool Server::udpSocketEvent(Threads::EventDispatcher::ListenerKey eventKey,int e
 void Server::udpConnectRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message)
 	{
 	/* This is a duplicate message; check for correctness, and then reply with another UDP connect reply: */
-	Client* client=clientMap.getEntry(clientId).getDest();
+	Client* client=getClient(clientId);
 	if(message.getUnread()==UDPConnectRequestMsg::size&&message.read<ClientID>()==clientId&&message.read<Misc::UInt32>()==client->udpConnectionTicket)
 		{
 		/* Send the UDP connect reply: */
@@ -1031,7 +1274,9 @@ Server::Server(const Misc::ConfigurationFileSection& sServerConfig,int portId,co
 	 listenSocket(portId,5),
 	 udpSocket(portId),
 	 name(sName),
-	 nextClientId(0),clientMap(17),clientAddressMap(17),
+	 nextClientId(0),clientSlots(64U,0),clientAddressMap(17),
+	 numJobThreads(0),jobThreads(0),stopJobThreads(false),numJobs(0),
+	 maxReadPerEvent(262144),
 	 pluginLoader(COLLABORATION_PLUGINDIR "/" COLLABORATION_PLUGINSERVERDSONAMETEMPLATE)
 	{
 	/* Dispatch read events on stdin: */
@@ -1071,8 +1316,25 @@ Server::Server(const Misc::ConfigurationFileSection& sServerConfig,int portId,co
 	commandDispatcher.addCommandCallback("listPlugins",Misc::CommandDispatcher::wrapMethod<Server,&Server::listPluginsCommand>,this,0,"Lists loaded plug-in protocols");
 	commandDispatcher.addCommandCallback("loadPlugin",Misc::CommandDispatcher::wrapMethod<Server,&Server::loadPluginCommand>,this,"<protocol name> <protocol version>","Loads the plug-in protocol of the given name and major version number");
 	commandDispatcher.addCommandCallback("unloadPlugin",Misc::CommandDispatcher::wrapMethod<Server,&Server::unloadPluginCommand>,this,"<protocol name>","Unloads the plug-in protocol of the given name");
+	commandDispatcher.addCommandCallback("memstat",Misc::CommandDispatcher::wrapMethod<Server,&Server::memstatCommand>,this,0,"Displays message buffer memory statistics per block size");
 	commandDispatcher.addCommandCallback("quit",Misc::CommandDispatcher::wrapMethod<Server,&Server::quitCommand>,this,0,"Shuts down the server");
 	
+	/* Limit the amount of unused message buffer memory held by the server: */
+	if(serverConfig.hasTag("./maxFreeMessageMemory"))
+		Allocator::setMaxFreeMemory(serverConfig.retrieveValue<size_t>("./maxFreeMessageMemory"));
+	
+	/* Periodically return idle message buffer memory to the operating system: */
+	unsigned int trimInterval=serverConfig.retrieveValue<unsigned int>("./messageMemoryTrimInterval",10U);
+	if(trimInterval>0)
+		{
+		Threads::EventDispatcher::Time interval(trimInterval,0);
+		Threads::EventDispatcher::Time first=Threads::EventDispatcher::Time::now();
+		dispatcher.addTimerEventListener(first,interval,Threads::EventDispatcher::wrapMethod<Server,&Server::trimAllocatorCallback>,this);
+		}
+	
+	/* Limit the amount of data read from a single client per read event, so that one client can not starve the others: */
+	maxReadPerEvent=serverConfig.retrieveValue<size_t>("./maxReadPerEvent",maxReadPerEvent);
+	
 	/* Make the listening socket non-blocking: */
 	listenSocket.setBlocking(false);
 	
@@ -1089,6 +1351,15 @@ Server::Server(const Misc::ConfigurationFileSection& sServerConfig,int portId,co
 	setUDPMessageHandler(PingRequest,wrapMethod<Server,&Server::udpPingRequestCallback>,this);
 	setMessageHandler(NameChangeRequest,wrapMethod<Server,&Server::nameChangeRequestCallback>,this,NameChangeRequestMsg::size);
 	
+	/* Create worker threads running CPU-heavy jobs off the main thread: */
+	jobSignalKey=dispatcher.addSignalListener(Threads::EventDispatcher::wrapMethod<Server,&Server::jobSignalCallback>,this);
+	numJobThreads=serverConfig.retrieveValue<unsigned int>("./numJobThreads",2U);
+	if(numJobThreads<1)
+		numJobThreads=1;
+	jobThreads=new Threads::Thread[numJobThreads];
+	for(unsigned int i=0;i<numJobThreads;++i)
+		jobThreads[i].start(this,&Server::jobThreadMethod);
+	
 	/* Initialize the plug-in protocol list: */
 	clientMessageBase=NumClientMessages;
 	serverMessageBase=NumServerMessages;
@@ -1096,6 +1367,22 @@ Server::Server(const Misc::ConfigurationFileSection& sServerConfig,int portId,co
 
 Server::~Server(void)
 	{
+	/* Stop all worker threads: */
+	{
+	Threads::MutexCond::Lock jobQueueLock(jobQueueCond);
+	stopJobThreads=true;
+	jobQueueCond.broadcast();
+	}
+	for(unsigned int i=0;i<numJobThreads;++i)
+		jobThreads[i].join();
+	delete[] jobThreads;
+	
+	/* Delete all jobs that were not finished: */
+	for(std::deque<Job*>::iterator jIt=jobQueue.begin();jIt!=jobQueue.end();++jIt)
+		delete *jIt;
+	for(std::vector<Job*>::iterator jIt=doneJobs.begin();jIt!=doneJobs.end();++jIt)
+		delete *jIt;
+	
 	/* Forcefully disconnect all remaining clients: */
 	for(ClientList::iterator cIt=clients.begin();cIt!=clients.end();++cIt)
 		delete *cIt;
@@ -1157,6 +1444,35 @@ void Server::setUDPMessageHandler(unsigned int messageId,Server::UDPMessageHandl
 		udpMessageHandlers.push_back(UDPMessageHandler(callback,callbackUserData));
 	}
 
+void Server::submitJob(unsigned int clientId,Server::Job* job)
+	{
+	job->clientId=clientId;
+	if(clientId!=0)
+		{
+		/* Access the client on whose behalf the job is submitted: */
+		Client* client=testAndGetClient(clientId);
+		if(client==0)
+			{
+			delete job;
+			throw std::runtime_error("Server::submitJob: Invalid client ID");
+			}
+		
+		/* Queue the job behind the client's other jobs: */
+		client->jobs.push_back(job);
+		++numJobs;
+		
+		/* Start the job right away if it is the client's only job: */
+		if(client->jobs.size()==1)
+			startJob(job);
+		}
+	else
+		{
+		/* Start the job right away: */
+		++numJobs;
+		startJob(job);
+		}
+	}
+
 PluginServer* Server::requestPluginProtocol(const char* protocolName,unsigned int protocolVersion)
 	{
 	/* Split the requested protocol version into major version (incompatible) and minor version (compatible): */
@@ -1197,6 +1513,7 @@ void Server::addPluginProtocol(PluginServer* protocol)
 	/* Add the new protocol to the plug-in list: */
 	protocol->setIndex(plugins.size());
 	plugins.push_back(protocol);
+	pluginNumClients.push_back(0);
 	
 	/* Set the new protocol's base message IDs: */
 	protocol->setMessageBases(clientMessageBase,serverMessageBase);
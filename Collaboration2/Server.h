@@ -8,9 +8,13 @@ Copyright (c) 2019-2020 Oliver Kreylos
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <Misc/HashTable.h>
 #include <Misc/CommandDispatcher.h>
 #include <Misc/ConfigurationFile.h>
+#include <Threads/Spinlock.h>
+#include <Threads/MutexCond.h>
+#include <Threads/Thread.h>
 #include <Threads/EventDispatcher.h>
 #include <Plugins/ObjectLoader.h>
 #include <Comm/ListeningTCPSocket.h>
@@ -29,6 +33,31 @@ class Server:public CoreProtocol
 	{
 	/* Embedded classes: */
 	public:
+	class Job // Base class for CPU-heavy work handed from the main thread to a worker thread
+		{
+		friend class Server;
+		
+		/* Elements: */
+		private:
+		unsigned int clientId; // ID of the client whose message processing is suspended until the job is finished, or 0
+		bool failed; // Flag whether the job's work failed
+		std::string error; // Reason why the job's work failed
+		
+		/* Constructors and destructors: */
+		public:
+		Job(void)
+			:clientId(0),failed(false)
+			{
+			}
+		virtual ~Job(void)
+			{
+			}
+		
+		/* Methods: */
+		virtual void run(void) =0; // Does the job's work in a worker thread; must only access state owned by the job; throws an exception on failure, which disconnects the job's client
+		virtual void finish(void) =0; // Completes the job in the main thread after its work succeeded
+		};
+	
 	class Client // Class representing a connected client
 		{
 		friend class Server;
@@ -42,6 +71,7 @@ class Server:public CoreProtocol
 			ReadingMessageID,
 			ReadingMessageBody,
 			HandlingMessage,
+			WaitingForJob, // Suspend processing messages until all of the client's jobs are finished
 			Drain, // Disconnect the client gently when its write queue is empty
 			Disconnect // Disconnect the client immediately
 			};
@@ -52,6 +82,7 @@ class Server:public CoreProtocol
 		static const std::runtime_error missingPluginError; // Error to be thrown when a caller requests a non-existing plug-in client
 		Server* server; // Pointer back to the server for simplified event handling
 		unsigned int id; // Unique ID for this client
+		unsigned int listIndex; // Index of the client in the server's list of current clients
 		NonBlockSocket socket; // TCP socket connected to the client
 		Byte nonce[PasswordRequestMsg::nonceLength]; // The nonce sent to the client during authentication
 		bool swapOnRead; // Flag whether data read from the client must be endianness-swapped
@@ -67,8 +98,12 @@ class Server:public CoreProtocol
 		MessageContinuation* continuation; // Message handler continuation state for the current partial message on the client's socket
 		std::vector<unsigned int> pluginIndices; // List of indices of plug-in protocols in which the client participates
 		PluginClientList plugins; // Client states of plug-in protocols
+		std::deque<Job*> jobs; // Queue of jobs submitted on behalf of the client in submission order; the first job is running, the others wait for it to finish
 		
 		/* Private methods: */
+		void processMessages(size_t unread); // Processes as much unread data in the socket's read buffer as possible
+		bool startNextMessage(size_t& unread); // Starts reading the next message unless the client submitted jobs; returns true if there is unread data to process
+		void resumeMessages(void); // Resumes processing messages after all of the client's jobs are finished
 		bool socketEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask); // Callback called when an I/O event occurs on the client's TCP socket
 		
 		/* Constructors and destructors: */
@@ -99,7 +134,6 @@ class Server:public CoreProtocol
 	friend class Client;
 	
 	typedef std::vector<Client*> ClientList; // Type for lists of clients
-	typedef Misc::HashTable<unsigned int,Client*> ClientMap; // Type for hash tables mapping client IDs to client structures
 	typedef Misc::HashTable<UDPSocket::Address,Client*> ClientAddressMap; // Type for hash tables mapping client's UDP socket addresses to client structures
 	typedef Plugins::ObjectLoader<PluginServer> PluginLoader; // Type for loader than can load plug-in protocols from DSOs
 	typedef std::vector<PluginServer*> PluginList; // Type for lists of plug-in protocols
@@ -151,6 +185,7 @@ class Server:public CoreProtocol
 		};
 	
 	/* Elements: */
+	static const std::runtime_error missingClientError; // Error to be thrown when a caller requests a non-existing client
 	Misc::ConfigurationFileSection serverConfig; // The server's configuration file section
 	Threads::EventDispatcher dispatcher; // Central dispatcher handling all communication channels
 	Threads::EventDispatcher::ListenerKey stdinKey; // Key for events on stdin
@@ -163,19 +198,34 @@ class Server:public CoreProtocol
 	Threads::EventDispatcher::ListenerKey udpSocketKey; // Key for UDP socket events
 	std::string name; // The server's name
 	std::string sessionPassword; // The server's session password
-	ClientID nextClientId; // ID number to be assigned to the next successfully connecting client
+	ClientID nextClientId; // ID number most recently assigned to a connecting client; increases monotonically and wraps around in the 16-bit ID space
 	ClientList clients; // List of currently connected clients
-	ClientMap clientMap; // Map from client IDs to client structures
+	ClientList clientSlots; // Dense table of client structures indexed by the low bits of their client IDs; size is a power of two, and unused slots are null
 	ClientAddressMap clientAddressMap; // Map from client's UDP socket addresses to client structures
+	unsigned int numJobThreads; // Number of worker threads running jobs
+	Threads::Thread* jobThreads; // Array of worker threads running jobs
+	Threads::MutexCond jobQueueCond; // Condition variable/mutex serializing access to the job queue and signaling new jobs to worker threads
+	std::deque<Job*> jobQueue; // Queue of jobs waiting for a worker thread
+	bool stopJobThreads; // Flag to shut down the worker threads
+	Threads::EventDispatcher::ListenerKey jobSignalKey; // Key for a signal raised when the queue of done jobs becomes non-empty
+	Threads::Spinlock doneJobsMutex; // Mutex serializing access to the queue of done jobs
+	std::vector<Job*> doneJobs; // Queue of jobs whose work is done, waiting to be finished in the main thread
+	std::vector<Job*> doneJobBatch; // Batch of done jobs taken from the queue in one go
+	unsigned int numJobs; // Number of submitted jobs that have not been finished yet
+	size_t maxReadPerEvent; // Amount of data after which the server stops draining a client's socket during a single read event
 	std::vector<MessageHandler> messageHandlers; // List of message handlers
 	std::vector<UDPMessageHandler> udpMessageHandlers; // List of message handlers for the shared UDP socket
 	PluginLoader pluginLoader; // Object to load plug-in protocols from DSOs
 	PluginList plugins; // List of plug-in protocols
+	std::vector<unsigned int> pluginNumClients; // Number of current clients participating in each plug-in protocol, parallel to the list of plug-in protocols
 	unsigned int clientMessageBase; // Base ID for client messages for the next plug-in protocol
 	unsigned int serverMessageBase; // Base ID for server messages for the next plug-in protocol
 	Misc::CommandDispatcher commandDispatcher; // A dispatcher for commands read from the console
 	
 	/* Private methods: */
+	void startJob(Job* job); // Hands the given job to the worker threads
+	void* jobThreadMethod(void); // Method running a worker thread
+	bool jobSignalCallback(Threads::EventDispatcher::ListenerKey signalKey,void* signalData); // Finishes all jobs whose work is done in the main thread
 	void disconnect(Client* client); // Disconnects the given client
 	void setPasswordCommand(const char* argumentBegin,const char* argumentEnd);
 	void netstatCommand(const char* argumentBegin,const char* argumentEnd);
@@ -184,11 +234,14 @@ class Server:public CoreProtocol
 	void listPluginsCommand(const char* argumentBegin,const char* argumentEnd);
 	void loadPluginCommand(const char* argumentBegin,const char* argumentEnd);
 	void unloadPluginCommand(const char* argumentBegin,const char* argumentEnd);
+	void memstatCommand(const char* argumentBegin,const char* argumentEnd);
 	void quitCommand(const char* argumentBegin,const char* argumentEnd);
 	bool stdinEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask); // Callback called when text arrives on stdin
 	bool commandPipeEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask); // Callback called when text arrives on the optional command pipe
 	bool listenSocketEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask); // Callback called when a connection request appears on the listening socket
+	void dispatchUDPMessage(unsigned int messageId,Client* client,MessageReader& message); // Dispatches a message from the given client arriving on the shared UDP socket
 	bool udpSocketEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask); // Callback called when a datagram appears on the UDP socket
+	bool trimAllocatorCallback(Threads::EventDispatcher::ListenerKey eventKey); // Called at regular intervals to return idle message buffer memory to the operating system
 	void udpConnectRequestCallback(unsigned int messageId,unsigned int clientId,MessageReader& message); // Handles a redundant UDP connection request from an already-connected client
 	MessageContinuation* disconnectRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation); // Handles a client's disconnect request message
 	MessageContinuation* pingRequestCallback(unsigned int messageId,unsigned int clientId,MessageContinuation* continuation); // Handles a client's ping request message
@@ -208,33 +261,32 @@ class Server:public CoreProtocol
 	void setPassword(const char* newSessionPassword); // Sets a session password that all clients have to know
 	Client* getClient(unsigned int clientId) // Returns the client structure associated with the given client ID; throws exception if client does not exist
 		{
-		return clientMap.getEntry(clientId).getDest();
+		/* Look up the client ID's slot in the client slot table and check that it holds the client of that ID: */
+		Client* client=clientSlots[clientId&(clientSlots.size()-1)];
+		if(client==0||client->id!=clientId)
+			throw missingClientError;
+		return client;
 		}
 	Client* testAndGetClient(unsigned int clientId) // Returns the client structure associated with the given client ID if that client ID exists; returns null otherwise
 		{
-		/* Find the client ID in the client map: */
-		ClientMap::Iterator cIt=clientMap.findEntry(clientId);
-		
-		/* Return the client structure if the client ID was found, null otherwise: */
-		if(!cIt.isFinished())
-			return cIt->getDest();
-		else
-			return 0;
+		/* Return the client structure if the client ID's slot in the client slot table holds the client of that ID, null otherwise: */
+		Client* client=clientSlots[clientId&(clientSlots.size()-1)];
+		return client!=0&&client->id==clientId?client:0;
 		}
 	void queueMessage(unsigned int clientId,MessageBuffer* message) // Queues the given message for sending on the given client's TCP socket; starts dispatching write events if necessary
 		{
 		/* Forward to the given client's method: */
-		clientMap.getEntry(clientId).getDest()->queueMessage(message);
+		getClient(clientId)->queueMessage(message);
 		}
 	void queueUDPMessage(const UDPSocket::Address& receiverAddress,MessageBuffer* message); // Queues the given message to the given receiver for sending on the UDP socket; starts dispatching write events if necessary
 	void queueUDPMessage(unsigned int clientId,MessageBuffer* message) // Queues the given message to the given client for sending on the UDP socket; starts dispatching write events if necessary
 		{
 		/* Retrieve client's UDP socket address and forward to the other method: */
-		queueUDPMessage(clientMap.getEntry(clientId).getDest()->udpAddress,message);
+		queueUDPMessage(getClient(clientId)->udpAddress,message);
 		}
 	void queueUDPMessageFallback(unsigned int clientId,MessageBuffer* message) // Queues the given message to the given client for sending on the UDP socket, or on the client's TCP socket if the client does not have UDP connectivity
 		{
-		Client* client=clientMap.getEntry(clientId).getDest();
+		Client* client=getClient(clientId);
 		if(client->haveUDP())
 			queueUDPMessage(client->udpAddress,message);
 		else
@@ -242,6 +294,7 @@ class Server:public CoreProtocol
 		}
 	void setMessageHandler(unsigned int messageId,MessageHandlerCallback callback,void* callbackUserData,size_t minUnread); // Sets the message handler for the given message ID
 	void setUDPMessageHandler(unsigned int messageId,UDPMessageHandlerCallback callback,void* callbackUserData); // Sets the message handler for the given message ID coming in over the shared UDP socket
+	void submitJob(unsigned int clientId,Job* job); // Hands the given job to a worker thread; if the client ID is not 0, suspends processing the client's messages after the current message handler returns until the job is finished, and finishes the client's jobs in submission order; server takes ownership of the job
 	
 	/* Handling of plug-in protocols: */
 	PluginServer* requestPluginProtocol(const char* protocolName,unsigned int protocolVersion); // Requests a plug-in protocol of the given name and version, which might load a new protocol from DSO; returns null on failure
@@ -250,7 +303,7 @@ class Server:public CoreProtocol
 	template <class PluginServerClientParam>
 	PluginServerClientParam* getPlugin(unsigned int clientId,unsigned int pluginIndex) // Returns the client plug-in of the given plug-in index for the client of the given ID; throws exception if client or plug-in do not exist
 		{
-		PluginServerClientParam* result=static_cast<PluginServerClientParam*>(clientMap.getEntry(clientId).getDest()->plugins[pluginIndex]);
+		PluginServerClientParam* result=static_cast<PluginServerClientParam*>(getClient(clientId)->plugins[pluginIndex]);
 		if(result==0)
 			throw Client::missingPluginError;
 		return result;
@@ -260,12 +313,12 @@ class Server:public CoreProtocol
 		{
 		PluginServerClientParam* result=0;
 		
-		/* Find the client ID in the client map: */
-		ClientMap::Iterator cIt=clientMap.findEntry(clientId);
-		if(!cIt.isFinished())
+		/* Find the client ID in the client slot table: */
+		Client* client=testAndGetClient(clientId);
+		if(client!=0)
 			{
 			/* Return the client's plug-in client: */
-			result=static_cast<PluginServerClientParam*>(cIt->getDest()->plugins[pluginIndex]);
+			result=static_cast<PluginServerClientParam*>(client->plugins[pluginIndex]);
 			}
 		
 		return result;
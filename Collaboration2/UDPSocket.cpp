@@ -1,7 +1,7 @@
 /***********************************************************************
 UDPSocket - Class to send and receive packets over a UDP socket in non-
 blocking mode.
-Copyright (c) 2019 Oliver Kreylos
+Copyright (c) 2019-2020 Oliver Kreylos
 ***********************************************************************/
 
 #include <Collaboration2/UDPSocket.h>
@@ -11,21 +11,42 @@ Copyright (c) 2019 Oliver Kreylos
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
-#include <sys/ioctl.h>
 #include <stdexcept>
+#include <Misc/SizedTypes.h>
 #include <Misc/ThrowStdErr.h>
 #include <Misc/MessageLogger.h>
 
 #include <Collaboration2/MessageBuffer.h>
+#include <Collaboration2/MessageReader.h>
 
 /**************************
 Methods of class UDPSocket:
 **************************/
 
+void UDPSocket::recyclePackets(void)
+	{
+	for(unsigned int i=0;i<numPackets;++i)
+		{
+		/* Re-use the packet's buffer if no one retained a reference to it; otherwise, replace it: */
+		if(packets[i]->isUnique())
+			packets[i]->reset(UDPSOCKET_MAXPACKETSIZE);
+		else
+			{
+			packets[i]->unref();
+			packets[i]=MessageBuffer::create(UDPSOCKET_MAXPACKETSIZE);
+			recvIovecs[i].iov_base=packets[i]->getBuffer();
+			}
+		}
+	numPackets=0;
+	}
+
 UDPSocket::UDPSocket(int portId)
 	:fd(-1),
-	 sendQueue(4),sendQueueSize(0)
+	 recvHeaders(0),recvIovecs(0),numPackets(0),
+	 sendQueue(4),sendQueueSize(0),
+	 sendHeaders(0),sendIovecs(0),aggregateBuffers(0)
 	{
 	/* Create a datagram socket for the IPv4 domain: */
 	fd=socket(AF_INET,SOCK_DGRAM,0);
@@ -54,6 +75,22 @@ UDPSocket::UDPSocket(int portId)
 		close(fd);
 		Misc::throwStdErr("UDPSocket::UDPSocket: Unable to bind socket to port %d due to error %d (%s)",portId,error,strerror(error));
 		}
+	
+	/* Create the packet buffer pool and the message headers to receive batches of packets: */
+	recvHeaders=new mmsghdr[UDPSOCKET_BATCHSIZE];
+	recvIovecs=new iovec[UDPSOCKET_BATCHSIZE];
+	for(unsigned int i=0;i<UDPSOCKET_BATCHSIZE;++i)
+		{
+		packets[i]=MessageBuffer::create(UDPSOCKET_MAXPACKETSIZE);
+		packetValid[i]=false;
+		recvIovecs[i].iov_base=packets[i]->getBuffer();
+		recvIovecs[i].iov_len=UDPSOCKET_MAXPACKETSIZE;
+		}
+	
+	/* Create the message headers and I/O vectors to send batches of packets: */
+	sendHeaders=new mmsghdr[UDPSOCKET_BATCHSIZE];
+	sendIovecs=new iovec[UDPSOCKET_MAXIOVECS];
+	aggregateBuffers=new char[UDPSOCKET_BATCHSIZE*UDPSOCKET_MAXAGGREGATESIZE];
 	}
 
 UDPSocket::~UDPSocket(void)
@@ -61,94 +98,282 @@ UDPSocket::~UDPSocket(void)
 	/* Close the socket: */
 	close(fd);
 	
+	/* Release the packet buffer pool: */
+	for(unsigned int i=0;i<UDPSOCKET_BATCHSIZE;++i)
+		packets[i]->unref();
+	delete[] recvHeaders;
+	delete[] recvIovecs;
+	
 	/* Release all messages still in the send queue: */
 	for(SendQueue::iterator sqIt=sendQueue.begin();sqIt!=sendQueue.end();++sqIt)
-		sqIt->message->unref();
+		if(sqIt->message!=0)
+			sqIt->message->unref();
+	delete[] sendHeaders;
+	delete[] sendIovecs;
+	delete[] aggregateBuffers;
 	}
 
-MessageBuffer* UDPSocket::readFromSocket(UDPSocket::Address& senderAddress)
+unsigned int UDPSocket::readFromSocket(void)
 	{
-	/* Retrieve the size of the next pending message in bytes: */
-	int messageSize;
-	if(ioctl(fd,FIONREAD,&messageSize)<0)
-		Misc::throwStdErr("UDPSocket::readFromSocket: Unable to query message size due to error %d (%s)",errno,strerror(errno));
+	/* Prepare the packet buffers of the previous batch for re-use: */
+	recyclePackets();
 	
-	/* Create a message buffer of the required size: */
-	MessageBuffer* result=MessageBuffer::create(messageSize);
+	/* Prepare the message headers, which are modified by each receive: */
+	for(unsigned int i=0;i<UDPSOCKET_BATCHSIZE;++i)
+		{
+		msghdr& hdr=recvHeaders[i].msg_hdr;
+		memset(&hdr,0,sizeof(msghdr));
+		hdr.msg_name=&senderAddresses[i];
+		hdr.msg_namelen=sizeof(Address);
+		hdr.msg_iov=&recvIovecs[i];
+		hdr.msg_iovlen=1;
+		}
 	
-	/* Read into the message buffer: */
-	socklen_t senderAddressLen=sizeof(Address);
-	ssize_t recvResult=recvfrom(fd,result->getBuffer(),result->getBufferSize(),0,(struct sockaddr*)&senderAddress,&senderAddressLen);
+	/* Receive as many pending packets as fit into the packet buffer pool: */
+	int recvResult=recvmmsg(fd,recvHeaders,UDPSOCKET_BATCHSIZE,0,0);
 	if(recvResult>=0)
 		{
-		/* Update the message buffer's size with the amount of data actually received: */
-		result->setBufferSize(size_t(recvResult));
-		
-		/* Check if the sender address was read successfully: */
-		if(senderAddressLen!=sizeof(Address))
+		numPackets=(unsigned int)(recvResult);
+		for(unsigned int i=0;i<numPackets;++i)
 			{
-			/* Discard the message: */
-			result->unref();
-			throw std::runtime_error("UDPSocket::readFromSocket: Invalid sender address");
+			/* Update the packet buffer's size with the amount of data actually received: */
+			packets[i]->setBufferSize(recvHeaders[i].msg_len);
+		
+			/* Check if the packet and its sender address were received intact: */
+			packetValid[i]=false;
+			if(recvHeaders[i].msg_hdr.msg_flags&MSG_TRUNC)
+				Misc::logWarning("UDPSocket::readFromSocket: Discarding oversized packet");
+			else if(recvHeaders[i].msg_hdr.msg_namelen!=sizeof(Address))
+				Misc::logWarning("UDPSocket::readFromSocket: Discarding packet with invalid sender address");
+			else
+				packetValid[i]=true;
 			}
 		}
 	else if(errno==EAGAIN||errno==EWOULDBLOCK)
 		{
 		/* Socket didn't have data (this shouldn't happen in event-driven I/O): */
-		result->unref();
-		result=0;
 		Misc::logWarning("UDPSocket::readFromSocket: Nothing to read");
 		}
 	else
-		{
-		/* There was an error: */
-		result->unref();
 		Misc::throwStdErr("UDPSocket::readFromSocket: Error %d (%s)",errno,strerror(errno));
-		}
+	
+	return numPackets;
+	}
+
+MessageBuffer* UDPSocket::getPacket(unsigned int index)
+	{
+	return packetValid[index]?packets[index]->ref():0;
+	}
+
+MessageBuffer* UDPSocket::unpackMessage(MessageReader& aggregate)
+	{
+	/* Read the message's size: */
+	if(aggregate.getUnread()<sizeof(Misc::UInt16))
+		throw std::runtime_error("UDPSocket::unpackMessage: Truncated aggregate packet");
+	size_t messageSize=aggregate.read<Misc::UInt16>();
+	if(messageSize<sizeof(MessageID)||messageSize>aggregate.getUnread())
+		throw std::runtime_error("UDPSocket::unpackMessage: Malformed aggregate packet");
+	
+	/* Copy the message into a new message buffer: */
+	MessageBuffer* result=MessageBuffer::create(messageSize);
+	memcpy(result->getBuffer(),aggregate.getReadPtr(),messageSize);
+	aggregate.advanceReadPtr(messageSize);
 	
 	return result;
 	}
 
 size_t UDPSocket::writeToSocket(void)
 	{
+	/* Embedded classes: */
+	struct Packet // Structure describing a packet in a batch
+		{
+		/* Elements: */
+		public:
+		const Address* receiverAddress; // Address to which to send the packet
+		MessageBuffer* message; // First message in the packet
+		size_t size; // Total size of the packet
+		unsigned int numMessages; // Number of messages in the packet; packets with more than one message are assembled in the aggregate buffers
+		};
+	
 	/* Bail out if the send queue is empty (this shouldn't happen in event-driven I/O): */
-	if(sendQueue.empty())
+	if(sendQueueSize==0)
 		{
 		Misc::logWarning("UDPSocket::writeToSocket: Nothing to write");
 		return 0;
 		}
 	
-	/* Write the first queued message to the socket: */
-	SendQueueEntry& sqf=sendQueue.front();
-	MessageBuffer* head=sqf.message;
-	ssize_t sendResult=sendto(fd,head->getBuffer(),head->getBufferSize(),0,(const struct sockaddr*)&sqf.receiverAddress,sizeof(Address));
-	if(sendResult>=0)
+	/* Send batches of queued messages until the send queue is empty or the socket is busy: */
+	bool sentAny=false;
+	while(sendQueueSize!=0)
 		{
-		/* Check if the entire message was sent: */
-		if(size_t(sendResult)!=head->getBufferSize())
-			Misc::throwStdErr("UDPSocket::writeToSocket: Packet was truncated; %u of %u bytes sent",(unsigned int)(sendResult),(unsigned int)(head->getBufferSize()));
+		/* Assemble a batch of packets from the front of the send queue, stopping at the first message that does not fit to retain message order for each receiver: */
+		Packet batch[UDPSOCKET_BATCHSIZE];
+		unsigned int batchSize=0;
+		size_t numIovecs=0;
+		SendQueue::iterator sqIt;
+		for(sqIt=sendQueue.begin();sqIt!=sendQueue.end();++sqIt)
+			{
+			/* Skip messages that were already sent: */
+			if(sqIt->message==0)
+				continue;
+			size_t messageSize=sqIt->message->getBufferSize();
+			
+			/* Find the most recent packet to the same receiver in the batch: */
+			unsigned int packetIndex;
+			for(packetIndex=batchSize;packetIndex>0&&!(*batch[packetIndex-1].receiverAddress==sqIt->receiverAddress);--packetIndex)
+				;
+			if(packetIndex>0)
+				{
+				/* Check if the message can be appended to the packet: */
+				Packet& packet=batch[packetIndex-1];
+				size_t aggregateSize=packet.numMessages==1?sizeof(MessageID)+sizeof(Misc::UInt16)+packet.size:packet.size;
+				aggregateSize+=sizeof(Misc::UInt16)+messageSize;
+				if(aggregateSize<=UDPSOCKET_MAXAGGREGATESIZE)
+					{
+					char* buffer=aggregateBuffers+(packetIndex-1)*UDPSOCKET_MAXAGGREGATESIZE;
+					if(packet.numMessages==1)
+						{
+						/* Turn the packet into an aggregate packet by copying its first message: */
+						MessageID marker(aggregateMessageId);
+						memcpy(buffer,&marker,sizeof(MessageID));
+						Misc::UInt16 firstSize(packet.size);
+						memcpy(buffer+sizeof(MessageID),&firstSize,sizeof(Misc::UInt16));
+						copyMessage(buffer+sizeof(MessageID)+sizeof(Misc::UInt16),packet.message);
+						packet.size+=sizeof(MessageID)+sizeof(Misc::UInt16);
+						}
+					
+					/* Append the message to the aggregate packet: */
+					Misc::UInt16 size(messageSize);
+					memcpy(buffer+packet.size,&size,sizeof(Misc::UInt16));
+					copyMessage(buffer+packet.size+sizeof(Misc::UInt16),sqIt->message);
+					packet.size=aggregateSize;
+					++packet.numMessages;
+					sqIt->packetIndex=packetIndex-1;
+					continue;
+					}
+				}
+			
+			/* Start a new packet if there is room in the batch: */
+			unsigned int numFragments=sqIt->message->isComposite()?sqIt->message->getNumFragments():1;
+			if(batchSize==UDPSOCKET_BATCHSIZE||numIovecs+numFragments>UDPSOCKET_MAXIOVECS)
+				{
+				if(batchSize==0)
+					Misc::throwStdErr("UDPSocket::writeToSocket: Message has too many fragments");
+				break;
+				}
+			Packet& packet=batch[batchSize];
+			packet.receiverAddress=&sqIt->receiverAddress;
+			packet.message=sqIt->message;
+			packet.size=messageSize;
+			packet.numMessages=1;
+			sqIt->packetIndex=batchSize;
+			++batchSize;
+			numIovecs+=numFragments;
+			}
+		SendQueue::iterator batchEnd=sqIt;
 		
-		/* Remove the sent packet from the send queue: */
-		sendQueue.pop_front();
-		sendQueueSize-=head->getBufferSize();
-		head->unref();
+		/* Create message headers for the packets in the batch: */
+		iovec* iovPtr=sendIovecs;
+		for(unsigned int i=0;i<batchSize;++i)
+			{
+			msghdr& hdr=sendHeaders[i].msg_hdr;
+			memset(&hdr,0,sizeof(msghdr));
+			hdr.msg_name=const_cast<Address*>(batch[i].receiverAddress);
+			hdr.msg_namelen=sizeof(Address);
+			hdr.msg_iov=iovPtr;
+			MessageBuffer* message=batch[i].message;
+			if(batch[i].numMessages>1)
+				{
+				/* Send the assembled aggregate packet: */
+				iovPtr->iov_base=aggregateBuffers+i*UDPSOCKET_MAXAGGREGATESIZE;
+				iovPtr->iov_len=batch[i].size;
+				++iovPtr;
+				}
+			else if(message->isComposite())
+				{
+				/* Gather the composite message's fragments into a single packet: */
+				for(unsigned int j=0;j<message->getNumFragments();++j,++iovPtr)
+					{
+					const MessageBuffer* fragment=message->getFragment(j);
+					iovPtr->iov_base=const_cast<char*>(fragment->getBuffer());
+					iovPtr->iov_len=fragment->getBufferSize();
+					}
+				}
+			else
+				{
+				iovPtr->iov_base=message->getBuffer();
+				iovPtr->iov_len=message->getBufferSize();
+				++iovPtr;
+				}
+			hdr.msg_iovlen=iovPtr-hdr.msg_iov;
+			}
+		
+		/* Send the batch: */
+		int sendResult=sendmmsg(fd,sendHeaders,batchSize,0);
+		int sendError=errno;
+		unsigned int numSent=0;
+		if(sendResult>0)
+			{
+			/* Check if the sent packets were sent completely: */
+			numSent=(unsigned int)(sendResult);
+			unsigned int numTruncated=0;
+			for(unsigned int i=0;i<numSent;++i)
+				if(sendHeaders[i].msg_len!=batch[i].size)
+					++numTruncated;
+			if(numTruncated!=0)
+				Misc::formattedLogWarning("UDPSocket::writeToSocket: %u packets were truncated",numTruncated);
+			sentAny=true;
+			}
+		else if(sendError==EAGAIN||sendError==EWOULDBLOCK)
+			{
+			/* Socket is busy (this shouldn't happen in event-driven I/O unless some packets were already sent): */
+			if(!sentAny)
+				Misc::logWarning("UDPSocket::writeToSocket: Socket is busy");
+			break;
+			}
+		else
+			{
+			/* Remove the offending packet, or this will probably just happen again: */
+			numSent=1;
+			}
+		
+		/* Release all messages in the sent packets: */
+		for(SendQueue::iterator sIt=sendQueue.begin();sIt!=batchEnd;++sIt)
+			if(sIt->message!=0&&sIt->packetIndex<numSent)
+				{
+				sendQueueSize-=sIt->message->getBufferSize();
+				sIt->message->unref();
+				sIt->message=0;
+				}
+		while(!sendQueue.empty()&&sendQueue.front().message==0)
+			sendQueue.pop_front();
+			
+		if(sendResult<0)
+			Misc::throwStdErr("UDPSocket::writeToSocket: Error %d (%s)",sendError,strerror(sendError));
+		
+		/* Stop if the socket did not accept the entire batch, as it is probably busy: */
+		if(numSent<batchSize)
+			break;
 		}
-	else if(errno==EAGAIN||errno==EWOULDBLOCK)
+	
+	return sendQueueSize;
+	}
+
+char* UDPSocket::copyMessage(char* dest,const MessageBuffer* message)
+	{
+	if(message->isComposite())
 		{
-		/* Socket is busy (this shouldn't happen in event-driven I/O): */
-		Misc::logWarning("UDPSocket::writeToSocket: Socket is busy");
+		/* Copy the composite message's fragments back-to-back: */
+		for(unsigned int i=0;i<message->getNumFragments();++i)
+			dest=copyMessage(dest,message->getFragment(i));
 		}
 	else
 		{
-		/* Remove the offending packet, or this will probably just happen again: */
-		sendQueue.pop_front();
-		sendQueueSize-=head->getBufferSize();
-		head->unref();
-		
-		Misc::throwStdErr("UDPSocket::writeToSocket: Error %d (%s)",errno,strerror(errno));
+		memcpy(dest,message->getBuffer(),message->getBufferSize());
+		dest+=message->getBufferSize();
 		}
 	
-	return sendQueueSize;
+	return dest;
 	}
 
 size_t UDPSocket::queueMessage(const UDPSocket::Address& receiverAddress,MessageBuffer* message)
@@ -160,6 +385,7 @@ size_t UDPSocket::queueMessage(const UDPSocket::Address& receiverAddress,Message
 	SendQueueEntry sqe;
 	sqe.receiverAddress=receiverAddress;
 	sqe.message=message;
+	sqe.packetIndex=0;
 	sendQueue.push_back(sqe);
 	sendQueueSize+=message->getBufferSize();
 	
@@ -1,18 +1,33 @@
 /***********************************************************************
 UDPSocket - Class to send and receive packets over a UDP socket in non-
 blocking mode.
-Copyright (c) 2019 Oliver Kreylos
+Copyright (c) 2019-2020 Oliver Kreylos
 ***********************************************************************/
 
 #ifndef UDPSOCKET_INCLUDED
 #define UDPSOCKET_INCLUDED
 
+/* Maximum number of packets received or sent by a single system call: */
+#define UDPSOCKET_BATCHSIZE 64
+
+/* Maximum size of a received packet; larger packets are discarded: */
+#define UDPSOCKET_MAXPACKETSIZE 1500
+
+/* Maximum size of a sent packet aggregating multiple messages; leaves room for IP and UDP headers and tunneling overhead below a 1500-byte path MTU to avoid IP fragmentation: */
+#define UDPSOCKET_MAXAGGREGATESIZE 1400
+
+/* Maximum number of I/O vectors to gather the packets of a single send batch: */
+#define UDPSOCKET_MAXIOVECS (2*UDPSOCKET_BATCHSIZE)
+
 #include <stddef.h>
 #include <Misc/RingBuffer.h>
 #include <Comm/IPv4SocketAddress.h>
 
 /* Forward declarations: */
 class MessageBuffer;
+class MessageReader;
+struct iovec;
+struct mmsghdr;
 
 class UDPSocket
 	{
@@ -20,12 +35,15 @@ class UDPSocket
 	public:
 	typedef Comm::IPv4SocketAddress Address; // Type for sender and receiver addresses
 	
+	static const unsigned int aggregateMessageId=0xffffU; // Message ID marking packets that contain multiple messages, each preceded by its size as a Misc::UInt16; independent of endianness
+	
 	struct SendQueueEntry // Structure for entries in the send queue
 		{
 		/* Elements: */
 		public:
 		Address receiverAddress; // Socket address to which to send the message
-		MessageBuffer* message; // Message to send to the receiver address
+		MessageBuffer* message; // Message to send to the receiver address, or null if the message was already sent as part of an aggregate packet
+		unsigned int packetIndex; // Index of the packet containing the message in the batch currently being sent
 		};
 	
 	typedef Misc::RingBuffer<SendQueueEntry> SendQueue; // Type for queues of messages waiting to be sent
@@ -34,9 +52,24 @@ class UDPSocket
 	private:
 	int fd; // Socket file descriptor
 	
+	/* Reading interface state: */
+	MessageBuffer* packets[UDPSOCKET_BATCHSIZE]; // Pool of pre-allocated buffers to receive a batch of packets
+	Address senderAddresses[UDPSOCKET_BATCHSIZE]; // Sender addresses of the received batch of packets
+	bool packetValid[UDPSOCKET_BATCHSIZE]; // Flags whether the packets in the received batch were received intact
+	mmsghdr* recvHeaders; // Message headers to receive a batch of packets
+	iovec* recvIovecs; // I/O vectors pointing into the packet buffer pool
+	unsigned int numPackets; // Number of packets in the most recently received batch
+	
 	/* Writing interface state: */
 	SendQueue sendQueue; // Queue of messages waiting to be sent
 	size_t sendQueueSize; // Total size of all messages currently in the send queue
+	mmsghdr* sendHeaders; // Message headers to send a batch of packets
+	iovec* sendIovecs; // I/O vectors to gather the messages of a batch of packets
+	char* aggregateBuffers; // Buffers to assemble the aggregate packets of a batch of packets
+	
+	/* Private methods: */
+	void recyclePackets(void); // Prepares the packet buffer pool for receiving the next batch of packets
+	static char* copyMessage(char* dest,const MessageBuffer* message); // Copies the given message into the given buffer; returns pointer behind the copied message
 	
 	/* Constructors and destructors: */
 	public:
@@ -50,10 +83,16 @@ class UDPSocket
 		}
 	
 	/* Read methods: */
-	MessageBuffer* readFromSocket(Address& senderAddress); // Returns the next pending message on the socket's input buffer and fills in sender address; returns null if there is no pending message; otherwise result will have ref count of 1
+	unsigned int readFromSocket(void); // Receives a batch of pending packets from the socket's input buffer; returns the number of received packets, which are accessible until the next call
+	MessageBuffer* getPacket(unsigned int index); // Returns a new reference to the received packet of the given index, or null if the packet was truncated or malformed
+	const Address& getSenderAddress(unsigned int index) const // Returns the sender address of the received packet of the given index
+		{
+		return senderAddresses[index];
+		}
+	static MessageBuffer* unpackMessage(MessageReader& aggregate); // Returns the next message contained in an aggregate packet whose message ID has already been read, with a reference count of 1; throws exception if the aggregate packet is malformed
 	
 	/* Write methods: */
-	size_t writeToSocket(void); // Writes data from the send queue to the socket; returns the new total amount of unsent data
+	size_t writeToSocket(void); // Writes batches of messages from the send queue to the socket until the queue is empty or the socket is busy, aggregating messages to the same receiver into packets of at most UDPSOCKET_MAXAGGREGATESIZE bytes; returns the new total amount of unsent data
 	size_t getUnsent(void) const // Returns the total amount of data that still needs to be written
 		{
 		return sendQueueSize;
@@ -0,0 +1,322 @@
+/***********************************************************************
+DrainBenchmark - Benchmark measuring the event throughput and dispatch
+latency of a server reading bursts of small messages from many clients
+over loopback, comparing reading once per event against draining
+sockets with a per-client read budget.
+Copyright (c) 2019-2020 Oliver Kreylos
+***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <Misc/SizedTypes.h>
+#include <Threads/MutexCond.h>
+#include <Threads/Thread.h>
+#include <Threads/EventDispatcher.h>
+#include <Realtime/Time.h>
+#include <Comm/ListeningTCPSocket.h>
+
+#include <Collaboration2/NonBlockSocket.h>
+
+/****************
+Helper functions:
+****************/
+
+inline Misc::SInt64 getTime(void) // Returns the current monotonic time in nanoseconds
+	{
+	Realtime::TimePointMonotonic now;
+	return Misc::SInt64(now.tv_sec)*Misc::SInt64(1000000000)+Misc::SInt64(now.tv_nsec);
+	}
+
+/**************
+Helper classes:
+**************/
+
+class DrainBenchmark // Class simulating a server reading small messages from many clients over loopback
+	{
+	/* Embedded classes: */
+	private:
+	static const size_t messageSize=64; // Size of each message, resembling a tracking state update; starts with the message's send time
+	
+	struct Connection // Structure for a client connection on the server side
+		{
+		/* Elements: */
+		public:
+		DrainBenchmark* benchmark; // Pointer back to the benchmark
+		NonBlockSocket socket; // Server side of the connection
+		
+		/* Constructors and destructors: */
+		Connection(DrainBenchmark* sBenchmark,Comm::ListeningTCPSocket& listenSocket)
+			:benchmark(sBenchmark),socket(listenSocket)
+			{
+			}
+		
+		/* Methods: */
+		bool socketEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask) // Callback called when data arrives on the connection
+			{
+			return benchmark->readMessages(*this);
+			}
+		};
+	
+	/* Elements: */
+	unsigned int numClients; // Number of simulated clients
+	size_t maxReadPerEvent; // Amount of data after which a client's socket is not drained further during a single read event; 0 reads once per event
+	size_t numRounds; // Number of rounds in which every client sends a burst of messages
+	size_t burstSize; // Number of messages each client sends per round
+	unsigned int firehoseFactor; // Multiplier for the number of messages sent by the first client per round
+	size_t window; // Maximum number of rounds the clients are allowed to run ahead of the server
+	size_t numMessages; // Total number of messages sent by all clients
+	Threads::EventDispatcher dispatcher; // Dispatcher handling the server's socket events
+	Comm::ListeningTCPSocket listenSocket; // Server's listening socket
+	std::vector<NonBlockSocket*> clientSockets; // Client sides of all connections
+	std::vector<Connection*> connections; // Server sides of all connections
+	Threads::MutexCond acceptCond; // Condition variable signaling that all connections were accepted
+	bool accepted; // Flag whether all connections were accepted
+	size_t numAcceptEvents; // Number of dispatched events on the listening socket
+	size_t numReadEvents; // Number of dispatched read events on client connections
+	size_t numReceived; // Number of messages received by the server; written by the server, read by the clients
+	std::vector<Misc::SInt64> latencies; // Time between sending and dispatching each message in nanoseconds
+	
+	/* Private methods: */
+	bool listenSocketEvent(Threads::EventDispatcher::ListenerKey eventKey,int eventTypeMask) // Accepts pending connections until the backlog is empty
+		{
+		++numAcceptEvents;
+		while(true)
+			{
+			try
+				{
+				Connection* connection=new Connection(this,listenSocket);
+				connections.push_back(connection);
+				dispatcher.addIOEventListener(connection->socket.getFd(),Threads::EventDispatcher::Read,Threads::EventDispatcher::wrapMethod<Connection,&Connection::socketEvent>,connection);
+				}
+			catch(const NonBlockSocket::NoPendingConnectionError& err)
+				{
+				/* The backlog is empty: */
+				break;
+				}
+			}
+		
+		if(connections.size()<numClients)
+			return false;
+		
+		/* Let the clients start sending and stop listening: */
+		{
+		Threads::MutexCond::Lock acceptLock(acceptCond);
+		accepted=true;
+		acceptCond.broadcast();
+		}
+		return true;
+		}
+	bool readMessages(Connection& connection) // Reads and dispatches messages from the given connection like Server::Client::socketEvent does
+		{
+		++numReadEvents;
+		NonBlockSocket& socket=connection.socket;
+		
+		/* Read data from the socket and dispatch all complete messages until the socket is drained or the client used up its read budget: */
+		size_t budget=maxReadPerEvent;
+		while(true)
+			{
+			size_t unreadBefore=socket.getUnread();
+			size_t unread=socket.readFromSocket();
+			size_t readSize=unread-unreadBefore;
+			Misc::SInt64 dispatchTime=getTime();
+			size_t numDispatched=0;
+			while(socket.getUnread()>=messageSize)
+				{
+				char message[messageSize];
+				socket.readRaw(message,messageSize);
+				Misc::SInt64 sendTime;
+				memcpy(&sendTime,message,sizeof(Misc::SInt64));
+				latencies.push_back(dispatchTime-sendTime);
+				++numDispatched;
+				}
+			__atomic_store_n(&numReceived,numReceived+numDispatched,__ATOMIC_RELEASE);
+			
+			/* Stop if the socket is drained or the budget is used up: */
+			if(socket.isDrained()||readSize>=budget)
+				break;
+			budget-=readSize;
+			}
+		
+		/* Stop the server once all messages have arrived: */
+		if(numReceived==numMessages)
+			dispatcher.stop();
+		
+		if(socket.eof())
+			throw std::runtime_error("DrainBenchmark: Client closed connection");
+		
+		return false;
+		}
+	size_t getNumSent(size_t round) const // Returns the number of messages sent by all clients before the given round
+		{
+		return round*burstSize*(numClients-1+firehoseFactor);
+		}
+	void* clientThreadMethod(void) // Sends bursts of messages from all clients
+		{
+		/* Wait until the server accepted all connections: */
+		{
+		Threads::MutexCond::Lock acceptLock(acceptCond);
+		while(!accepted)
+			acceptCond.wait(acceptLock);
+		}
+		
+		std::vector<char> burst(burstSize*firehoseFactor*messageSize,0);
+		for(size_t round=0;round<numRounds;++round)
+			{
+			/* Wait until the server caught up to within the window: */
+			while(round>=window&&__atomic_load_n(&numReceived,__ATOMIC_ACQUIRE)<getNumSent(round-window))
+				sched_yield();
+			
+			/* Send a burst of messages from each client: */
+			for(unsigned int client=0;client<numClients;++client)
+				{
+				/* Stamp the burst's messages with the current time: */
+				size_t numBurstMessages=client==0?burstSize*firehoseFactor:burstSize;
+				Misc::SInt64 sendTime=getTime();
+				for(size_t i=0;i<numBurstMessages;++i)
+					memcpy(&burst[i*messageSize],&sendTime,sizeof(Misc::SInt64));
+				
+				/* Write the burst, waiting while the socket is busy: */
+				const char* burstPtr=&burst[0];
+				size_t burstLeft=numBurstMessages*messageSize;
+				while(burstLeft>0)
+					{
+					ssize_t writeResult=write(clientSockets[client]->getFd(),burstPtr,burstLeft);
+					if(writeResult>0)
+						{
+						burstPtr+=writeResult;
+						burstLeft-=size_t(writeResult);
+						}
+					else if(errno==EAGAIN||errno==EWOULDBLOCK)
+						sched_yield();
+					else
+						{
+						std::cerr<<"DrainBenchmark: Error "<<errno<<" ("<<strerror(errno)<<") while sending"<<std::endl;
+						exit(1);
+						}
+					}
+				}
+			}
+		
+		return 0;
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	DrainBenchmark(unsigned int sNumClients,size_t sMaxReadPerEvent,size_t sNumRounds,size_t sBurstSize,unsigned int sFirehoseFactor,size_t sWindow)
+		:numClients(sNumClients),maxReadPerEvent(sMaxReadPerEvent),
+		 numRounds(sNumRounds),burstSize(sBurstSize),firehoseFactor(sFirehoseFactor),window(sWindow),
+		 numMessages(0),
+		 listenSocket(0,sNumClients),
+		 accepted(false),numAcceptEvents(0),numReadEvents(0),numReceived(0)
+		{
+		numMessages=getNumSent(numRounds);
+		latencies.reserve(numMessages);
+		
+		/* Accept connections through the dispatcher like Server::listenSocketEvent does: */
+		listenSocket.setBlocking(false);
+		dispatcher.addIOEventListener(listenSocket.getFd(),Threads::EventDispatcher::Read,Threads::EventDispatcher::wrapMethod<DrainBenchmark,&DrainBenchmark::listenSocketEvent>,this);
+		
+		/* Connect all clients: */
+		for(unsigned int i=0;i<numClients;++i)
+			clientSockets.push_back(new NonBlockSocket("127.0.0.1",listenSocket.getPortId()));
+		}
+	~DrainBenchmark(void)
+		{
+		for(std::vector<NonBlockSocket*>::iterator csIt=clientSockets.begin();csIt!=clientSockets.end();++csIt)
+			delete *csIt;
+		for(std::vector<Connection*>::iterator cIt=connections.begin();cIt!=connections.end();++cIt)
+			delete *cIt;
+		}
+	
+	/* Methods: */
+	void run(const char* name) // Runs the benchmark and prints its results
+		{
+		/* Start sending from the clients and dispatch events until all messages arrived: */
+		Threads::Thread clientThread;
+		clientThread.start(this,&DrainBenchmark::clientThreadMethod);
+		Realtime::TimePointMonotonic timer;
+		dispatcher.dispatchEvents();
+		double time=double(timer.setAndDiff());
+		clientThread.join();
+		
+		/* Calculate median and 99th percentile dispatch latencies: */
+		std::vector<Misc::SInt64>::iterator median=latencies.begin()+latencies.size()/2;
+		std::nth_element(latencies.begin(),median,latencies.end());
+		double p50=double(*median)*1.0e-3;
+		std::vector<Misc::SInt64>::iterator p99It=latencies.begin()+(latencies.size()*99)/100;
+		std::nth_element(latencies.begin(),p99It,latencies.end());
+		double p99=double(*p99It)*1.0e-3;
+		
+		std::cout<<std::setw(28)<<std::left<<name<<std::right<<std::fixed<<std::setprecision(0);
+		std::cout<<std::setw(12)<<double(numReadEvents)/time<<std::setw(12)<<double(numMessages)/time;
+		std::cout<<std::setprecision(1)<<std::setw(10)<<double(numMessages)/double(numReadEvents);
+		std::cout<<std::setw(10)<<p50<<" us"<<std::setw(10)<<p99<<" us"<<std::setw(8)<<numAcceptEvents<<std::endl;
+		}
+	};
+
+/*************
+Main function:
+*************/
+
+int main(int argc,char* argv[])
+	{
+	/* Parse the command line: */
+	unsigned int numClients=200;
+	size_t numRounds=2000;
+	size_t burstSize=8;
+	unsigned int firehoseFactor=64;
+	size_t window=4;
+	size_t maxReadPerEvent=262144;
+	for(int argi=1;argi<argc;++argi)
+		{
+		if(strcasecmp(argv[argi],"-clients")==0&&argi+1<argc)
+			numClients=(unsigned int)(atoi(argv[++argi]));
+		else if(strcasecmp(argv[argi],"-rounds")==0&&argi+1<argc)
+			numRounds=size_t(atol(argv[++argi]));
+		else if(strcasecmp(argv[argi],"-burst")==0&&argi+1<argc)
+			burstSize=size_t(atol(argv[++argi]));
+		else if(strcasecmp(argv[argi],"-firehose")==0&&argi+1<argc)
+			firehoseFactor=(unsigned int)(atoi(argv[++argi]));
+		else if(strcasecmp(argv[argi],"-window")==0&&argi+1<argc)
+			window=size_t(atol(argv[++argi]));
+		else if(strcasecmp(argv[argi],"-maxReadPerEvent")==0&&argi+1<argc)
+			maxReadPerEvent=size_t(atol(argv[++argi]));
+		else
+			{
+			std::cerr<<"Usage: "<<argv[0]<<" [-clients <number of clients>] [-rounds <number of rounds>] [-burst <messages per client per round>] [-firehose <message multiplier for first client>] [-window <rounds ahead of server>] [-maxReadPerEvent <read budget in bytes>]"<<std::endl;
+			return 1;
+			}
+		}
+	if(numClients==0||burstSize==0||firehoseFactor==0||window==0)
+		{
+		std::cerr<<"DrainBenchmark: Number of clients, burst size, firehose factor, and window must be positive"<<std::endl;
+		return 1;
+		}
+	
+	std::cout<<numClients<<" clients sending "<<numRounds<<" rounds of "<<burstSize<<" messages each; first client sends "<<firehoseFactor<<"x as many"<<std::endl;
+	std::cout<<std::setw(28)<<std::left<<"Benchmark"<<std::right<<std::setw(12)<<"events/s"<<std::setw(12)<<"msgs/s"<<std::setw(10)<<"msgs/evt";
+	std::cout<<std::setw(13)<<"p50 latency"<<std::setw(13)<<"p99 latency"<<std::setw(8)<<"accepts"<<std::endl;
+	
+	/* Compare reading once per event against draining with the given and with an unlimited budget: */
+	try
+		{
+		DrainBenchmark(numClients,0,numRounds,burstSize,firehoseFactor,window).run("Read once per event");
+		DrainBenchmark(numClients,maxReadPerEvent,numRounds,burstSize,firehoseFactor,window).run("Drain with read budget");
+		DrainBenchmark(numClients,~size_t(0),numRounds,burstSize,firehoseFactor,window).run("Drain without read budget");
+		}
+	catch(const std::runtime_error& err)
+		{
+		std::cerr<<"DrainBenchmark: Caught exception "<<err.what()<<std::endl;
+		return 1;
+		}
+	
+	return 0;
+	}
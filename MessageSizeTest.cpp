@@ -0,0 +1,102 @@
+/***********************************************************************
+MessageSizeTest - Test program to check that fixed-size protocol
+messages allocated from slab pools have the sizes their message
+structures declare.
+Copyright (c) 2019-2020 Oliver Kreylos
+***********************************************************************/
+
+#include <iostream>
+
+#include <Collaboration2/Protocol.h>
+#include <Collaboration2/MessageBuffer.h>
+#include <Collaboration2/CoreProtocol.h>
+#include <Collaboration2/Plugins/KoinoniaProtocol.h>
+#include <Collaboration2/Plugins/VruiCoreProtocol.h>
+
+/****************
+Helper functions:
+****************/
+
+template <class MsgParam>
+bool checkMessageSize(const char* msgName,unsigned int messageId) // Checks that a message created for the given message structure has the declared size
+	{
+	/* Create a message and compare its buffer size against the message structure's declared size: */
+	MessageBuffer* msg=MsgParam::createMessage(messageId);
+	size_t expectedSize=sizeof(MessageID)+MsgParam::size;
+	bool ok=msg->getBufferSize()==expectedSize;
+	if(ok)
+		std::cout<<msgName<<": OK ("<<expectedSize<<" bytes)"<<std::endl;
+	else
+		std::cout<<msgName<<": FAILED (buffer has "<<msg->getBufferSize()<<" bytes instead of "<<expectedSize<<')'<<std::endl;
+	msg->unref();
+	
+	return ok;
+	}
+
+/*********************************************************************
+Helper classes to access the protocols' protected message structures:
+*********************************************************************/
+
+class CoreProtocolTest:public CoreProtocol
+	{
+	/* Methods: */
+	public:
+	static unsigned int run(void) // Returns the number of failed checks
+		{
+		unsigned int numFailures=0;
+		if(!checkMessageSize<PingMsg>("PingMsg",PingRequest))
+			++numFailures;
+		return numFailures;
+		}
+	};
+
+class KoinoniaProtocolTest:public KoinoniaProtocol
+	{
+	/* Methods: */
+	public:
+	static unsigned int run(void) // Returns the number of failed checks
+		{
+		unsigned int numFailures=0;
+		if(!checkMessageSize<ReplaceNsObjectReplyMsg>("ReplaceNsObjectReplyMsg",0))
+			++numFailures;
+		return numFailures;
+		}
+	};
+
+class VruiCoreProtocolTest:public VruiCoreProtocol
+	{
+	/* Methods: */
+	public:
+	static unsigned int run(void) // Returns the number of failed checks
+		{
+		unsigned int numFailures=0;
+		if(!checkMessageSize<ViewerConfigUpdateMsg>("ViewerConfigUpdateMsg",ViewerConfigUpdateRequest))
+			++numFailures;
+		if(!checkMessageSize<ViewerUpdateMsg>("ViewerUpdateMsg",ViewerUpdateRequest))
+			++numFailures;
+		if(!checkMessageSize<UpdateInputDeviceMsg>("UpdateInputDeviceMsg",UpdateInputDeviceRequest))
+			++numFailures;
+		return numFailures;
+		}
+	};
+
+/*************
+Main function:
+*************/
+
+int main(void)
+	{
+	/* Check all fixed-size messages that are allocated from slab pools: */
+	unsigned int numFailures=0;
+	numFailures+=CoreProtocolTest::run();
+	numFailures+=KoinoniaProtocolTest::run();
+	numFailures+=VruiCoreProtocolTest::run();
+	
+	if(numFailures!=0)
+		{
+		std::cout<<numFailures<<" message size check(s) failed"<<std::endl;
+		return 1;
+		}
+	
+	return 0;
+	}